@@ -0,0 +1,127 @@
+// Throughput of utf8_validate() on IRC-sized lines: pure ASCII, UTF-8
+// with some multibyte text, and Latin-1 (which fails early), against a
+// byte-at-a-time validator. Build and run with: make bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utf8.h"
+
+#define LINE_COUNT 20000
+#define LINE_LENGTH 400
+#define ROUNDS 50
+
+typedef bool (*validator_t)(const char *s, size_t len);
+
+// One byte per step, no ASCII fast path
+static bool bytewise_validate(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+
+    while (i < len) {
+        unsigned char c = u[i];
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            n = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) lo = 0xA0;
+            if (c == 0xED) hi = 0x9F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) lo = 0x90;
+            if (c == 0xF4) hi = 0x8F;
+        } else {
+            return false;
+        }
+
+        if (i + n > len || u[i + 1] < lo || u[i + 1] > hi) return false;
+        for (size_t k = 2; k < n; k++) {
+            if ((u[i + k] & 0xC0) != 0x80) return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+static bool fast_validate(const char *s, size_t len) {
+    return utf8_validate(s, len);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Lines shaped like PRIVMSGs; non-ASCII words appear with the given
+// percentage, written as UTF-8 or as Latin-1
+static char *make_lines(int percent, bool latin1) {
+    static const char *ascii_words[] = { "hello", "channel", "the", "build", "is", "green", "again", "ok" };
+    static const char *utf8_words[] = { "caf\xc3\xa9", "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82",
+                                        "\xe6\x97\xa5\xe6\x9c\xac", "\xf0\x9f\x98\x80" };
+    static const char *latin1_words[] = { "caf\xe9", "na\xefve", "gr\xfc\xdf", "\xe0 bient\xf4t" };
+    char *lines = malloc((size_t)LINE_COUNT * LINE_LENGTH);
+    unsigned seed = 1;
+
+    if (!lines) exit(1);
+
+    for (int i = 0; i < LINE_COUNT; i++) {
+        char *line = lines + (size_t)i * LINE_LENGTH;
+        size_t pos = (size_t)snprintf(line, LINE_LENGTH, ":nick!user@host PRIVMSG #channel :");
+
+        while (pos < LINE_LENGTH - 24) {
+            seed = seed * 1103515245 + 12345;
+            const char *word = (int)(seed >> 16) % 100 < percent
+                ? (latin1 ? latin1_words : utf8_words)[(seed >> 8) % 4]
+                : ascii_words[(seed >> 8) % 8];
+            pos += (size_t)snprintf(line + pos, LINE_LENGTH - pos, "%s ", word);
+        }
+        memset(line + pos, 'x', LINE_LENGTH - pos);
+    }
+    return lines;
+}
+
+static void run(const char *name, const char *lines, validator_t validate) {
+    double start = now_s();
+    int valid = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < LINE_COUNT; i++) {
+            valid += validate(lines + (size_t)i * LINE_LENGTH, LINE_LENGTH);
+        }
+    }
+
+    double seconds = now_s() - start;
+    double bytes = (double)LINE_COUNT * LINE_LENGTH * ROUNDS;
+    printf("  %-10s %8.0f MB/s  %6.1f ns/line  (%d%% valid)\n", name, bytes / seconds / 1e6,
+           seconds * 1e9 / ((double)LINE_COUNT * ROUNDS), valid * 100 / (LINE_COUNT * ROUNDS));
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        int percent;
+        bool latin1;
+    } inputs[] = {
+        { "ASCII", 0, false },
+        { "UTF-8 5%", 5, false },
+        { "UTF-8 50%", 50, false },
+        { "Latin-1 5%", 5, true },
+    };
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        char *lines = make_lines(inputs[i].percent, inputs[i].latin1);
+        printf("%s, %d lines of %d bytes:\n", inputs[i].name, LINE_COUNT, LINE_LENGTH);
+        run("bytewise", lines, bytewise_validate);
+        run("utf8.c", lines, fast_validate);
+        free(lines);
+    }
+    return 0;
+}
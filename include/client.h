@@ -4,6 +4,9 @@
 #include <gtk/gtk.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <openssl/ssl.h>
+#include "plugin.h"
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -20,9 +23,23 @@
 #define MAX_NICK_LENGTH 32
 #define MAX_CHANNEL_LENGTH 64
 #define MAX_SERVER_NAME 128
-#define MAX_SERVERS 16
-#define MAX_CHANNELS_PER_SERVER 32
 #define CONFIG_FILE "irc_config.json"
+#define CONFIG_CACHE_FILE "irc_config.cache" // Parsed CONFIG_FILE, see config.c
+#define MAX_PATH_LENGTH 256
+#define MAX_BATCH_TARGETS 256
+// Candidates offered per Tab completion
+#define ROSTER_COMPLETE_MAX 64
+#define MAX_NETSPLITS 4
+#define PLUGIN_DIR "plugins"
+#define SCROLLBACK_MAX_LINES 10000
+// Line history kept in memory over all channels; the rest goes to disk
+#define SCROLLBACK_BUDGET_BYTES (64 << 20)
+#define SNAPSHOT_TAIL_LINES 200
+#define DAEMON_SOCKET_NAME "irc-client.sock"
+#define NET_SEND_TIMEOUT_MS 10000
+// Network worker threads at most, see shard.c
+#define SHARD_MAX 64
+#define DCC_DOWNLOAD_DIR "downloads"
 
 typedef enum {
     CONN_DISCONNECTED,
@@ -31,36 +48,355 @@ typedef enum {
     CONN_ERROR
 } connection_state_t;
 
+typedef enum {
+    REJOIN_NONE,
+    REJOIN_QUEUED,
+    REJOIN_SENT,
+    REJOIN_FAILED       // Name too long for any JOIN line; never sent
+} rejoin_state_t;
+
+// One nick on a server, shared by every roster and netsplit group that
+// mentions it; equal nicks under the casemapping are the same entry
+typedef struct intern_entry {
+    struct intern_entry *next; // Hash chain
+    uint32_t hash;
+    uint32_t refs;
+    char name[MAX_NICK_LENGTH]; // As the server last spelled it
+} intern_t;
+
+typedef struct {
+    const intern_t *nick;
+    uint32_t last_spoke; // channel->speak_seq when they last talked, 0 if never
+    char prefix; // Highest status symbol (@, +, ...) or 0
+} channel_member_t;
+
+// How much has happened in a channel since it was last viewed; only ever
+// escalates until the channel is read
+typedef enum {
+    ACTIVITY_NONE,
+    ACTIVITY_EVENT,     // Joins, parts, modes...
+    ACTIVITY_MESSAGE,
+    ACTIVITY_HIGHLIGHT  // Our nick was mentioned, or a DM
+} activity_t;
+
+// Channel list row updates
+typedef enum {
+    CHANNEL_ROW_ADD,
+    CHANNEL_ROW_REMOVE,
+    CHANNEL_ROW_RENAME
+} channel_row_op_t;
+
+// Columns of the per-server channel list model
+enum {
+    CHANNEL_COL_NAME,
+    CHANNEL_COL_INDEX,      // Index into server->channels, -1 for group rows
+    CHANNEL_COL_UNREAD,
+    CHANNEL_COL_HIGHLIGHTS,
+    CHANNEL_COL_ACTIVITY,
+    CHANNEL_COL_COUNT
+};
+
+// Growable array whose elements never move: segment k holds SLOTS_BASE << k
+// of them, so growing adds a segment instead of reallocating and pointers
+// held by other threads stay valid. Released indices are reused first.
+#define SLOTS_BASE 8
+#define SLOTS_SEGMENTS 24
+
+typedef struct {
+    void *segments[SLOTS_SEGMENTS];
+    size_t elem_size;
+    int count;         // Indices below this have storage
+    int *free_list;
+    int free_count;
+    int free_capacity;
+} slots_t;
+
+// A scrollback line: its text while resident, its offset in the channel's
+// spill segment once evicted
+typedef union {
+    char *text;
+    uint64_t offset;
+} scrollback_slot_t;
+
+// Raw history of a channel as a ring of lines, numbered by sequence. The
+// oldest `spilled` lines are on disk, see scrollback.c.
+typedef struct {
+    scrollback_slot_t *lines;
+    int capacity;
+    int head;
+    int count;
+    int spilled;
+    uint64_t next_seq;        // Sequence number of the next line appended
+    size_t resident_bytes;
+    uint64_t viewed_us;       // Last shown; least recently viewed spill first
+    
+    unsigned spill_id;        // Names the segment file, 0 before the first eviction
+    uint64_t spill_size;
+    GMappedFile *spill_map;   // Read side, dropped whenever the file changes
+    
+    uint64_t evicted;         // Lines written to the segment
+    uint64_t paged_in;        // Spilled or trimmed lines shown again
+} scrollback_t;
+
+// A line waiting to be inserted into a channel buffer
+typedef struct pending_line {
+    struct pending_line *next;
+    uint64_t trace_id;
+    char text[];
+} pending_line_t;
+
+// Only the GTK thread (or the daemon's main loop) touches these
 typedef struct {
-    char name[MAX_CHANNEL_LENGTH];
-    GtkWidget *text_view;
     GtkTextBuffer *buffer;
-    bool active;
+    uint64_t first_seq;       // Scrollback sequence of the buffer's first line
+    bool loaded;              // Attached GUI: backlog fetched from the daemon
+    int unread;               // Daemon: counted while no GUI shows the channel
+    int highlights;
+    activity_t activity;
+} channel_ui_t;
+
+// Lives in a server's channels slots; its index never changes while it
+// exists. Fields read for every routed line come first.
+typedef struct {
+    bool in_use;
     bool is_private_msg;
+    bool active;              // Joined on connect (auto_join)
+    rejoin_state_t rejoin_state;
+    uint32_t generation;      // Bumped on removal, so stale handles miss
+    char name[MAX_CHANNEL_LENGTH];
     char target_nick[MAX_NICK_LENGTH]; // For private messages
+    
+    // Sorted by casefolded nick so lookups and completion are binary
+    // searches; guarded by client.gui_mutex
+    channel_member_t *members;
+    int member_count;
+    int member_capacity;
+    uint32_t speak_seq;
+    
+    pending_line_t *pending_head; // Not yet in buffer, guarded by client.gui_mutex
+    pending_line_t *pending_tail;
+    int pending_count;
+    
+    scrollback_t scrollback;  // Guarded by client.gui_mutex
+    char encoding[32];        // Overrides the server's, if set
+    channel_ui_t ui;
 } channel_info_t;
 
+// A user back from a split, added to the roster with the rest of the batch
+typedef struct {
+    const intern_t *nick;     // Referenced
+    int channel_idx;
+    uint32_t generation;
+} netjoin_t;
+
+// QUITs of one netsplit, coalesced into a single roster update
+typedef struct {
+    bool in_use;
+    bool applied;         // Removed from the rosters
+    bool joins_pending;   // Netjoins not yet reported
+    char servers[2 * MAX_SERVER_NAME]; // The "server1 server2" QUIT reason
+    const intern_t **nicks;            // Referenced; sorted once applied
+    int nick_count;
+    int nick_capacity;
+    int *join_counts;     // By channel index
+    int join_capacity;
+    netjoin_t *joiners;   // Not yet in the rosters
+    int joiner_count;
+    int joiner_capacity;
+    uint64_t split_at_us;
+    uint64_t last_event_us;
+} netsplit_t;
+
+typedef enum {
+    CASEMAP_RFC1459,
+    CASEMAP_STRICT_RFC1459,
+    CASEMAP_ASCII
+} casemapping_t;
+
+// Parsed RPL_ISUPPORT (005). Target limits of 0 mean unlimited.
+typedef struct {
+    char chantypes[8];
+    char prefix_modes[16];   // e.g. "ov"
+    char prefix_symbols[16]; // e.g. "@+", same order as prefix_modes
+    casemapping_t casemapping;
+    int linelen;             // Including CRLF
+    int chanlimit;           // Max '#' channels, 0 if unlimited
+    int targmax_join;
+    int targmax_part;
+    int targmax_privmsg;
+    int targmax_notice;
+} isupport_t;
+
+// What the GTK thread knows of a channel, copied out at publish time
+typedef struct {
+    int index;
+    uint32_t generation;
+    bool is_private_msg;
+    char name[MAX_CHANNEL_LENGTH];
+    char target_nick[MAX_NICK_LENGTH];
+} channel_view_t;
+
+// A server's channels and ISUPPORT tables as of one channel_publish();
+// never changes once published. Channels are sorted by index.
+typedef struct {
+    uint64_t version;
+    isupport_t isupport;
+    int count;
+    channel_view_t channels[];
+} server_snapshot_t;
+
+typedef struct {
+    intern_t **buckets;
+    uint32_t bucket_mask;       // Bucket count - 1, a power of two
+    uint32_t count;
+    casemapping_t casemapping;  // The one the hashes were computed under
+} intern_table_t;
+
+typedef struct {
+    unsigned handshakes;
+    unsigned resumed;
+    uint64_t total_handshake_us;
+    uint64_t last_handshake_us;
+} tls_stats_t;
+
+typedef enum {
+    NET_BACKEND_POLL,
+    NET_BACKEND_URING
+} net_backend_t;
+
+// Per-connection I/O cost, reset on connect; compare backends by
+// syscalls and CPU per 1k lines
+typedef struct {
+    net_backend_t backend;
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t converted;   // Lines that were not UTF-8
+    uint64_t rx_syscalls; // Network thread only
+    uint64_t tx_syscalls; // Under io_mutex
+} net_stats_t;
+
+// io_uring state of a plaintext connection, NULL on the poll() path
+typedef struct net_uring net_uring_t;
+
+// /LIST results and their browser window, see chanlist.c
+typedef struct chanlist chanlist_t;
+
+typedef struct {
+    // Backoff, owned by the GTK thread
+    unsigned attempts;
+    guint timer_id;
+    
+    // Paced rejoin, owned by the network thread
+    bool rejoining;
+    int rejoin_outstanding;
+    uint64_t next_rejoin_us;
+    
+    // Metrics
+    uint64_t lost_at_us;
+    unsigned reconnects;
+    uint64_t last_reconnect_us;   // Link lost -> logged in again
+    uint64_t last_rejoin_us;      // Link lost -> every channel rejoined
+    uint64_t max_reconnect_us;
+    uint64_t max_rejoin_us;
+} reconnect_state_t;
+
+// RTT buckets: <50, <100, <200, <500 ms, <1, <2, <5 s, longer
+#define LAG_BUCKETS 8
+
+// Client-initiated PINGs, owned by the network thread. The histogram and
+// counters survive reconnects.
+typedef struct {
+    bool active;              // Registered; the server only answers after 001
+    uint64_t next_ping_us;
+    uint64_t ping_sent_us;    // Outstanding PING, 0 when none
+    int shown_wait_s;         // Seconds without a reply last put on the status bar
+    
+    // Metrics
+    uint64_t last_rtt_us;
+    uint64_t max_rtt_us;
+    unsigned samples;
+    unsigned timeouts;
+    unsigned histogram[LAG_BUCKETS];
+} lag_state_t;
+
+// Saved in the configuration file
 typedef struct {
     char name[MAX_SERVER_NAME];
     char hostname[INET6_ADDRSTRLEN];
     int port;
-    char nick[MAX_NICK_LENGTH];
     char real_name[64];
     char password[64]; // Optional server password
-    
+    bool use_tls;
+    bool tls_verify;
+    bool sasl_external; // Authenticate with the client certificate (CertFP)
+    char client_cert[MAX_PATH_LENGTH]; // PEM certificate, may also hold the key
+    char client_key[MAX_PATH_LENGTH];
+    bool auto_connect;
+    bool auto_reconnect;
+    int ping_interval;  // Seconds between client PINGs
+    int lag_warn;       // Seconds without a PONG before the status bar says so
+    int lag_timeout;    // Seconds without a PONG before reconnecting
+    char encoding[32];  // For lines that are not UTF-8
+} server_config_t;
+
+typedef struct {
+    GtkTreeIter iter;
+    bool present;
+} channel_row_t;
+
+// Channel list model, only touched on the GTK thread. Rows are kept per
+// channel index; network threads post changes through channel_list_post()
+// so the model never rebuilds.
+typedef struct {
+    GtkTreeStore *channel_store;
+    GtkTreeIter channel_groups[2]; // Channels, Direct Messages
+    channel_row_t *channel_rows;
+    int channel_row_capacity;
+    char lag_text[64];             // Lag meter, shown while the server is active
+} server_ui_t;
+
+// Lives in client.servers; servers are never removed, so the index and the
+// pointer stay valid. Fields touched for every line come first.
+typedef struct {
+    int index;                // Position in client.servers
     int sockfd;
+    SSL *ssl;
+    net_uring_t *uring;
     connection_state_t state;
-    pthread_t network_thread;
+    char nick[MAX_NICK_LENGTH];
+    isupport_t isupport;      // Written under client.gui_mutex by the network thread
+    slots_t channels;         // channel_info_t, see channel_get()
+    server_snapshot_t *snapshot; // For the GTK thread, see server_snapshot()
+    uint64_t snapshot_version;
+    unsigned config_version;     // Bumped by config_mark_dirty()
+    int active_channel;       // GTK thread only
+    intern_table_t nicks;     // Guarded by client.gui_mutex
+    bool roster_refresh_pending;
+    pthread_mutex_t io_mutex; // Serializes socket/SSL access between threads
+    net_stats_t net_stats;
     
-    channel_info_t channels[MAX_CHANNELS_PER_SERVER];
-    int channel_count;
-    int active_channel;
+    pthread_t network_thread;
+    int shard;                // Worker it is pinned to, -1 with a thread of its own
+    size_t rx_pos;            // Partial line carried between reads
+    char rx_line[MAX_MSG_LENGTH * 2];
+    SSL_SESSION *tls_session; // Cached for resumption on reconnect
+    tls_stats_t tls_stats;
+    bool cap_sasl_seen;       // On any line of the CAP LS reply so far
+    reconnect_state_t reconnect;
+    lag_state_t lag;
+    netsplit_t netsplits[MAX_NETSPLITS];
+    chanlist_t *chanlist;     // NULL until the first LIST reply
     
-    GtkWidget *server_item;
-    GtkWidget *channel_list;
-    bool auto_connect;
+    server_config_t config;
+    server_ui_t ui;
 } server_info_t;
 
+typedef enum {
+    CLIENT_STANDALONE,  // Window and network core in one process
+    CLIENT_DAEMON,      // Network core only, GUIs attach over a socket
+    CLIENT_ATTACHED     // Window only, mirroring a daemon
+} client_mode_t;
+
 typedef struct {
     GtkWidget *window;
     GtkWidget *main_paned;
@@ -68,53 +404,347 @@ typedef struct {
     GtkWidget *channel_paned;
     GtkWidget *channel_list;
     GtkWidget *chat_area;
+    GtkWidget *chat_scrolled;
+    GtkWidget *new_lines_button;
     GtkWidget *message_entry;
     GtkWidget *user_list;
     GtkWidget *status_bar;
+    GtkWidget *lag_label;
     
-    server_info_t servers[MAX_SERVERS];
-    int server_count;
+    slots_t servers;          // server_info_t, see server_get()
     int active_server;
     
     pthread_mutex_t gui_mutex;
     bool running;
+    client_mode_t mode;
+    bool replaying;           // Fed from a capture: nothing is sent or saved
+    bool loadtest;            // Throwaway servers on loopback: nothing is saved
 } client_t;
 
+// Daemon <-> GUI wire protocol
+#define WIRE_PROTOCOL_VERSION 2
+#define WIRE_HEADER_SIZE 5
+#define WIRE_MAX_FRAME (16 * 1024 * 1024)
+#define WIRE_LINES_BACKLOG 0x01
+
+typedef enum {
+    // Daemon to GUI
+    WIRE_SNAPSHOT_BEGIN = 1,
+    WIRE_SERVER,
+    WIRE_CHANNEL,           // Also sent when a channel is added or renamed
+    WIRE_CHANNEL_REMOVE,
+    WIRE_LINES,
+    WIRE_ROSTER,
+    WIRE_STATUS,
+    WIRE_SNAPSHOT_END,
+    
+    // GUI to daemon
+    WIRE_HELLO = 64,
+    WIRE_VIEW,
+    WIRE_FETCH,
+    WIRE_INPUT,
+    WIRE_CONNECT
+} wire_type_t;
+
+typedef struct {
+    uint8_t type;
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    bool error;
+} wire_reader_t;
+
 // Global client instance
 extern client_t client;
 
 // Function prototypes
 void init_client(void);
+void init_server(server_info_t *server);
 void cleanup_client(void);
 void load_config(void);
 void save_config(void);
+void config_mark_dirty(server_info_t *server);
+
+// Registry functions
+void slots_init(slots_t *slots, size_t elem_size);
+void *slots_at(const slots_t *slots, int idx);
+int slots_acquire(slots_t *slots);
+void slots_release(slots_t *slots, int idx);
+bool slots_claim(slots_t *slots, int idx);
+server_info_t *server_get(int server_idx);
+server_info_t *server_add(void);
+channel_info_t *channel_get(server_info_t *server, int channel_idx);
+uint32_t channel_generation(server_info_t *server, int channel_idx);
+bool channel_current(server_info_t *server, int channel_idx, uint32_t generation);
+int channel_alloc(server_info_t *server, int channel_idx);
+int channel_alloc_locked(server_info_t *server, int channel_idx);
+void channel_remove(server_info_t *server, int channel_idx);
+void channel_publish(server_info_t *server);
+const server_snapshot_t *server_snapshot(server_info_t *server);
+const channel_view_t *snapshot_channel(const server_snapshot_t *snapshot, int channel_idx);
 
 // Network functions
 void* network_thread_func(void* arg);
 int connect_to_server(server_info_t *server);
+int start_server_connection(int server_idx);
+void close_server_connection(server_info_t *server);
 void disconnect_server(server_info_t *server);
 void send_irc_command(server_info_t *server, const char *cmd);
 void handle_irc_message(server_info_t *server, const char *message);
+void net_handle_line(server_info_t *server, const char *line);
+void queue_channel_message(int server_idx, int channel_idx, const char *message);
+void queue_channel_activity(int server_idx, int channel_idx, const char *message, activity_t activity);
+int net_wait_socket(int sockfd, short events, int timeout_ms);
+ssize_t net_read(server_info_t *server, char *buf, size_t len);
+bool net_read_failed(server_info_t *server, ssize_t ret);
+unsigned net_feed(server_info_t *server, const char *data, size_t len);
+bool net_tick(server_info_t *server);
+int net_poll_timeout(server_info_t *server, int timeout_ms);
+void net_format_stats(server_info_t *server, char *buf, size_t len);
+int net_queue_depth(int queue);
+void net_queue_stats(int queue, int *depth, int *max_depth, uint64_t *merged);
+
+// Shard functions
+void shard_init(int count);
+int shard_count(void);
+bool shard_attach(server_info_t *server);
+void shard_detach(server_info_t *server);
+bool shard_format_stats(int shard_idx, char *buf, size_t len);
+int loadtest_run(int servers, int seconds);
+
+// io_uring backend functions
+bool uring_attach(server_info_t *server);
+void uring_detach(server_info_t *server);
+ssize_t uring_recv(server_info_t *server, const char **data, int timeout_ms);
+ssize_t uring_send(server_info_t *server, const char *buf, size_t len);
+
+// ISUPPORT functions
+void isupport_reset(isupport_t *isupport);
+void isupport_parse(isupport_t *isupport, char *params);
+int isupport_targmax(const isupport_t *isupport, const char *command);
+bool isupport_is_channel(const isupport_t *isupport, const char *target);
+char isupport_fold(const isupport_t *isupport, char c);
+int isupport_casecmp(const isupport_t *isupport, const char *a, const char *b);
+int isupport_pack_targets(const isupport_t *isupport, const char *command,
+                          const char **targets, int count, const char *trailing,
+                          char *buf, size_t buf_len);
+int send_batched_targets(server_info_t *server, const char *command,
+                         const char **targets, int count, const char *trailing);
+int split_targets(char *list, const char **targets, int max_targets);
+
+// Roster functions
+int find_channel(server_info_t *server, const char *name);
+void roster_add(server_info_t *server, int channel_idx, const char *nick, char prefix);
+void roster_add_batch(server_info_t *server, int channel_idx, const intern_t **nicks, int count);
+bool roster_remove(server_info_t *server, int channel_idx, const char *nick);
+int roster_remove_sorted(server_info_t *server, int channel_idx, const intern_t **nicks, int count);
+int roster_rename(server_info_t *server, const char *old_nick, const char *new_nick, bool *in_channel, int channel_count);
+void roster_clear(server_info_t *server, channel_info_t *channel);
+void roster_handle_names(server_info_t *server, char *params);
+void roster_notify(server_info_t *server);
+void roster_sort(server_info_t *server, channel_info_t *channel);
+void roster_resort(server_info_t *server);
+void roster_spoke(server_info_t *server, int channel_idx, const char *nick);
+int roster_complete(server_info_t *server, int channel_idx, const char *prefix,
+                    char (*out)[MAX_NICK_LENGTH], int max);
+
+// Intern functions
+const intern_t *intern_lookup(server_info_t *server, const char *nick);
+const intern_t *intern_nick(server_info_t *server, const char *nick);
+void intern_ref(const intern_t *entry);
+void intern_release(server_info_t *server, const intern_t *entry);
+bool intern_rename(server_info_t *server, const intern_t *entry, const char *new_nick);
+bool intern_rehash(server_info_t *server);
+int intern_compare(const void *a, const void *b);
+
+// Netsplit functions
+bool netsplit_is_split_reason(const char *reason);
+bool netsplit_handle_quit(server_info_t *server, const char *nick, const char *reason);
+bool netsplit_handle_join(server_info_t *server, const char *nick, int channel_idx);
+void netsplit_tick(server_info_t *server);
+int netsplit_poll_timeout(server_info_t *server, int timeout_ms);
+void netsplit_apply_joins(server_info_t *server);
+void netsplit_reset(server_info_t *server);
+
+// Reconnect functions
+void reconnect_connection_lost(server_info_t *server);
+void reconnect_schedule(server_info_t *server);
+void reconnect_cancel(server_info_t *server);
+void reconnect_now(server_info_t *server);
+void rejoin_start(server_info_t *server);
+void rejoin_tick(server_info_t *server);
+int rejoin_poll_timeout(server_info_t *server, int timeout_ms);
+void rejoin_channel_resolved(server_info_t *server, const char *channel_name, bool joined);
+void reconnect_format_stats(server_info_t *server, char *buf, size_t len);
+
+// Lag functions
+void lag_reset(server_info_t *server);
+void lag_start(server_info_t *server);
+bool lag_tick(server_info_t *server);
+void lag_handle_pong(server_info_t *server, const char *params);
+void lag_show(int server_idx);
+void lag_format_stats(server_info_t *server, char *buf, size_t len);
+
+// Shutdown functions
+bool shutdown_servers(void);
+void shutdown_install_signals(void);
+
+// Watchdog functions
+void watchdog_init(void);
+const char *watchdog_enter(const char *activity);
+void watchdog_leave(const char *previous);
+void watchdog_set_backtraces(bool enabled);
+void watchdog_format_frames(char *buf, size_t len);
+void watchdog_format_stalls(char *buf, size_t len);
+
+// Encoding functions
+char *encoding_convert_line(server_info_t *server, const char *line, size_t len);
+
+// Search functions
+GtkWidget *search_bar_new(void);
+void search_open(void);
+gboolean on_main_window_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data);
+
+// Channel browser functions
+void chanlist_start(server_info_t *server);
+void chanlist_add(server_info_t *server, const char *params);
+void chanlist_end(server_info_t *server);
+void chanlist_free(server_info_t *server);
+
+// DCC functions
+void dcc_post_ctcp(int server_idx, const char *nick, const char *ctcp);
+void dcc_command(int server_idx, int channel_idx, const char *args);
+void dcc_close_all(void);
+
+// Core functions
+void core_append_line(int server_idx, int channel_idx, const char *text, activity_t activity);
+void core_channel_changed(int server_idx, channel_row_op_t op, int channel_idx);
+void handle_user_input(int server_idx, int channel_idx, const char *message);
+
+// Scrollback functions
+uint64_t scrollback_append(scrollback_t *sb, const char *text);
+uint64_t scrollback_first_seq(const scrollback_t *sb);
+uint64_t scrollback_resident_seq(const scrollback_t *sb);
+const char *scrollback_get(scrollback_t *sb, uint64_t seq);
+void scrollback_reset(scrollback_t *sb, uint64_t next_seq);
+void scrollback_free(scrollback_t *sb);
+void scrollback_cleanup(void);
+void scrollback_format_totals(char *buf, size_t len);
+bool scrollback_format_channel(server_info_t *server, int channel_idx, char *buf, size_t len);
+
+// Daemon functions
+int daemon_run(void);
+void daemon_broadcast_line(int server_idx, int channel_idx, uint64_t seq, const char *text, activity_t activity);
+void daemon_channel_changed(int server_idx, channel_row_op_t op, int channel_idx);
+void daemon_broadcast_roster(int server_idx);
+void daemon_broadcast_status(const char *text);
+
+// Attach functions
+int attach_connect(void);
+void attach_start(void);
+void attach_view_changed(int server_idx, int channel_idx);
+void attach_send_input(int server_idx, int channel_idx, const char *text);
+void attach_send_connect(int server_idx);
+
+// Wire protocol functions
+size_t wire_begin(GByteArray *out, uint8_t type);
+void wire_end(GByteArray *out, size_t start);
+void wire_put_u8(GByteArray *out, uint8_t value);
+void wire_put_u16(GByteArray *out, uint16_t value);
+void wire_put_u32(GByteArray *out, uint32_t value);
+void wire_put_u64(GByteArray *out, uint64_t value);
+void wire_put_str(GByteArray *out, const char *str);
+long wire_frame_length(const uint8_t *buf, size_t len);
+void wire_reader_init(wire_reader_t *reader, const uint8_t *frame, size_t len);
+uint8_t wire_get_u8(wire_reader_t *reader);
+uint16_t wire_get_u16(wire_reader_t *reader);
+uint32_t wire_get_u32(wire_reader_t *reader);
+uint64_t wire_get_u64(wire_reader_t *reader);
+void wire_get_str(wire_reader_t *reader, char *buf, size_t len);
+int wire_write_all(int fd, const uint8_t *data, size_t len);
+void wire_socket_path(char *buf, size_t len);
+
+// Plugin functions
+extern uint32_t plugin_event_mask;
+// The only cost of an event nobody subscribed to
+#define plugin_wants(type) (plugin_event_mask & IRC_EVENT_MASK(type))
+void plugin_load_all(const char *dir);
+void plugin_unload_all(void);
+void plugin_emit(irc_event_t *event);
+int plugin_get_count(void);
+void plugin_format_stats(int idx, char *buf, size_t len);
+
+// TLS functions
+int tls_init(void);
+void tls_cleanup(void);
+int tls_connect(server_info_t *server);
+void tls_close(server_info_t *server);
+void tls_forget_session(server_info_t *server);
+bool tls_pending(server_info_t *server);
+ssize_t tls_read(server_info_t *server, char *buf, size_t len);
+ssize_t tls_write(server_info_t *server, const char *buf, size_t len);
 
 // GUI functions
 void create_main_window(void);
 void add_server_dialog(void);
 void connect_to_server_gui(int server_idx);
-void add_channel_to_server(int server_idx, const char *channel_name, bool is_dm);
+int add_channel_to_server(int server_idx, const char *channel_name, bool is_dm);
 void switch_to_channel(int server_idx, int channel_idx);
 void append_message_to_channel(int server_idx, int channel_idx, const char *message);
 void update_status(const char *message);
 void update_channel_list(int server_idx);
+void add_server_row(int server_idx);
 void show_user_list(int server_idx, const char *channel);
 
+// Channel list model functions
+void channel_list_init(server_info_t *server);
+void channel_list_setup_view(void);
+void channel_list_post(int server_idx, channel_row_op_t op, int channel_idx);
+void channel_list_apply(int server_idx, channel_row_op_t op, int channel_idx);
+void channel_list_set_counts(int server_idx, int channel_idx, int unread, int highlights, activity_t activity);
+void channel_list_mark_activity(int server_idx, int channel_idx, activity_t activity);
+void channel_list_mark_read(int server_idx, int channel_idx);
+void channel_list_select(int server_idx, int channel_idx);
+
+// Chat rendering functions
+void init_render(void);
+GtkTextBuffer *create_channel_buffer(void);
+GtkTextBuffer *channel_buffer(channel_info_t *channel);
+void channel_trim_buffer(channel_info_t *channel, int min_lines);
+void channel_page_in(channel_info_t *channel, uint64_t seq);
+void scroll_chat_to_end(void);
+void reset_new_lines_indicator(void);
+void discard_pending_lines(channel_info_t *channel);
+
+// Capture functions
+int capture_open(const char *path, bool redact);
+void capture_line(server_info_t *server, bool outbound, const char *line, size_t len);
+void capture_close(void);
+int replay_start(const char *path, bool fast);
+
+// Trace functions
+void trace_init(void);
+void trace_thread_name(const char *name);
+uint64_t trace_begin(void);
+void trace_end(const char *name, uint64_t start_us, uint64_t id);
+uint64_t trace_new_id(void);
+void trace_set_current(uint64_t id);
+uint64_t trace_current(void);
+void trace_set_enabled(bool enabled);
+bool trace_enabled(void);
+int trace_dump(int seconds, char *path, size_t path_len);
+
 // Utility functions
 char* get_timestamp(void);
+uint64_t get_monotonic_us(void);
 void log_message(const char *level, const char *format, ...);
+void log_set_verbose(bool verbose);
 gboolean gui_update_callback(gpointer data);
 
 // GUI Callbacks
 void on_window_destroy(GtkWidget *widget, gpointer data);
 void on_message_entry_activate(GtkEntry *entry, gpointer data);
+gboolean on_message_entry_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data);
 void on_server_connect_clicked(GtkButton *button, gpointer data);
 void on_add_server_clicked(GtkButton *button, gpointer data);
 void on_channel_selection_changed(GtkTreeSelection *selection, gpointer data);
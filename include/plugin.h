@@ -0,0 +1,67 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+// Public plugin ABI. Plugins are shared objects that export
+// irc_plugin_register(); they only need this header, not client.h.
+//
+// Handlers run on a worker thread owned by the plugin, never on the GTK or
+// network threads, so they may block. Events are copies: the pointers in
+// an irc_event_t are only valid for the duration of the call.
+
+#include <stdint.h>
+
+#define IRC_PLUGIN_ABI_VERSION 1
+#define IRC_PLUGIN_ENTRY "irc_plugin_register"
+
+typedef enum {
+    IRC_EVENT_MESSAGE,  // Every parsed line from a server
+    IRC_EVENT_JOIN,     // Someone (possibly us) joined a channel
+    IRC_EVENT_SEND,     // A line we sent to a server
+    IRC_EVENT_CONNECT,  // Logged in (001)
+    IRC_EVENT_COUNT
+} irc_event_type_t;
+
+#define IRC_EVENT_MASK(type) (1u << (type))
+
+typedef struct {
+    irc_event_type_t type;
+    int server_idx;
+    const char *server_name;
+    uint64_t timestamp_us;  // Monotonic clock
+
+    // IRC_EVENT_MESSAGE; prefix may be NULL
+    const char *prefix;
+    const char *command;
+    const char *params;
+
+    // IRC_EVENT_JOIN
+    const char *nick;
+    const char *channel;
+
+    // IRC_EVENT_SEND, without the trailing CRLF
+    const char *line;
+} irc_event_t;
+
+// Services the client offers to plugins; safe to call from handlers
+typedef struct {
+    int abi_version;
+    // line may omit the trailing CRLF
+    void (*send_raw)(int server_idx, const char *line);
+    void (*log)(const char *level, const char *format, ...);
+} irc_plugin_api_t;
+
+typedef struct {
+    int abi_version;        // IRC_PLUGIN_ABI_VERSION
+    const char *name;
+    uint32_t events;        // IRC_EVENT_MASK() of everything handled
+
+    // Optional; a non-zero return refuses the load
+    int (*init)(const irc_plugin_api_t *api);
+    void (*handle_event)(const irc_event_t *event);
+    // Optional
+    void (*shutdown)(void);
+} irc_plugin_t;
+
+typedef const irc_plugin_t *(*irc_plugin_register_fn)(void);
+
+#endif
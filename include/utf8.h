@@ -0,0 +1,12 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+// UTF-8 validation without GLib, shared by the client and bench/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+size_t utf8_ascii_prefix(const char *s, size_t len);
+bool utf8_validate(const char *s, size_t len);
+
+#endif
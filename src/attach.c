@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+#include "client.h"
+
+// GUI side of daemon mode. client.servers mirrors the daemon's state from
+// the snapshot and the events that follow; nothing here touches the network.
+
+#ifndef _WIN32
+
+static int daemon_fd = -1;
+static guint daemon_watch = 0;
+static GByteArray *daemon_in;
+
+static void attach_send(GByteArray *frame) {
+    if (daemon_fd < 0) return;
+
+    if (wire_write_all(daemon_fd, frame->data, frame->len) < 0) {
+        log_message("ERROR", "Lost the connection to the daemon: %s", strerror(errno));
+    }
+}
+
+static void attach_add_channel(int server_idx, wire_reader_t *reader) {
+    server_info_t *server = server_get(server_idx);
+    int channel_idx = wire_get_u16(reader);
+    char name[MAX_CHANNEL_LENGTH];
+    char target_nick[MAX_NICK_LENGTH];
+
+    wire_get_str(reader, name, sizeof(name));
+    wire_get_str(reader, target_nick, sizeof(target_nick));
+    bool is_dm = wire_get_u8(reader);
+    int unread = (int)wire_get_u32(reader);
+    int highlights = (int)wire_get_u32(reader);
+    activity_t activity = (activity_t)wire_get_u8(reader);
+
+    if (reader->error) return;
+
+    // The daemon numbers channels; take the same slot here
+    bool added = !channel_get(server, channel_idx);
+    if (added && channel_alloc(server, channel_idx) < 0) {
+        reader->error = true;
+        return;
+    }
+
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, channel_idx);
+
+    if (added) {
+        channel->active = true;
+        channel->is_private_msg = is_dm;
+    }
+    strcpy(channel->name, name);
+    strcpy(channel->target_nick, target_nick);
+    pthread_mutex_unlock(&client.gui_mutex);
+    channel_publish(server);
+
+    channel_list_apply(server_idx, added ? CHANNEL_ROW_ADD : CHANNEL_ROW_RENAME, channel_idx);
+    if (added) channel_list_set_counts(server_idx, channel_idx, unread, highlights, activity);
+}
+
+static void attach_remove_channel(wire_reader_t *reader) {
+    int server_idx = wire_get_u16(reader);
+    int channel_idx = wire_get_u16(reader);
+
+    server_info_t *server = server_get(server_idx);
+    if (reader->error || !server || !channel_get(server, channel_idx)) return;
+
+    channel_remove(server, channel_idx);
+    channel_list_apply(server_idx, CHANNEL_ROW_REMOVE, channel_idx);
+}
+
+static void attach_lines(wire_reader_t *reader) {
+    int server_idx = wire_get_u16(reader);
+    int channel_idx = wire_get_u16(reader);
+    uint8_t flags = wire_get_u8(reader);
+    activity_t activity = (activity_t)wire_get_u8(reader);
+    uint64_t seq = wire_get_u64(reader);
+    uint32_t count = wire_get_u32(reader);
+    char text[MAX_MSG_LENGTH];
+
+    server_info_t *server = server_get(server_idx);
+    channel_info_t *channel = server && !reader->error ? channel_get(server, channel_idx) : NULL;
+    if (!channel) return;
+
+    bool backlog = flags & WIRE_LINES_BACKLOG;
+
+    if (backlog) {
+        // Only the tail was sent; older history stays on the daemon
+        pthread_mutex_lock(&client.gui_mutex);
+        scrollback_reset(&channel->scrollback, seq);
+        channel->ui.first_seq = seq;
+        channel->ui.loaded = true;
+        pthread_mutex_unlock(&client.gui_mutex);
+    } else if (!channel->ui.loaded) {
+        // Not shown yet; the backlog fetched on switching will include it
+        channel_list_mark_activity(server_idx, channel_idx, activity);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count && !reader->error; i++) {
+        wire_get_str(reader, text, sizeof(text));
+
+        pthread_mutex_lock(&client.gui_mutex);
+        scrollback_append(&channel->scrollback, text);
+        pthread_mutex_unlock(&client.gui_mutex);
+
+        append_message_to_channel(server_idx, channel_idx, text);
+    }
+
+    if (!backlog) channel_list_mark_activity(server_idx, channel_idx, activity);
+}
+
+static void attach_roster(wire_reader_t *reader) {
+    int server_idx = wire_get_u16(reader);
+    int channel_idx = wire_get_u16(reader);
+    uint32_t count = wire_get_u32(reader);
+
+    server_info_t *server = server_get(server_idx);
+    channel_info_t *channel = server && !reader->error ? channel_get(server, channel_idx) : NULL;
+    if (!channel) return;
+
+    roster_clear(server, channel);
+
+    pthread_mutex_lock(&client.gui_mutex);
+    channel->members = count > 0 ? malloc(count * sizeof(channel_member_t)) : NULL;
+    channel->member_capacity = channel->members ? (int)count : 0;
+    for (uint32_t i = 0; i < (uint32_t)channel->member_capacity && !reader->error; i++) {
+        char nick[MAX_NICK_LENGTH];
+        char prefix = (char)wire_get_u8(reader);
+
+        wire_get_str(reader, nick, sizeof(nick));
+        const intern_t *entry = reader->error ? NULL : intern_nick(server, nick);
+        if (!entry) break;
+
+        channel->members[channel->member_count].nick = entry;
+        channel->members[channel->member_count].last_spoke = 0;
+        channel->members[channel->member_count++].prefix = prefix;
+    }
+    // Our casemapping may differ from the daemon's
+    roster_sort(server, channel);
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    if (server_idx == client.active_server && channel_idx == server->active_channel) {
+        show_user_list(server_idx, channel->name);
+    }
+}
+
+static void handle_frame(wire_reader_t *reader) {
+    char text[MAX_MSG_LENGTH];
+
+    switch (reader->type) {
+        case WIRE_SNAPSHOT_BEGIN:
+            wire_get_u16(reader); // Protocol version
+            break;
+
+        case WIRE_SERVER: {
+            int server_idx = wire_get_u16(reader);
+            server_info_t *server = server_idx == client.servers.count ? server_add() : NULL;
+            if (!server) {
+                reader->error = true;
+                return;
+            }
+
+            wire_get_str(reader, server->config.name, sizeof(server->config.name));
+            wire_get_str(reader, server->nick, sizeof(server->nick));
+            server->state = (connection_state_t)wire_get_u8(reader);
+            add_server_row(server_idx);
+            break;
+        }
+
+        case WIRE_CHANNEL: {
+            int server_idx = wire_get_u16(reader);
+            if (server_idx >= client.servers.count) {
+                reader->error = true;
+                return;
+            }
+            attach_add_channel(server_idx, reader);
+            break;
+        }
+
+        case WIRE_CHANNEL_REMOVE:
+            attach_remove_channel(reader);
+            break;
+
+        case WIRE_LINES:
+            attach_lines(reader);
+            break;
+
+        case WIRE_ROSTER:
+            attach_roster(reader);
+            break;
+
+        case WIRE_STATUS:
+            wire_get_str(reader, text, sizeof(text));
+            update_status(text);
+            break;
+
+        case WIRE_SNAPSHOT_END: {
+            int server_idx = wire_get_u16(reader) - 1;
+            int channel_idx = wire_get_u16(reader) - 1;
+
+            if (server_idx >= 0 && server_idx < client.servers.count) {
+                client.active_server = server_idx;
+                update_channel_list(server_idx);
+                switch_to_channel(server_idx, channel_idx);
+            }
+            update_status("Attached to daemon");
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static gboolean daemon_readable_cb(GIOChannel *source, GIOCondition condition, gpointer data) {
+    (void)source;
+    (void)data;
+    uint8_t buf[16384];
+
+    ssize_t n = (condition & G_IO_IN) ? recv(daemon_fd, buf, sizeof(buf), 0) : 0;
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return TRUE;
+
+    if (n <= 0) {
+        log_message("ERROR", "The daemon went away");
+        update_status("Daemon connection lost");
+        close(daemon_fd);
+        daemon_fd = -1;
+        daemon_watch = 0;
+        return FALSE;
+    }
+
+    g_byte_array_append(daemon_in, buf, (guint)n);
+
+    long frame_len;
+    while ((frame_len = wire_frame_length(daemon_in->data, daemon_in->len)) > 0) {
+        wire_reader_t reader;
+        wire_reader_init(&reader, daemon_in->data, (size_t)frame_len);
+        handle_frame(&reader);
+        g_byte_array_remove_range(daemon_in, 0, (guint)frame_len);
+
+        if (reader.error) log_message("WARNING", "Malformed frame %u from the daemon", reader.type);
+    }
+
+    if (frame_len < 0) {
+        log_message("ERROR", "Corrupt stream from the daemon, detaching");
+        update_status("Daemon connection lost");
+        close(daemon_fd);
+        daemon_fd = -1;
+        daemon_watch = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Connects to a running daemon. Returns -1 when there is none.
+int attach_connect(void) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    wire_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+    daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (daemon_fd < 0) return -1;
+
+    if (connect(daemon_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(daemon_fd);
+        daemon_fd = -1;
+        return -1;
+    }
+
+    log_message("INFO", "Attached to daemon at %s", addr.sun_path);
+    return 0;
+}
+
+// Starts reading the daemon's stream; call once the window exists
+void attach_start(void) {
+    daemon_in = g_byte_array_new();
+
+    GIOChannel *channel = g_io_channel_unix_new(daemon_fd);
+    daemon_watch = g_io_add_watch(channel, G_IO_IN | G_IO_ERR | G_IO_HUP, daemon_readable_cb, NULL);
+    g_io_channel_unref(channel);
+
+    GByteArray *frame = g_byte_array_new();
+    size_t start = wire_begin(frame, WIRE_HELLO);
+    wire_put_u16(frame, WIRE_PROTOCOL_VERSION);
+    wire_end(frame, start);
+    attach_send(frame);
+    g_byte_array_free(frame, TRUE);
+}
+
+// Tells the daemon what is on screen, fetching its lines the first time
+void attach_view_changed(int server_idx, int channel_idx) {
+    GByteArray *frame = g_byte_array_new();
+    size_t start;
+
+    channel_info_t *channel = channel_get(server_get(server_idx), channel_idx);
+
+    if (channel && !channel->ui.loaded) {
+        start = wire_begin(frame, WIRE_FETCH);
+        wire_put_u16(frame, (uint16_t)server_idx);
+        wire_put_u16(frame, (uint16_t)channel_idx);
+        wire_put_u64(frame, 0);
+        wire_end(frame, start);
+    }
+
+    start = wire_begin(frame, WIRE_VIEW);
+    wire_put_u16(frame, (uint16_t)server_idx);
+    wire_put_u16(frame, (uint16_t)channel_idx);
+    wire_end(frame, start);
+
+    attach_send(frame);
+    g_byte_array_free(frame, TRUE);
+}
+
+void attach_send_input(int server_idx, int channel_idx, const char *text) {
+    GByteArray *frame = g_byte_array_new();
+    size_t start = wire_begin(frame, WIRE_INPUT);
+
+    wire_put_u16(frame, (uint16_t)server_idx);
+    wire_put_u16(frame, (uint16_t)channel_idx);
+    wire_put_str(frame, text);
+    wire_end(frame, start);
+
+    attach_send(frame);
+    g_byte_array_free(frame, TRUE);
+}
+
+void attach_send_connect(int server_idx) {
+    GByteArray *frame = g_byte_array_new();
+    size_t start = wire_begin(frame, WIRE_CONNECT);
+
+    wire_put_u16(frame, (uint16_t)server_idx);
+    wire_end(frame, start);
+
+    attach_send(frame);
+    g_byte_array_free(frame, TRUE);
+}
+
+#else
+
+int attach_connect(void) {
+    return -1;
+}
+
+void attach_start(void) {
+}
+
+void attach_view_changed(int server_idx, int channel_idx) {
+    (void)server_idx;
+    (void)channel_idx;
+}
+
+void attach_send_input(int server_idx, int channel_idx, const char *text) {
+    (void)server_idx;
+    (void)channel_idx;
+    (void)text;
+}
+
+void attach_send_connect(int server_idx) {
+    (void)server_idx;
+}
+
+#endif
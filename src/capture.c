@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Traffic capture and replay, for reproducing a slow session offline.
+// --record writes every line received or sent, per server, with its time;
+// --replay feeds the received lines back through net_handle_line() and the
+// GUI path, at the recorded pace or, with --fast, as fast as possible.
+//
+// The file is CAPTURE_MAGIC followed by frames in the daemon socket's
+// framing (see wire.c). A server frame names a server before its first
+// line; a line frame holds the server number, the microseconds since the
+// previous line and the line without CRLF.
+
+#define CAPTURE_MAGIC "IRCCAP1\n"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_FLUSH_US 1000000    // Bounds what a crash loses
+
+enum {
+    CAPTURE_SERVER = 1,     // u16 server, str name, str nick
+    CAPTURE_RECV,           // u16 server, u32 delta_us, str line
+    CAPTURE_SEND            // Same, for lines the client sent
+};
+
+static struct {
+    FILE *file;
+    bool redact;
+    pthread_mutex_t mutex;
+    GByteArray *frame;
+    bool *announced;        // By server index
+    int announced_count;
+    uint64_t last_us;
+    uint64_t last_flush_us;
+    uint64_t lines;
+} capture = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Overwrites text with 'x', keeping its length and word breaks, so the
+// replay costs about the same to parse, wrap and render
+static void redact_text(char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] != ' ' && text[i] != '\001') text[i] = 'x';
+    }
+}
+
+// Past the next space, or end
+static char *skip_word(char *p, char *end) {
+    char *space = memchr(p, ' ', (size_t)(end - p));
+    return space ? space + 1 : end;
+}
+
+// Whether an outbound PRIVMSG goes to NickServ, whose commands (IDENTIFY,
+// REGISTER, GHOST, SET PASSWORD...) carry passwords
+static bool to_nickserv(char *params, char *end) {
+    char *target = params + 1;
+    char *target_end = memchr(target, ' ', (size_t)(end - target));
+    size_t target_len = (size_t)((target_end ? target_end : end) - target);
+    char *at = memchr(target, '@', target_len);
+
+    if (at) target_len = (size_t)(at - target);
+    return target_len == 8 && g_ascii_strncasecmp(target, "NickServ", 8) == 0;
+}
+
+// Redacts the free text of one line: message bodies and reasons with
+// --redact, credentials (including services logins) always
+static void redact_line(char *line, size_t len, bool outbound) {
+    static const char *texts[] = { "PRIVMSG", "NOTICE", "TOPIC", "332", "PART", "QUIT", "KICK", "AWAY" };
+    static const char *secrets[] = { "PASS", "OPER", "AUTHENTICATE", "NS", "NICKSERV", "IDENTIFY" };
+    char *p = line;
+    char *end = line + len;
+
+    if (p < end && *p == '@') p = skip_word(p, end);
+    if (p < end && *p == ':') p = skip_word(p, end);
+
+    char *command = p;
+    char *params = memchr(p, ' ', (size_t)(end - p));
+    size_t command_len = (size_t)((params ? params : end) - command);
+    if (!params) return;
+
+    for (size_t i = 0; outbound && i < sizeof(secrets) / sizeof(secrets[0]); i++) {
+        if (strlen(secrets[i]) == command_len && g_ascii_strncasecmp(command, secrets[i], command_len) == 0) {
+            redact_text(params + 1, (size_t)(end - params - 1));
+            return;
+        }
+    }
+
+    bool nickserv = outbound && command_len == 7 && g_ascii_strncasecmp(command, "PRIVMSG", 7) == 0 &&
+                    to_nickserv(params, end);
+    if (!capture.redact && !nickserv) return;
+
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        if (strlen(texts[i]) != command_len || g_ascii_strncasecmp(command, texts[i], command_len) != 0) continue;
+
+        for (char *q = params; q + 1 < end; q++) {
+            if (q[0] == ' ' && q[1] == ':') {
+                redact_text(q + 2, (size_t)(end - q - 2));
+                break;
+            }
+        }
+        return;
+    }
+}
+
+// Starts recording to path, replacing it. Returns 0 on success.
+int capture_open(const char *path, bool redact) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        log_message("ERROR", "Failed to create capture %s", path);
+        return -1;
+    }
+
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, file);
+
+    pthread_mutex_lock(&capture.mutex);
+    capture.file = file;
+    capture.redact = redact;
+    capture.frame = g_byte_array_new();
+    capture.last_us = get_monotonic_us();
+    capture.last_flush_us = capture.last_us;
+    pthread_mutex_unlock(&capture.mutex);
+
+    log_message("INFO", "Recording traffic to %s%s", path, redact ? " (message text redacted)" : "");
+    return 0;
+}
+
+// Records one line without its CRLF; called from network threads and the
+// GTK thread alike
+void capture_line(server_info_t *server, bool outbound, const char *line, size_t len) {
+    if (!capture.file) return;
+
+    char copy[MAX_MSG_LENGTH * 2];
+    if (len >= sizeof(copy)) len = sizeof(copy) - 1;
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    redact_line(copy, len, outbound);
+
+    pthread_mutex_lock(&capture.mutex);
+    if (!capture.file) {
+        pthread_mutex_unlock(&capture.mutex);
+        return;
+    }
+
+    GByteArray *frame = capture.frame;
+    g_byte_array_set_size(frame, 0);
+
+    if (server->index >= capture.announced_count) {
+        int count = server->index + 8;
+        bool *announced = realloc(capture.announced, count * sizeof(bool));
+        if (announced) {
+            memset(announced + capture.announced_count, 0, (count - capture.announced_count) * sizeof(bool));
+            capture.announced = announced;
+            capture.announced_count = count;
+        }
+    }
+    if (server->index < capture.announced_count && !capture.announced[server->index]) {
+        size_t start = wire_begin(frame, CAPTURE_SERVER);
+        wire_put_u16(frame, (uint16_t)server->index);
+        wire_put_str(frame, server->config.name);
+        wire_put_str(frame, server->nick);
+        wire_end(frame, start);
+        capture.announced[server->index] = true;
+    }
+
+    uint64_t now = get_monotonic_us();
+    uint64_t delta = now - capture.last_us;
+    capture.last_us = now;
+
+    size_t start = wire_begin(frame, outbound ? CAPTURE_SEND : CAPTURE_RECV);
+    wire_put_u16(frame, (uint16_t)server->index);
+    wire_put_u32(frame, delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta);
+    wire_put_str(frame, copy);
+    wire_end(frame, start);
+
+    fwrite(frame->data, 1, frame->len, capture.file);
+    capture.lines++;
+
+    if (now - capture.last_flush_us >= CAPTURE_FLUSH_US) {
+        fflush(capture.file);
+        capture.last_flush_us = now;
+    }
+    pthread_mutex_unlock(&capture.mutex);
+}
+
+void capture_close(void) {
+    pthread_mutex_lock(&capture.mutex);
+    if (capture.file) {
+        fclose(capture.file);
+        capture.file = NULL;
+        g_byte_array_free(capture.frame, TRUE);
+        free(capture.announced);
+        capture.announced = NULL;
+        capture.announced_count = 0;
+        log_message("INFO", "Capture closed after %llu lines", (unsigned long long)capture.lines);
+    }
+    pthread_mutex_unlock(&capture.mutex);
+}
+
+typedef struct {
+    GMappedFile *mapped;
+    bool fast;
+    int *servers;           // Capture server number -> server index, -1 if unknown
+    int server_count;
+} replay_t;
+
+// Calls visit for each frame; stops at the first corrupt one. Returns the
+// number of frames visited.
+static long replay_frames(const uint8_t *data, size_t len, bool (*visit)(wire_reader_t *, void *), void *arg) {
+    size_t pos = CAPTURE_MAGIC_LEN;
+    long frames = 0;
+
+    while (pos < len) {
+        long frame_len = wire_frame_length(data + pos, len - pos);
+        if (frame_len <= 0) {
+            log_message("WARNING", "Capture truncated or corrupt at byte %zu", pos);
+            break;
+        }
+
+        wire_reader_t reader;
+        wire_reader_init(&reader, data + pos, (size_t)frame_len);
+        pos += (size_t)frame_len;
+        frames++;
+
+        if (!visit(&reader, arg)) break;
+    }
+    return frames;
+}
+
+// First pass, on the GTK thread: a server for every server frame
+static bool replay_add_server(wire_reader_t *reader, void *arg) {
+    replay_t *replay = arg;
+
+    if (reader->type != CAPTURE_SERVER) return true;
+
+    int number = wire_get_u16(reader);
+    if (number >= replay->server_count) {
+        int count = number + 8;
+        int *servers = realloc(replay->servers, count * sizeof(int));
+        if (!servers) return false;
+        for (int i = replay->server_count; i < count; i++) servers[i] = -1;
+        replay->servers = servers;
+        replay->server_count = count;
+    }
+
+    server_info_t *server = server_add();
+    if (!server) return false;
+
+    wire_get_str(reader, server->config.name, sizeof(server->config.name));
+    wire_get_str(reader, server->nick, sizeof(server->nick));
+    strcpy(server->config.hostname, "replay");
+    server->config.auto_reconnect = false;
+    server->config.ping_interval = 0;
+    server->state = CONN_CONNECTED;
+
+    replay->servers[number] = server->index;
+    add_server_row(server->index);
+    return true;
+}
+
+typedef struct {
+    replay_t *replay;
+    uint64_t start_us;
+    uint64_t offset_us;     // Recorded time of the current line
+    long lines;
+} replay_run_t;
+
+static bool replay_line(wire_reader_t *reader, void *arg) {
+    replay_run_t *run = arg;
+    replay_t *replay = run->replay;
+    char line[MAX_MSG_LENGTH * 2];
+
+    if (!client.running) return false;
+    if (reader->type != CAPTURE_RECV && reader->type != CAPTURE_SEND) return true;
+
+    int number = wire_get_u16(reader);
+    run->offset_us += wire_get_u32(reader);
+    if (reader->type == CAPTURE_SEND) return true;
+
+    wire_get_str(reader, line, sizeof(line));
+    if (reader->error || number >= replay->server_count || replay->servers[number] < 0) return true;
+
+    // Original pacing: wait for the line's time, in short steps so quitting
+    // is not held up by a long idle stretch
+    while (!replay->fast && client.running) {
+        uint64_t now = get_monotonic_us() - run->start_us;
+        if (now >= run->offset_us) break;
+        uint64_t wait = run->offset_us - now;
+        g_usleep(wait > 100000 ? 100000 : (gulong)wait);
+    }
+
+    net_handle_line(server_get(replay->servers[number]), line);
+    run->lines++;
+    return true;
+}
+
+static gboolean replay_done_cb(gpointer data) {
+    char *text = data;
+    update_status(text);
+    g_free(text);
+    return FALSE;
+}
+
+static void *replay_thread_func(void *arg) {
+    replay_t *replay = arg;
+    replay_run_t run = { .replay = replay, .start_us = get_monotonic_us() };
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(replay->mapped);
+
+    trace_thread_name("replay");
+    replay_frames(data, g_mapped_file_get_length(replay->mapped), replay_line, &run);
+
+    double seconds = (get_monotonic_us() - run.start_us) / 1e6;
+    char *text = g_strdup_printf("Replayed %ld lines in %.2f s (%.0f lines/s)", run.lines, seconds,
+                                 seconds > 0 ? run.lines / seconds : 0.0);
+    log_message("INFO", "%s", text);
+    g_idle_add(replay_done_cb, text);
+
+    g_mapped_file_unref(replay->mapped);
+    free(replay->servers);
+    free(replay);
+    return NULL;
+}
+
+// Creates the capture's servers and starts feeding its lines from a thread
+// of their own. Call on the GTK thread once the window exists. Returns 0 on
+// success.
+int replay_start(const char *path, bool fast) {
+    GError *error = NULL;
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, &error);
+
+    if (!mapped) {
+        log_message("ERROR", "Failed to open capture %s: %s", path, error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(mapped);
+    size_t len = g_mapped_file_get_length(mapped);
+    if (len < CAPTURE_MAGIC_LEN || memcmp(data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        log_message("ERROR", "%s is not a traffic capture", path);
+        g_mapped_file_unref(mapped);
+        return -1;
+    }
+
+    replay_t *replay = calloc(1, sizeof(replay_t));
+    if (!replay) {
+        g_mapped_file_unref(mapped);
+        return -1;
+    }
+    replay->mapped = mapped;
+    replay->fast = fast;
+
+    client.replaying = true;
+    long frames = replay_frames(data, len, replay_add_server, replay);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replay_thread_func, replay) != 0) {
+        log_message("ERROR", "Failed to create replay thread");
+        g_mapped_file_unref(mapped);
+        free(replay->servers);
+        free(replay);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    log_message("INFO", "Replaying %ld frames from %s%s", frames, path, fast ? " as fast as possible" : "");
+    return 0;
+}
@@ -0,0 +1,662 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "client.h"
+
+// Channel browser for /LIST. Replies (321/322/323) stream into a columnar
+// store on the network thread: one string arena plus fixed-width columns of
+// offsets and user counts, about 12 bytes a row besides the text. A worker
+// thread runs the filter over the store and hands matching row numbers to
+// the GTK thread in chunks. The window's tree model is a thin view over
+// those row numbers, so nothing is copied into a GtkListStore and rows show
+// up while the server is still sending them.
+
+#define CHANLIST_CHUNK 4096       // Rows the worker scans per lock hold
+#define CHANLIST_WAKE 256         // Rows received between worker wakeups
+#define CHANLIST_FILTER_MAX 128
+#define CHANLIST_FILTER_WORDS 8
+
+enum {
+    CHANLIST_COL_NAME,
+    CHANLIST_COL_USERS,
+    CHANLIST_COL_TOPIC,
+    CHANLIST_COLS
+};
+
+struct chanlist {
+    int server_idx;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t worker;
+
+    // Store, appended by the network thread under mutex
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    uint32_t *name_off;
+    uint32_t *topic_off;
+    uint32_t *users;
+    int count;
+    int capacity;
+    bool receiving;           // Between the first 322 and 323
+    uint64_t started_us;
+    char receive_stats[128];
+
+    // Worker input, under mutex
+    char filter[CHANLIST_FILTER_MAX];
+    uint32_t generation;      // Bumped by a new filter or a new LIST
+    bool quit;
+
+    // GTK thread only
+    GtkWidget *window;
+    GtkWidget *view;
+    GtkWidget *label;
+    GtkTreeModel *model;
+    uint32_t *rows;           // Store rows on screen, in order
+    int row_count;
+    int row_cap;
+    int stamp;
+    uint32_t shown_generation;
+    int filter_scanned;
+    uint64_t filter_us;
+};
+
+typedef struct {
+    char words[CHANLIST_FILTER_WORDS][CHANLIST_FILTER_MAX]; // Lowercase
+    int word_count;
+    uint32_t min_users;
+    uint32_t max_users;
+} chanlist_filter_t;
+
+// Matches found by one worker pass over part of the store
+typedef struct {
+    chanlist_t *list;
+    uint32_t generation;
+    int scanned;              // Rows of the store filtered so far
+    uint64_t filter_us;       // Time spent on them
+    int count;
+    uint32_t rows[];
+} chanlist_chunk_t;
+
+// Tree model
+
+typedef struct {
+    GObject parent;
+    chanlist_t *list;
+} ChanlistModel;
+
+typedef struct {
+    GObjectClass parent_class;
+} ChanlistModelClass;
+
+static void chanlist_model_iface_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ChanlistModel, chanlist_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, chanlist_model_iface_init))
+
+#define MODEL_LIST(model) (((ChanlistModel *)(model))->list)
+
+static void chanlist_model_class_init(ChanlistModelClass *klass) {
+    (void)klass;
+}
+
+static void chanlist_model_init(ChanlistModel *model) {
+    (void)model;
+}
+
+static void model_set_iter(chanlist_t *list, GtkTreeIter *iter, int pos) {
+    iter->stamp = list->stamp;
+    iter->user_data = GINT_TO_POINTER(pos);
+}
+
+static GtkTreeModelFlags model_get_flags(GtkTreeModel *model) {
+    (void)model;
+    return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint model_get_n_columns(GtkTreeModel *model) {
+    (void)model;
+    return CHANLIST_COLS;
+}
+
+static GType model_get_column_type(GtkTreeModel *model, gint column) {
+    (void)model;
+    return column == CHANLIST_COL_USERS ? G_TYPE_UINT : G_TYPE_STRING;
+}
+
+static gboolean model_get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path) {
+    chanlist_t *list = MODEL_LIST(model);
+    int pos = gtk_tree_path_get_indices(path)[0];
+
+    if (gtk_tree_path_get_depth(path) != 1 || pos < 0 || pos >= list->row_count) return FALSE;
+    model_set_iter(list, iter, pos);
+    return TRUE;
+}
+
+static GtkTreePath *model_get_path(GtkTreeModel *model, GtkTreeIter *iter) {
+    (void)model;
+    return gtk_tree_path_new_from_indices(GPOINTER_TO_INT(iter->user_data), -1);
+}
+
+static void model_get_value(GtkTreeModel *model, GtkTreeIter *iter, gint column, GValue *value) {
+    chanlist_t *list = MODEL_LIST(model);
+    int pos = GPOINTER_TO_INT(iter->user_data);
+
+    g_value_init(value, model_get_column_type(model, column));
+    if (pos >= list->row_count) return;
+
+    uint32_t row = list->rows[pos];
+    pthread_mutex_lock(&list->mutex);
+    // A new LIST may have emptied the store before its rows reach the view
+    if ((int)row < list->count) {
+        switch (column) {
+            case CHANLIST_COL_NAME:
+                g_value_set_string(value, list->text + list->name_off[row]);
+                break;
+            case CHANLIST_COL_USERS:
+                g_value_set_uint(value, list->users[row]);
+                break;
+            default:
+                g_value_set_string(value, list->text + list->topic_off[row]);
+                break;
+        }
+    }
+    pthread_mutex_unlock(&list->mutex);
+}
+
+static gboolean model_iter_next(GtkTreeModel *model, GtkTreeIter *iter) {
+    chanlist_t *list = MODEL_LIST(model);
+    int pos = GPOINTER_TO_INT(iter->user_data) + 1;
+
+    if (pos >= list->row_count) return FALSE;
+    model_set_iter(list, iter, pos);
+    return TRUE;
+}
+
+static gboolean model_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {
+    chanlist_t *list = MODEL_LIST(model);
+
+    if (parent || n < 0 || n >= list->row_count) return FALSE;
+    model_set_iter(list, iter, n);
+    return TRUE;
+}
+
+static gboolean model_iter_children(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    return model_iter_nth_child(model, iter, parent, 0);
+}
+
+static gboolean model_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter) {
+    (void)model;
+    (void)iter;
+    return FALSE;
+}
+
+static gint model_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter) {
+    return iter ? 0 : MODEL_LIST(model)->row_count;
+}
+
+static gboolean model_iter_parent(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *child) {
+    (void)model;
+    (void)iter;
+    (void)child;
+    return FALSE;
+}
+
+static void chanlist_model_iface_init(GtkTreeModelIface *iface) {
+    iface->get_flags = model_get_flags;
+    iface->get_n_columns = model_get_n_columns;
+    iface->get_column_type = model_get_column_type;
+    iface->get_iter = model_get_iter;
+    iface->get_path = model_get_path;
+    iface->get_value = model_get_value;
+    iface->iter_next = model_iter_next;
+    iface->iter_children = model_iter_children;
+    iface->iter_has_child = model_iter_has_child;
+    iface->iter_n_children = model_iter_n_children;
+    iface->iter_nth_child = model_iter_nth_child;
+    iface->iter_parent = model_iter_parent;
+}
+
+// Filtering, on the worker thread
+
+// Words must all appear in the name or topic; ">N" and "<N" bound the
+// user count
+static void chanlist_parse_filter(const char *text, chanlist_filter_t *filter) {
+    char copy[CHANLIST_FILTER_MAX];
+    char *saveptr;
+
+    memset(filter, 0, sizeof(chanlist_filter_t));
+    filter->max_users = UINT32_MAX;
+    strncpy(copy, text, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    for (char *word = strtok_r(copy, " ", &saveptr); word; word = strtok_r(NULL, " ", &saveptr)) {
+        if ((word[0] == '>' || word[0] == '<') && isdigit((unsigned char)word[1])) {
+            unsigned long n = strtoul(word + 1, NULL, 10);
+            if (word[0] == '>') {
+                filter->min_users = n >= UINT32_MAX ? UINT32_MAX : (uint32_t)n + 1;
+            } else {
+                filter->max_users = n == 0 ? 0 : (uint32_t)(n - 1);
+            }
+        } else if (filter->word_count < CHANLIST_FILTER_WORDS) {
+            char *out = filter->words[filter->word_count++];
+            for (; *word; word++) *out++ = (char)tolower((unsigned char)*word);
+            *out = '\0';
+        }
+    }
+}
+
+// Case-insensitive substring test; word is already lowercase
+static bool contains_folded(const char *text, const char *word) {
+    for (; *text; text++) {
+        size_t i = 0;
+        while (word[i] && tolower((unsigned char)text[i]) == word[i]) i++;
+        if (!word[i]) return true;
+    }
+    return false;
+}
+
+static bool chanlist_match(const chanlist_t *list, const chanlist_filter_t *filter, int row) {
+    if (list->users[row] < filter->min_users || list->users[row] > filter->max_users) return false;
+
+    for (int i = 0; i < filter->word_count; i++) {
+        if (!contains_folded(list->text + list->name_off[row], filter->words[i]) &&
+            !contains_folded(list->text + list->topic_off[row], filter->words[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static gboolean chanlist_chunk_cb(gpointer data);
+
+// Filters rows as they arrive, and the whole store again whenever the
+// filter changes. Each pass ends with a chunk even if nothing matched, so
+// the GTK thread always learns that a new filter has been applied.
+static void *chanlist_worker(void *arg) {
+    chanlist_t *list = arg;
+    chanlist_filter_t filter;
+    uint32_t generation;
+    int scanned = 0;
+    uint64_t filter_us = 0;
+    bool reported = false;
+
+    pthread_mutex_lock(&list->mutex);
+    generation = list->generation - 1;
+
+    while (!list->quit) {
+        if (generation != list->generation) {
+            generation = list->generation;
+            chanlist_parse_filter(list->filter, &filter);
+            scanned = 0;
+            filter_us = 0;
+            reported = false;
+        }
+
+        int end = list->count < scanned + CHANLIST_CHUNK ? list->count : scanned + CHANLIST_CHUNK;
+        if (end == scanned && reported) {
+            pthread_cond_wait(&list->cond, &list->mutex);
+            continue;
+        }
+
+        chanlist_chunk_t *chunk = malloc(sizeof(chanlist_chunk_t) + (size_t)(end - scanned) * sizeof(uint32_t));
+        if (!chunk) break;
+
+        uint64_t start_us = get_monotonic_us();
+        chunk->count = 0;
+        for (int row = scanned; row < end; row++) {
+            if (chanlist_match(list, &filter, row)) chunk->rows[chunk->count++] = (uint32_t)row;
+        }
+        filter_us += get_monotonic_us() - start_us;
+        scanned = end;
+        reported = true;
+
+        chunk->list = list;
+        chunk->generation = generation;
+        chunk->scanned = scanned;
+        chunk->filter_us = filter_us;
+
+        pthread_mutex_unlock(&list->mutex);
+        g_idle_add(chanlist_chunk_cb, chunk);
+        pthread_mutex_lock(&list->mutex);
+    }
+
+    pthread_mutex_unlock(&list->mutex);
+    return NULL;
+}
+
+// Window, on the GTK thread
+
+static void chanlist_update_label(chanlist_t *list) {
+    char text[256];
+    char receive[128];
+    int total;
+
+    pthread_mutex_lock(&list->mutex);
+    total = list->count;
+    memcpy(receive, list->receive_stats, sizeof(receive));
+    pthread_mutex_unlock(&list->mutex);
+
+    if (list->filter_scanned > 0) {
+        snprintf(text, sizeof(text), "%d of %d channels, filtered in %.1f ms (%.2f ms per 10k). %s",
+                 list->row_count, total, list->filter_us / 1000.0,
+                 list->filter_us / 1000.0 * 10000 / list->filter_scanned, receive);
+    } else {
+        snprintf(text, sizeof(text), "%d of %d channels. %s", list->row_count, total, receive);
+    }
+    gtk_label_set_text(GTK_LABEL(list->label), text);
+}
+
+static void chanlist_clear_rows(chanlist_t *list) {
+    // Swapping the model out is cheaper than a row-deleted per row
+    gtk_tree_view_set_model(GTK_TREE_VIEW(list->view), NULL);
+    list->row_count = 0;
+    list->stamp++;
+    gtk_tree_view_set_model(GTK_TREE_VIEW(list->view), list->model);
+}
+
+static gboolean chanlist_chunk_cb(gpointer data) {
+    chanlist_chunk_t *chunk = data;
+    chanlist_t *list = chunk->list;
+    int32_t age = (int32_t)(chunk->generation - list->shown_generation);
+
+    // Old filters' results are dropped; the first chunk of a new one
+    // replaces what is on screen, so the view never flashes empty
+    if (age < 0 || !list->view) {
+        free(chunk);
+        return FALSE;
+    }
+    if (age > 0) {
+        chanlist_clear_rows(list);
+        list->shown_generation = chunk->generation;
+    }
+
+    if (list->row_count + chunk->count > list->row_cap) {
+        int cap = list->row_cap ? list->row_cap : 1024;
+        while (cap < list->row_count + chunk->count) cap *= 2;
+        uint32_t *rows = realloc(list->rows, (size_t)cap * sizeof(uint32_t));
+        if (!rows) {
+            log_message("ERROR", "Out of memory showing the channel list");
+            free(chunk);
+            return FALSE;
+        }
+        list->rows = rows;
+        list->row_cap = cap;
+    }
+
+    for (int i = 0; i < chunk->count; i++) {
+        GtkTreeIter iter;
+        GtkTreePath *path = gtk_tree_path_new_from_indices(list->row_count, -1);
+
+        list->rows[list->row_count] = chunk->rows[i];
+        model_set_iter(list, &iter, list->row_count++);
+        gtk_tree_model_row_inserted(list->model, path, &iter);
+        gtk_tree_path_free(path);
+    }
+
+    list->filter_scanned = chunk->scanned;
+    list->filter_us = chunk->filter_us;
+    chanlist_update_label(list);
+
+    free(chunk);
+    return FALSE;
+}
+
+static void chanlist_filter_changed(GtkEditable *editable, gpointer data) {
+    chanlist_t *list = data;
+
+    pthread_mutex_lock(&list->mutex);
+    strncpy(list->filter, gtk_entry_get_text(GTK_ENTRY(editable)), sizeof(list->filter) - 1);
+    list->generation++;
+    pthread_cond_signal(&list->cond);
+    pthread_mutex_unlock(&list->mutex);
+}
+
+// Double-click joins
+static void chanlist_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *column, gpointer data) {
+    chanlist_t *list = data;
+    GtkTreeIter iter;
+    char *name = NULL;
+    (void)column;
+
+    if (!gtk_tree_model_get_iter(gtk_tree_view_get_model(view), &iter, path)) return;
+    gtk_tree_model_get(list->model, &iter, CHANLIST_COL_NAME, &name, -1);
+
+    if (name && *name) {
+        char cmd[MAX_MSG_LENGTH];
+        snprintf(cmd, sizeof(cmd), "JOIN %s\r\n", name);
+        send_irc_command(server_get(list->server_idx), cmd);
+    }
+    g_free(name);
+}
+
+static void chanlist_add_column(chanlist_t *list, const char *title, int column, int width) {
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *view_column = gtk_tree_view_column_new_with_attributes(title, renderer, "text", column, NULL);
+
+    // Fixed-height mode needs fixed-size columns
+    gtk_tree_view_column_set_sizing(view_column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(view_column, width);
+    gtk_tree_view_column_set_resizable(view_column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(list->view), view_column);
+}
+
+static void chanlist_show(chanlist_t *list) {
+    if (!list->window) {
+        server_info_t *server = server_get(list->server_idx);
+        char title[MAX_SERVER_NAME + 32];
+
+        ChanlistModel *model = g_object_new(chanlist_model_get_type(), NULL);
+        model->list = list;
+        list->model = GTK_TREE_MODEL(model);
+
+        list->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        snprintf(title, sizeof(title), "Channels on %s", server->config.name);
+        gtk_window_set_title(GTK_WINDOW(list->window), title);
+        gtk_window_set_default_size(GTK_WINDOW(list->window), 720, 480);
+        gtk_window_set_transient_for(GTK_WINDOW(list->window), GTK_WINDOW(client.window));
+        // Closing only hides it; the next LIST shows it again
+        g_signal_connect(list->window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+        gtk_container_add(GTK_CONTAINER(list->window), box);
+
+        GtkWidget *entry = gtk_entry_new();
+        gtk_entry_set_placeholder_text(GTK_ENTRY(entry), "Filter by name or topic; >N or <N users");
+        g_signal_connect(entry, "changed", G_CALLBACK(chanlist_filter_changed), list);
+        gtk_box_pack_start(GTK_BOX(box), entry, FALSE, FALSE, 0);
+
+        list->view = gtk_tree_view_new_with_model(list->model);
+        chanlist_add_column(list, "Channel", CHANLIST_COL_NAME, 180);
+        chanlist_add_column(list, "Users", CHANLIST_COL_USERS, 60);
+        chanlist_add_column(list, "Topic", CHANLIST_COL_TOPIC, 440);
+        gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(list->view), TRUE);
+        g_signal_connect(list->view, "row-activated", G_CALLBACK(chanlist_row_activated), list);
+
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+        gtk_container_add(GTK_CONTAINER(scrolled), list->view);
+        gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
+
+        list->label = gtk_label_new("");
+        gtk_label_set_xalign(GTK_LABEL(list->label), 0.0);
+        gtk_box_pack_start(GTK_BOX(box), list->label, FALSE, FALSE, 0);
+    }
+
+    chanlist_update_label(list);
+    gtk_widget_show_all(list->window);
+    gtk_window_present(GTK_WINDOW(list->window));
+}
+
+static gboolean chanlist_show_cb(gpointer data) {
+    chanlist_show(data);
+    return FALSE;
+}
+
+static gboolean chanlist_label_cb(gpointer data) {
+    chanlist_t *list = data;
+    if (list->label) chanlist_update_label(list);
+    return FALSE;
+}
+
+// Store, on the network thread
+
+// Created on the first LIST reply; lives as long as the server
+static chanlist_t *chanlist_get(server_info_t *server) {
+    if (server->chanlist) return server->chanlist;
+
+    chanlist_t *list = calloc(1, sizeof(chanlist_t));
+    if (!list) return NULL;
+
+    list->server_idx = server->index;
+    pthread_mutex_init(&list->mutex, NULL);
+    pthread_cond_init(&list->cond, NULL);
+    if (pthread_create(&list->worker, NULL, chanlist_worker, list) != 0) {
+        log_message("ERROR", "Failed to start the channel list worker");
+        pthread_mutex_destroy(&list->mutex);
+        pthread_cond_destroy(&list->cond);
+        free(list);
+        return NULL;
+    }
+
+    server->chanlist = list;
+    return list;
+}
+
+static bool chanlist_reserve(chanlist_t *list, size_t text) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 1024;
+        uint32_t *name_off = realloc(list->name_off, (size_t)capacity * sizeof(uint32_t));
+        if (name_off) list->name_off = name_off;
+        uint32_t *topic_off = realloc(list->topic_off, (size_t)capacity * sizeof(uint32_t));
+        if (topic_off) list->topic_off = topic_off;
+        uint32_t *users = realloc(list->users, (size_t)capacity * sizeof(uint32_t));
+        if (users) list->users = users;
+        if (!name_off || !topic_off || !users) return false;
+        list->capacity = capacity;
+    }
+
+    if (list->text_len + text > list->text_cap) {
+        size_t cap = list->text_cap ? list->text_cap : 64 * 1024;
+        while (list->text_len + text > cap) cap *= 2;
+        if (cap > UINT32_MAX) return false;
+        char *grown = realloc(list->text, cap);
+        if (!grown) return false;
+        list->text = grown;
+        list->text_cap = cap;
+    }
+    return true;
+}
+
+// 321, or the first 322 of a reply without one: empties the store
+void chanlist_start(server_info_t *server) {
+    if (client.mode == CLIENT_DAEMON) return;
+
+    chanlist_t *list = chanlist_get(server);
+    if (!list) return;
+
+    pthread_mutex_lock(&list->mutex);
+    list->count = 0;
+    list->text_len = 0;
+    list->receiving = true;
+    list->started_us = get_monotonic_us();
+    snprintf(list->receive_stats, sizeof(list->receive_stats), "Receiving...");
+    list->generation++;
+    pthread_cond_signal(&list->cond);
+    pthread_mutex_unlock(&list->mutex);
+
+    g_idle_add(chanlist_show_cb, list);
+}
+
+// 322 <me> <channel> <users> :<topic>
+void chanlist_add(server_info_t *server, const char *params) {
+    if (client.mode == CLIENT_DAEMON || !params) return;
+    if (!server->chanlist || !server->chanlist->receiving) chanlist_start(server);
+
+    chanlist_t *list = server->chanlist;
+    if (!list) return;
+
+    const char *channel = strchr(params, ' ');
+    if (!channel) return;
+    channel++;
+    const char *count = strchr(channel, ' ');
+    if (!count) return;
+    size_t channel_len = (size_t)(count - channel);
+    char *topic_start;
+    unsigned long users = strtoul(count + 1, &topic_start, 10);
+    const char *topic = strchr(topic_start, ':');
+    topic = topic ? topic + 1 : "";
+    size_t topic_len = strlen(topic);
+
+    pthread_mutex_lock(&list->mutex);
+    if (!chanlist_reserve(list, channel_len + topic_len + 2)) {
+        pthread_mutex_unlock(&list->mutex);
+        log_message("ERROR", "Out of memory storing the channel list of %s", server->config.name);
+        return;
+    }
+
+    int row = list->count;
+    list->name_off[row] = (uint32_t)list->text_len;
+    memcpy(list->text + list->text_len, channel, channel_len);
+    list->text_len += channel_len;
+    list->text[list->text_len++] = '\0';
+    list->topic_off[row] = (uint32_t)list->text_len;
+    memcpy(list->text + list->text_len, topic, topic_len + 1);
+    list->text_len += topic_len + 1;
+    list->users[row] = users > UINT32_MAX ? UINT32_MAX : (uint32_t)users;
+    list->count++;
+
+    if (list->count % CHANLIST_WAKE == 0) pthread_cond_signal(&list->cond);
+    pthread_mutex_unlock(&list->mutex);
+}
+
+// 323: the reply is complete
+void chanlist_end(server_info_t *server) {
+    chanlist_t *list = server->chanlist;
+    if (!list || !list->receiving) return;
+
+    pthread_mutex_lock(&list->mutex);
+    list->receiving = false;
+
+    double seconds = (get_monotonic_us() - list->started_us) / 1000000.0;
+    size_t bytes = list->text_cap + (size_t)list->capacity * 3 * sizeof(uint32_t);
+    int count = list->count;
+
+    if (count > 0) {
+        snprintf(list->receive_stats, sizeof(list->receive_stats),
+                 "Received in %.2f s, %.1f MB (%.0f KB and %.0f ms per 10k)",
+                 seconds, bytes / (1024.0 * 1024), bytes / 1024.0 * 10000 / count, seconds * 1000 * 10000 / count);
+    } else {
+        snprintf(list->receive_stats, sizeof(list->receive_stats), "No channels listed");
+    }
+    pthread_cond_signal(&list->cond);
+    pthread_mutex_unlock(&list->mutex);
+
+    log_message("INFO", "LIST from %s: %d channels in %.2f s, %zu bytes stored",
+                server->config.name, count, seconds, bytes);
+    g_idle_add(chanlist_label_cb, list);
+}
+
+// Stops the worker; at exit only
+void chanlist_free(server_info_t *server) {
+    chanlist_t *list = server->chanlist;
+    if (!list) return;
+
+    pthread_mutex_lock(&list->mutex);
+    list->quit = true;
+    pthread_cond_signal(&list->cond);
+    pthread_mutex_unlock(&list->mutex);
+    pthread_join(list->worker, NULL);
+
+    if (list->model) g_object_unref(list->model);
+    pthread_mutex_destroy(&list->mutex);
+    pthread_cond_destroy(&list->cond);
+    free(list->text);
+    free(list->name_off);
+    free(list->topic_off);
+    free(list->users);
+    free(list->rows);
+    free(list);
+    server->chanlist = NULL;
+}
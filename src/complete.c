@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Tab completion in the message entry. The word before the cursor is
+// completed as a /command at the start of the line, a channel if it starts
+// with a channel prefix, and a nick of the current channel otherwise.
+// Every source is a sorted array searched for the run of names sharing
+// the prefix; nicks come from the roster itself, recent speakers first.
+// Repeated Tabs cycle through the candidates, Shift+Tab goes back.
+
+// Longest thing inserted: "#" + channel name
+#define COMPLETE_WORD (MAX_CHANNEL_LENGTH + 1)
+
+// Sorted; commands handled by handle_user_input() plus common raw ones
+static const char *commands[] = {
+    "amsg", "dcc", "join", "kick", "lag", "lagstats", "list", "me", "mode", "msg", "netstats", "nick",
+    "notice", "part", "pluginstats", "quit", "reconnect", "reconnectstats",
+    "scrollback", "tlsstats", "topic", "trace", "whois"
+};
+
+static struct {
+    char candidates[ROSTER_COMPLETE_MAX][COMPLETE_WORD];
+    int count;
+    int current;
+    const char *suffix;
+    int start;          // Where the completed word starts, in characters
+    int inserted;       // Characters of the current candidate plus suffix
+    char *expect;       // Entry text right after the last completion
+} state;
+
+static const isupport_t *complete_isupport;
+
+static int compare_names(const void *a, const void *b) {
+    return isupport_casecmp(complete_isupport, *(const char *const *)a, *(const char *const *)b);
+}
+
+static bool has_prefix(const isupport_t *isupport, const char *name, const char *prefix) {
+    for (; *prefix; name++, prefix++) {
+        if (isupport_fold(isupport, *name) != isupport_fold(isupport, *prefix)) return false;
+    }
+    return true;
+}
+
+// Adds the run of sorted names that start with prefix, each after lead
+static void add_matches(const isupport_t *isupport, const char *const *names, int count,
+                        const char *lead, const char *prefix) {
+    int lo = 0;
+    int hi = count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (isupport_casecmp(isupport, names[mid], prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (int i = lo; i < count && state.count < ROSTER_COMPLETE_MAX; i++) {
+        if (!has_prefix(isupport, names[i], prefix)) break;
+        snprintf(state.candidates[state.count++], COMPLETE_WORD, "%s%s", lead, names[i]);
+    }
+}
+
+static void complete_channels(server_info_t *server, const char *prefix) {
+    const server_snapshot_t *snapshot = server_snapshot(server);
+    const isupport_t *isupport = &snapshot->isupport;
+    char (*names)[COMPLETE_WORD] = malloc(snapshot->count * sizeof(*names) + 1);
+    const char **sorted = malloc(snapshot->count * sizeof(*sorted) + 1);
+    int count = 0;
+
+    if (names && sorted) {
+        for (int i = 0; i < snapshot->count; i++) {
+            const channel_view_t *channel = &snapshot->channels[i];
+            if (channel->is_private_msg) continue;
+            // '#' is stripped from stored names, other prefixes are not
+            snprintf(names[count], COMPLETE_WORD, "%s%s",
+                     isupport_is_channel(isupport, channel->name) ? "" : "#", channel->name);
+            sorted[count] = names[count];
+            count++;
+        }
+
+        complete_isupport = isupport;
+        qsort(sorted, count, sizeof(*sorted), compare_names);
+        add_matches(isupport, sorted, count, "", prefix);
+    }
+
+    free(names);
+    free(sorted);
+}
+
+static void complete_nicks(server_info_t *server, const channel_view_t *channel, const char *prefix) {
+    if (channel->is_private_msg) {
+        if (has_prefix(&server_snapshot(server)->isupport, channel->target_nick, prefix)) {
+            snprintf(state.candidates[state.count++], COMPLETE_WORD, "%s", channel->target_nick);
+        }
+        return;
+    }
+
+    char nicks[ROSTER_COMPLETE_MAX][MAX_NICK_LENGTH];
+    int count = roster_complete(server, server->active_channel, prefix, nicks, ROSTER_COMPLETE_MAX);
+
+    for (int i = 0; i < count; i++) {
+        snprintf(state.candidates[state.count++], COMPLETE_WORD, "%s", nicks[i]);
+    }
+}
+
+// Replaces the completed word with candidate i
+static void complete_insert(GtkEditable *editable, int i) {
+    char text[COMPLETE_WORD + 2];
+    int position = state.start;
+
+    snprintf(text, sizeof(text), "%s%s", state.candidates[i], state.suffix);
+
+    gtk_editable_delete_text(editable, state.start, state.start + state.inserted);
+    gtk_editable_insert_text(editable, text, -1, &position);
+    gtk_editable_set_position(editable, position);
+
+    state.current = i;
+    state.inserted = position - state.start;
+    g_free(state.expect);
+    state.expect = g_strdup(gtk_entry_get_text(GTK_ENTRY(editable)));
+}
+
+// Completes at the cursor. Returns false when there was nothing to do.
+static bool complete_entry(GtkEntry *entry, bool backwards) {
+    GtkEditable *editable = GTK_EDITABLE(entry);
+    const char *text = gtk_entry_get_text(entry);
+    int cursor = gtk_editable_get_position(editable);
+
+    // Another Tab right after a completion moves on to the next candidate
+    if (state.count > 0 && state.expect && strcmp(text, state.expect) == 0 &&
+        cursor == state.start + state.inserted) {
+        int step = backwards ? state.count - 1 : 1;
+        complete_insert(editable, (state.current + step) % state.count);
+        return true;
+    }
+
+    state.count = 0;
+    if (client.active_server < 0) return false;
+
+    server_info_t *server = server_get(client.active_server);
+    const server_snapshot_t *snapshot = server_snapshot(server);
+    const channel_view_t *channel = snapshot_channel(snapshot, server->active_channel);
+    if (!channel) return false;
+
+    const char *end = g_utf8_offset_to_pointer(text, cursor);
+    const char *word = end;
+    while (word > text && word[-1] != ' ') word--;
+
+    char prefix[COMPLETE_WORD];
+    size_t len = (size_t)(end - word);
+    if (len >= sizeof(prefix)) return false;
+    memcpy(prefix, word, len);
+    prefix[len] = '\0';
+
+    if (word == text && prefix[0] == '/') {
+        add_matches(&snapshot->isupport, commands, (int)(sizeof(commands) / sizeof(commands[0])), "/", prefix + 1);
+        state.suffix = " ";
+    } else if (isupport_is_channel(&snapshot->isupport, prefix)) {
+        complete_channels(server, prefix);
+        state.suffix = " ";
+    } else {
+        complete_nicks(server, channel, prefix);
+        state.suffix = word == text ? ": " : " ";
+    }
+
+    if (state.count == 0) return false;
+
+    state.start = (int)g_utf8_pointer_to_offset(text, word);
+    state.inserted = cursor - state.start;
+    complete_insert(editable, backwards ? state.count - 1 : 0);
+    return true;
+}
+
+gboolean on_message_entry_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+    (void)data;
+
+    if (event->keyval != GDK_KEY_Tab && event->keyval != GDK_KEY_ISO_Left_Tab) return FALSE;
+    if (event->state & GDK_CONTROL_MASK) return FALSE;
+
+    // Tab never moves the focus out of the entry
+    complete_entry(GTK_ENTRY(widget), event->keyval == GDK_KEY_ISO_Left_Tab);
+    return GDK_EVENT_STOP;
+}
@@ -5,12 +5,188 @@
 #include <json-c/json.h>
 #include "client.h"
 
-void load_config(void) {
-    FILE *file = fopen(CONFIG_FILE, "r");
-    if (!file) {
-        log_message("INFO", "No configuration file found, starting fresh");
-        return;
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Persistence. Changes are announced with config_mark_dirty(); a thread of
+// its own saves them once no change has come for CONFIG_SAVE_DELAY_MS, or
+// CONFIG_SAVE_MAX_DELAY_MS after the first under steady churn, so a crash
+// costs seconds of changes instead of the session. Files are written to a
+// temporary name, synced and renamed over the old one: a crash mid-save
+// leaves the previous version. Each server's JSON text is kept between
+// saves and only rebuilt when that server was marked.
+//
+// Every save also writes CONFIG_CACHE_FILE: the same settings in the daemon
+// socket's framing (see wire.c), stamped with the JSON's mtime and size and
+// sealed with a checksum. Startup loads it instead of parsing the JSON while
+// the stamp matches, i.e. until the JSON is edited by hand.
+
+#define CONFIG_SAVE_DELAY_MS 2000
+#define CONFIG_SAVE_MAX_DELAY_MS 10000
+#define CACHE_MAGIC "IRCCFG1\n"
+#define CACHE_MAGIC_LEN 8
+
+enum {
+    CACHE_SOURCE = 1,       // u64 JSON mtime, u64 JSON size
+    CACHE_SERVER,           // See cache_put_server()
+    CACHE_CHANNEL,          // A channel of the last server, see cache_put_channel()
+    CACHE_END               // u32 checksum of all bytes before this frame
+};
+
+// Server flags
+#define CACHE_TLS             0x01
+#define CACHE_TLS_VERIFY      0x02
+#define CACHE_SASL_EXTERNAL   0x04
+#define CACHE_AUTO_CONNECT    0x08
+#define CACHE_AUTO_RECONNECT  0x10
+
+// Channel flags
+#define CACHE_PRIVATE_MSG     0x01
+#define CACHE_AUTO_JOIN       0x02
+
+typedef struct {
+    char *json;             // Pretty-printed server object
+    unsigned version;       // server->config_version it was built from
+} fragment_t;
+
+static struct {
+    pthread_mutex_t mutex;  // Guards the fields up to write_mutex and server->config_version
+    pthread_cond_t changed;
+    bool thread_started;
+    unsigned generation;    // Bumped by every change
+    unsigned saved_generation;
+    uint64_t first_change_us; // Of the unsaved changes, 0 when there are none
+    uint64_t last_change_us;
+    
+    pthread_mutex_t write_mutex; // One save at a time; guards the fragments
+    fragment_t *fragments;  // By server index
+    int fragment_count;
+} saver = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+    .write_mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+// A channel read from the JSON or the cache is complete
+static void config_channel_loaded(server_info_t *server, int channel_idx) {
+    channel_publish(server);
+    core_channel_changed(server->index, CHANNEL_ROW_ADD, channel_idx);
+}
+
+// FNV-1a, enough to tell a torn or foreign file from ours
+static uint32_t cache_checksum(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Applies a cache whose checksum was verified; frames follow CACHE_SOURCE
+static void cache_apply(const uint8_t *data, size_t len) {
+    server_info_t *server = NULL;
+    size_t pos = CACHE_MAGIC_LEN;
+    
+    while (pos < len) {
+        long frame_len = wire_frame_length(data + pos, len - pos);
+        if (frame_len <= 0) break;
+        
+        wire_reader_t reader;
+        wire_reader_init(&reader, data + pos, (size_t)frame_len);
+        pos += (size_t)frame_len;
+        
+        if (reader.type == CACHE_SERVER) {
+            server = server_add();
+            if (!server) break;
+            
+            wire_get_str(&reader, server->config.name, sizeof(server->config.name));
+            wire_get_str(&reader, server->config.hostname, sizeof(server->config.hostname));
+            wire_get_str(&reader, server->nick, sizeof(server->nick));
+            wire_get_str(&reader, server->config.real_name, sizeof(server->config.real_name));
+            wire_get_str(&reader, server->config.password, sizeof(server->config.password));
+            wire_get_str(&reader, server->config.encoding, sizeof(server->config.encoding));
+            wire_get_str(&reader, server->config.client_cert, sizeof(server->config.client_cert));
+            wire_get_str(&reader, server->config.client_key, sizeof(server->config.client_key));
+            server->config.port = wire_get_u16(&reader);
+            server->config.ping_interval = (int)wire_get_u32(&reader);
+            server->config.lag_warn = (int)wire_get_u32(&reader);
+            server->config.lag_timeout = (int)wire_get_u32(&reader);
+            
+            uint8_t flags = wire_get_u8(&reader);
+            server->config.use_tls = flags & CACHE_TLS;
+            server->config.tls_verify = flags & CACHE_TLS_VERIFY;
+            server->config.sasl_external = flags & CACHE_SASL_EXTERNAL;
+            server->config.auto_connect = flags & CACHE_AUTO_CONNECT;
+            server->config.auto_reconnect = flags & CACHE_AUTO_RECONNECT;
+        } else if (reader.type == CACHE_CHANNEL && server) {
+            int channel_idx = channel_alloc(server, -1);
+            if (channel_idx < 0) continue;
+            channel_info_t *channel = channel_get(server, channel_idx);
+            
+            wire_get_str(&reader, channel->name, sizeof(channel->name));
+            wire_get_str(&reader, channel->target_nick, sizeof(channel->target_nick));
+            wire_get_str(&reader, channel->encoding, sizeof(channel->encoding));
+            
+            uint8_t flags = wire_get_u8(&reader);
+            channel->is_private_msg = flags & CACHE_PRIVATE_MSG;
+            channel->active = flags & CACHE_AUTO_JOIN;
+            
+            config_channel_loaded(server, channel_idx);
+        }
     }
+}
+
+// Loads the cache if it is intact and was made from the JSON as it is now.
+// Returns false, having loaded nothing, otherwise.
+static bool cache_load(const struct stat *source) {
+    GMappedFile *mapped = g_mapped_file_new(CONFIG_CACHE_FILE, FALSE, NULL);
+    if (!mapped) return false;
+    
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(mapped);
+    size_t len = g_mapped_file_get_length(mapped);
+    bool valid = false;
+    
+    if (len > CACHE_MAGIC_LEN && memcmp(data, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0) {
+        size_t pos = CACHE_MAGIC_LEN;
+        bool stamped = false;
+        
+        // Every frame must be whole and the last one must seal the rest
+        while (pos < len) {
+            long frame_len = wire_frame_length(data + pos, len - pos);
+            if (frame_len <= 0) break;
+            
+            wire_reader_t reader;
+            wire_reader_init(&reader, data + pos, (size_t)frame_len);
+            
+            if (pos == CACHE_MAGIC_LEN) {
+                uint64_t mtime = wire_get_u64(&reader);
+                uint64_t size = wire_get_u64(&reader);
+                stamped = reader.type == CACHE_SOURCE && !reader.error &&
+                          mtime == (uint64_t)source->st_mtime && size == (uint64_t)source->st_size;
+                if (!stamped) break;
+            } else if (reader.type == CACHE_END) {
+                uint32_t checksum = wire_get_u32(&reader);
+                valid = !reader.error && pos + (size_t)frame_len == len &&
+                        checksum == cache_checksum(data, pos);
+                break;
+            }
+            pos += (size_t)frame_len;
+        }
+    }
+    
+    if (valid) cache_apply(data, len);
+    g_mapped_file_unref(mapped);
+    return valid;
+}
+
+// Parses CONFIG_FILE. Returns false if it is not valid JSON.
+static bool config_parse_json(void) {
+    FILE *file = fopen(CONFIG_FILE, "r");
+    if (!file) return false;
     
     // Get file size
     fseek(file, 0, SEEK_END);
@@ -19,7 +195,7 @@ void load_config(void) {
     
     if (file_size <= 0) {
         fclose(file);
-        return;
+        return false;
     }
     
     // Read file content
@@ -34,7 +210,7 @@ void load_config(void) {
     
     if (!root) {
         log_message("ERROR", "Failed to parse configuration file");
-        return;
+        return false;
     }
     
     // Load servers array
@@ -42,28 +218,26 @@ void load_config(void) {
     if (json_object_object_get_ex(root, "servers", &servers_array)) {
         int array_len = json_object_array_length(servers_array);
         
-        for (int i = 0; i < array_len && i < MAX_SERVERS; i++) {
+        for (int i = 0; i < array_len; i++) {
             json_object *server_obj = json_object_array_get_idx(servers_array, i);
             if (!server_obj) continue;
             
-            server_info_t *server = &client.servers[client.server_count];
-            memset(server, 0, sizeof(server_info_t));
+            server_info_t *server = server_add();
+            if (!server) break;
             
             // Load server properties
             json_object *prop;
             
             if (json_object_object_get_ex(server_obj, "name", &prop)) {
-                strncpy(server->name, json_object_get_string(prop), MAX_SERVER_NAME - 1);
+                strncpy(server->config.name, json_object_get_string(prop), MAX_SERVER_NAME - 1);
             }
             
             if (json_object_object_get_ex(server_obj, "hostname", &prop)) {
-                strncpy(server->hostname, json_object_get_string(prop), INET6_ADDRSTRLEN - 1);
+                strncpy(server->config.hostname, json_object_get_string(prop), INET6_ADDRSTRLEN - 1);
             }
             
             if (json_object_object_get_ex(server_obj, "port", &prop)) {
-                server->port = json_object_get_int(prop);
-            } else {
-                server->port = 6667;
+                server->config.port = json_object_get_int(prop);
             }
             
             if (json_object_object_get_ex(server_obj, "nick", &prop)) {
@@ -71,32 +245,69 @@ void load_config(void) {
             }
             
             if (json_object_object_get_ex(server_obj, "real_name", &prop)) {
-                strncpy(server->real_name, json_object_get_string(prop), 63);
+                strncpy(server->config.real_name, json_object_get_string(prop), 63);
             }
             
             if (json_object_object_get_ex(server_obj, "password", &prop)) {
-                strncpy(server->password, json_object_get_string(prop), 63);
+                strncpy(server->config.password, json_object_get_string(prop), 63);
             }
             
             if (json_object_object_get_ex(server_obj, "auto_connect", &prop)) {
-                server->auto_connect = json_object_get_boolean(prop);
+                server->config.auto_connect = json_object_get_boolean(prop);
             }
             
-            server->state = CONN_DISCONNECTED;
-            server->sockfd = -1;
-            server->active_channel = -1;
+            if (json_object_object_get_ex(server_obj, "auto_reconnect", &prop)) {
+                server->config.auto_reconnect = json_object_get_boolean(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "ping_interval", &prop)) {
+                server->config.ping_interval = json_object_get_int(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "lag_warn", &prop)) {
+                server->config.lag_warn = json_object_get_int(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "lag_timeout", &prop)) {
+                server->config.lag_timeout = json_object_get_int(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "encoding", &prop)) {
+                strncpy(server->config.encoding, json_object_get_string(prop), sizeof(server->config.encoding) - 1);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "tls", &prop)) {
+                server->config.use_tls = json_object_get_boolean(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "tls_verify", &prop)) {
+                server->config.tls_verify = json_object_get_boolean(prop);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "client_cert", &prop)) {
+                strncpy(server->config.client_cert, json_object_get_string(prop), MAX_PATH_LENGTH - 1);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "client_key", &prop)) {
+                strncpy(server->config.client_key, json_object_get_string(prop), MAX_PATH_LENGTH - 1);
+            }
+            
+            if (json_object_object_get_ex(server_obj, "sasl_external", &prop)) {
+                server->config.sasl_external = json_object_get_boolean(prop);
+            }
             
             // Load channels for this server
             json_object *channels_array;
             if (json_object_object_get_ex(server_obj, "channels", &channels_array)) {
                 int channels_len = json_object_array_length(channels_array);
                 
-                for (int j = 0; j < channels_len && j < MAX_CHANNELS_PER_SERVER; j++) {
+                for (int j = 0; j < channels_len; j++) {
                     json_object *channel_obj = json_object_array_get_idx(channels_array, j);
                     if (!channel_obj) continue;
                     
-                    channel_info_t *channel = &server->channels[server->channel_count];
-                    memset(channel, 0, sizeof(channel_info_t));
+                    int channel_idx = channel_alloc(server, -1);
+                    if (channel_idx < 0) break;
+                    channel_info_t *channel = channel_get(server, channel_idx);
                     
                     if (json_object_object_get_ex(channel_obj, "name", &prop)) {
                         strncpy(channel->name, json_object_get_string(prop), MAX_CHANNEL_LENGTH - 1);
@@ -114,73 +325,383 @@ void load_config(void) {
                         channel->active = json_object_get_boolean(prop);
                     }
                     
-                    channel->buffer = gtk_text_buffer_new(NULL);
-                    server->channel_count++;
+                    if (json_object_object_get_ex(channel_obj, "encoding", &prop)) {
+                        strncpy(channel->encoding, json_object_get_string(prop), sizeof(channel->encoding) - 1);
+                    }
+                    
+                    config_channel_loaded(server, channel_idx);
                 }
             }
-            
-            client.server_count++;
         }
     }
     
     json_object_put(root);
+    return true;
+}
+
+
+static int cache_write(GByteArray *body);
+static void cache_put_server(GByteArray *out, server_info_t *server);
+
+void load_config(void) {
+    struct stat source;
+    
+    if (stat(CONFIG_FILE, &source) != 0) {
+        log_message("INFO", "No configuration file found, starting fresh");
+        return;
+    }
+    
+    uint64_t start = get_monotonic_us();
+    if (cache_load(&source)) {
+        log_message("INFO", "Loaded configuration from cache: %d servers in %.1f ms", client.servers.count,
+                    (get_monotonic_us() - start) / 1000.0);
+        return;
+    }
+    
+    if (!config_parse_json()) return;
+    log_message("INFO", "Loaded configuration: %d servers in %.1f ms", client.servers.count,
+                (get_monotonic_us() - start) / 1000.0);
     
-    log_message("INFO", "Loaded configuration: %d servers", client.server_count);
+    // The next start can skip the parse
+    GByteArray *body = g_byte_array_new();
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < client.servers.count; i++) cache_put_server(body, server_get(i));
+    pthread_mutex_unlock(&client.gui_mutex);
+    cache_write(body);
+    g_byte_array_free(body, TRUE);
 }
 
-void save_config(void) {
-    json_object *root = json_object_new_object();
-    json_object *servers_array = json_object_new_array();
+// One server and its channels, as CACHE_SERVER and CACHE_CHANNEL frames
+static void cache_put_server(GByteArray *out, server_info_t *server) {
+    size_t start = wire_begin(out, CACHE_SERVER);
+    wire_put_str(out, server->config.name);
+    wire_put_str(out, server->config.hostname);
+    wire_put_str(out, server->nick);
+    wire_put_str(out, server->config.real_name);
+    wire_put_str(out, server->config.password);
+    wire_put_str(out, server->config.encoding);
+    wire_put_str(out, server->config.client_cert);
+    wire_put_str(out, server->config.client_key);
+    wire_put_u16(out, (uint16_t)server->config.port);
+    wire_put_u32(out, (uint32_t)server->config.ping_interval);
+    wire_put_u32(out, (uint32_t)server->config.lag_warn);
+    wire_put_u32(out, (uint32_t)server->config.lag_timeout);
+    wire_put_u8(out, (server->config.use_tls ? CACHE_TLS : 0) |
+                     (server->config.tls_verify ? CACHE_TLS_VERIFY : 0) |
+                     (server->config.sasl_external ? CACHE_SASL_EXTERNAL : 0) |
+                     (server->config.auto_connect ? CACHE_AUTO_CONNECT : 0) |
+                     (server->config.auto_reconnect ? CACHE_AUTO_RECONNECT : 0));
+    wire_end(out, start);
     
-    for (int i = 0; i < client.server_count; i++) {
-        server_info_t *server = &client.servers[i];
-        json_object *server_obj = json_object_new_object();
+    for (int j = 0; j < server->channels.count; j++) {
+        channel_info_t *channel = channel_get(server, j);
+        if (!channel) continue;
         
-        json_object_object_add(server_obj, "name", json_object_new_string(server->name));
-        json_object_object_add(server_obj, "hostname", json_object_new_string(server->hostname));
-        json_object_object_add(server_obj, "port", json_object_new_int(server->port));
-        json_object_object_add(server_obj, "nick", json_object_new_string(server->nick));
-        json_object_object_add(server_obj, "real_name", json_object_new_string(server->real_name));
+        start = wire_begin(out, CACHE_CHANNEL);
+        wire_put_str(out, channel->name);
+        wire_put_str(out, channel->target_nick);
+        wire_put_str(out, channel->encoding);
+        wire_put_u8(out, (channel->is_private_msg ? CACHE_PRIVATE_MSG : 0) |
+                         (channel->active ? CACHE_AUTO_JOIN : 0));
+        wire_end(out, start);
+    }
+}
+
+// Replaces path with data through a synced temporary file, so a crash
+// leaves either the old contents or the new. Returns 0 on success.
+static int write_atomic(const char *path, const GByteArray *data) {
+    char tmp[MAX_PATH_LENGTH];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        log_message("ERROR", "Failed to create %s", tmp);
+        return -1;
+    }
+    
+    bool ok = fwrite(data->data, 1, data->len, file) == data->len && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+    
+#ifdef _WIN32
+    // rename() does not replace an existing file here
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0) {
+        log_message("ERROR", "Failed to write %s", path);
+        remove(tmp);
+        return -1;
+    }
+    
+#ifndef _WIN32
+    // The rename itself is only durable once the directory is
+    int dir = open(".", O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+#endif
+    return 0;
+}
+
+// Stamps body (server frames) with the JSON as it is on disk, seals it and
+// writes the cache. Returns 0 on success.
+static int cache_write(GByteArray *body) {
+    struct stat source;
+    if (stat(CONFIG_FILE, &source) != 0) return -1;
+    
+    GByteArray *out = g_byte_array_new();
+    g_byte_array_append(out, (const guint8 *)CACHE_MAGIC, CACHE_MAGIC_LEN);
+    
+    size_t start = wire_begin(out, CACHE_SOURCE);
+    wire_put_u64(out, (uint64_t)source.st_mtime);
+    wire_put_u64(out, (uint64_t)source.st_size);
+    wire_end(out, start);
+    
+    g_byte_array_append(out, body->data, body->len);
+    
+    uint32_t checksum = cache_checksum(out->data, out->len);
+    start = wire_begin(out, CACHE_END);
+    wire_put_u32(out, checksum);
+    wire_end(out, start);
+    
+    int rc = write_atomic(CONFIG_CACHE_FILE, out);
+    g_byte_array_free(out, TRUE);
+    return rc;
+}
+
+// One server as a pretty-printed JSON object
+static char *server_to_json(server_info_t *server) {
+    json_object *server_obj = json_object_new_object();
+    
+    json_object_object_add(server_obj, "name", json_object_new_string(server->config.name));
+    json_object_object_add(server_obj, "hostname", json_object_new_string(server->config.hostname));
+    json_object_object_add(server_obj, "port", json_object_new_int(server->config.port));
+    json_object_object_add(server_obj, "nick", json_object_new_string(server->nick));
+    json_object_object_add(server_obj, "real_name", json_object_new_string(server->config.real_name));
+    
+    if (strlen(server->config.password) > 0) {
+        json_object_object_add(server_obj, "password", json_object_new_string(server->config.password));
+    }
+    
+    json_object_object_add(server_obj, "auto_connect", json_object_new_boolean(server->config.auto_connect));
+    json_object_object_add(server_obj, "auto_reconnect", json_object_new_boolean(server->config.auto_reconnect));
+    json_object_object_add(server_obj, "ping_interval", json_object_new_int(server->config.ping_interval));
+    json_object_object_add(server_obj, "lag_warn", json_object_new_int(server->config.lag_warn));
+    json_object_object_add(server_obj, "lag_timeout", json_object_new_int(server->config.lag_timeout));
+    json_object_object_add(server_obj, "encoding", json_object_new_string(server->config.encoding));
+    json_object_object_add(server_obj, "tls", json_object_new_boolean(server->config.use_tls));
+    json_object_object_add(server_obj, "tls_verify", json_object_new_boolean(server->config.tls_verify));
+    
+    if (strlen(server->config.client_cert) > 0) {
+        json_object_object_add(server_obj, "client_cert", json_object_new_string(server->config.client_cert));
+        json_object_object_add(server_obj, "sasl_external", json_object_new_boolean(server->config.sasl_external));
+    }
+    
+    if (strlen(server->config.client_key) > 0) {
+        json_object_object_add(server_obj, "client_key", json_object_new_string(server->config.client_key));
+    }
+    
+    // Save channels
+    json_object *channels_array = json_object_new_array();
+    for (int j = 0; j < server->channels.count; j++) {
+        channel_info_t *channel = channel_get(server, j);
+        if (!channel) continue;
         
-        if (strlen(server->password) > 0) {
-            json_object_object_add(server_obj, "password", json_object_new_string(server->password));
-        }
+        json_object *channel_obj = json_object_new_object();
         
-        json_object_object_add(server_obj, "auto_connect", json_object_new_boolean(server->auto_connect));
+        json_object_object_add(channel_obj, "name", json_object_new_string(channel->name));
+        json_object_object_add(channel_obj, "is_private_msg", json_object_new_boolean(channel->is_private_msg));
+        json_object_object_add(channel_obj, "auto_join", json_object_new_boolean(channel->active));
         
-        // Save channels
-        json_object *channels_array = json_object_new_array();
-        for (int j = 0; j < server->channel_count; j++) {
-            channel_info_t *channel = &server->channels[j];
-            json_object *channel_obj = json_object_new_object();
-            
-            json_object_object_add(channel_obj, "name", json_object_new_string(channel->name));
-            json_object_object_add(channel_obj, "is_private_msg", json_object_new_boolean(channel->is_private_msg));
-            json_object_object_add(channel_obj, "auto_join", json_object_new_boolean(channel->active));
-            
-            if (channel->is_private_msg) {
-                json_object_object_add(channel_obj, "target_nick", json_object_new_string(channel->target_nick));
-            }
-            
-            json_object_array_add(channels_array, channel_obj);
+        if (channel->is_private_msg) {
+            json_object_object_add(channel_obj, "target_nick", json_object_new_string(channel->target_nick));
+        }
+        
+        if (channel->encoding[0]) {
+            json_object_object_add(channel_obj, "encoding", json_object_new_string(channel->encoding));
         }
         
+        json_object_array_add(channels_array, channel_obj);
+    }
+    
         json_object_object_add(server_obj, "channels", channels_array);
-        json_object_array_add(servers_array, server_obj);
+    
+    char *json = strdup(json_object_to_json_string_ext(server_obj, JSON_C_TO_STRING_PRETTY));
+    json_object_put(server_obj);
+    return json;
+}
+
+// The server's JSON text, rebuilt if it changed since the last save.
+// Called with write_mutex and client.gui_mutex held.
+static const char *server_fragment(server_info_t *server) {
+    if (server->index >= saver.fragment_count) {
+        int count = server->index + 8;
+        fragment_t *fragments = realloc(saver.fragments, count * sizeof(fragment_t));
+        if (!fragments) return NULL;
+        memset(fragments + saver.fragment_count, 0, (count - saver.fragment_count) * sizeof(fragment_t));
+        saver.fragments = fragments;
+        saver.fragment_count = count;
     }
     
-    json_object_object_add(root, "servers", servers_array);
+    fragment_t *fragment = &saver.fragments[server->index];
     
-    // Write to file
-    FILE *file = fopen(CONFIG_FILE, "w");
-    if (file) {
-        const char *json_string = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
-        fprintf(file, "%s\n", json_string);
-        fclose(file);
-        log_message("INFO", "Configuration saved");
-    } else {
-        log_message("ERROR", "Failed to save configuration file");
+    pthread_mutex_lock(&saver.mutex);
+    unsigned version = server->config_version;
+    pthread_mutex_unlock(&saver.mutex);
+    
+    if (fragment->json && fragment->version == version) return fragment->json;
+    
+    // A change marked while this runs bumps the version again
+    free(fragment->json);
+    fragment->json = server_to_json(server);
+    fragment->version = version;
+    return fragment->json;
+}
+
+// Appends text with indent after every line break
+static void append_indented(GByteArray *out, const char *text, const char *indent) {
+    size_t indent_len = strlen(indent);
+    
+    g_byte_array_append(out, (const guint8 *)indent, (guint)indent_len);
+    for (const char *p = text; *p; p++) {
+        g_byte_array_append(out, (const guint8 *)p, 1);
+        if (*p == '\n') g_byte_array_append(out, (const guint8 *)indent, (guint)indent_len);
     }
+}
+
+// Writes the JSON and the cache from the same view of the settings.
+// Called with write_mutex held. Returns 0 on success.
+static int config_write(void) {
+    static const char open_text[] = "{\n  \"servers\":[\n";
+    static const char close_text[] = "\n  ]\n}\n";
+    GByteArray *text = g_byte_array_new();
+    GByteArray *body = g_byte_array_new();
+    bool complete = true;
     
-    json_object_put(root);
+    g_byte_array_append(text, (const guint8 *)open_text, sizeof(open_text) - 1);
+    
+    // Network threads may be renaming or removing channels
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < client.servers.count; i++) {
+        server_info_t *server = server_get(i);
+        const char *fragment = server_fragment(server);
+        if (!fragment) {
+            complete = false;
+            break;
+        }
+        
+        if (i > 0) g_byte_array_append(text, (const guint8 *)",\n", 2);
+        append_indented(text, fragment, "    ");
+        cache_put_server(body, server);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+    
+    g_byte_array_append(text, (const guint8 *)close_text, sizeof(close_text) - 1);
+    
+    int rc = -1;
+    if (!complete) {
+        log_message("ERROR", "Out of memory saving the configuration");
+    } else if (write_atomic(CONFIG_FILE, text) == 0) {
+        rc = 0;
+        if (cache_write(body) != 0) {
+            // Stale now; the JSON's new stamp keeps it from being used
+            log_message("WARNING", "Configuration cache not updated");
+        }
+    }
+    
+    g_byte_array_free(text, TRUE);
+    g_byte_array_free(body, TRUE);
+    return rc;
+}
+
+// Writes whatever changed since the last save, if anything
+static void config_save_pending(void) {
+    pthread_mutex_lock(&saver.write_mutex);
+    
+    pthread_mutex_lock(&saver.mutex);
+    unsigned generation = saver.generation;
+    bool pending = generation != saver.saved_generation;
+    saver.first_change_us = 0;
+    saver.last_change_us = 0;
+    pthread_mutex_unlock(&saver.mutex);
+    
+    if (pending) {
+        uint64_t start = get_monotonic_us();
+        if (config_write() == 0) {
+            pthread_mutex_lock(&saver.mutex);
+            saver.saved_generation = generation;
+            pthread_mutex_unlock(&saver.mutex);
+            log_message("INFO", "Configuration saved in %.1f ms", (get_monotonic_us() - start) / 1000.0);
+        }
+    }
+    
+    pthread_mutex_unlock(&saver.write_mutex);
+}
+
+static void *saver_thread_func(void *arg) {
+    (void)arg;
+    trace_thread_name("config");
+    
+    pthread_mutex_lock(&saver.mutex);
+    while (client.running) {
+        if (!saver.first_change_us) {
+            pthread_cond_wait(&saver.changed, &saver.mutex);
+            continue;
+        }
+        
+        uint64_t now = get_monotonic_us();
+        uint64_t due = saver.last_change_us + CONFIG_SAVE_DELAY_MS * 1000ULL;
+        uint64_t latest = saver.first_change_us + CONFIG_SAVE_MAX_DELAY_MS * 1000ULL;
+        if (due > latest) due = latest;
+        
+        pthread_mutex_unlock(&saver.mutex);
+        if (now < due) {
+            // Short steps, so quitting is not held up
+            g_usleep(due - now > 100000 ? 100000 : (gulong)(due - now));
+        } else {
+            config_save_pending();
+        }
+        pthread_mutex_lock(&saver.mutex);
+    }
+    pthread_mutex_unlock(&saver.mutex);
+    return NULL;
+}
+
+// Notes that the server's saved settings or channels changed; they are
+// written shortly after, off the calling thread. Any thread.
+void config_mark_dirty(server_info_t *server) {
+    // Replayed and load test servers are not the user's; an attached GUI's
+    // belong to the daemon
+    if (client.replaying || client.loadtest || client.mode == CLIENT_ATTACHED) return;
+    
+    pthread_mutex_lock(&saver.mutex);
+    server->config_version++;
+    saver.generation++;
+    saver.last_change_us = get_monotonic_us();
+    if (!saver.first_change_us) saver.first_change_us = saver.last_change_us;
+    
+    if (!saver.thread_started) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, saver_thread_func, NULL) == 0) {
+            pthread_detach(thread);
+            saver.thread_started = true;
+        } else {
+            log_message("WARNING", "Failed to start the config saver; changes are saved at exit");
+        }
+    }
+    pthread_cond_signal(&saver.changed);
+    pthread_mutex_unlock(&saver.mutex);
+}
+
+// Writes unsaved changes now, on the calling thread; used at shutdown
+void save_config(void) {
+    // Servers of a replayed capture or a load test are not the user's
+    if (client.replaying || client.loadtest) return;
+    
+    const char *mark = watchdog_enter("save_config");
+    config_save_pending();
+    watchdog_leave(mark);
 }
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// The seam between the network core and whoever displays it: the local
+// GTK window, or GUIs attached to the daemon.
+
+// Records a line in a channel's scrollback and shows it. GTK thread only.
+void core_append_line(int server_idx, int channel_idx, const char *text, activity_t activity) {
+    server_info_t *server = server_get(server_idx);
+    channel_info_t *channel = server ? channel_get(server, channel_idx) : NULL;
+    if (!channel) return;
+    
+    pthread_mutex_lock(&client.gui_mutex);
+    uint64_t seq = scrollback_append(&channel->scrollback, text);
+    pthread_mutex_unlock(&client.gui_mutex);
+    
+    if (client.mode == CLIENT_DAEMON) {
+        daemon_broadcast_line(server_idx, channel_idx, seq, text, activity);
+    } else {
+        append_message_to_channel(server_idx, channel_idx, text);
+        channel_list_mark_activity(server_idx, channel_idx, activity);
+    }
+}
+
+// A channel was added, removed or renamed; safe from any thread
+void core_channel_changed(int server_idx, channel_row_op_t op, int channel_idx) {
+    if (client.mode == CLIENT_DAEMON) {
+        daemon_channel_changed(server_idx, op, channel_idx);
+    } else {
+        channel_list_post(server_idx, op, channel_idx);
+    }
+}
+
+// Runs a line typed into a channel: a /command or a message to it. Needs
+// no GTK, so the daemon runs the same code for attached GUIs.
+void handle_user_input(int server_idx, int channel_idx, const char *message) {
+    server_info_t *server = server_get(server_idx);
+    channel_info_t *channel = channel_get(server, channel_idx);
+    const isupport_t *isupport = &server_snapshot(server)->isupport;
+    char cmd[MAX_MSG_LENGTH];
+    
+    if (!channel) return;
+    
+    if (message[0] == '/') {
+        // Handle commands
+        if (strncmp(message, "/join ", 6) == 0 || strncmp(message, "/part ", 6) == 0) {
+            // /join #a,#b,c [key,...] - packed into as few lines as the server allows
+            const char *irc_command = message[1] == 'j' ? "JOIN" : "PART";
+            char list[MAX_MSG_LENGTH];
+            char names[MAX_BATCH_TARGETS][MAX_CHANNEL_LENGTH + 1];
+            const char *targets[MAX_BATCH_TARGETS];
+            
+            strncpy(list, message + 6, sizeof(list) - 1);
+            list[sizeof(list) - 1] = '\0';
+            
+            char *rest = strchr(list, ' ');
+            if (rest) *rest++ = '\0';
+            
+            int count = split_targets(list, targets, MAX_BATCH_TARGETS);
+            for (int i = 0; i < count; i++) {
+                if (!isupport_is_channel(isupport, targets[i])) {
+                    snprintf(names[i], sizeof(names[i]), "#%s", targets[i]);
+                    targets[i] = names[i];
+                }
+            }
+            
+            if (rest && *rest) {
+                // Keys and part reasons are positional, keep the user's line
+                snprintf(cmd, sizeof(cmd), "%s %s\r\n", irc_command, message + 6);
+                send_irc_command(server, cmd);
+            } else if (count > 0) {
+                send_batched_targets(server, irc_command, targets, count, NULL);
+            }
+        } else if (strcmp(message, "/tlsstats") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            tls_stats_t *stats = &server->tls_stats;
+            
+            if (stats->handshakes == 0) {
+                snprintf(stats_msg, sizeof(stats_msg), "%s TLS: no handshakes with %s\n",
+                         get_timestamp(), server->config.name);
+            } else {
+                snprintf(stats_msg, sizeof(stats_msg),
+                         "%s TLS: %u handshakes, %u resumed (%.0f%%), last %.2f ms, avg %.2f ms\n",
+                         get_timestamp(), stats->handshakes, stats->resumed,
+                         100.0 * stats->resumed / stats->handshakes,
+                         stats->last_handshake_us / 1000.0,
+                         stats->total_handshake_us / 1000.0 / stats->handshakes);
+            }
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+        } else if (strcmp(message, "/pluginstats") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            
+            if (plugin_get_count() == 0) {
+                snprintf(stats_msg, sizeof(stats_msg), "%s Plugins: none loaded from %s/\n",
+                         get_timestamp(), PLUGIN_DIR);
+                core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            }
+            for (int i = 0; i < plugin_get_count(); i++) {
+                plugin_format_stats(i, stats_msg, sizeof(stats_msg));
+                core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            }
+        } else if (strncmp(message, "/dcc", 4) == 0 && (message[4] == ' ' || message[4] == '\0')) {
+            dcc_command(server_idx, channel_idx, message[4] ? message + 5 : "");
+        } else if (strcmp(message, "/netstats") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            net_format_stats(server, stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            for (int s = 0; shard_format_stats(s, stats_msg, sizeof(stats_msg)); s++) {
+                core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            }
+        } else if (strcmp(message, "/lag") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            lag_format_stats(server, stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+        } else if (strncmp(message, "/trace", 6) == 0 && (message[6] == ' ' || message[6] == '\0')) {
+            // /trace [seconds] dumps recent spans, /trace on|off toggles recording
+            char trace_msg[MAX_MSG_LENGTH];
+            const char *arg = message[6] ? message + 7 : "";
+            
+            if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) {
+                trace_set_enabled(arg[1] == 'n');
+                snprintf(trace_msg, sizeof(trace_msg), "%s Tracing %s\n", get_timestamp(), arg);
+            } else {
+                char path[64];
+                int seconds = atoi(arg) > 0 ? atoi(arg) : 10;
+                
+                if (trace_dump(seconds, path, sizeof(path)) == 0) {
+                    snprintf(trace_msg, sizeof(trace_msg), "%s Trace of the last %d s written to %s%s\n",
+                             get_timestamp(), seconds, path, trace_enabled() ? "" : " (tracing is off)");
+                } else {
+                    snprintf(trace_msg, sizeof(trace_msg), "%s Failed to write the trace\n", get_timestamp());
+                }
+            }
+            core_append_line(server_idx, channel_idx, trace_msg, ACTIVITY_NONE);
+        } else if (strcmp(message, "/lagstats") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            watchdog_format_frames(stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            watchdog_format_stalls(stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+        } else if (strcmp(message, "/lagstats backtraces on") == 0 || strcmp(message, "/lagstats backtraces off") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            bool enabled = strcmp(message + 21, "on") == 0;
+            watchdog_set_backtraces(enabled);
+            snprintf(stats_msg, sizeof(stats_msg), "%s Stall backtraces %s\n", get_timestamp(),
+                     enabled ? "on: stalls over 1 s print the GTK thread's stack to stderr" : "off");
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+        } else if (strcmp(message, "/scrollback") == 0) {
+            // Totals, then each channel's share
+            char stats_msg[MAX_MSG_LENGTH];
+            scrollback_format_totals(stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+            for (int s = 0; s < client.servers.count; s++) {
+                server_info_t *other = server_get(s);
+                for (int c = 0; c < other->channels.count; c++) {
+                    if (scrollback_format_channel(other, c, stats_msg, sizeof(stats_msg))) {
+                        core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+                    }
+                }
+            }
+        } else if (strcmp(message, "/reconnectstats") == 0) {
+            char stats_msg[MAX_MSG_LENGTH];
+            reconnect_format_stats(server, stats_msg, sizeof(stats_msg));
+            core_append_line(server_idx, channel_idx, stats_msg, ACTIVITY_NONE);
+        } else if (strcmp(message, "/reconnect") == 0) {
+            if (server->state == CONN_CONNECTED) {
+                send_irc_command(server, "QUIT :Reconnecting\r\n");
+                server->state = CONN_DISCONNECTED;
+                close_server_connection(server);
+            }
+            reconnect_now(server);
+        } else if (strncmp(message, "/quit", 5) == 0) {
+            disconnect_server(server);
+        } else if (strncmp(message, "/msg ", 5) == 0 || strncmp(message, "/notice ", 8) == 0) {
+            // /msg target[,target...] message
+            bool notice = message[1] == 'n';
+            char list[MAX_MSG_LENGTH];
+            const char *targets[MAX_BATCH_TARGETS];
+            
+            strncpy(list, message + (notice ? 8 : 5), sizeof(list) - 1);
+            list[sizeof(list) - 1] = '\0';
+            
+            char *space = strchr(list, ' ');
+            if (space) {
+                *space = '\0';
+                const char *msg = space + 1;
+                int count = split_targets(list, targets, MAX_BATCH_TARGETS);
+                char display_msg[MAX_MSG_LENGTH];
+                
+                if (send_batched_targets(server, notice ? "NOTICE" : "PRIVMSG", targets, count, msg) < 0) {
+                    snprintf(display_msg, sizeof(display_msg), "%s *** Message too long, not sent\n",
+                             get_timestamp());
+                    core_append_line(server_idx, channel_idx, display_msg, ACTIVITY_NONE);
+                    return;
+                }
+                
+                snprintf(display_msg, sizeof(display_msg), notice ? "%s -%s- %s\n" : "%s <%s> %s\n", 
+                         get_timestamp(), server->nick, msg);
+                
+                for (int t = 0; t < count; t++) {
+                    const char *target = targets[t];
+                    int target_channel = -1;
+                    
+                    if (isupport_is_channel(isupport, target)) {
+                        for (int i = 0; i < server->channels.count; i++) {
+                            channel_info_t *joined = channel_get(server, i);
+                            if (joined && !joined->is_private_msg && 
+                                isupport_casecmp(isupport, joined->name, target + 1) == 0) {
+                                target_channel = i;
+                                break;
+                            }
+                        }
+                    } else {
+                        // Add to DM channel or create it
+                        for (int i = 0; i < server->channels.count; i++) {
+                            channel_info_t *dm = channel_get(server, i);
+                            if (dm && dm->is_private_msg && 
+                                isupport_casecmp(isupport, dm->target_nick, target) == 0) {
+                                target_channel = i;
+                                break;
+                            }
+                        }
+                        
+                        if (target_channel == -1) {
+                            target_channel = add_channel_to_server(server_idx, target, true);
+                        }
+                    }
+                    
+                    if (target_channel >= 0) {
+                        core_append_line(server_idx, target_channel, display_msg, ACTIVITY_NONE);
+                    }
+                }
+            }
+        } else if (strncmp(message, "/amsg ", 6) == 0) {
+            // Announce to every joined channel on this server
+            const char *msg = message + 6;
+            int slots = server->channels.count;
+            char (*names)[MAX_CHANNEL_LENGTH + 1] = malloc(slots * sizeof(*names) + 1);
+            const char **targets = malloc(slots * sizeof(*targets) + 1);
+            int count = 0;
+            
+            if (!names || !targets) {
+                free(names);
+                free(targets);
+                return;
+            }
+            
+            for (int i = 0; i < slots; i++) {
+                channel_info_t *joined = channel_get(server, i);
+                if (!joined || joined->is_private_msg) continue;
+                snprintf(names[count], sizeof(names[count]), "#%s", joined->name);
+                targets[count] = names[count];
+                count++;
+            }
+            
+            int lines = send_batched_targets(server, "PRIVMSG", targets, count, msg);
+            free(names);
+            free(targets);
+            
+            char display_msg[MAX_MSG_LENGTH];
+            if (lines < 0) {
+                snprintf(display_msg, sizeof(display_msg), "%s *** Message too long, not sent\n",
+                         get_timestamp());
+                core_append_line(server_idx, channel_idx, display_msg, ACTIVITY_NONE);
+                return;
+            }
+            log_message("INFO", "Announced to %d channels in %d lines", count, lines);
+            snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
+                     get_timestamp(), server->nick, msg);
+            for (int i = 0; i < slots; i++) {
+                channel_info_t *joined = channel_get(server, i);
+                if (joined && !joined->is_private_msg) {
+                    core_append_line(server_idx, i, display_msg, ACTIVITY_NONE);
+                }
+            }
+        } else if (strncmp(message, "/me ", 4) == 0) {
+            // CTCP ACTION to the channel or query being typed in
+            const char *action = message + 4;
+            
+            if (channel->is_private_msg) {
+                snprintf(cmd, sizeof(cmd), "PRIVMSG %s :\001ACTION %s\001\r\n", channel->target_nick, action);
+            } else {
+                snprintf(cmd, sizeof(cmd), "PRIVMSG #%s :\001ACTION %s\001\r\n", channel->name, action);
+            }
+            send_irc_command(server, cmd);
+            
+            char display_msg[MAX_MSG_LENGTH];
+            snprintf(display_msg, sizeof(display_msg), "%s * %s %s\n",
+                     get_timestamp(), server->nick, action);
+            core_append_line(server_idx, channel_idx, display_msg, ACTIVITY_NONE);
+        } else {
+            // Send raw command
+            snprintf(cmd, sizeof(cmd), "%s\r\n", message + 1);
+            send_irc_command(server, cmd);
+        }
+    } else {
+        // Regular message
+        if (channel->is_private_msg) {
+            snprintf(cmd, sizeof(cmd), "PRIVMSG %s :%s\r\n", channel->target_nick, message);
+        } else {
+            snprintf(cmd, sizeof(cmd), "PRIVMSG #%s :%s\r\n", channel->name, message);
+        }
+        send_irc_command(server, cmd);
+        
+        // Echo message to chat
+        char display_msg[MAX_MSG_LENGTH];
+        snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
+                 get_timestamp(), server->nick, message);
+        core_append_line(server_idx, channel_idx, display_msg, ACTIVITY_NONE);
+    }
+}
@@ -0,0 +1,645 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <glib-unix.h>
+#endif
+
+#include "client.h"
+
+// Headless mode: the network core runs here and GUIs attach over a Unix
+// socket. Everything in this file runs on the GLib main loop thread.
+
+#ifndef _WIN32
+
+#define MAX_ATTACHED 8
+// A GUI that stops reading is dropped once this much output is queued
+#define ATTACH_MAX_BACKLOG (8 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    guint in_watch;
+    guint out_watch;
+    GIOChannel *channel;
+    GByteArray *in;
+    GByteArray *out;
+    bool hello;
+    bool dead;          // Dropped by gui_send(), freed from an idle callback
+    int view_server;
+    int view_channel;
+} attached_gui_t;
+
+static attached_gui_t *guis[MAX_ATTACHED];
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static GMainLoop *main_loop;
+
+// The channel the most recent GUI was showing; a new GUI opens on it
+static int last_view_server = -1;
+static int last_view_channel = -1;
+
+static void gui_close(attached_gui_t *gui) {
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i] == gui) guis[i] = NULL;
+    }
+
+    if (gui->in_watch) g_source_remove(gui->in_watch);
+    if (gui->out_watch) g_source_remove(gui->out_watch);
+    g_io_channel_unref(gui->channel);
+    close(gui->fd);
+    g_byte_array_free(gui->in, TRUE);
+    g_byte_array_free(gui->out, TRUE);
+    free(gui);
+
+    log_message("INFO", "GUI detached");
+}
+
+static gboolean gui_free_cb(gpointer data) {
+    gui_close(data);
+    return FALSE;
+}
+
+// Detaches a GUI whose frames may still be handled further up the stack
+// (its input can print lines that are broadcast back to it), so it is
+// only freed once the main loop is idle
+static void gui_drop(attached_gui_t *gui) {
+    if (gui->dead) return;
+    gui->dead = true;
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i] == gui) guis[i] = NULL;
+    }
+    if (gui->in_watch) g_source_remove(gui->in_watch);
+    if (gui->out_watch) g_source_remove(gui->out_watch);
+    gui->in_watch = 0;
+    gui->out_watch = 0;
+    g_idle_add(gui_free_cb, gui);
+}
+
+static bool gui_flush(attached_gui_t *gui) {
+    while (gui->out->len > 0) {
+        ssize_t n = send(gui->fd, gui->out->data, gui->out->len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        g_byte_array_remove_range(gui->out, 0, (guint)n);
+    }
+    return true;
+}
+
+static gboolean gui_writable_cb(GIOChannel *source, GIOCondition condition, gpointer data) {
+    (void)source;
+    attached_gui_t *gui = data;
+
+    if ((condition & (G_IO_ERR | G_IO_HUP)) || !gui_flush(gui)) {
+        gui->out_watch = 0;
+        gui_close(gui);
+        return FALSE;
+    }
+
+    if (gui->out->len == 0) {
+        gui->out_watch = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Sends whatever frames have been built into gui->out. Never frees the
+// GUI; a broken one is dropped with gui_drop().
+static void gui_send(attached_gui_t *gui) {
+    if (gui->dead || gui->out_watch) return; // Already waiting for room
+
+    if (!gui_flush(gui)) {
+        gui_drop(gui);
+        return;
+    }
+
+    if (gui->out->len > ATTACH_MAX_BACKLOG) {
+        log_message("WARNING", "GUI is not reading, detaching it");
+        gui_drop(gui);
+    } else if (gui->out->len > 0) {
+        gui->out_watch = g_io_add_watch(gui->channel, G_IO_OUT | G_IO_ERR | G_IO_HUP, gui_writable_cb, gui);
+    }
+}
+
+static void put_channel(GByteArray *out, int server_idx, int channel_idx) {
+    channel_info_t *channel = channel_get(server_get(server_idx), channel_idx);
+    size_t frame = wire_begin(out, WIRE_CHANNEL);
+
+    wire_put_u16(out, (uint16_t)server_idx);
+    wire_put_u16(out, (uint16_t)channel_idx);
+    wire_put_str(out, channel->name);
+    wire_put_str(out, channel->target_nick);
+    wire_put_u8(out, channel->is_private_msg);
+    wire_put_u32(out, (uint32_t)channel->ui.unread);
+    wire_put_u32(out, (uint32_t)channel->ui.highlights);
+    wire_put_u8(out, (uint8_t)channel->ui.activity);
+    wire_end(out, frame);
+}
+
+// The newest lines of a channel, at most SNAPSHOT_TAIL_LINES and none
+// before since_seq. Called with client.gui_mutex held.
+static void put_backlog(GByteArray *out, int server_idx, int channel_idx, uint64_t since_seq) {
+    scrollback_t *sb = &channel_get(server_get(server_idx), channel_idx)->scrollback;
+    uint64_t first = scrollback_first_seq(sb);
+
+    if (sb->next_seq > SNAPSHOT_TAIL_LINES && first < sb->next_seq - SNAPSHOT_TAIL_LINES) {
+        first = sb->next_seq - SNAPSHOT_TAIL_LINES;
+    }
+    if (first < since_seq) first = since_seq;
+
+    size_t frame = wire_begin(out, WIRE_LINES);
+    wire_put_u16(out, (uint16_t)server_idx);
+    wire_put_u16(out, (uint16_t)channel_idx);
+    wire_put_u8(out, WIRE_LINES_BACKLOG);
+    wire_put_u8(out, ACTIVITY_NONE);
+    wire_put_u64(out, first);
+    wire_put_u32(out, (uint32_t)(sb->next_seq - first));
+    for (uint64_t seq = first; seq < sb->next_seq; seq++) {
+        wire_put_str(out, scrollback_get(sb, seq));
+    }
+    wire_end(out, frame);
+}
+
+// Called with client.gui_mutex held
+static void put_roster(GByteArray *out, int server_idx, int channel_idx) {
+    channel_info_t *channel = channel_get(server_get(server_idx), channel_idx);
+    size_t frame = wire_begin(out, WIRE_ROSTER);
+
+    wire_put_u16(out, (uint16_t)server_idx);
+    wire_put_u16(out, (uint16_t)channel_idx);
+    wire_put_u32(out, (uint32_t)channel->member_count);
+    for (int i = 0; i < channel->member_count; i++) {
+        wire_put_u8(out, (uint8_t)channel->members[i].prefix);
+        wire_put_str(out, channel->members[i].nick->name);
+    }
+    wire_end(out, frame);
+}
+
+static bool valid_channel(int server_idx, int channel_idx) {
+    server_info_t *server = server_get(server_idx);
+    return server && channel_get(server, channel_idx);
+}
+
+// Metadata for every server and channel, but lines and members only for
+// the channel the GUI will show first; the rest is fetched on demand.
+static void send_snapshot(attached_gui_t *gui) {
+    GByteArray *out = gui->out;
+    size_t frame;
+
+    pthread_mutex_lock(&client.gui_mutex);
+
+    frame = wire_begin(out, WIRE_SNAPSHOT_BEGIN);
+    wire_put_u16(out, WIRE_PROTOCOL_VERSION);
+    wire_put_u16(out, (uint16_t)client.servers.count);
+    wire_end(out, frame);
+
+    for (int s = 0; s < client.servers.count; s++) {
+        server_info_t *server = server_get(s);
+
+        frame = wire_begin(out, WIRE_SERVER);
+        wire_put_u16(out, (uint16_t)s);
+        wire_put_str(out, server->config.name);
+        wire_put_str(out, server->nick);
+        wire_put_u8(out, (uint8_t)server->state);
+        wire_end(out, frame);
+
+        for (int c = 0; c < server->channels.count; c++) {
+            if (channel_get(server, c)) put_channel(out, s, c);
+        }
+    }
+
+    // Otherwise the first channel there is
+    if (!valid_channel(last_view_server, last_view_channel)) {
+        last_view_server = client.servers.count > 0 ? 0 : -1;
+        last_view_channel = -1;
+        for (int c = 0; last_view_server >= 0 && c < server_get(0)->channels.count; c++) {
+            if (channel_get(server_get(0), c)) {
+                last_view_channel = c;
+                break;
+            }
+        }
+    }
+
+    if (valid_channel(last_view_server, last_view_channel)) {
+        put_backlog(out, last_view_server, last_view_channel, 0);
+        put_roster(out, last_view_server, last_view_channel);
+    }
+
+    frame = wire_begin(out, WIRE_SNAPSHOT_END);
+    wire_put_u16(out, (uint16_t)(last_view_server + 1));
+    wire_put_u16(out, (uint16_t)(last_view_channel + 1));
+    wire_end(out, frame);
+
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    log_message("INFO", "GUI attached, snapshot is %u bytes", out->len);
+}
+
+static void handle_frame(attached_gui_t *gui, wire_reader_t *reader) {
+    char text[MAX_MSG_LENGTH];
+
+    if (!gui->hello && reader->type != WIRE_HELLO) {
+        reader->error = true;
+        return;
+    }
+
+    switch (reader->type) {
+        case WIRE_HELLO:
+            if (wire_get_u16(reader) != WIRE_PROTOCOL_VERSION) {
+                log_message("WARNING", "GUI speaks another protocol version");
+                reader->error = true;
+                return;
+            }
+            gui->hello = true;
+            send_snapshot(gui);
+            break;
+
+        case WIRE_VIEW: {
+            int server_idx = wire_get_u16(reader);
+            int channel_idx = wire_get_u16(reader);
+            if (reader->error || !valid_channel(server_idx, channel_idx)) return;
+
+            gui->view_server = last_view_server = server_idx;
+            gui->view_channel = last_view_channel = channel_idx;
+
+            pthread_mutex_lock(&client.gui_mutex);
+            channel_info_t *channel = channel_get(server_get(server_idx), channel_idx);
+            channel->ui.unread = 0;
+            channel->ui.highlights = 0;
+            channel->ui.activity = ACTIVITY_NONE;
+            channel->scrollback.viewed_us = get_monotonic_us();
+            put_roster(gui->out, server_idx, channel_idx);
+            pthread_mutex_unlock(&client.gui_mutex);
+            break;
+        }
+
+        case WIRE_FETCH: {
+            int server_idx = wire_get_u16(reader);
+            int channel_idx = wire_get_u16(reader);
+            uint64_t since_seq = wire_get_u64(reader);
+            if (reader->error || !valid_channel(server_idx, channel_idx)) return;
+
+            pthread_mutex_lock(&client.gui_mutex);
+            put_backlog(gui->out, server_idx, channel_idx, since_seq);
+            pthread_mutex_unlock(&client.gui_mutex);
+            break;
+        }
+
+        case WIRE_INPUT: {
+            int server_idx = wire_get_u16(reader);
+            int channel_idx = wire_get_u16(reader);
+            wire_get_str(reader, text, sizeof(text));
+            if (reader->error || !valid_channel(server_idx, channel_idx)) return;
+
+            handle_user_input(server_idx, channel_idx, text);
+            break;
+        }
+
+        case WIRE_CONNECT: {
+            int server_idx = wire_get_u16(reader);
+            if (reader->error || server_idx >= client.servers.count) return;
+
+            server_info_t *server = server_get(server_idx);
+            if (server->state != CONN_CONNECTED) {
+                reconnect_cancel(server);
+                start_server_connection(server_idx);
+            }
+            break;
+        }
+
+        default:
+            // Newer GUIs may send frames we do not know; skip them
+            break;
+    }
+}
+
+static gboolean gui_readable_cb(GIOChannel *source, GIOCondition condition, gpointer data) {
+    (void)source;
+    attached_gui_t *gui = data;
+    uint8_t buf[4096];
+
+    ssize_t n = (condition & G_IO_IN) ? recv(gui->fd, buf, sizeof(buf), 0) : 0;
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return TRUE;
+    if (n <= 0) {
+        gui->in_watch = 0;
+        gui_close(gui);
+        return FALSE;
+    }
+
+    g_byte_array_append(gui->in, buf, (guint)n);
+
+    long frame_len;
+    while ((frame_len = wire_frame_length(gui->in->data, gui->in->len)) > 0) {
+        wire_reader_t reader;
+        wire_reader_init(&reader, gui->in->data, (size_t)frame_len);
+        handle_frame(gui, &reader);
+        // Its own input may have been echoed to it and failed to send
+        if (gui->dead) return FALSE;
+        g_byte_array_remove_range(gui->in, 0, (guint)frame_len);
+
+        if (reader.error) {
+            frame_len = -1;
+            break;
+        }
+    }
+
+    if (frame_len < 0) {
+        log_message("WARNING", "Malformed data from GUI, detaching it");
+        gui->in_watch = 0;
+        gui_close(gui);
+        return FALSE;
+    }
+
+    gui_send(gui);
+    return TRUE;
+}
+
+static gboolean accept_cb(GIOChannel *source, GIOCondition condition, gpointer data) {
+    (void)source;
+    (void)condition;
+    (void)data;
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return TRUE;
+
+    int slot = -1;
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (!guis[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        log_message("WARNING", "Too many GUIs attached, refusing another");
+        close(fd);
+        return TRUE;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    attached_gui_t *gui = calloc(1, sizeof(attached_gui_t));
+    gui->fd = fd;
+    gui->in = g_byte_array_new();
+    gui->out = g_byte_array_new();
+    gui->view_server = -1;
+    gui->view_channel = -1;
+    gui->channel = g_io_channel_unix_new(fd);
+    gui->in_watch = g_io_add_watch(gui->channel, G_IO_IN | G_IO_ERR | G_IO_HUP, gui_readable_cb, gui);
+    guis[slot] = gui;
+
+    return TRUE;
+}
+
+static bool channel_viewed(int server_idx, int channel_idx) {
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i] && guis[i]->view_server == server_idx && guis[i]->view_channel == channel_idx) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A new line in a channel; seq is its scrollback sequence number
+void daemon_broadcast_line(int server_idx, int channel_idx, uint64_t seq, const char *text, activity_t activity) {
+    if (!channel_viewed(server_idx, channel_idx) && activity != ACTIVITY_NONE) {
+        channel_info_t *channel = channel_get(server_get(server_idx), channel_idx);
+        if (activity >= ACTIVITY_MESSAGE) channel->ui.unread++;
+        if (activity == ACTIVITY_HIGHLIGHT) channel->ui.highlights++;
+        if (activity > channel->ui.activity) channel->ui.activity = activity;
+    }
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        attached_gui_t *gui = guis[i];
+        if (!gui || !gui->hello) continue;
+
+        size_t frame = wire_begin(gui->out, WIRE_LINES);
+        wire_put_u16(gui->out, (uint16_t)server_idx);
+        wire_put_u16(gui->out, (uint16_t)channel_idx);
+        wire_put_u8(gui->out, 0);
+        wire_put_u8(gui->out, (uint8_t)activity);
+        wire_put_u64(gui->out, seq);
+        wire_put_u32(gui->out, 1);
+        wire_put_str(gui->out, text);
+        wire_end(gui->out, frame);
+        gui_send(gui);
+    }
+}
+
+typedef struct {
+    int server_idx;
+    channel_row_op_t op;
+    int channel_idx;
+    uint32_t generation;
+} channel_change_t;
+
+static gboolean channel_changed_cb(gpointer data) {
+    channel_change_t *change = data;
+    server_info_t *server = server_get(change->server_idx);
+
+    // Removal frees the slot, nothing else moves
+    if (change->op == CHANNEL_ROW_REMOVE && last_view_server == change->server_idx &&
+        last_view_channel == change->channel_idx) {
+        last_view_channel = -1;
+    }
+
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        attached_gui_t *gui = guis[i];
+        if (!gui || !gui->hello) continue;
+
+        if (change->op == CHANNEL_ROW_REMOVE) {
+            size_t frame = wire_begin(gui->out, WIRE_CHANNEL_REMOVE);
+            wire_put_u16(gui->out, (uint16_t)change->server_idx);
+            wire_put_u16(gui->out, (uint16_t)change->channel_idx);
+            wire_end(gui->out, frame);
+
+            if (gui->view_server == change->server_idx && gui->view_channel == change->channel_idx) {
+                gui->view_channel = -1;
+            }
+        } else if (channel_current(server, change->channel_idx, change->generation)) {
+            put_channel(gui->out, change->server_idx, change->channel_idx);
+        }
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i]) gui_send(guis[i]);
+    }
+
+    free(change);
+    return FALSE;
+}
+
+// A channel was added, removed or renamed; safe to call from network threads. Changes reach the
+// GUIs in the order they were posted, like channel_list_post().
+void daemon_channel_changed(int server_idx, channel_row_op_t op, int channel_idx) {
+    channel_change_t *change = malloc(sizeof(channel_change_t));
+    if (!change) return;
+
+    change->server_idx = server_idx;
+    change->op = op;
+    change->channel_idx = channel_idx;
+    change->generation = channel_generation(server_get(server_idx), channel_idx);
+    g_idle_add(channel_changed_cb, change);
+}
+
+// Members of a server's channels changed; refreshes GUIs viewing one of them
+void daemon_broadcast_roster(int server_idx) {
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        attached_gui_t *gui = guis[i];
+        if (gui && gui->hello && gui->view_server == server_idx && valid_channel(server_idx, gui->view_channel)) {
+            put_roster(gui->out, server_idx, gui->view_channel);
+        }
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i]) gui_send(guis[i]);
+    }
+}
+
+static gboolean status_cb(gpointer data) {
+    char *text = data;
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        attached_gui_t *gui = guis[i];
+        if (!gui || !gui->hello) continue;
+
+        size_t frame = wire_begin(gui->out, WIRE_STATUS);
+        wire_put_str(gui->out, text);
+        wire_end(gui->out, frame);
+        gui_send(gui);
+    }
+
+    free(text);
+    return FALSE;
+}
+
+// Status bar text for attached GUIs; safe to call from network threads
+void daemon_broadcast_status(const char *text) {
+    char *copy = strdup(text);
+    if (copy) g_idle_add(status_cb, copy);
+}
+
+static int daemon_listen(void) {
+    struct sockaddr_un addr;
+
+    wire_socket_path(socket_path, sizeof(socket_path));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        log_message("ERROR", "Failed to create daemon socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // A socket file nobody answers on is left over from a crash
+    if (connect(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        log_message("ERROR", "A daemon is already listening on %s", socket_path);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    close(listen_fd);
+    unlink(socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    // Only our own user may attach
+    mode_t old_umask = umask(0077);
+    int bound = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+
+    if (bound < 0 || listen(listen_fd, MAX_ATTACHED) < 0) {
+        log_message("ERROR", "Failed to listen on %s: %s", socket_path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    GIOChannel *channel = g_io_channel_unix_new(listen_fd);
+    g_io_add_watch(channel, G_IO_IN, accept_cb, NULL);
+    g_io_channel_unref(channel);
+
+    log_message("INFO", "Daemon listening on %s", socket_path);
+    return 0;
+}
+
+static gboolean quit_signal_cb(gpointer data) {
+    (void)data;
+    g_main_loop_quit(main_loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Runs the core without a window until SIGINT/SIGTERM. Returns the exit code.
+int daemon_run(void) {
+    if (daemon_listen() < 0) return 1;
+
+    main_loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGINT, quit_signal_cb, NULL);
+    g_unix_signal_add(SIGTERM, quit_signal_cb, NULL);
+
+    // Nobody is around to press Connect
+    for (int i = 0; i < client.servers.count; i++) {
+        if (server_get(i)->config.auto_connect) {
+            start_server_connection(i);
+        }
+    }
+
+    g_main_loop_run(main_loop);
+
+    for (int i = 0; i < MAX_ATTACHED; i++) {
+        if (guis[i]) gui_close(guis[i]);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    g_main_loop_unref(main_loop);
+
+    cleanup_client();
+    return 0;
+}
+
+#else
+
+int daemon_run(void) {
+    log_message("ERROR", "Daemon mode is not supported on Windows yet");
+    return 1;
+}
+
+void daemon_broadcast_line(int server_idx, int channel_idx, uint64_t seq, const char *text, activity_t activity) {
+    (void)server_idx;
+    (void)channel_idx;
+    (void)seq;
+    (void)text;
+    (void)activity;
+}
+
+void daemon_channel_changed(int server_idx, channel_row_op_t op, int channel_idx) {
+    (void)server_idx;
+    (void)op;
+    (void)channel_idx;
+}
+
+void daemon_broadcast_roster(int server_idx) {
+    (void)server_idx;
+}
+
+void daemon_broadcast_status(const char *text) {
+    (void)text;
+}
+
+#endif
@@ -0,0 +1,1064 @@
+// splice() and F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <arpa/inet.h>
+    #ifdef __linux__
+        #include <sys/sendfile.h>
+    #endif
+#endif
+
+// DCC SEND file transfers, active and passive (reverse), with RESUME.
+// Everything here runs on the main loop: the GTK thread, or the daemon's
+// GLib loop. Network threads hand CTCP requests over with dcc_post_ctcp().
+// Data never passes through userspace on Linux: sendfile() on the sending
+// side and splice() through a pipe on the receiving side.
+
+#ifndef _WIN32
+
+#define MAX_DCC_TRANSFERS 16
+// Largest single sendfile()/splice() call
+#define DCC_CHUNK_SIZE (1024 * 1024)
+// Smallest write a throttled transfer bothers with
+#define DCC_MIN_CHUNK (16 * 1024)
+// Buffer for the read()/write() fallback
+#define DCC_COPY_BUFFER (256 * 1024)
+// Unanswered offers and connections are given up after this long
+#define DCC_TIMEOUT_S 300
+// How long a throttled transfer sleeps before it tries again
+#define DCC_THROTTLE_MS 50
+#define DCC_PROGRESS_MS 500
+
+typedef enum {
+    DCC_SEND,
+    DCC_RECV
+} dcc_direction_t;
+
+typedef enum {
+    DCC_OFFERED,     // Incoming offer, not accepted yet
+    DCC_WAITING,     // Waiting for the peer: to connect, to answer a passive offer or a RESUME
+    DCC_CONNECTING,
+    DCC_ACTIVE,
+    DCC_DONE,
+    DCC_FAILED
+} dcc_state_t;
+
+typedef struct {
+    int id;
+    int server_idx;
+    dcc_direction_t direction;
+    dcc_state_t state;
+    bool passive;
+    char nick[MAX_NICK_LENGTH];
+    char filename[MAX_PATH_LENGTH - 16]; // As offered, without directories
+    char path[MAX_PATH_LENGTH];     // Local file
+
+    uint32_t addr;                  // Peer address, host order
+    uint16_t port;                  // Port from the offer, 0 for passive
+    uint32_t token;                 // Passive DCC token
+    uint64_t size;                  // 0 when the sender did not say
+    uint64_t start;                 // Resume position
+    uint64_t position;              // Bytes of the file done so far
+
+    int file_fd;
+    int listen_fd;
+    int sock_fd;
+    int pipe_fds[2];
+    bool use_splice;
+    guint watch;
+    guint timer;
+    guint throttle_timer;
+
+    // Peer acknowledgements, sending side
+    uint8_t ack[4];
+    int ack_len;
+
+    // Throughput limit in bytes per second, 0 for none
+    uint64_t rate_limit;
+    uint64_t tokens;
+    uint64_t refill_us;
+
+    uint64_t started_us;
+    uint64_t finished_us;
+
+    GtkWidget *row_label;
+    GtkWidget *row_progress;
+} dcc_transfer_t;
+
+static dcc_transfer_t transfers[MAX_DCC_TRANSFERS];
+static int transfer_count = 0;
+static int next_id = 1;
+// Limit given to new transfers, bytes per second
+static uint64_t default_rate_limit = 0;
+static guint progress_timer = 0;
+static GtkWidget *transfers_window = NULL;
+static GtkWidget *transfers_box = NULL;
+
+static void dcc_arm(dcc_transfer_t *t);
+static gboolean dcc_io_cb(GIOChannel *source, GIOCondition condition, gpointer data);
+
+static const char *state_names[] = {
+    "offered", "waiting", "connecting", "active", "done", "failed"
+};
+
+// Shows a DCC message in the DM with the peer, opening it if needed
+static void dcc_notice(dcc_transfer_t *t, activity_t activity, const char *format, ...) {
+    char text[MAX_MSG_LENGTH - 64];
+    char line[MAX_MSG_LENGTH];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    snprintf(line, sizeof(line), "%s DCC: %s\n", get_timestamp(), text);
+
+    // Finds the DM under client.gui_mutex, or opens it
+    int channel_idx = add_channel_to_server(t->server_idx, t->nick, true);
+
+    if (channel_idx >= 0) {
+        core_append_line(t->server_idx, channel_idx, line, activity);
+    }
+    log_message("INFO", "DCC #%d: %s", t->id, text);
+}
+
+static void format_size(uint64_t bytes, char *buf, size_t len) {
+    if (bytes >= 1024ULL * 1024 * 1024) {
+        snprintf(buf, len, "%.2f GB", bytes / (1024.0 * 1024 * 1024));
+    } else if (bytes >= 1024 * 1024) {
+        snprintf(buf, len, "%.1f MB", bytes / (1024.0 * 1024));
+    } else {
+        snprintf(buf, len, "%.1f KB", bytes / 1024.0);
+    }
+}
+
+// Average rate in bytes per second since the data connection opened
+static double dcc_rate(dcc_transfer_t *t) {
+    if (!t->started_us) return 0;
+    uint64_t end = t->finished_us ? t->finished_us : get_monotonic_us();
+    if (end <= t->started_us) return 0;
+    return (t->position - t->start) * 1000000.0 / (end - t->started_us);
+}
+
+static void dcc_describe(dcc_transfer_t *t, char *buf, size_t len) {
+    char done[32], total[32], rate[32];
+
+    format_size(t->position, done, sizeof(done));
+    format_size(t->size, total, sizeof(total));
+    format_size((uint64_t)dcc_rate(t), rate, sizeof(rate));
+
+    snprintf(buf, len, "#%d %s %s %s %s: %s of %s, %s/s%s",
+             t->id, t->direction == DCC_SEND ? "to" : "from", t->nick,
+             t->filename, state_names[t->state], done, t->size ? total : "?",
+             rate, t->rate_limit ? " (limited)" : "");
+}
+
+static void dcc_update_row(dcc_transfer_t *t) {
+    char text[MAX_MSG_LENGTH];
+
+    if (!t->row_label) return;
+
+    dcc_describe(t, text, sizeof(text));
+    gtk_label_set_text(GTK_LABEL(t->row_label), text);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(t->row_progress),
+                                  t->size ? (double)t->position / t->size : 0.0);
+}
+
+// Progress for the window, or the status line of attached GUIs in daemon mode
+static gboolean dcc_progress_cb(gpointer data) {
+    (void)data;
+    bool active = false;
+
+    for (int i = 0; i < transfer_count; i++) {
+        dcc_transfer_t *t = &transfers[i];
+        if (t->state != DCC_ACTIVE) continue;
+        active = true;
+
+        if (client.mode == CLIENT_DAEMON) {
+            char text[MAX_MSG_LENGTH];
+            dcc_describe(t, text, sizeof(text));
+            update_status(text);
+        } else {
+            dcc_update_row(t);
+        }
+    }
+
+    if (!active) progress_timer = 0;
+    return active;
+}
+
+static void dcc_show_row(dcc_transfer_t *t) {
+    if (client.mode == CLIENT_DAEMON) return;
+
+    if (!transfers_window) {
+        transfers_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(transfers_window), "File Transfers");
+        gtk_window_set_default_size(GTK_WINDOW(transfers_window), 520, 200);
+        gtk_window_set_transient_for(GTK_WINDOW(transfers_window), GTK_WINDOW(client.window));
+        // Closing only hides it; rows keep pointing into it
+        g_signal_connect(transfers_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+        transfers_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+        gtk_container_add(GTK_CONTAINER(transfers_window), transfers_box);
+    }
+
+    if (!t->row_label) {
+        t->row_label = gtk_label_new("");
+        t->row_progress = gtk_progress_bar_new();
+        gtk_box_pack_start(GTK_BOX(transfers_box), t->row_label, FALSE, FALSE, 0);
+        gtk_box_pack_start(GTK_BOX(transfers_box), t->row_progress, FALSE, FALSE, 0);
+    }
+
+    dcc_update_row(t);
+    gtk_widget_show_all(transfers_window);
+    gtk_window_present(GTK_WINDOW(transfers_window));
+}
+
+static void dcc_close_fds(dcc_transfer_t *t) {
+    if (t->watch) g_source_remove(t->watch);
+    if (t->timer) g_source_remove(t->timer);
+    if (t->throttle_timer) g_source_remove(t->throttle_timer);
+    t->watch = t->timer = t->throttle_timer = 0;
+
+    if (t->listen_fd >= 0) close(t->listen_fd);
+    if (t->sock_fd >= 0) close(t->sock_fd);
+    if (t->file_fd >= 0) close(t->file_fd);
+    if (t->pipe_fds[0] >= 0) close(t->pipe_fds[0]);
+    if (t->pipe_fds[1] >= 0) close(t->pipe_fds[1]);
+    t->listen_fd = t->sock_fd = t->file_fd = -1;
+    t->pipe_fds[0] = t->pipe_fds[1] = -1;
+}
+
+static void dcc_finish(dcc_transfer_t *t, dcc_state_t state, const char *reason) {
+    char size[32], rate[32];
+
+    if (t->state == DCC_DONE || t->state == DCC_FAILED) return;
+
+    dcc_close_fds(t);
+    t->state = state;
+    t->finished_us = get_monotonic_us();
+
+    format_size(t->position - t->start, size, sizeof(size));
+    format_size((uint64_t)dcc_rate(t), rate, sizeof(rate));
+
+    if (state == DCC_DONE) {
+        dcc_notice(t, ACTIVITY_MESSAGE, "%s %s %s %s (%s at %s/s)", t->direction == DCC_SEND ? "Sent" : "Received",
+                   t->filename, t->direction == DCC_SEND ? "to" : "from", t->nick, size, rate);
+    } else {
+        dcc_notice(t, ACTIVITY_MESSAGE, "Transfer #%d of %s failed: %s", t->id, t->filename, reason);
+    }
+    dcc_update_row(t);
+}
+
+// Reuses finished slots once the table is full
+static dcc_transfer_t *dcc_new(int server_idx, dcc_direction_t direction, const char *nick) {
+    dcc_transfer_t *t = NULL;
+
+    if (transfer_count < MAX_DCC_TRANSFERS) {
+        t = &transfers[transfer_count++];
+    } else {
+        for (int i = 0; i < MAX_DCC_TRANSFERS && !t; i++) {
+            if (transfers[i].state == DCC_DONE || transfers[i].state == DCC_FAILED) {
+                t = &transfers[i];
+                if (t->row_label) {
+                    gtk_widget_destroy(t->row_label);
+                    gtk_widget_destroy(t->row_progress);
+                }
+            }
+        }
+        if (!t) return NULL;
+    }
+
+    memset(t, 0, sizeof(dcc_transfer_t));
+    t->id = next_id++;
+    t->server_idx = server_idx;
+    t->direction = direction;
+    t->listen_fd = t->sock_fd = t->file_fd = -1;
+    t->pipe_fds[0] = t->pipe_fds[1] = -1;
+    t->use_splice = true;
+    t->rate_limit = default_rate_limit;
+    strncpy(t->nick, nick, MAX_NICK_LENGTH - 1);
+    return t;
+}
+
+static dcc_transfer_t *dcc_find_id(int id) {
+    for (int i = 0; i < transfer_count; i++) {
+        if (transfers[i].id == id) return &transfers[i];
+    }
+    return NULL;
+}
+
+static gboolean dcc_timeout_cb(gpointer data) {
+    dcc_transfer_t *t = data;
+    t->timer = 0;
+    dcc_finish(t, DCC_FAILED, "timed out");
+    return FALSE;
+}
+
+static void dcc_send_ctcp(dcc_transfer_t *t, const char *format, ...) {
+    char ctcp[MAX_MSG_LENGTH - 64];
+    char cmd[MAX_MSG_LENGTH];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(ctcp, sizeof(ctcp), format, args);
+    va_end(args);
+
+    snprintf(cmd, sizeof(cmd), "PRIVMSG %s :\001DCC %s\001\r\n", t->nick, ctcp);
+    send_irc_command(server_get(t->server_idx), cmd);
+}
+
+// Our address as the peer should dial it: the local end of the IRC link
+static uint32_t dcc_local_addr(int server_idx) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(server_get(server_idx)->sockfd, (struct sockaddr*)&addr, &len) < 0 ||
+        addr.sin_family != AF_INET) {
+        return 0;
+    }
+    return ntohl(addr.sin_addr.s_addr);
+}
+
+static int dcc_listen(dcc_transfer_t *t) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    t->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (t->listen_fd < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+
+    if (bind(t->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(t->listen_fd, 1) < 0 ||
+        getsockname(t->listen_fd, (struct sockaddr*)&addr, &len) < 0) {
+        close(t->listen_fd);
+        t->listen_fd = -1;
+        return -1;
+    }
+
+    fcntl(t->listen_fd, F_SETFL, fcntl(t->listen_fd, F_GETFL, 0) | O_NONBLOCK);
+    t->state = DCC_WAITING;
+    dcc_arm(t);
+    return ntohs(addr.sin_port);
+}
+
+static int dcc_connect(dcc_transfer_t *t) {
+    struct sockaddr_in addr;
+
+    t->sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (t->sock_fd < 0) return -1;
+    fcntl(t->sock_fd, F_SETFL, fcntl(t->sock_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(t->addr);
+    addr.sin_port = htons(t->port);
+
+    if (connect(t->sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        return -1;
+    }
+
+    t->state = DCC_CONNECTING;
+    dcc_arm(t);
+    return 0;
+}
+
+// Data connection is up; start moving bytes
+static void dcc_start(dcc_transfer_t *t) {
+    char size[32];
+
+    if (t->timer) {
+        g_source_remove(t->timer);
+        t->timer = 0;
+    }
+
+    t->state = DCC_ACTIVE;
+    t->position = t->start;
+    t->started_us = t->refill_us = get_monotonic_us();
+    t->tokens = 0;
+
+#ifdef __linux__
+    if (t->direction == DCC_RECV && pipe(t->pipe_fds) == 0) {
+        fcntl(t->pipe_fds[0], F_SETPIPE_SZ, DCC_CHUNK_SIZE);
+    } else {
+        t->use_splice = false;
+    }
+#else
+    t->use_splice = false;
+#endif
+
+    format_size(t->size, size, sizeof(size));
+    dcc_notice(t, ACTIVITY_EVENT, "%s %s (%s)%s", t->direction == DCC_SEND ? "Sending" : "Receiving",
+               t->filename, size, t->start ? ", resumed" : "");
+
+    dcc_arm(t);
+    dcc_show_row(t);
+    if (!progress_timer) progress_timer = g_timeout_add(DCC_PROGRESS_MS, dcc_progress_cb, NULL);
+}
+
+// Bytes the throughput limit allows right now, at most want. Returns 0
+// until a worthwhile chunk has accrued, rather than trickling tiny writes.
+static size_t dcc_budget(dcc_transfer_t *t, size_t want) {
+    if (!t->rate_limit) return want;
+
+    uint64_t now = get_monotonic_us();
+    // Allow a quarter second of burst so small limits still move whole chunks
+    uint64_t burst = t->rate_limit / 4 > DCC_MIN_CHUNK ? t->rate_limit / 4 : DCC_MIN_CHUNK;
+
+    uint64_t earned = (now - t->refill_us) * t->rate_limit / 1000000;
+    if (earned > 0) {
+        t->tokens = t->tokens + earned > burst ? burst : t->tokens + earned;
+        t->refill_us = now;
+    }
+
+    if (t->tokens >= want) return want;
+    return t->tokens >= DCC_MIN_CHUNK ? (size_t)t->tokens : 0;
+}
+
+static void dcc_consume(dcc_transfer_t *t, size_t bytes) {
+    if (t->rate_limit) t->tokens = t->tokens > bytes ? t->tokens - bytes : 0;
+}
+
+static gboolean dcc_throttle_cb(gpointer data) {
+    dcc_transfer_t *t = data;
+    t->throttle_timer = 0;
+    dcc_arm(t);
+    return FALSE;
+}
+
+// Stops polling until the limit allows more
+static void dcc_throttle(dcc_transfer_t *t) {
+    if (t->watch) {
+        g_source_remove(t->watch);
+        t->watch = 0;
+    }
+    if (!t->throttle_timer) t->throttle_timer = g_timeout_add(DCC_THROTTLE_MS, dcc_throttle_cb, t);
+}
+
+// (Re)installs the watch for whatever the transfer waits on next
+static void dcc_arm(dcc_transfer_t *t) {
+    GIOCondition condition = G_IO_ERR | G_IO_HUP;
+    int fd = t->sock_fd;
+
+    if (t->watch) g_source_remove(t->watch);
+    t->watch = 0;
+
+    switch (t->state) {
+        case DCC_WAITING:
+            if (t->listen_fd < 0) return; // Waiting on an IRC reply
+            fd = t->listen_fd;
+            condition |= G_IO_IN;
+            break;
+        case DCC_CONNECTING:
+            condition |= G_IO_OUT;
+            break;
+        case DCC_ACTIVE:
+            condition |= G_IO_IN;
+            if (t->direction == DCC_SEND && t->position < t->size) condition |= G_IO_OUT;
+            break;
+        default:
+            return;
+    }
+
+    GIOChannel *channel = g_io_channel_unix_new(fd);
+    t->watch = g_io_add_watch(channel, condition, dcc_io_cb, t);
+    g_io_channel_unref(channel);
+}
+
+// Reads peer acknowledgements: the low 32 bits of bytes received
+static bool dcc_read_acks(dcc_transfer_t *t) {
+    for (;;) {
+        ssize_t n = recv(t->sock_fd, t->ack + t->ack_len, sizeof(t->ack) - t->ack_len, 0);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (n == 0) {
+            // Many clients hang up as soon as they have everything
+            if (t->position >= t->size) {
+                dcc_finish(t, DCC_DONE, NULL);
+            } else {
+                dcc_finish(t, DCC_FAILED, "peer closed the connection");
+            }
+            return false;
+        }
+
+        t->ack_len += (int)n;
+        if (t->ack_len < 4) continue;
+        t->ack_len = 0;
+
+        uint32_t ack = ((uint32_t)t->ack[0] << 24) | ((uint32_t)t->ack[1] << 16) |
+                       ((uint32_t)t->ack[2] << 8) | t->ack[3];
+        if (t->position >= t->size && ack == (uint32_t)t->size) {
+            dcc_finish(t, DCC_DONE, NULL);
+            return false;
+        }
+    }
+}
+
+static void dcc_send_data(dcc_transfer_t *t) {
+    size_t want = t->size - t->position < DCC_CHUNK_SIZE ? (size_t)(t->size - t->position) : DCC_CHUNK_SIZE;
+    size_t budget = dcc_budget(t, want);
+    ssize_t n;
+
+    if (budget == 0) {
+        dcc_throttle(t);
+        return;
+    }
+
+#ifdef __linux__
+    off_t offset = (off_t)t->position;
+    n = sendfile(t->sock_fd, t->file_fd, &offset, budget);
+#else
+    static char buf[DCC_COPY_BUFFER];
+    if (budget > sizeof(buf)) budget = sizeof(buf);
+    n = pread(t->file_fd, buf, budget, (off_t)t->position);
+    if (n > 0) n = send(t->sock_fd, buf, (size_t)n, 0);
+#endif
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) dcc_finish(t, DCC_FAILED, strerror(errno));
+        return;
+    }
+    if (n == 0) {
+        dcc_finish(t, DCC_FAILED, "file is shorter than offered");
+        return;
+    }
+
+    t->position += (uint64_t)n;
+    dcc_consume(t, (size_t)n);
+
+    // Everything is out; only acknowledgements are left to wait for
+    if (t->position >= t->size) dcc_arm(t);
+}
+
+static void dcc_send_ack(dcc_transfer_t *t) {
+    uint32_t ack = htonl((uint32_t)t->position);
+    // Acks are cumulative; one lost to a full buffer is replaced by the next
+    ssize_t n = send(t->sock_fd, &ack, sizeof(ack), MSG_NOSIGNAL);
+    (void)n;
+}
+
+// Copies through userspace; used when splice() is not possible here
+static ssize_t dcc_copy(dcc_transfer_t *t, size_t budget) {
+    static char buf[DCC_COPY_BUFFER];
+    if (budget > sizeof(buf)) budget = sizeof(buf);
+
+    ssize_t n = recv(t->sock_fd, buf, budget, 0);
+    if (n <= 0) return n;
+
+    for (ssize_t done = 0; done < n; ) {
+        ssize_t w = write(t->file_fd, buf + done, (size_t)(n - done));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -2;
+        }
+        done += w;
+    }
+    return n;
+}
+
+#ifdef __linux__
+static ssize_t dcc_splice(dcc_transfer_t *t, size_t budget) {
+    ssize_t n = splice(t->sock_fd, NULL, t->pipe_fds[1], NULL, budget, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0) return n;
+
+    for (ssize_t left = n; left > 0; ) {
+        ssize_t w = splice(t->pipe_fds[0], NULL, t->file_fd, NULL, (size_t)left, SPLICE_F_MOVE);
+        if (w < 0 && errno == EINTR) continue;
+
+        if (w < 0 && errno == EINVAL) {
+            // The file system cannot take splices; empty the pipe by hand
+            char buf[4096];
+            t->use_splice = false;
+            while (left > 0) {
+                ssize_t r = read(t->pipe_fds[0], buf, sizeof(buf));
+                if (r <= 0 || write(t->file_fd, buf, (size_t)r) != r) return -2;
+                left -= r;
+            }
+            break;
+        }
+        if (w <= 0) return -2;
+        left -= w;
+    }
+    return n;
+}
+#endif
+
+static void dcc_recv_data(dcc_transfer_t *t) {
+    size_t want = DCC_CHUNK_SIZE;
+    if (t->size && t->size - t->position < want) want = (size_t)(t->size - t->position);
+
+    size_t budget = dcc_budget(t, want);
+    if (budget == 0) {
+        dcc_throttle(t);
+        return;
+    }
+
+    ssize_t n;
+#ifdef __linux__
+    n = t->use_splice ? dcc_splice(t, budget) : dcc_copy(t, budget);
+    if (n < 0 && errno == EINVAL && t->use_splice) {
+        t->use_splice = false;
+        n = dcc_copy(t, budget);
+    }
+#else
+    n = dcc_copy(t, budget);
+#endif
+
+    if (n == -2) {
+        dcc_finish(t, DCC_FAILED, strerror(errno));
+        return;
+    }
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) dcc_finish(t, DCC_FAILED, strerror(errno));
+        return;
+    }
+    if (n == 0) {
+        if (t->size == 0 || t->position >= t->size) {
+            dcc_finish(t, DCC_DONE, NULL);
+        } else {
+            dcc_finish(t, DCC_FAILED, "peer closed the connection early, /dcc get resumes it");
+        }
+        return;
+    }
+
+    t->position += (uint64_t)n;
+    dcc_consume(t, (size_t)n);
+    dcc_send_ack(t);
+
+    if (t->size && t->position >= t->size) dcc_finish(t, DCC_DONE, NULL);
+}
+
+static gboolean dcc_io_cb(GIOChannel *source, GIOCondition condition, gpointer data) {
+    (void)source;
+    dcc_transfer_t *t = data;
+    guint self = t->watch;
+
+    switch (t->state) {
+        case DCC_WAITING: {
+            int fd = accept(t->listen_fd, NULL, NULL);
+            if (fd < 0) break;
+
+            close(t->listen_fd);
+            t->listen_fd = -1;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            t->sock_fd = fd;
+            dcc_start(t);
+            break;
+        }
+
+        case DCC_CONNECTING: {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(t->sock_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+            if (error || (condition & (G_IO_ERR | G_IO_HUP))) {
+                dcc_finish(t, DCC_FAILED, error ? strerror(error) : "connection refused");
+            } else {
+                dcc_start(t);
+            }
+            break;
+        }
+
+        case DCC_ACTIVE:
+            if (t->direction == DCC_RECV) {
+                dcc_recv_data(t);
+            } else if (!(condition & (G_IO_IN | G_IO_HUP | G_IO_ERR)) || dcc_read_acks(t)) {
+                if ((condition & G_IO_OUT) && t->position < t->size) dcc_send_data(t);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // Keep this watch unless the transfer replaced or removed it
+    return self != 0 && t->watch == self;
+}
+
+// Strips directories and hidden-file dots from a name chosen by the peer
+static void sanitize_filename(const char *name, char *out, size_t len) {
+    const char *base = name;
+    for (const char *p = name; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    while (*base == '.') base++;
+
+    snprintf(out, len, "%s", *base ? base : "file");
+}
+
+static uint32_t parse_addr(const char *text) {
+    struct in_addr in;
+
+    if (strchr(text, '.')) {
+        return inet_pton(AF_INET, text, &in) == 1 ? ntohl(in.s_addr) : 0;
+    }
+    return (uint32_t)strtoul(text, NULL, 10);
+}
+
+// Whether a reply comes from the nick and server the transfer is with;
+// tokens and ports alone are easy to guess
+static bool dcc_from_peer(dcc_transfer_t *t, int server_idx, const char *nick) {
+    return t->server_idx == server_idx &&
+           isupport_casecmp(&server_snapshot(server_get(server_idx))->isupport, t->nick, nick) == 0;
+}
+
+// Handles "SEND|RESUME|ACCEPT <file> ..." from a CTCP DCC request
+static void dcc_handle_ctcp(int server_idx, const char *nick, char *args) {
+    char *type = args;
+    char *name;
+    char *rest;
+    char *fields[4] = { NULL, NULL, NULL, NULL };
+    int field_count = 0;
+
+    rest = strchr(type, ' ');
+    if (!rest) return;
+    *rest++ = '\0';
+
+    // The filename may be quoted to carry spaces
+    if (*rest == '"') {
+        name = rest + 1;
+        rest = strchr(name, '"');
+        if (!rest) return;
+        *rest++ = '\0';
+    } else {
+        name = rest;
+        rest = strchr(name, ' ');
+        if (rest) *rest++ = '\0';
+    }
+
+    char *saveptr;
+    for (char *tok = rest ? strtok_r(rest, " ", &saveptr) : NULL; tok && field_count < 4;
+         tok = strtok_r(NULL, " ", &saveptr)) {
+        fields[field_count++] = tok;
+    }
+
+    if (strcmp(type, "SEND") == 0 && field_count >= 3) {
+        uint32_t addr = parse_addr(fields[0]);
+        uint16_t port = (uint16_t)atoi(fields[1]);
+        uint64_t size = strtoull(fields[2], NULL, 10);
+        uint32_t token = fields[3] ? (uint32_t)strtoul(fields[3], NULL, 10) : 0;
+
+        // The answer to one of our passive offers: the peer is listening now
+        if (port && fields[3]) {
+            for (int i = 0; i < transfer_count; i++) {
+                dcc_transfer_t *t = &transfers[i];
+                if (t->direction == DCC_SEND && t->passive && t->state == DCC_WAITING && t->token == token &&
+                    dcc_from_peer(t, server_idx, nick)) {
+                    t->addr = addr;
+                    t->port = port;
+                    if (dcc_connect(t) < 0) dcc_finish(t, DCC_FAILED, strerror(errno));
+                    return;
+                }
+            }
+        }
+
+        dcc_transfer_t *t = dcc_new(server_idx, DCC_RECV, nick);
+        if (!t) {
+            log_message("WARNING", "Too many DCC transfers, ignoring offer from %s", nick);
+            return;
+        }
+
+        sanitize_filename(name, t->filename, sizeof(t->filename));
+        t->addr = addr;
+        t->port = port;
+        t->size = size;
+        t->token = token;
+        t->passive = port == 0;
+        t->state = DCC_OFFERED;
+        t->timer = g_timeout_add_seconds(DCC_TIMEOUT_S, dcc_timeout_cb, t);
+
+        char size_text[32];
+        format_size(size, size_text, sizeof(size_text));
+        dcc_notice(t, ACTIVITY_HIGHLIGHT, "%s offers %s (%s)%s. Type /dcc get %s to accept", nick, t->filename, size_text,
+                   t->passive ? " via passive DCC" : "", nick);
+    } else if (strcmp(type, "RESUME") == 0 && field_count >= 2) {
+        uint16_t port = (uint16_t)atoi(fields[0]);
+        uint64_t position = strtoull(fields[1], NULL, 10);
+        uint32_t token = fields[2] ? (uint32_t)strtoul(fields[2], NULL, 10) : 0;
+
+        for (int i = 0; i < transfer_count; i++) {
+            dcc_transfer_t *t = &transfers[i];
+            if (t->direction != DCC_SEND || t->state != DCC_WAITING) continue;
+            if (t->passive ? t->token != token : t->port != port) continue;
+            if (!dcc_from_peer(t, server_idx, nick)) continue;
+
+            if (position > t->size) {
+                dcc_finish(t, DCC_FAILED, "peer asked to resume past the end");
+                return;
+            }
+
+            t->start = position;
+            if (t->passive) {
+                dcc_send_ctcp(t, "ACCEPT \"%s\" 0 %llu %u", t->filename, (unsigned long long)position, t->token);
+            } else {
+                dcc_send_ctcp(t, "ACCEPT \"%s\" %u %llu", t->filename, t->port, (unsigned long long)position);
+            }
+            return;
+        }
+    } else if (strcmp(type, "ACCEPT") == 0 && field_count >= 2) {
+        uint16_t port = (uint16_t)atoi(fields[0]);
+        uint64_t position = strtoull(fields[1], NULL, 10);
+        uint32_t token = fields[2] ? (uint32_t)strtoul(fields[2], NULL, 10) : 0;
+
+        for (int i = 0; i < transfer_count; i++) {
+            dcc_transfer_t *t = &transfers[i];
+            if (t->direction != DCC_RECV || t->state != DCC_WAITING || t->listen_fd >= 0) continue;
+            if (t->passive ? t->token != token : t->port != port) continue;
+            if (!dcc_from_peer(t, server_idx, nick)) continue;
+
+            t->file_fd = open(t->path, O_WRONLY);
+            if (t->file_fd < 0 || lseek(t->file_fd, (off_t)position, SEEK_SET) < 0) {
+                dcc_finish(t, DCC_FAILED, strerror(errno));
+                return;
+            }
+            t->start = position;
+
+            if (t->passive) {
+                int listen_port = dcc_listen(t);
+                if (listen_port < 0) {
+                    dcc_finish(t, DCC_FAILED, strerror(errno));
+                    return;
+                }
+                uint32_t local = dcc_local_addr(t->server_idx);
+                dcc_send_ctcp(t, "SEND \"%s\" %u %d %llu %u", t->filename, local, listen_port,
+                              (unsigned long long)t->size, t->token);
+            } else if (dcc_connect(t) < 0) {
+                dcc_finish(t, DCC_FAILED, strerror(errno));
+            }
+            return;
+        }
+    }
+}
+
+typedef struct {
+    int server_idx;
+    char nick[MAX_NICK_LENGTH];
+    char args[MAX_MSG_LENGTH];
+} dcc_ctcp_t;
+
+static gboolean dcc_ctcp_cb(gpointer data) {
+    dcc_ctcp_t *ctcp = data;
+    dcc_handle_ctcp(ctcp->server_idx, ctcp->nick, ctcp->args);
+    free(ctcp);
+    return FALSE;
+}
+
+// A "\001DCC ...\001" request from nick; safe from network threads
+void dcc_post_ctcp(int server_idx, const char *nick, const char *ctcp) {
+    dcc_ctcp_t *request = malloc(sizeof(dcc_ctcp_t));
+    if (!request) return;
+
+    request->server_idx = server_idx;
+    snprintf(request->nick, sizeof(request->nick), "%s", nick);
+    snprintf(request->args, sizeof(request->args), "%s", ctcp + 5); // Past "\001DCC "
+
+    char *end = strchr(request->args, '\001');
+    if (end) *end = '\0';
+
+    g_idle_add(dcc_ctcp_cb, request);
+}
+
+static void dcc_offer(int server_idx, const char *nick, const char *path, bool passive, char *reply, size_t reply_len) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        snprintf(reply, reply_len, "Cannot send %s: %s", path, fd < 0 ? strerror(errno) : "not a file");
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    uint32_t local = dcc_local_addr(server_idx);
+    if (!local && !passive) {
+        snprintf(reply, reply_len, "Not connected to %s", server_get(server_idx)->config.name);
+        close(fd);
+        return;
+    }
+
+    dcc_transfer_t *t = dcc_new(server_idx, DCC_SEND, nick);
+    if (!t) {
+        snprintf(reply, reply_len, "Too many transfers");
+        close(fd);
+        return;
+    }
+
+    t->file_fd = fd;
+    t->size = (uint64_t)st.st_size;
+    t->passive = passive;
+    snprintf(t->path, sizeof(t->path), "%s", path);
+    sanitize_filename(path, t->filename, sizeof(t->filename));
+    t->timer = g_timeout_add_seconds(DCC_TIMEOUT_S, dcc_timeout_cb, t);
+
+    if (passive) {
+        // The peer listens and tells us where; the token pairs the answer,
+        // so it must not be guessable
+        t->token = g_random_int();
+        t->state = DCC_WAITING;
+        dcc_send_ctcp(t, "SEND \"%s\" %u 0 %llu %u", t->filename, local, (unsigned long long)t->size, t->token);
+    } else {
+        int port = dcc_listen(t);
+        if (port < 0) {
+            dcc_finish(t, DCC_FAILED, strerror(errno));
+            return;
+        }
+        t->port = (uint16_t)port;
+        dcc_send_ctcp(t, "SEND \"%s\" %u %d %llu", t->filename, local, port, (unsigned long long)t->size);
+    }
+
+    snprintf(reply, reply_len, "Offered %s to %s as #%d", t->filename, nick, t->id);
+}
+
+static void dcc_accept(int server_idx, const char *nick, const char *name, char *reply, size_t reply_len) {
+    server_info_t *server = server_get(server_idx);
+    dcc_transfer_t *t = NULL;
+
+    for (int i = 0; i < transfer_count && !t; i++) {
+        dcc_transfer_t *c = &transfers[i];
+        if (c->server_idx == server_idx && c->direction == DCC_RECV && c->state == DCC_OFFERED &&
+            isupport_casecmp(&server_snapshot(server)->isupport, c->nick, nick) == 0 &&
+            (!name || strcmp(c->filename, name) == 0)) {
+            t = c;
+        }
+    }
+    if (!t) {
+        snprintf(reply, reply_len, "No pending offer from %s", nick);
+        return;
+    }
+
+    mkdir(DCC_DOWNLOAD_DIR, 0700);
+    snprintf(t->path, sizeof(t->path), "%s/%s", DCC_DOWNLOAD_DIR, t->filename);
+
+    struct stat st;
+    if (stat(t->path, &st) == 0 && st.st_size > 0 && t->size && (uint64_t)st.st_size < t->size) {
+        // Continue a partial download; the sender answers with ACCEPT
+        t->state = DCC_WAITING;
+        if (t->passive) {
+            dcc_send_ctcp(t, "RESUME \"%s\" 0 %llu %u", t->filename, (unsigned long long)st.st_size, t->token);
+        } else {
+            dcc_send_ctcp(t, "RESUME \"%s\" %u %llu", t->filename, t->port, (unsigned long long)st.st_size);
+        }
+        snprintf(reply, reply_len, "Resuming %s at %llu bytes", t->filename, (unsigned long long)st.st_size);
+        return;
+    }
+
+    t->file_fd = open(t->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (t->file_fd < 0) {
+        dcc_finish(t, DCC_FAILED, strerror(errno));
+        snprintf(reply, reply_len, "Cannot write %s", t->path);
+        return;
+    }
+
+    if (t->passive) {
+        int port = dcc_listen(t);
+        if (port < 0) {
+            dcc_finish(t, DCC_FAILED, strerror(errno));
+            snprintf(reply, reply_len, "Cannot listen for %s", t->filename);
+            return;
+        }
+        dcc_send_ctcp(t, "SEND \"%s\" %u %d %llu %u", t->filename, dcc_local_addr(server_idx), port,
+                      (unsigned long long)t->size, t->token);
+    } else if (dcc_connect(t) < 0) {
+        dcc_finish(t, DCC_FAILED, strerror(errno));
+        snprintf(reply, reply_len, "Cannot connect for %s", t->filename);
+        return;
+    }
+
+    snprintf(reply, reply_len, "Accepted %s from %s as #%d", t->filename, nick, t->id);
+}
+
+// /dcc send|psend <nick> <path>, get <nick> [file], list, close <id>,
+// limit <id>|default <KiB/s>
+void dcc_command(int server_idx, int channel_idx, const char *args) {
+    char buf[MAX_MSG_LENGTH];
+    char reply[MAX_MSG_LENGTH - 64] = "";
+    char line[MAX_MSG_LENGTH];
+    char *saveptr;
+
+    snprintf(buf, sizeof(buf), "%s", args);
+    char *sub = strtok_r(buf, " ", &saveptr);
+    char *arg1 = sub ? strtok_r(NULL, " ", &saveptr) : NULL;
+    char *arg2 = arg1 ? saveptr : NULL;   // Paths may contain spaces
+    if (arg2 && !*arg2) arg2 = NULL;
+
+    if (sub && (strcmp(sub, "send") == 0 || strcmp(sub, "psend") == 0) && arg1 && arg2) {
+        dcc_offer(server_idx, arg1, arg2, sub[0] == 'p', reply, sizeof(reply));
+    } else if (sub && strcmp(sub, "get") == 0 && arg1) {
+        dcc_accept(server_idx, arg1, arg2, reply, sizeof(reply));
+    } else if (sub && strcmp(sub, "list") == 0) {
+        if (transfer_count == 0) snprintf(reply, sizeof(reply), "No transfers");
+        for (int i = 0; i < transfer_count; i++) {
+            dcc_describe(&transfers[i], reply, sizeof(reply));
+            snprintf(line, sizeof(line), "%s DCC: %s\n", get_timestamp(), reply);
+            core_append_line(server_idx, channel_idx, line, ACTIVITY_NONE);
+        }
+        if (transfer_count > 0) return;
+    } else if (sub && strcmp(sub, "close") == 0 && arg1) {
+        dcc_transfer_t *t = dcc_find_id(atoi(arg1));
+        if (t) {
+            dcc_finish(t, DCC_FAILED, "closed");
+            return;
+        }
+        snprintf(reply, sizeof(reply), "No transfer #%s", arg1);
+    } else if (sub && strcmp(sub, "limit") == 0 && arg1 && arg2 && strcmp(arg1, "default") == 0) {
+        default_rate_limit = strtoull(arg2, NULL, 10) * 1024;
+        snprintf(reply, sizeof(reply), "New transfers limited to %s KiB/s", default_rate_limit ? arg2 : "unlimited");
+    } else if (sub && strcmp(sub, "limit") == 0 && arg1 && arg2) {
+        dcc_transfer_t *t = dcc_find_id(atoi(arg1));
+        if (t) {
+            t->rate_limit = strtoull(arg2, NULL, 10) * 1024;
+            t->tokens = 0;
+            t->refill_us = get_monotonic_us();
+            snprintf(reply, sizeof(reply), "Transfer #%d limited to %s KiB/s", t->id,
+                     t->rate_limit ? arg2 : "unlimited");
+        } else {
+            snprintf(reply, sizeof(reply), "No transfer #%s", arg1);
+        }
+    } else {
+        snprintf(reply, sizeof(reply),
+                 "Usage: /dcc send|psend <nick> <file>, get <nick> [file], list, close <id>, limit <id>|default <KiB/s>");
+    }
+
+    snprintf(line, sizeof(line), "%s DCC: %s\n", get_timestamp(), reply);
+    core_append_line(server_idx, channel_idx, line, ACTIVITY_NONE);
+}
+
+void dcc_close_all(void) {
+    for (int i = 0; i < transfer_count; i++) {
+        dcc_close_fds(&transfers[i]);
+    }
+    if (progress_timer) g_source_remove(progress_timer);
+    progress_timer = 0;
+}
+
+#else
+
+void dcc_post_ctcp(int server_idx, const char *nick, const char *ctcp) {
+    (void)server_idx;
+    (void)nick;
+    (void)ctcp;
+}
+
+void dcc_command(int server_idx, int channel_idx, const char *args) {
+    char line[MAX_MSG_LENGTH];
+    (void)args;
+    snprintf(line, sizeof(line), "%s DCC is not supported on Windows yet\n", get_timestamp());
+    core_append_line(server_idx, channel_idx, line, ACTIVITY_NONE);
+}
+
+void dcc_close_all(void) {
+}
+
+#endif
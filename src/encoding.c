@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+#include "utf8.h"
+
+// Every line from a server passes through here before it is parsed, so
+// everything downstream (scrollback, the GTK buffers, the daemon's frames)
+// can rely on UTF-8. Valid lines are used in place. Only invalid ones are
+// converted, from the channel's "encoding" if it has one, else from the
+// server's (CP1252 by default, which covers Latin-1 text).
+
+// The encoding for a line that is not UTF-8: its channel's, else the
+// server's. Network thread.
+static const char *encoding_for_line(server_info_t *server, const char *line) {
+    char target[MAX_CHANNEL_LENGTH + 1];
+    const char *p = line;
+
+    // [:prefix] COMMAND target ...
+    if (*p == ':') {
+        p = strchr(p, ' ');
+        if (!p) return server->config.encoding;
+        p++;
+    }
+    p = strchr(p, ' ');
+    if (!p) return server->config.encoding;
+    p++;
+
+    size_t len = strcspn(p, " ");
+    if (len == 0 || len >= sizeof(target)) return server->config.encoding;
+    memcpy(target, p, len);
+    target[len] = '\0';
+
+    if (isupport_is_channel(&server->isupport, target)) {
+        channel_info_t *channel = channel_get(server, find_channel(server, target));
+        if (channel && channel->encoding[0]) return channel->encoding;
+    }
+    return server->config.encoding;
+}
+
+// NULL if line is valid UTF-8 and can be used as it is, else a converted
+// copy for the caller to g_free()
+char *encoding_convert_line(server_info_t *server, const char *line, size_t len) {
+    if (utf8_validate(line, len)) return NULL;
+
+    const char *charset = encoding_for_line(server, line);
+    gsize written;
+    char *converted = g_convert(line, (gssize)len, "UTF-8", charset, NULL, &written, NULL);
+
+    // Bytes the encoding leaves undefined, or an unknown encoding name;
+    // every byte is a Latin-1 character
+    if (!converted) {
+        converted = g_convert(line, (gssize)len, "UTF-8", "ISO-8859-1", NULL, &written, NULL);
+    }
+
+    if (converted) server->net_stats.converted++;
+    return converted;
+}
@@ -1,13 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "client.h"
 
 void add_server_dialog(void) {
+    if (client.mode == CLIENT_ATTACHED) {
+        // The daemon owns the configuration
+        update_status("Add servers to the daemon's configuration");
+        return;
+    }
+    
     GtkWidget *dialog, *content_area, *grid;
     GtkWidget *name_entry, *hostname_entry, *port_entry, *nick_entry, *realname_entry, *password_entry;
-    GtkWidget *autoconnect_check;
-    GtkWidget *name_label, *hostname_label, *port_label, *nick_label, *realname_label, *password_label;
+    GtkWidget *autoconnect_check, *tls_check, *cert_entry;
+    GtkWidget *name_label, *hostname_label, *port_label, *nick_label, *realname_label, *password_label, *cert_label;
     
     dialog = gtk_dialog_new_with_buttons("Add Server",
                                          GTK_WINDOW(client.window),
@@ -55,6 +62,12 @@ void add_server_dialog(void) {
     gtk_entry_set_visibility(GTK_ENTRY(password_entry), FALSE);
     gtk_entry_set_placeholder_text(GTK_ENTRY(password_entry), "(optional)");
     
+    cert_label = gtk_label_new("Client Cert:");
+    gtk_widget_set_halign(cert_label, GTK_ALIGN_END);
+    cert_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(cert_entry), "(optional, PEM for CertFP)");
+    
+    tls_check = gtk_check_button_new_with_label("Use TLS");
     autoconnect_check = gtk_check_button_new_with_label("Auto-connect on startup");
     
     // Add to grid
@@ -70,51 +83,53 @@ void add_server_dialog(void) {
     gtk_grid_attach(GTK_GRID(grid), realname_entry, 1, 4, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), password_label, 0, 5, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), password_entry, 1, 5, 1, 1);
-    gtk_grid_attach(GTK_GRID(grid), autoconnect_check, 0, 6, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), cert_label, 0, 6, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), cert_entry, 1, 6, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), tls_check, 0, 7, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), autoconnect_check, 0, 8, 2, 1);
     
     gtk_widget_show_all(dialog);
     
     int response = gtk_dialog_run(GTK_DIALOG(dialog));
     
-    if (response == GTK_RESPONSE_ACCEPT && client.server_count < MAX_SERVERS) {
-        server_info_t *server = &client.servers[client.server_count];
-        memset(server, 0, sizeof(server_info_t));
-        
-        strncpy(server->name, gtk_entry_get_text(GTK_ENTRY(name_entry)), MAX_SERVER_NAME - 1);
-        strncpy(server->hostname, gtk_entry_get_text(GTK_ENTRY(hostname_entry)), INET6_ADDRSTRLEN - 1);
-        server->port = atoi(gtk_entry_get_text(GTK_ENTRY(port_entry)));
-        if (server->port <= 0) server->port = 6667;
+    server_info_t *server = response == GTK_RESPONSE_ACCEPT ? server_add() : NULL;
+    
+    if (server) {
+        strncpy(server->config.name, gtk_entry_get_text(GTK_ENTRY(name_entry)), MAX_SERVER_NAME - 1);
+        strncpy(server->config.hostname, gtk_entry_get_text(GTK_ENTRY(hostname_entry)), INET6_ADDRSTRLEN - 1);
+        server->config.use_tls = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(tls_check));
+        server->config.port = atoi(gtk_entry_get_text(GTK_ENTRY(port_entry)));
+        if (server->config.port <= 0) server->config.port = server->config.use_tls ? 6697 : 6667;
         
         strncpy(server->nick, gtk_entry_get_text(GTK_ENTRY(nick_entry)), MAX_NICK_LENGTH - 1);
-        strncpy(server->real_name, gtk_entry_get_text(GTK_ENTRY(realname_entry)), 63);
-        strncpy(server->password, gtk_entry_get_text(GTK_ENTRY(password_entry)), 63);
-        
-        server->auto_connect = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(autoconnect_check));
-        server->state = CONN_DISCONNECTED;
-        server->sockfd = -1;
-        server->active_channel = -1;
-        
-        // Add to server list
-        GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(client.server_list));
-        GtkTreeIter iter;
+        strncpy(server->config.real_name, gtk_entry_get_text(GTK_ENTRY(realname_entry)), 63);
+        strncpy(server->config.password, gtk_entry_get_text(GTK_ENTRY(password_entry)), 63);
+        strncpy(server->config.client_cert, gtk_entry_get_text(GTK_ENTRY(cert_entry)), MAX_PATH_LENGTH - 1);
         
-        gtk_tree_store_append(GTK_TREE_STORE(model), &iter, NULL);
-        gtk_tree_store_set(GTK_TREE_STORE(model), &iter, 
-                           0, server->name,
-                           1, client.server_count,
-                           -1);
+        server->config.auto_connect = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(autoconnect_check));
         
-        client.server_count++;
-        save_config();
+        add_server_row(server->index);
+        config_mark_dirty(server);
         
         char status_msg[256];
-        snprintf(status_msg, sizeof(status_msg), "Added server: %s", server->name);
+        snprintf(status_msg, sizeof(status_msg), "Added server: %s", server->config.name);
         update_status(status_msg);
     }
     
     gtk_widget_destroy(dialog);
 }
 
+void add_server_row(int server_idx) {
+    GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(client.server_list));
+    GtkTreeIter iter;
+    
+    gtk_tree_store_append(GTK_TREE_STORE(model), &iter, NULL);
+    gtk_tree_store_set(GTK_TREE_STORE(model), &iter, 
+                       0, server_get(server_idx)->config.name,
+                       1, server_idx,
+                       -1);
+}
+
 void on_add_server_clicked(GtkButton *button, gpointer data) {
     (void)button;
     (void)data;
@@ -139,125 +154,359 @@ void on_server_connect_clicked(GtkButton *button, gpointer data) {
 }
 
 void connect_to_server_gui(int server_idx) {
-    if (server_idx < 0 || server_idx >= client.server_count) return;
-    
-    server_info_t *server = &client.servers[server_idx];
+    server_info_t *server = server_get(server_idx);
+    if (!server) return;
     
     if (server->state == CONN_CONNECTED) {
         update_status("Already connected to this server");
         return;
     }
     
+    if (client.mode == CLIENT_ATTACHED) {
+        // The daemon connects; its channels show up as they are joined
+        attach_send_connect(server_idx);
+        client.active_server = server_idx;
+        update_channel_list(server_idx);
+        return;
+    }
+    
+    // A manual connect supersedes any pending automatic one
+    reconnect_cancel(server);
+    
     char status_msg[256];
-    snprintf(status_msg, sizeof(status_msg), "Connecting to %s...", server->name);
+    snprintf(status_msg, sizeof(status_msg), "Connecting to %s...", server->config.name);
     update_status(status_msg);
     
-    if (connect_to_server(server) >= 0) {
+    if (start_server_connection(server_idx) == 0) {
         client.active_server = server_idx;
-        
-        // Start network thread
-        int *server_idx_ptr = malloc(sizeof(int));
-        *server_idx_ptr = server_idx;
-        
-        if (pthread_create(&server->network_thread, NULL, network_thread_func, server_idx_ptr) != 0) {
-            log_message("ERROR", "Failed to create network thread");
-            disconnect_server(server);
-            free(server_idx_ptr);
-            return;
-        }
+        lag_show(server_idx);
         
         // Update channel list for this server
         update_channel_list(server_idx);
         
-        snprintf(status_msg, sizeof(status_msg), "Connected to %s", server->name);
+        snprintf(status_msg, sizeof(status_msg), "Connected to %s", server->config.name);
         update_status(status_msg);
     } else {
         update_status("Failed to connect");
     }
 }
 
-void add_channel_to_server(int server_idx, const char *channel_name, bool is_dm) {
-    if (server_idx < 0 || server_idx >= client.server_count) return;
-    
-    server_info_t *server = &client.servers[server_idx];
-    if (server->channel_count >= MAX_CHANNELS_PER_SERVER) return;
-    
-    // Check if channel already exists
-    for (int i = 0; i < server->channel_count; i++) {
-        if (server->channels[i].is_private_msg == is_dm) {
-            if (is_dm) {
-                if (strcmp(server->channels[i].target_nick, channel_name) == 0) return;
-            } else {
-                if (strcmp(server->channels[i].name, channel_name) == 0) return;
+// Returns the channel's index, whether it was added or already there, or -1
+int add_channel_to_server(int server_idx, const char *channel_name, bool is_dm) {
+    server_info_t *server = server_get(server_idx);
+    if (!server) return -1;
+    
+    // The GTK thread and the network thread both create channels; the
+    // lookup, the allocation and the name go in under one lock so neither
+    // adds a duplicate or publishes a slot without its name
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *existing = channel_get(server, i);
+        if (existing && existing->is_private_msg == is_dm) {
+            if (is_dm ? isupport_casecmp(&server->isupport, existing->target_nick, channel_name) == 0
+                      : strcmp(existing->name, channel_name) == 0) {
+                pthread_mutex_unlock(&client.gui_mutex);
+                return i;
             }
         }
     }
     
-    channel_info_t *channel = &server->channels[server->channel_count];
-    memset(channel, 0, sizeof(channel_info_t));
+    int channel_idx = channel_alloc_locked(server, -1);
+    if (channel_idx < 0) {
+        pthread_mutex_unlock(&client.gui_mutex);
+        log_message("ERROR", "Out of memory adding a channel to %s", server->config.name);
+        return -1;
+    }
     
+    channel_info_t *channel = channel_get(server, channel_idx);
     strncpy(channel->name, channel_name, MAX_CHANNEL_LENGTH - 1);
     channel->is_private_msg = is_dm;
     channel->active = true;
+    if (is_dm) {
+        strncpy(channel->target_nick, channel_name, MAX_NICK_LENGTH - 1);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
     
-    // Create text buffer for this channel
-    channel->buffer = gtk_text_buffer_new(NULL);
-    
-    server->channel_count++;
-    
-    // Update GUI
-    update_channel_list(server_idx);
+    // Update GUI; this may run on a network thread. The text buffer is
+    // made by the GTK thread when the first line is drained into it.
+    channel_publish(server);
+    core_channel_changed(server_idx, CHANNEL_ROW_ADD, channel_idx);
+    config_mark_dirty(server);
     
     log_message("INFO", "Added %s %s to server %s", 
-               is_dm ? "DM" : "channel", channel_name, server->name);
+               is_dm ? "DM" : "channel", channel_name, server->config.name);
+    return channel_idx;
 }
 
+// Shows a server's channel list; the model is kept up to date as channels
+// come and go, so this only swaps it in
 void update_channel_list(int server_idx) {
     if (server_idx != client.active_server) return;
     
-    server_info_t *server = &client.servers[server_idx];
+    server_info_t *server = server_get(server_idx);
     
-    // Clear existing model
-    GtkTreeStore *store = gtk_tree_store_new(2, G_TYPE_STRING, G_TYPE_INT);
-    gtk_tree_view_set_model(GTK_TREE_VIEW(client.channel_list), GTK_TREE_MODEL(store));
+    gtk_tree_view_set_model(GTK_TREE_VIEW(client.channel_list), GTK_TREE_MODEL(server->ui.channel_store));
+    gtk_tree_view_expand_all(GTK_TREE_VIEW(client.channel_list));
+}
+
+void channel_list_init(server_info_t *server) {
+    server_ui_t *ui = &server->ui;
     
-    // Add channels
-    GtkTreeIter channels_iter, dm_iter, iter;
-    gtk_tree_store_append(store, &channels_iter, NULL);
-    gtk_tree_store_set(store, &channels_iter, 0, "Channels", 1, -1, -1);
+    ui->channel_store = gtk_tree_store_new(CHANNEL_COL_COUNT, G_TYPE_STRING, G_TYPE_INT,
+                                           G_TYPE_INT, G_TYPE_INT, G_TYPE_INT);
     
-    gtk_tree_store_append(store, &dm_iter, NULL);
-    gtk_tree_store_set(store, &dm_iter, 0, "Direct Messages", 1, -1, -1);
+    gtk_tree_store_append(ui->channel_store, &ui->channel_groups[0], NULL);
+    gtk_tree_store_set(ui->channel_store, &ui->channel_groups[0],
+                       CHANNEL_COL_NAME, "Channels", CHANNEL_COL_INDEX, -1, -1);
     
-    for (int i = 0; i < server->channel_count; i++) {
-        channel_info_t *channel = &server->channels[i];
-        GtkTreeIter *parent = channel->is_private_msg ? &dm_iter : &channels_iter;
-        
-        gtk_tree_store_append(store, &iter, parent);
-        char display_name[MAX_CHANNEL_LENGTH + 2];
-        if (channel->is_private_msg) {
-            snprintf(display_name, sizeof(display_name), "@%s", channel->target_nick);
-        } else {
-            snprintf(display_name, sizeof(display_name), "#%s", channel->name);
-        }
-        gtk_tree_store_set(store, &iter, 0, display_name, 1, i, -1);
+    gtk_tree_store_append(ui->channel_store, &ui->channel_groups[1], NULL);
+    gtk_tree_store_set(ui->channel_store, &ui->channel_groups[1],
+                       CHANNEL_COL_NAME, "Direct Messages", CHANNEL_COL_INDEX, -1, -1);
+}
+
+static void channel_display_name(const channel_view_t *channel, char *buf, size_t len) {
+    if (channel->is_private_msg) {
+        snprintf(buf, len, "@%s", channel->target_nick);
+    } else {
+        snprintf(buf, len, "#%s", channel->name);
     }
+}
+
+static void channel_name_data_func(GtkTreeViewColumn *column, GtkCellRenderer *renderer,
+                                   GtkTreeModel *model, GtkTreeIter *iter, gpointer data) {
+    (void)column;
+    (void)data;
     
-    // Expand all
-    gtk_tree_view_expand_all(GTK_TREE_VIEW(client.channel_list));
+    int activity;
+    gtk_tree_model_get(model, iter, CHANNEL_COL_ACTIVITY, &activity, -1);
+    
+    g_object_set(renderer,
+                 "weight", activity >= ACTIVITY_MESSAGE ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL,
+                 "foreground", activity == ACTIVITY_HIGHLIGHT ? "#c01c28" :
+                               activity == ACTIVITY_EVENT ? "#3584e4" : NULL,
+                 NULL);
+}
+
+static void channel_badge_data_func(GtkTreeViewColumn *column, GtkCellRenderer *renderer,
+                                    GtkTreeModel *model, GtkTreeIter *iter, gpointer data) {
+    (void)column;
+    (void)data;
+    
+    int unread, highlights;
+    char badge[32] = "";
+    gtk_tree_model_get(model, iter, CHANNEL_COL_UNREAD, &unread, CHANNEL_COL_HIGHLIGHTS, &highlights, -1);
+    
+    if (highlights > 0) {
+        snprintf(badge, sizeof(badge), "%d (%d!)", unread, highlights);
+    } else if (unread > 0) {
+        snprintf(badge, sizeof(badge), "%d", unread);
+    }
+    g_object_set(renderer, "text", badge, NULL);
+}
+
+// Columns and the selection handler are set up once, whatever model is shown
+void channel_list_setup_view(void) {
+    GtkTreeViewColumn *column = gtk_tree_view_column_new();
+    gtk_tree_view_column_set_title(column, "Channels");
+    
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_add_attribute(column, renderer, "text", CHANNEL_COL_NAME);
+    gtk_tree_view_column_set_cell_data_func(column, renderer, channel_name_data_func, NULL, NULL);
+    
+    renderer = gtk_cell_renderer_text_new();
+    gtk_tree_view_column_pack_end(column, renderer, FALSE);
+    gtk_tree_view_column_set_cell_data_func(column, renderer, channel_badge_data_func, NULL, NULL);
+    
+    gtk_tree_view_append_column(GTK_TREE_VIEW(client.channel_list), column);
     
-    // Add selection handler
     GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(client.channel_list));
     g_signal_connect(selection, "changed", G_CALLBACK(on_channel_selection_changed), NULL);
+}
+
+typedef struct {
+    int server_idx;
+    channel_row_op_t op;
+    int channel_idx;
+    uint32_t generation;
+} channel_row_update_t;
+
+// The row of a channel index, or NULL if it has none
+static channel_row_t *channel_row(server_info_t *server, int channel_idx) {
+    if (channel_idx < 0 || channel_idx >= server->ui.channel_row_capacity) return NULL;
+    
+    channel_row_t *row = &server->ui.channel_rows[channel_idx];
+    return row->present ? row : NULL;
+}
+
+static void channel_row_add(server_info_t *server, int channel_idx) {
+    server_ui_t *ui = &server->ui;
+    char display_name[MAX_CHANNEL_LENGTH + 2];
+    bool is_dm = false;
+    
+    // Already mirrored, e.g. channels loaded from the config
+    if (channel_row(server, channel_idx)) return;
+    
+    const channel_view_t *channel = snapshot_channel(server_snapshot(server), channel_idx);
+    if (!channel) return;
+    channel_display_name(channel, display_name, sizeof(display_name));
+    is_dm = channel->is_private_msg;
+    
+    if (channel_idx >= ui->channel_row_capacity) {
+        int capacity = ui->channel_row_capacity ? ui->channel_row_capacity : 16;
+        while (capacity <= channel_idx) capacity *= 2;
+        
+        channel_row_t *rows = realloc(ui->channel_rows, capacity * sizeof(channel_row_t));
+        if (!rows) return;
+        memset(rows + ui->channel_row_capacity, 0, (capacity - ui->channel_row_capacity) * sizeof(channel_row_t));
+        ui->channel_rows = rows;
+        ui->channel_row_capacity = capacity;
+    }
+    
+    channel_row_t *row = &ui->channel_rows[channel_idx];
+    gtk_tree_store_append(ui->channel_store, &row->iter, &ui->channel_groups[is_dm ? 1 : 0]);
+    gtk_tree_store_set(ui->channel_store, &row->iter,
+                       CHANNEL_COL_NAME, display_name,
+                       CHANNEL_COL_INDEX, channel_idx,
+                       CHANNEL_COL_UNREAD, 0,
+                       CHANNEL_COL_HIGHLIGHTS, 0,
+                       CHANNEL_COL_ACTIVITY, ACTIVITY_NONE,
+                       -1);
+    row->present = true;
+    
+    if (server->index == client.active_server) {
+        gtk_tree_view_expand_all(GTK_TREE_VIEW(client.channel_list));
+    }
+}
+
+// Other rows keep their indices, so nothing is renumbered
+static void channel_row_remove(server_info_t *server, int channel_idx) {
+    channel_row_t *row = channel_row(server, channel_idx);
+    if (!row) return;
+    
+    gtk_tree_store_remove(server->ui.channel_store, &row->iter);
+    row->present = false;
     
-    // Set up column if not already done
-    if (gtk_tree_view_get_n_columns(GTK_TREE_VIEW(client.channel_list)) == 0) {
-        GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
-        GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes("Channels", renderer, "text", 0, NULL);
-        gtk_tree_view_append_column(GTK_TREE_VIEW(client.channel_list), column);
+    if (server->active_channel == channel_idx) {
+        server->active_channel = -1;
+    }
+}
+
+// Applies a structural change right away; GTK thread only
+void channel_list_apply(int server_idx, channel_row_op_t op, int channel_idx) {
+    server_info_t *server = server_get(server_idx);
+    
+    switch (op) {
+        case CHANNEL_ROW_ADD:
+            channel_row_add(server, channel_idx);
+            break;
+        case CHANNEL_ROW_REMOVE:
+            channel_row_remove(server, channel_idx);
+            break;
+        case CHANNEL_ROW_RENAME: {
+            channel_row_t *row = channel_row(server, channel_idx);
+            char display_name[MAX_CHANNEL_LENGTH + 2];
+            const channel_view_t *channel = row ? snapshot_channel(server_snapshot(server), channel_idx) : NULL;
+            
+            if (channel) {
+                channel_display_name(channel, display_name, sizeof(display_name));
+                gtk_tree_store_set(server->ui.channel_store, &row->iter, CHANNEL_COL_NAME, display_name, -1);
+            }
+            break;
+        }
     }
 }
 
+static gboolean channel_row_update_cb(gpointer data) {
+    channel_row_update_t *update = data;
+    server_info_t *server = server_get(update->server_idx);
+    
+    // A channel removed since the post has a REMOVE queued behind this
+    if (update->op == CHANNEL_ROW_REMOVE ||
+        channel_current(server, update->channel_idx, update->generation)) {
+        channel_list_apply(update->server_idx, update->op, update->channel_idx);
+    }
+    
+    free(update);
+    return FALSE;
+}
+
+// Queues a structural change for the GTK thread. Updates are applied in the
+// order they were posted; each names the channel by index and generation,
+// so one for a channel that has since gone is skipped.
+void channel_list_post(int server_idx, channel_row_op_t op, int channel_idx) {
+    channel_row_update_t *update = malloc(sizeof(channel_row_update_t));
+    if (!update) return;
+    
+    update->server_idx = server_idx;
+    update->op = op;
+    update->channel_idx = channel_idx;
+    update->generation = channel_generation(server_get(server_idx), channel_idx);
+    g_idle_add(channel_row_update_cb, update);
+}
+
+void channel_list_mark_activity(int server_idx, int channel_idx, activity_t activity) {
+    server_info_t *server = server_get(server_idx);
+    channel_row_t *row = channel_row(server, channel_idx);
+    
+    if (!row) return;
+    if (server_idx == client.active_server && channel_idx == server->active_channel) return;
+    
+    int unread, highlights, current;
+    
+    gtk_tree_model_get(GTK_TREE_MODEL(server->ui.channel_store), &row->iter,
+                       CHANNEL_COL_UNREAD, &unread,
+                       CHANNEL_COL_HIGHLIGHTS, &highlights,
+                       CHANNEL_COL_ACTIVITY, &current,
+                       -1);
+    
+    if (activity >= ACTIVITY_MESSAGE) unread++;
+    if (activity == ACTIVITY_HIGHLIGHT) highlights++;
+    if ((int)activity > current) current = activity;
+    
+    gtk_tree_store_set(server->ui.channel_store, &row->iter,
+                       CHANNEL_COL_UNREAD, unread,
+                       CHANNEL_COL_HIGHLIGHTS, highlights,
+                       CHANNEL_COL_ACTIVITY, current,
+                       -1);
+}
+
+void channel_list_set_counts(int server_idx, int channel_idx, int unread, int highlights, activity_t activity) {
+    server_info_t *server = server_get(server_idx);
+    channel_row_t *row = channel_row(server, channel_idx);
+    
+    if (!row) return;
+    
+    gtk_tree_store_set(server->ui.channel_store, &row->iter,
+                       CHANNEL_COL_UNREAD, unread,
+                       CHANNEL_COL_HIGHLIGHTS, highlights,
+                       CHANNEL_COL_ACTIVITY, activity,
+                       -1);
+}
+
+void channel_list_mark_read(int server_idx, int channel_idx) {
+    server_info_t *server = server_get(server_idx);
+    channel_row_t *row = channel_row(server, channel_idx);
+    
+    if (!row) return;
+    
+    gtk_tree_store_set(server->ui.channel_store, &row->iter,
+                       CHANNEL_COL_UNREAD, 0,
+                       CHANNEL_COL_HIGHLIGHTS, 0,
+                       CHANNEL_COL_ACTIVITY, ACTIVITY_NONE,
+                       -1);
+}
+
+// Selects a channel's row, which switches to it like a click would
+void channel_list_select(int server_idx, int channel_idx) {
+    server_info_t *server = server_get(server_idx);
+    channel_row_t *row = server ? channel_row(server, channel_idx) : NULL;
+    
+    if (!row || server_idx != client.active_server) return;
+    
+    gtk_tree_selection_select_iter(gtk_tree_view_get_selection(GTK_TREE_VIEW(client.channel_list)), &row->iter);
+}
+
 void on_channel_selection_changed(GtkTreeSelection *selection, gpointer data) {
     (void)data;
     
@@ -266,7 +515,7 @@ void on_channel_selection_changed(GtkTreeSelection *selection, gpointer data) {
     
     if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
         int channel_idx;
-        gtk_tree_model_get(model, &iter, 1, &channel_idx, -1);
+        gtk_tree_model_get(model, &iter, CHANNEL_COL_INDEX, &channel_idx, -1);
         
         if (channel_idx >= 0 && client.active_server >= 0) {
             switch_to_channel(client.active_server, channel_idx);
@@ -275,31 +524,53 @@ void on_channel_selection_changed(GtkTreeSelection *selection, gpointer data) {
 }
 
 void switch_to_channel(int server_idx, int channel_idx) {
-    if (server_idx < 0 || server_idx >= client.server_count ||
-        channel_idx < 0 || channel_idx >= client.servers[server_idx].channel_count) {
-        return;
+    server_info_t *server = server_get(server_idx);
+    const channel_view_t *channel = server ? snapshot_channel(server_snapshot(server), channel_idx) : NULL;
+    if (!channel) return;
+    
+    // Removal clears the buffer under the lock, and the snapshot may be a
+    // moment behind it
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *info = channel_get(server, channel_idx);
+    GtkTextBuffer *buffer = info ? channel_buffer(info) : NULL;
+    if (buffer) {
+        server_info_t *previous_server = client.active_server >= 0 ? server_get(client.active_server) : NULL;
+        channel_info_t *previous = previous_server ? channel_get(previous_server, previous_server->active_channel) : NULL;
+        uint64_t now = get_monotonic_us();
+        
+        // Lines paged in for reading, or kept while on screen, can go now
+        if (previous && previous != info) {
+            previous->scrollback.viewed_us = now;
+            channel_trim_buffer(previous, 1);
+        }
+        info->scrollback.viewed_us = now;
     }
-    
-    server_info_t *server = &client.servers[server_idx];
-    channel_info_t *channel = &server->channels[channel_idx];
+    pthread_mutex_unlock(&client.gui_mutex);
+    if (!buffer) return;
     
     server->active_channel = channel_idx;
+    channel_list_mark_read(server_idx, channel_idx);
     
     // Update chat area with channel's buffer
-    gtk_text_view_set_buffer(GTK_TEXT_VIEW(client.chat_area), channel->buffer);
+    gtk_text_view_set_buffer(GTK_TEXT_VIEW(client.chat_area), buffer);
+    
+    // Scroll to bottom; unseen counts belonged to the previous buffer
+    scroll_chat_to_end();
     
-    // Scroll to bottom
-    GtkTextMark *mark = gtk_text_buffer_get_insert(channel->buffer);
-    gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(client.chat_area), mark);
+    show_user_list(server_idx, channel->is_private_msg ? NULL : channel->name);
+    
+    if (client.mode == CLIENT_ATTACHED) {
+        attach_view_changed(server_idx, channel_idx);
+    }
     
     // Update window title
     char title[256];
     if (channel->is_private_msg) {
         snprintf(title, sizeof(title), "IRC Client - %s (@%s)", 
-                server->name, channel->target_nick);
+                server->config.name, channel->target_nick);
     } else {
         snprintf(title, sizeof(title), "IRC Client - %s (#%s)", 
-                server->name, channel->name);
+                server->config.name, channel->name);
     }
     gtk_window_set_title(GTK_WINDOW(client.window), title);
     
@@ -314,24 +585,68 @@ void switch_to_channel(int server_idx, int channel_idx) {
     gtk_widget_grab_focus(client.message_entry);
 }
 
-void append_message_to_channel(int server_idx, int channel_idx, const char *message) {
-    if (server_idx < 0 || server_idx >= client.server_count ||
-        channel_idx < 0 || channel_idx >= client.servers[server_idx].channel_count) {
-        return;
+static int member_rank(const char *symbols, char prefix) {
+    const char *pos = prefix ? strchr(symbols, prefix) : NULL;
+    return pos ? (int)(pos - symbols) : (int)strlen(symbols);
+}
+
+static const char *sort_symbols;
+
+// A member as displayed; copied out because the nick entries it came
+// from are renamed and freed under client.gui_mutex
+typedef struct {
+    char nick[MAX_NICK_LENGTH];
+    char prefix;
+} user_row_t;
+
+static int compare_members(const void *a, const void *b) {
+    const user_row_t *ma = a;
+    const user_row_t *mb = b;
+    int rank = member_rank(sort_symbols, ma->prefix) - member_rank(sort_symbols, mb->prefix);
+    return rank != 0 ? rank : strcasecmp(ma->nick, mb->nick);
+}
+
+void show_user_list(int server_idx, const char *channel) {
+    GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(client.user_list)));
+    server_info_t *server = server_get(server_idx);
+    user_row_t *members = NULL;
+    int count = 0;
+    
+    // Copy under the lock; the network thread keeps mutating the roster
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *info = channel ? channel_get(server, find_channel(server, channel)) : NULL;
+    if (info && info->member_count > 0) {
+        members = malloc(info->member_count * sizeof(user_row_t));
+        for (int i = 0; members && i < info->member_count; i++) {
+            memcpy(members[i].nick, info->members[i].nick->name, MAX_NICK_LENGTH);
+            members[i].prefix = info->members[i].prefix;
+        }
+        count = members ? info->member_count : 0;
     }
+    pthread_mutex_unlock(&client.gui_mutex);
     
-    channel_info_t *channel = &client.servers[server_idx].channels[channel_idx];
+    sort_symbols = server_snapshot(server)->isupport.prefix_symbols;
+    qsort(members, count, sizeof(user_row_t), compare_members);
     
-    // Append to buffer
-    GtkTextIter iter;
-    gtk_text_buffer_get_end_iter(channel->buffer, &iter);
-    gtk_text_buffer_insert(channel->buffer, &iter, message, -1);
+    // Detach while filling so the view does not relayout per row
+    g_object_ref(store);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(client.user_list), NULL);
+    gtk_list_store_clear(store);
     
-    // Auto-scroll if this is the active channel
-    if (server_idx == client.active_server && 
-        channel_idx == client.servers[server_idx].active_channel) {
+    for (int i = 0; i < count; i++) {
+        GtkTreeIter iter;
+        char display_name[MAX_NICK_LENGTH + 1];
         
-        GtkTextMark *mark = gtk_text_buffer_get_insert(channel->buffer);
-        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(client.chat_area), mark);
+        if (members[i].prefix) {
+            snprintf(display_name, sizeof(display_name), "%c%s", members[i].prefix, members[i].nick);
+        } else {
+            snprintf(display_name, sizeof(display_name), "%s", members[i].nick);
+        }
+        gtk_list_store_append(store, &iter);
+        gtk_list_store_set(store, &iter, 0, display_name, -1);
     }
+    
+    gtk_tree_view_set_model(GTK_TREE_VIEW(client.user_list), GTK_TREE_MODEL(store));
+    g_object_unref(store);
+    free(members);
 }
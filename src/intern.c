@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Per-server nick table. Every roster entry and netsplit group points at
+// one shared, refcounted entry per nick, so membership tests are pointer
+// compares and a NICK change rewrites a single entry. Keys are compared
+// under the server's casemapping. Guarded by client.gui_mutex.
+
+#define INTERN_MIN_BUCKETS 256
+
+static uint32_t intern_hash(const isupport_t *isupport, const char *nick) {
+    uint32_t hash = 2166136261u; // FNV-1a over the casefolded nick
+
+    for (const char *p = nick; *p; p++) {
+        hash ^= (unsigned char)isupport_fold(isupport, *p);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void intern_link(intern_table_t *table, intern_t *entry) {
+    intern_t **bucket = &table->buckets[entry->hash & table->bucket_mask];
+    entry->next = *bucket;
+    *bucket = entry;
+}
+
+static void intern_unlink(intern_table_t *table, intern_t *entry) {
+    intern_t **link = &table->buckets[entry->hash & table->bucket_mask];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+}
+
+static bool intern_resize(intern_table_t *table, uint32_t bucket_count) {
+    intern_t **old = table->buckets;
+    uint32_t old_count = old ? table->bucket_mask + 1 : 0;
+
+    intern_t **buckets = calloc(bucket_count, sizeof(intern_t*));
+    if (!buckets) return false;
+
+    table->buckets = buckets;
+    table->bucket_mask = bucket_count - 1;
+
+    for (uint32_t i = 0; i < old_count; i++) {
+        intern_t *entry = old[i];
+        while (entry) {
+            intern_t *next = entry->next;
+            intern_link(table, entry);
+            entry = next;
+        }
+    }
+    free(old);
+    return true;
+}
+
+static intern_t *intern_find(server_info_t *server, const char *nick, uint32_t hash) {
+    intern_table_t *table = &server->nicks;
+
+    if (!table->buckets) return NULL;
+
+    for (intern_t *entry = table->buckets[hash & table->bucket_mask]; entry; entry = entry->next) {
+        if (entry->hash == hash && isupport_casecmp(&server->isupport, entry->name, nick) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Returns the entry for nick without taking a reference, or NULL
+const intern_t *intern_lookup(server_info_t *server, const char *nick) {
+    char name[MAX_NICK_LENGTH];
+
+    strncpy(name, nick, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    return intern_find(server, name, intern_hash(&server->isupport, name));
+}
+
+// Returns the entry for nick, creating it if needed, and takes a
+// reference that the caller drops with intern_release()
+const intern_t *intern_nick(server_info_t *server, const char *nick) {
+    intern_table_t *table = &server->nicks;
+    char name[MAX_NICK_LENGTH];
+
+    strncpy(name, nick, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    uint32_t hash = intern_hash(&server->isupport, name);
+    intern_t *entry = intern_find(server, name, hash);
+
+    if (!entry) {
+        if (!table->buckets || table->count > table->bucket_mask) {
+            uint32_t buckets = table->buckets ? (table->bucket_mask + 1) * 2 : INTERN_MIN_BUCKETS;
+            if (!intern_resize(table, buckets) && !table->buckets) return NULL;
+        }
+
+        entry = calloc(1, sizeof(intern_t));
+        if (!entry) return NULL;
+        memcpy(entry->name, name, sizeof(name));
+        entry->hash = hash;
+        intern_link(table, entry);
+        table->count++;
+    }
+
+    entry->refs++;
+    return entry;
+}
+
+void intern_ref(const intern_t *entry) {
+    ((intern_t*)entry)->refs++;
+}
+
+void intern_release(server_info_t *server, const intern_t *entry) {
+    intern_t *e = (intern_t*)entry;
+
+    if (!e || --e->refs > 0) return;
+
+    intern_unlink(&server->nicks, e);
+    server->nicks.count--;
+    free(e);
+}
+
+// Gives an entry a new spelling in place, so everything pointing at it
+// follows. Returns false when new_nick already has an entry of its own;
+// the caller then moves its references over instead.
+bool intern_rename(server_info_t *server, const intern_t *entry, const char *new_nick) {
+    intern_t *e = (intern_t*)entry;
+    char name[MAX_NICK_LENGTH];
+
+    strncpy(name, new_nick, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    uint32_t hash = intern_hash(&server->isupport, name);
+    intern_t *existing = intern_find(server, name, hash);
+    if (existing && existing != e) return false;
+
+    // A case-only change keeps its bucket
+    if (hash != e->hash) {
+        intern_unlink(&server->nicks, e);
+        e->hash = hash;
+        intern_link(&server->nicks, e);
+    }
+    memcpy(e->name, name, sizeof(name));
+    return true;
+}
+
+// Rehashes after 005 changed CASEMAPPING. Nicks that only collide under
+// the new mapping keep separate entries until they leave. Returns whether
+// the mapping changed.
+bool intern_rehash(server_info_t *server) {
+    intern_table_t *table = &server->nicks;
+    bool changed;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    changed = table->casemapping != server->isupport.casemapping;
+    if (changed) {
+        table->casemapping = server->isupport.casemapping;
+
+        if (table->buckets) {
+            intern_t *all = NULL;
+
+            for (uint32_t i = 0; i <= table->bucket_mask; i++) {
+                while (table->buckets[i]) {
+                    intern_t *entry = table->buckets[i];
+                    table->buckets[i] = entry->next;
+                    entry->next = all;
+                    all = entry;
+                }
+            }
+            while (all) {
+                intern_t *next = all->next;
+                all->hash = intern_hash(&server->isupport, all->name);
+                intern_link(table, all);
+                all = next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+    return changed;
+}
+
+// qsort/bsearch order for arrays of entry pointers
+int intern_compare(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(const intern_t *const *)a;
+    uintptr_t pb = (uintptr_t)*(const intern_t *const *)b;
+    return pa < pb ? -1 : pa > pb;
+}
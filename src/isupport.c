@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+#ifdef _WIN32
+#define strtok_r strtok_s
+#endif
+
+#define ISUPPORT_MIN_LINELEN 64
+#define ISUPPORT_MAX_LINELEN 4096
+// What a server puts in front of a message it relays, ":nick!user@host ",
+// beyond the nick: the usual USERLEN and the longest DNS label
+#define RELAY_PREFIX_EXTRA (4 + 10 + 63)
+
+void isupport_reset(isupport_t *isupport) {
+    memset(isupport, 0, sizeof(isupport_t));
+
+    // RFC 1459/2812 defaults for servers that advertise nothing
+    strcpy(isupport->chantypes, "#&");
+    strcpy(isupport->prefix_modes, "ov");
+    strcpy(isupport->prefix_symbols, "@+");
+    isupport->casemapping = CASEMAP_RFC1459;
+    isupport->linelen = MAX_MSG_LENGTH;
+    isupport->chanlimit = 0;
+
+    // Comma lists for JOIN/PART are in every RFC; multi-target PRIVMSG is not
+    isupport->targmax_join = 0;
+    isupport->targmax_part = 0;
+    isupport->targmax_privmsg = 1;
+    isupport->targmax_notice = 1;
+}
+
+static int parse_targmax_value(const char *value) {
+    // An empty value means no limit
+    return (value && *value) ? atoi(value) : 0;
+}
+
+// TARGMAX=JOIN:,PART:,PRIVMSG:4,NOTICE:4,...
+static void parse_targmax(isupport_t *isupport, char *value) {
+    char *saveptr;
+
+    for (char *entry = strtok_r(value, ",", &saveptr); entry; entry = strtok_r(NULL, ",", &saveptr)) {
+        char *colon = strchr(entry, ':');
+        if (!colon) continue;
+        *colon = '\0';
+
+        int limit = parse_targmax_value(colon + 1);
+
+        if (strcmp(entry, "JOIN") == 0) {
+            isupport->targmax_join = limit;
+        } else if (strcmp(entry, "PART") == 0) {
+            isupport->targmax_part = limit;
+        } else if (strcmp(entry, "PRIVMSG") == 0) {
+            isupport->targmax_privmsg = limit;
+        } else if (strcmp(entry, "NOTICE") == 0) {
+            isupport->targmax_notice = limit;
+        }
+    }
+}
+
+// CHANLIMIT=#&:120,+: - we keep the limit that covers '#'
+static void parse_chanlimit(isupport_t *isupport, char *value) {
+    char *saveptr;
+
+    for (char *entry = strtok_r(value, ",", &saveptr); entry; entry = strtok_r(NULL, ",", &saveptr)) {
+        char *colon = strchr(entry, ':');
+        if (!colon) continue;
+        *colon = '\0';
+
+        if (strchr(entry, '#')) {
+            isupport->chanlimit = parse_targmax_value(colon + 1);
+            return;
+        }
+    }
+}
+
+// PREFIX=(ov)@+
+static void parse_prefix(isupport_t *isupport, const char *value) {
+    const char *close = strchr(value, ')');
+    if (value[0] != '(' || !close) return;
+
+    size_t count = close - value - 1;
+    if (count >= sizeof(isupport->prefix_modes) || strlen(close + 1) != count) return;
+
+    memcpy(isupport->prefix_modes, value + 1, count);
+    isupport->prefix_modes[count] = '\0';
+    strcpy(isupport->prefix_symbols, close + 1);
+}
+
+static void apply_token(isupport_t *isupport, char *token) {
+    bool negate = token[0] == '-';
+    if (negate) token++;
+
+    char *value = strchr(token, '=');
+    if (value) *value++ = '\0';
+
+    isupport_t defaults;
+    isupport_reset(&defaults);
+
+    if (strcmp(token, "CHANTYPES") == 0) {
+        if (negate || !value) {
+            strcpy(isupport->chantypes, defaults.chantypes);
+        } else {
+            strncpy(isupport->chantypes, value, sizeof(isupport->chantypes) - 1);
+            isupport->chantypes[sizeof(isupport->chantypes) - 1] = '\0';
+        }
+    } else if (strcmp(token, "PREFIX") == 0) {
+        strcpy(isupport->prefix_modes, defaults.prefix_modes);
+        strcpy(isupport->prefix_symbols, defaults.prefix_symbols);
+        if (!negate && value) parse_prefix(isupport, value);
+    } else if (strcmp(token, "CASEMAPPING") == 0) {
+        isupport->casemapping = defaults.casemapping;
+        if (!negate && value) {
+            if (strcmp(value, "ascii") == 0) {
+                isupport->casemapping = CASEMAP_ASCII;
+            } else if (strcmp(value, "strict-rfc1459") == 0) {
+                isupport->casemapping = CASEMAP_STRICT_RFC1459;
+            }
+        }
+    } else if (strcmp(token, "LINELEN") == 0) {
+        isupport->linelen = defaults.linelen;
+        if (!negate && value && atoi(value) >= ISUPPORT_MIN_LINELEN) {
+            isupport->linelen = atoi(value) < ISUPPORT_MAX_LINELEN ? atoi(value) : ISUPPORT_MAX_LINELEN;
+        }
+    } else if (strcmp(token, "CHANLIMIT") == 0) {
+        isupport->chanlimit = 0;
+        if (!negate && value) parse_chanlimit(isupport, value);
+    } else if (strcmp(token, "MAXTARGETS") == 0) {
+        // Pre-TARGMAX servers: applies to PRIVMSG and NOTICE
+        int limit = (!negate && value) ? parse_targmax_value(value) : 1;
+        isupport->targmax_privmsg = limit;
+        isupport->targmax_notice = limit;
+    } else if (strcmp(token, "TARGMAX") == 0) {
+        isupport->targmax_join = defaults.targmax_join;
+        isupport->targmax_part = defaults.targmax_part;
+        isupport->targmax_privmsg = defaults.targmax_privmsg;
+        isupport->targmax_notice = defaults.targmax_notice;
+        if (!negate && value) parse_targmax(isupport, value);
+    }
+}
+
+// params is everything after "005": <nick> TOKEN[=value] ... :are supported
+void isupport_parse(isupport_t *isupport, char *params) {
+    char *saveptr;
+    char *token = strtok_r(params, " ", &saveptr); // Our nick
+
+    while ((token = strtok_r(NULL, " ", &saveptr)) != NULL) {
+        if (token[0] == ':') break;
+        apply_token(isupport, token);
+    }
+}
+
+int isupport_targmax(const isupport_t *isupport, const char *command) {
+    if (strcmp(command, "JOIN") == 0) return isupport->targmax_join;
+    if (strcmp(command, "PART") == 0) return isupport->targmax_part;
+    if (strcmp(command, "PRIVMSG") == 0) return isupport->targmax_privmsg;
+    if (strcmp(command, "NOTICE") == 0) return isupport->targmax_notice;
+    return 1;
+}
+
+bool isupport_is_channel(const isupport_t *isupport, const char *target) {
+    return target[0] != '\0' && strchr(isupport->chantypes, target[0]) != NULL;
+}
+
+char isupport_fold(const isupport_t *isupport, char c) {
+    if (c >= 'A' && c <= 'Z') return c + ('a' - 'A');
+    if (isupport->casemapping == CASEMAP_ASCII) return c;
+
+    // rfc1459 treats []\~ as the upper case of {}|^; strict leaves out ~
+    switch (c) {
+        case '[': return '{';
+        case ']': return '}';
+        case '\\': return '|';
+        case '~': return isupport->casemapping == CASEMAP_RFC1459 ? '^' : c;
+        default: return c;
+    }
+}
+
+int isupport_casecmp(const isupport_t *isupport, const char *a, const char *b) {
+    for (;; a++, b++) {
+        char ca = isupport_fold(isupport, *a);
+        char cb = isupport_fold(isupport, *b);
+        if (ca != cb || ca == '\0') return (unsigned char)ca - (unsigned char)cb;
+    }
+}
+
+// Builds one "<command> t1,t2,... [:trailing]\r\n" line into buf, packing as
+// many targets as TARGMAX and the line length allow. Returns how many
+// targets were consumed; 0 means not even the first one fits.
+int isupport_pack_targets(const isupport_t *isupport, const char *command,
+                          const char **targets, int count, const char *trailing,
+                          char *buf, size_t buf_len) {
+    // LINELEN counts the CRLF; leave room for the terminating NUL
+    size_t limit = (size_t)isupport->linelen < buf_len ? (size_t)isupport->linelen : buf_len - 1;
+    size_t tail = 2 + (trailing ? 2 + strlen(trailing) : 0);
+    int targmax = isupport_targmax(isupport, command);
+
+    size_t len = snprintf(buf, buf_len, "%s ", command);
+    int used = 0;
+
+    while (used < count && (targmax <= 0 || used < targmax)) {
+        size_t target_len = strlen(targets[used]);
+        size_t need = target_len + (used > 0 ? 1 : 0);
+
+        if (len + need + tail > limit) break;
+
+        if (used > 0) buf[len++] = ',';
+        memcpy(buf + len, targets[used], target_len);
+        len += target_len;
+        used++;
+    }
+
+    if (used == 0) return 0;
+
+    if (trailing) {
+        snprintf(buf + len, buf_len - len, " :%s\r\n", trailing);
+    } else {
+        snprintf(buf + len, buf_len - len, "\r\n");
+    }
+
+    return used;
+}
+
+// Length of the next piece of text that fits in room bytes: up to the
+// last space if there is one, never inside a UTF-8 sequence. *skip is set
+// to the separator to drop before the following piece.
+static size_t trailing_piece(const char *text, size_t room, size_t *skip) {
+    size_t len = strlen(text);
+
+    *skip = 0;
+    if (len <= room) return len;
+
+    for (size_t i = room; i > room / 2; i--) {
+        if (text[i] == ' ') {
+            *skip = 1;
+            return i;
+        }
+    }
+
+    size_t cut = room;
+    while (cut > 0 && ((unsigned char)text[cut] & 0xC0) == 0x80) cut--;
+    return cut > 0 ? cut : room;
+}
+
+// Sends a command to many targets in as few lines as the server allows.
+// Trailing text too long for one line is split over several, short enough
+// that the server can still relay each piece with its prefix in front.
+// Returns the number of lines sent, or -1 without sending anything when a
+// target leaves no room for the text. Main loop only.
+int send_batched_targets(server_info_t *server, const char *command,
+                         const char **targets, int count, const char *trailing) {
+    const isupport_t *isupport = &server_snapshot(server)->isupport;
+    char line[ISUPPORT_MAX_LINELEN];
+    char piece[ISUPPORT_MAX_LINELEN];
+    size_t limit = (size_t)isupport->linelen < sizeof(line) ? (size_t)isupport->linelen : sizeof(line) - 1;
+    size_t longest = 0;
+    const char *longest_target = NULL;
+    int lines = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (strlen(targets[i]) >= longest) {
+            longest = strlen(targets[i]);
+            longest_target = targets[i];
+        }
+    }
+    if (count == 0) return 0;
+
+    // "<command> <target> :<piece>\r\n" as relayed, with the prefix
+    size_t overhead = strlen(command) + 1 + longest + 2;
+    if (trailing) overhead += 2 + strlen(server->nick) + RELAY_PREFIX_EXTRA;
+    if (overhead >= limit) {
+        log_message("WARNING", "%s to %s does not fit in one line, not sent", command, longest_target);
+        return -1;
+    }
+
+    const char *text = trailing;
+    do {
+        const char **pending = targets;
+        int left = count;
+        size_t skip = 0;
+
+        if (text) {
+            size_t len = trailing_piece(text, limit - overhead, &skip);
+            memcpy(piece, text, len);
+            piece[len] = '\0';
+            text += len + skip;
+        }
+
+        while (left > 0) {
+            int used = isupport_pack_targets(isupport, command, pending, left,
+                                             trailing ? piece : NULL, line, sizeof(line));
+            if (used == 0) break;
+            send_irc_command(server, line);
+            lines++;
+            pending += used;
+            left -= used;
+        }
+    } while (text && *text);
+
+    return lines;
+}
+
+// Splits a comma separated target list in place. Returns the number of
+// targets stored in targets[].
+int split_targets(char *list, const char **targets, int max_targets) {
+    char *saveptr;
+    int count = 0;
+
+    for (char *target = strtok_r(list, ",", &saveptr); target && count < max_targets;
+         target = strtok_r(NULL, ",", &saveptr)) {
+        if (*target) targets[count++] = target;
+    }
+
+    return count;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Lag meter. Once registered, the network thread sends "PING :LAG<us>"
+// every ping_interval seconds, counted from the last PONG, and files each
+// round trip in a histogram. A PING unanswered for lag_warn seconds shows
+// on the status bar; after lag_timeout seconds the link is treated as
+// dead and the usual reconnect takes over, long before recv() would fail.
+
+#define LAG_TOKEN "LAG"
+
+// Upper bounds of all but the last bucket
+static const unsigned lag_bounds_ms[LAG_BUCKETS - 1] = { 50, 100, 200, 500, 1000, 2000, 5000 };
+static const char *lag_bucket_names[LAG_BUCKETS] = {
+    "<50 ms", "<100 ms", "<200 ms", "<500 ms", "<1 s", "<2 s", "<5 s", ">=5 s"
+};
+// One bar per bucket, from empty to full
+static const char *lag_bars[] = { " ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+
+typedef struct {
+    int server_idx;
+    char text[64];
+} lag_update_t;
+
+static gboolean lag_update_cb(gpointer data) {
+    lag_update_t *update = data;
+    server_info_t *server = server_get(update->server_idx);
+
+    memcpy(server->ui.lag_text, update->text, sizeof(server->ui.lag_text));
+    if (update->server_idx == client.active_server) {
+        lag_show(update->server_idx);
+    }
+
+    free(update);
+    return FALSE;
+}
+
+// Hands the meter text to the GTK thread. The daemon has no meter, so
+// only warnings reach its GUIs, as status lines.
+static void lag_post(server_info_t *server, const char *text, bool warning) {
+    if (client.mode == CLIENT_DAEMON) {
+        if (warning) daemon_broadcast_status(text);
+        return;
+    }
+
+    lag_update_t *update = malloc(sizeof(lag_update_t));
+    if (!update) return;
+
+    update->server_idx = server->index;
+    strncpy(update->text, text, sizeof(update->text) - 1);
+    update->text[sizeof(update->text) - 1] = '\0';
+    g_idle_add(lag_update_cb, update);
+}
+
+// "Lag: 42 ms " followed by one bar per histogram bucket
+static void lag_format_meter(server_info_t *server, char *buf, size_t len) {
+    lag_state_t *lag = &server->lag;
+    unsigned peak = 0;
+    size_t pos;
+
+    for (int i = 0; i < LAG_BUCKETS; i++) {
+        if (lag->histogram[i] > peak) peak = lag->histogram[i];
+    }
+
+    pos = (size_t)snprintf(buf, len, "Lag: %llu ms ", (unsigned long long)(lag->last_rtt_us / 1000));
+    for (int i = 0; i < LAG_BUCKETS && pos < len; i++) {
+        unsigned count = lag->histogram[i];
+        int level = count == 0 ? 0 : 1 + (int)((uint64_t)count * 7 / peak);
+        pos += (size_t)snprintf(buf + pos, len - pos, "%s", lag_bars[level]);
+    }
+}
+
+// A new connection; nothing is pinged until lag_start()
+void lag_reset(server_info_t *server) {
+    server->lag.active = false;
+    server->lag.ping_sent_us = 0;
+    server->lag.shown_wait_s = 0;
+    lag_post(server, "", false);
+}
+
+// Registration finished (001); the first PING goes out right away
+void lag_start(server_info_t *server) {
+    server->lag.active = true;
+    server->lag.next_ping_us = get_monotonic_us();
+}
+
+// Sends a due PING and checks the outstanding one. Returns false once the
+// link has gone quiet for lag_timeout; the state is then CONN_ERROR.
+bool lag_tick(server_info_t *server) {
+    lag_state_t *lag = &server->lag;
+    uint64_t now = get_monotonic_us();
+
+    if (!lag->active || server->config.ping_interval <= 0) return true;
+
+    if (lag->ping_sent_us) {
+        int waited_s = (int)((now - lag->ping_sent_us) / 1000000);
+
+        if (server->config.lag_timeout > 0 && waited_s >= server->config.lag_timeout) {
+            char text[MAX_MSG_LENGTH];
+
+            lag->timeouts++;
+            lag->active = false;
+            lag->ping_sent_us = 0;
+            log_message("WARNING", "No PONG from %s in %d s, reconnecting", server->config.name, waited_s);
+            snprintf(text, sizeof(text), "%s: no reply in %d s, reconnecting", server->config.name, waited_s);
+            lag_post(server, text, true);
+            server->state = CONN_ERROR;
+            return false;
+        }
+
+        if (server->config.lag_warn > 0 && waited_s >= server->config.lag_warn && waited_s != lag->shown_wait_s) {
+            char text[64];
+
+            lag->shown_wait_s = waited_s;
+            snprintf(text, sizeof(text), "Lag: %d s, no reply", waited_s);
+            lag_post(server, text, true);
+        }
+        return true;
+    }
+
+    if (now >= lag->next_ping_us) {
+        char cmd[64];
+
+        snprintf(cmd, sizeof(cmd), "PING :" LAG_TOKEN "%llu\r\n", (unsigned long long)now);
+        lag->ping_sent_us = now;
+        lag->shown_wait_s = 0;
+        send_irc_command(server, cmd);
+    }
+    return true;
+}
+
+// PONG <server> :LAG<us>; replies to PINGs sent by anyone else are ignored
+void lag_handle_pong(server_info_t *server, const char *params) {
+    lag_state_t *lag = &server->lag;
+    const char *token = params ? strstr(params, LAG_TOKEN) : NULL;
+
+    if (!token || !lag->ping_sent_us) return;
+    if (strtoull(token + strlen(LAG_TOKEN), NULL, 10) != lag->ping_sent_us) return;
+
+    uint64_t now = get_monotonic_us();
+    uint64_t rtt = now - lag->ping_sent_us;
+    int bucket = 0;
+
+    while (bucket < LAG_BUCKETS - 1 && rtt >= (uint64_t)lag_bounds_ms[bucket] * 1000) {
+        bucket++;
+    }
+    lag->histogram[bucket]++;
+    lag->samples++;
+    lag->last_rtt_us = rtt;
+    if (rtt > lag->max_rtt_us) lag->max_rtt_us = rtt;
+
+    lag->ping_sent_us = 0;
+    lag->next_ping_us = now + (uint64_t)server->config.ping_interval * 1000000;
+
+    char text[64];
+    lag_format_meter(server, text, sizeof(text));
+    lag_post(server, text, lag->shown_wait_s > 0);
+    lag->shown_wait_s = 0;
+}
+
+// Puts a server's meter on the status bar; GTK thread only
+void lag_show(int server_idx) {
+    server_info_t *server = server_get(server_idx);
+
+    if (client.lag_label && server) {
+        gtk_label_set_text(GTK_LABEL(client.lag_label), server->ui.lag_text);
+    }
+}
+
+void lag_format_stats(server_info_t *server, char *buf, size_t len) {
+    lag_state_t *lag = &server->lag;
+    size_t pos;
+
+    if (lag->samples == 0) {
+        snprintf(buf, len, "%s Lag: no PONGs from %s yet, %u timeouts\n",
+                 get_timestamp(), server->config.name, lag->timeouts);
+        return;
+    }
+
+    pos = (size_t)snprintf(buf, len, "%s Lag: last %.0f ms, max %.0f ms, %u samples, %u timeouts;",
+                           get_timestamp(), lag->last_rtt_us / 1000.0, lag->max_rtt_us / 1000.0,
+                           lag->samples, lag->timeouts);
+    for (int i = 0; i < LAG_BUCKETS && pos < len; i++) {
+        if (lag->histogram[i] == 0) continue;
+        pos += (size_t)snprintf(buf + pos, len - pos, " %s: %u", lag_bucket_names[i], lag->histogram[i]);
+    }
+    if (pos < len) snprintf(buf + pos, len - pos, "\n");
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+
+// Loopback load test for the network shards. --loadtest SERVERS starts a
+// throwaway IRC server on 127.0.0.1 that welcomes every connection, joins
+// it to #load and floods it with PRIVMSGs. The client connects SERVERS
+// servers to it without a window, config or plugins, lets the traffic
+// settle for LOADTEST_WARMUP_MS and then reports how many lines per second
+// were parsed (on the network threads or shards) and merged into the
+// scrollback (on the main loop). Run it with --shards 1, 2, 4... to see
+// how parsing scales with cores; `make loadtest` does.
+
+#ifndef _WIN32
+
+#define LOADTEST_WARMUP_MS 1000
+#define LOADTEST_FLOOD_BYTES (64 * 1024)
+#define LOADTEST_NICK "load"
+
+static struct {
+    int listen_fd;
+    int expected;
+    gint feeding;
+    char *flood;
+    size_t flood_len;
+    GMainLoop *loop;
+    uint64_t start_us;
+    uint64_t start_parsed;
+    uint64_t start_merged;
+    double start_cpu_ms;
+} loadtest = { .listen_fd = -1 };
+
+static bool send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, 0);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        buf += sent;
+        len -= (size_t)sent;
+    }
+    return true;
+}
+
+// Server side of one connection: welcome after USER, then flood
+static void *feeder_thread_func(void *arg) {
+    int fd = GPOINTER_TO_INT(arg);
+    char greeting[256];
+    size_t pos = 0;
+
+    trace_thread_name("loadtest feeder");
+
+    while (pos < sizeof(greeting) - 1) {
+        ssize_t got = recv(fd, greeting + pos, sizeof(greeting) - 1 - pos, 0);
+        if (got <= 0) break;
+        pos += (size_t)got;
+        greeting[pos] = '\0';
+        if (strstr(greeting, "USER ")) break;
+    }
+
+    static const char welcome[] = ":load.test 001 " LOADTEST_NICK " :Welcome to the load test\r\n"
+                                  ":" LOADTEST_NICK "!" LOADTEST_NICK "@load.test JOIN :#load\r\n";
+    if (send_all(fd, welcome, sizeof(welcome) - 1)) {
+        while (g_atomic_int_get(&loadtest.feeding) && send_all(fd, loadtest.flood, loadtest.flood_len)) {
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void *acceptor_thread_func(void *arg) {
+    (void)arg;
+    trace_thread_name("loadtest accept");
+
+    for (int i = 0; i < loadtest.expected; i++) {
+        int fd = accept(loadtest.listen_fd, NULL, NULL);
+        pthread_t thread;
+
+        if (fd < 0) {
+            if (errno == EINTR) {
+                i--;
+                continue;
+            }
+            break;
+        }
+        if (pthread_create(&thread, NULL, feeder_thread_func, GINT_TO_POINTER(fd)) != 0) {
+            log_message("ERROR", "Failed to start a load test feeder");
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+// Lines of many speakers, some long; the buffer ends on a line boundary
+static bool build_flood(void) {
+    loadtest.flood = malloc(LOADTEST_FLOOD_BYTES);
+    if (!loadtest.flood) return false;
+
+    for (unsigned i = 0; ; i++) {
+        char line[MAX_MSG_LENGTH];
+        int len = snprintf(line, sizeof(line), ":user%u!ident@host%u.example PRIVMSG #load :message %u %.*s\r\n",
+                           i % 97, i % 13, i, (int)(i % 7) * 20,
+                           "the quick brown fox jumps over the lazy dog, again and again and again, "
+                           "until the line is long enough to wrap in a narrow window");
+        if (loadtest.flood_len + (size_t)len > LOADTEST_FLOOD_BYTES) break;
+        memcpy(loadtest.flood + loadtest.flood_len, line, (size_t)len);
+        loadtest.flood_len += (size_t)len;
+    }
+    return true;
+}
+
+static uint64_t lines_parsed(void) {
+    uint64_t total = 0;
+
+    for (int i = 0; i < client.servers.count; i++) {
+        total += server_get(i)->net_stats.lines;
+    }
+    return total;
+}
+
+static uint64_t lines_merged(void) {
+    int queues = shard_count() > 0 ? shard_count() : 1;
+    uint64_t total = 0;
+
+    for (int i = 0; i < queues; i++) {
+        int depth, max_depth;
+        uint64_t merged;
+        net_queue_stats(i, &depth, &max_depth, &merged);
+        total += merged;
+    }
+    return total;
+}
+
+static double process_cpu_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0;
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static gboolean loadtest_warm_cb(gpointer data) {
+    (void)data;
+    loadtest.start_us = get_monotonic_us();
+    loadtest.start_parsed = lines_parsed();
+    loadtest.start_merged = lines_merged();
+    loadtest.start_cpu_ms = process_cpu_ms();
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean loadtest_done_cb(gpointer data) {
+    (void)data;
+    g_main_loop_quit(loadtest.loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Runs the load test for seconds after the warmup and prints the result.
+// Returns the process exit code.
+int loadtest_run(int servers, int seconds) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t acceptor;
+    int connected = 0;
+
+    // Headless, and none of it may end up in the user's config
+    client.mode = CLIENT_DAEMON;
+    client.loadtest = true;
+    log_set_verbose(false);
+
+    if (servers <= 0 || !build_flood()) {
+        log_message("ERROR", "Nothing to load test");
+        return 1;
+    }
+
+    loadtest.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (loadtest.listen_fd < 0 || bind(loadtest.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(loadtest.listen_fd, SOMAXCONN) < 0 ||
+        getsockname(loadtest.listen_fd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        log_message("ERROR", "Failed to listen on loopback: %s", strerror(errno));
+        return 1;
+    }
+
+    loadtest.expected = servers;
+    g_atomic_int_set(&loadtest.feeding, 1);
+    if (pthread_create(&acceptor, NULL, acceptor_thread_func, NULL) != 0) {
+        log_message("ERROR", "Failed to start the load test server");
+        return 1;
+    }
+    pthread_detach(acceptor);
+
+    for (int i = 0; i < servers; i++) {
+        server_info_t *server = server_add();
+        if (!server) break;
+
+        snprintf(server->config.name, sizeof(server->config.name), "load%d", i);
+        strcpy(server->config.hostname, "127.0.0.1");
+        server->config.port = ntohs(addr.sin_port);
+        server->config.auto_reconnect = false;
+        server->config.ping_interval = 0;
+        strcpy(server->config.real_name, "Load test");
+        strcpy(server->nick, LOADTEST_NICK);
+
+        if (start_server_connection(server->index) == 0) connected++;
+    }
+
+    loadtest.loop = g_main_loop_new(NULL, FALSE);
+    g_timeout_add(LOADTEST_WARMUP_MS, loadtest_warm_cb, NULL);
+    g_timeout_add(LOADTEST_WARMUP_MS + (guint)seconds * 1000, loadtest_done_cb, NULL);
+    g_main_loop_run(loadtest.loop);
+
+    double elapsed_s = (get_monotonic_us() - loadtest.start_us) / 1000000.0;
+    uint64_t parsed = lines_parsed() - loadtest.start_parsed;
+    uint64_t merged = lines_merged() - loadtest.start_merged;
+    double cpu_ms = process_cpu_ms() - loadtest.start_cpu_ms;
+
+    g_atomic_int_set(&loadtest.feeding, 0);
+    shutdown(loadtest.listen_fd, SHUT_RDWR);
+    close(loadtest.listen_fd);
+    g_main_loop_unref(loadtest.loop);
+
+    printf("Load test: %d/%d servers, %d shards on %ld cores: %.0f lines/s parsed, %.0f lines/s merged, %.2f ms CPU per 1k lines\n",
+           connected, servers, shard_count(), sysconf(_SC_NPROCESSORS_ONLN), parsed / elapsed_s, merged / elapsed_s,
+           parsed > 0 ? cpu_ms * 1000.0 / parsed : 0.0);
+    fflush(stdout);
+
+    cleanup_client();
+    free(loadtest.flood);
+    return connected == servers ? 0 : 1;
+}
+
+#else
+
+int loadtest_run(int servers, int seconds) {
+    (void)servers;
+    (void)seconds;
+    log_message("ERROR", "The load test is not supported on Windows yet");
+    return 1;
+}
+
+#endif
@@ -32,37 +32,130 @@ void init_client(void) {
     }
 #endif
 
+#ifndef _WIN32
+    // A peer that went away must fail the send(), not kill the client
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
     memset(&client, 0, sizeof(client));
+    slots_init(&client.servers, sizeof(server_info_t));
     client.active_server = -1;
     client.running = true;
     pthread_mutex_init(&client.gui_mutex, NULL);
 }
 
+void init_server(server_info_t *server) {
+    memset(server, 0, sizeof(server_info_t));
+    server->config.port = 6667;
+    server->config.tls_verify = true;
+    server->config.sasl_external = true;
+    server->config.auto_reconnect = true;
+    server->config.ping_interval = 30;
+    server->config.lag_warn = 10;
+    server->config.lag_timeout = 90;
+    strcpy(server->config.encoding, "CP1252");
+    slots_init(&server->channels, sizeof(channel_info_t));
+    server->state = CONN_DISCONNECTED;
+    server->sockfd = -1;
+    server->active_channel = -1;
+    server->shard = -1;
+    isupport_reset(&server->isupport);
+    pthread_mutex_init(&server->io_mutex, NULL);
+    if (client.mode != CLIENT_DAEMON) {
+        channel_list_init(server);
+    }
+}
+
 void cleanup_client(void) {
+    static bool cleaned_up = false;
+    
+    if (cleaned_up) return;
+    cleaned_up = true;
     client.running = false;
     
-    for (int i = 0; i < client.server_count; i++) {
-        disconnect_server(&client.servers[i]);
+    // An attached GUI only mirrors the daemon's servers; they stay connected
+    if (client.mode != CLIENT_ATTACHED) {
+        if (!shutdown_servers()) {
+            // Threads past the deadline still use the mutexes, SSL objects
+            // and scrollback; the config is saved, so leave without freeing.
+            // The capture takes its own lock against late lines.
+            log_message("WARNING", "Exiting with connections still closing");
+            capture_close();
+            fflush(stdout);
+            _exit(0);
+        }
+        
+        for (int i = 0; i < client.servers.count; i++) {
+            tls_forget_session(server_get(i));
+            chanlist_free(server_get(i));
+        }
+        
+        dcc_close_all();
+        plugin_unload_all();
     }
     
+    // After the disconnects, so the QUITs are in it
+    capture_close();
+    scrollback_cleanup();
+    
     pthread_mutex_destroy(&client.gui_mutex);
-    save_config();
+    tls_cleanup();
     
 #ifdef _WIN32
     WSACleanup();
 #endif
 }
 
+#define TIMESTAMP_LENGTH 32
+
+static pthread_key_t timestamp_key;
+static pthread_once_t timestamp_once = PTHREAD_ONCE_INIT;
+
+static void timestamp_make_key(void) {
+    pthread_key_create(&timestamp_key, free);
+}
+
+// "[HH:MM:SS]" for display lines. Network threads and shards format lines
+// in parallel, so every thread fills a buffer of its own; it holds until
+// that thread's next call.
 char* get_timestamp(void) {
-    static char timestamp[32];
+    static char fallback[] = "[--:--:--]";
+    struct tm tm_info;
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(timestamp, sizeof(timestamp), "[%H:%M:%S]", tm_info);
+
+    pthread_once(&timestamp_once, timestamp_make_key);
+    char *timestamp = pthread_getspecific(timestamp_key);
+    if (!timestamp) {
+        timestamp = malloc(TIMESTAMP_LENGTH);
+        if (!timestamp || pthread_setspecific(timestamp_key, timestamp) != 0) {
+            free(timestamp);
+            return fallback;
+        }
+    }
+
+#ifdef _WIN32
+    localtime_s(&tm_info, &now);
+#else
+    localtime_r(&now, &tm_info);
+#endif
+    strftime(timestamp, TIMESTAMP_LENGTH, "[%H:%M:%S]", &tm_info);
     return timestamp;
 }
 
+uint64_t get_monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool log_verbose = true;
+
 void log_message(const char *level, const char *format, ...) {
     va_list args;
+    
+    // Every line received is logged at DEBUG; the load test cannot afford it
+    if (!log_verbose && strcmp(level, "DEBUG") == 0) return;
+    
     va_start(args, format);
     
     printf("%s [%s] ", get_timestamp(), level);
@@ -72,22 +165,136 @@ void log_message(const char *level, const char *format, ...) {
     va_end(args);
 }
 
+void log_set_verbose(bool verbose) {
+    log_verbose = verbose;
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [--daemon | --standalone] [--shards N] [--record FILE [--redact]]\n", program);
+    printf("       %s --replay FILE [--fast]\n", program);
+    printf("       %s --loadtest SERVERS [--seconds S] [--shards N]\n", program);
+    printf("  --daemon        Run the network core without a window; GUIs attach to it\n");
+    printf("  --standalone    Run without a daemon even if one is running\n");
+    printf("  --shards N      Serve all connections from N network threads instead of one each\n");
+    printf("  --record FILE   Capture all server traffic to FILE\n");
+    printf("  --redact        Blank out message text in the capture\n");
+    printf("  --replay FILE   Feed a capture through the client instead of connecting\n");
+    printf("  --fast          Replay as fast as possible instead of at the recorded pace\n");
+    printf("  --loadtest N    Flood N loopback connections and report lines per second\n");
+    printf("  --seconds S     Length of the load test (default 5)\n");
+    printf("With no option the GUI attaches to a running daemon, or runs standalone.\n");
+}
+
 int main(int argc, char *argv[]) {
-    // Initialize GTK
-    gtk_init(&argc, &argv);
+    bool daemon_mode = false;
+    bool standalone = false;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    bool redact = false;
+    bool fast = false;
+    int shards = 0;
+    int loadtest_servers = 0;
+    int loadtest_seconds = 5;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = true;
+        } else if (strcmp(argv[i], "--standalone") == 0) {
+            standalone = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--redact") == 0) {
+            redact = true;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shards = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loadtest") == 0 && i + 1 < argc) {
+            loadtest_servers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            loadtest_seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+    
+    // Before any thread exists, so all of them leave SIGUSR1 to the tracer
+    trace_init();
     
     // Initialize client
     init_client();
     
+    // Before any server connects; replayed servers never do
+    if (!replay_path) shard_init(shards);
+    
+    if (loadtest_servers > 0) {
+        return loadtest_run(loadtest_servers, loadtest_seconds > 0 ? loadtest_seconds : 5);
+    }
+    
+    // A replay is not recorded again
+    if (record_path && !replay_path && capture_open(record_path, redact) < 0) {
+        return 1;
+    }
+    
+    if (daemon_mode) {
+        // No GTK at all: the core runs on a plain GLib main loop
+        client.mode = CLIENT_DAEMON;
+        uint64_t span = trace_begin();
+        load_config();
+        trace_end("load_config", span, 0);
+        plugin_load_all(PLUGIN_DIR);
+        watchdog_init();
+        return daemon_run();
+    }
+    
+    // Initialize GTK
+    gtk_init(&argc, &argv);
+    
+    if (replay_path) {
+        // The capture's servers stand in for the configured ones
+        plugin_load_all(PLUGIN_DIR);
+        create_main_window();
+        watchdog_init();
+        if (replay_start(replay_path, fast) < 0) {
+            cleanup_client();
+            return 1;
+        }
+        gtk_main();
+        cleanup_client();
+        return 0;
+    }
+    
+    if (!standalone && attach_connect() == 0) {
+        // The daemon owns servers, config and plugins
+        client.mode = CLIENT_ATTACHED;
+        create_main_window();
+        watchdog_init();
+        attach_start();
+        gtk_main();
+        cleanup_client();
+        return 0;
+    }
+    
     // Load configuration
+    uint64_t span = trace_begin();
     load_config();
+    trace_end("load_config", span, 0);
+    
+    // Load plugins before any connection can produce events
+    plugin_load_all(PLUGIN_DIR);
     
     // Create main window
     create_main_window();
+    for (int i = 0; i < client.servers.count; i++) {
+        add_server_row(i);
+    }
+    watchdog_init();
     
     // Set up signal handlers
-    signal(SIGTERM, (void(*)(int))cleanup_client);
-    signal(SIGINT, (void(*)(int))cleanup_client);
+    shutdown_install_signals();
     
     // Run GTK main loop
     gtk_main();
@@ -101,7 +308,8 @@ int main(int argc, char *argv[]) {
 void on_window_destroy(GtkWidget *widget, gpointer data) {
     (void)widget;
     (void)data;
-    cleanup_client();
+    
+    // main() cleans up once gtk_main() returns
     gtk_main_quit();
 }
 
@@ -111,6 +319,7 @@ void create_main_window(void) {
     GtkTreeStore *server_store;
     GtkCellRenderer *renderer;
     GtkTreeViewColumn *column;
+    uint64_t span = trace_begin();
     
     // Create main window
     client.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -168,6 +377,7 @@ void create_main_window(void) {
     gtk_widget_set_size_request(scrolled, 150, -1);
     
     client.channel_list = gtk_tree_view_new();
+    channel_list_setup_view();
     gtk_container_add(GTK_CONTAINER(scrolled), client.channel_list);
     gtk_paned_pack1(GTK_PANED(client.channel_paned), scrolled, FALSE, TRUE);
     
@@ -190,7 +400,23 @@ void create_main_window(void) {
     gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(client.chat_area), GTK_WRAP_WORD);
     
     gtk_container_add(GTK_CONTAINER(scrolled), client.chat_area);
-    gtk_box_pack_start(GTK_BOX(chat_vbox), scrolled, TRUE, TRUE, 0);
+    client.chat_scrolled = scrolled;
+    
+    // "N new lines" indicator, floated over the bottom of the chat
+    GtkWidget *chat_overlay = gtk_overlay_new();
+    gtk_container_add(GTK_CONTAINER(chat_overlay), scrolled);
+    client.new_lines_button = gtk_button_new_with_label("");
+    gtk_widget_set_halign(client.new_lines_button, GTK_ALIGN_CENTER);
+    gtk_widget_set_valign(client.new_lines_button, GTK_ALIGN_END);
+    gtk_widget_set_margin_bottom(client.new_lines_button, 8);
+    gtk_widget_set_no_show_all(client.new_lines_button, TRUE);
+    gtk_overlay_add_overlay(GTK_OVERLAY(chat_overlay), client.new_lines_button);
+    gtk_box_pack_start(GTK_BOX(chat_vbox), chat_overlay, TRUE, TRUE, 0);
+    init_render();
+    
+    // Find bar, opened with Ctrl+F
+    gtk_box_pack_start(GTK_BOX(chat_vbox), search_bar_new(), FALSE, FALSE, 0);
+    g_signal_connect(client.window, "key-press-event", G_CALLBACK(on_main_window_key_press), NULL);
     
     // Message entry
     client.message_entry = gtk_entry_new();
@@ -198,6 +424,7 @@ void create_main_window(void) {
     gtk_box_pack_start(GTK_BOX(chat_vbox), client.message_entry, FALSE, FALSE, 0);
     
     g_signal_connect(client.message_entry, "activate", G_CALLBACK(on_message_entry_activate), NULL);
+    g_signal_connect(client.message_entry, "key-press-event", G_CALLBACK(on_message_entry_key_press), NULL);
     
     // Create user list (right panel)
     scrolled = gtk_scrolled_window_new(NULL, NULL);
@@ -205,7 +432,10 @@ void create_main_window(void) {
                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
     gtk_widget_set_size_request(scrolled, 120, -1);
     
-    client.user_list = gtk_tree_view_new();
+    client.user_list = gtk_tree_view_new_with_model(GTK_TREE_MODEL(gtk_list_store_new(1, G_TYPE_STRING)));
+    renderer = gtk_cell_renderer_text_new();
+    column = gtk_tree_view_column_new_with_attributes("Users", renderer, "text", 0, NULL);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(client.user_list), column);
     gtk_container_add(GTK_CONTAINER(scrolled), client.user_list);
     gtk_paned_pack2(GTK_PANED(chat_paned), scrolled, FALSE, TRUE);
     
@@ -213,10 +443,15 @@ void create_main_window(void) {
     client.status_bar = gtk_statusbar_new();
     gtk_box_pack_start(GTK_BOX(vbox), client.status_bar, FALSE, FALSE, 0);
     
+    // Lag meter of the active server, at the right end of the status bar
+    client.lag_label = gtk_label_new("");
+    gtk_box_pack_end(GTK_BOX(client.status_bar), client.lag_label, FALSE, FALSE, 0);
+    
     update_status("Ready");
     
     // Show all widgets
     gtk_widget_show_all(client.window);
+    trace_end("create_main_window", span, 0);
 }
 
 void on_message_entry_activate(GtkEntry *entry, gpointer data) {
@@ -224,80 +459,37 @@ void on_message_entry_activate(GtkEntry *entry, gpointer data) {
     
     if (client.active_server < 0) return;
     
-    server_info_t *server = &client.servers[client.active_server];
-    if (server->active_channel < 0) return;
+    server_info_t *server = server_get(client.active_server);
+    if (!snapshot_channel(server_snapshot(server), server->active_channel)) return;
     
     const char *message = gtk_entry_get_text(entry);
     if (strlen(message) == 0) return;
     
-    channel_info_t *channel = &server->channels[server->active_channel];
-    char cmd[MAX_MSG_LENGTH];
-    
-    if (message[0] == '/') {
-        // Handle commands
-        if (strncmp(message, "/join ", 6) == 0) {
-            snprintf(cmd, sizeof(cmd), "JOIN %s\r\n", message + 6);
-            send_irc_command(server, cmd);
-        } else if (strncmp(message, "/quit", 5) == 0) {
-            disconnect_server(server);
-        } else if (strncmp(message, "/msg ", 5) == 0) {
-            // Private message: /msg nick message
-            char *space = strchr(message + 5, ' ');
-            if (space) {
-                *space = '\0';
-                const char *nick = message + 5;
-                const char *msg = space + 1;
-                
-                snprintf(cmd, sizeof(cmd), "PRIVMSG %s :%s\r\n", nick, msg);
-                send_irc_command(server, cmd);
-                
-                // Add to DM channel or create it
-                int dm_channel = -1;
-                for (int i = 0; i < server->channel_count; i++) {
-                    if (server->channels[i].is_private_msg && 
-                        strcmp(server->channels[i].target_nick, nick) == 0) {
-                        dm_channel = i;
-                        break;
-                    }
-                }
-                
-                if (dm_channel == -1) {
-                    add_channel_to_server(client.active_server, nick, true);
-                    dm_channel = server->channel_count - 1;
-                    strcpy(server->channels[dm_channel].target_nick, nick);
-                }
-                
-                char display_msg[MAX_MSG_LENGTH];
-                snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
-                         get_timestamp(), server->nick, msg);
-                append_message_to_channel(client.active_server, dm_channel, display_msg);
-            }
-        } else {
-            // Send raw command
-            snprintf(cmd, sizeof(cmd), "%s\r\n", message + 1);
-            send_irc_command(server, cmd);
-        }
+    if (client.mode == CLIENT_ATTACHED) {
+        attach_send_input(client.active_server, server->active_channel, message);
     } else {
-        // Regular message
-        if (channel->is_private_msg) {
-            snprintf(cmd, sizeof(cmd), "PRIVMSG %s :%s\r\n", channel->target_nick, message);
-        } else {
-            snprintf(cmd, sizeof(cmd), "PRIVMSG #%s :%s\r\n", channel->name, message);
-        }
-        send_irc_command(server, cmd);
-        
-        // Echo message to chat
-        char display_msg[MAX_MSG_LENGTH];
-        snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
-                 get_timestamp(), server->nick, message);
-        append_message_to_channel(client.active_server, server->active_channel, display_msg);
+        handle_user_input(client.active_server, server->active_channel, message);
     }
     
     gtk_entry_set_text(entry, "");
 }
 
+static gboolean update_status_cb(gpointer data) {
+    update_status(data);
+    g_free(data);
+    return FALSE;
+}
+
+// Safe from any thread; others hand the text to the main loop
 void update_status(const char *message) {
-    if (client.status_bar) {
+    if (client.mode != CLIENT_DAEMON && !g_main_context_is_owner(NULL)) {
+        g_idle_add(update_status_cb, g_strdup(message));
+        return;
+    }
+    
+    if (client.mode == CLIENT_DAEMON) {
+        daemon_broadcast_status(message);
+    } else if (client.status_bar) {
         gtk_statusbar_remove_all(GTK_STATUSBAR(client.status_bar), 1);
         gtk_statusbar_push(GTK_STATUSBAR(client.status_bar), 1, message);
     }
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// A split group stays open while QUITs keep coming; it is applied to the
+// rosters in one pass once the burst has been quiet for this long.
+#define NETSPLIT_QUIET_MS 1500
+// How long users of an applied split are recognised as netjoining
+#define NETJOIN_WINDOW_MS (30 * 60 * 1000)
+
+static bool is_server_name(const char *name, size_t len) {
+    bool has_dot = false;
+
+    if (len == 0 || name[0] == '.' || name[len - 1] == '.') return false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (c == '.') {
+            has_dot = true;
+        } else if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c >= '0' && c <= '9') || c == '-' || c == '*' || c == '_')) {
+            return false;
+        }
+    }
+    return has_dot;
+}
+
+// Servers phrase split QUITs as exactly "<server1> <server2>"
+bool netsplit_is_split_reason(const char *reason) {
+    const char *space = strchr(reason, ' ');
+    if (!space || strchr(space + 1, ' ')) return false;
+
+    size_t left_len = space - reason;
+    size_t right_len = strlen(space + 1);
+
+    if (left_len == right_len && strncmp(reason, space + 1, left_len) == 0) return false;
+
+    return is_server_name(reason, left_len) && is_server_name(space + 1, right_len);
+}
+
+// "1234567" -> "1,234,567"
+static void format_count(int count, char *buf, size_t len) {
+    char digits[16];
+    int n = snprintf(digits, sizeof(digits), "%d", count);
+    size_t pos = 0;
+
+    for (int i = 0; i < n && pos + 1 < len; i++) {
+        if (i > 0 && (n - i) % 3 == 0 && pos + 2 < len) buf[pos++] = ',';
+        buf[pos++] = digits[i];
+    }
+    buf[pos] = '\0';
+}
+
+// "hub.example.net leaf.example.net" -> "hub.example.net <-> leaf.example.net"
+static void format_servers(const netsplit_t *split, char *buf, size_t len) {
+    const char *space = strchr(split->servers, ' ');
+    snprintf(buf, len, "%.*s <-> %s", (int)(space - split->servers), split->servers, space + 1);
+}
+
+static void netsplit_free(server_info_t *server, netsplit_t *split) {
+    if (split->nick_count > 0 || split->joiner_count > 0) {
+        pthread_mutex_lock(&client.gui_mutex);
+        for (int i = 0; i < split->nick_count; i++) {
+            intern_release(server, split->nicks[i]);
+        }
+        for (int i = 0; i < split->joiner_count; i++) {
+            intern_release(server, split->joiners[i].nick);
+        }
+        pthread_mutex_unlock(&client.gui_mutex);
+    }
+    free(split->nicks);
+    free(split->join_counts);
+    free(split->joiners);
+    memset(split, 0, sizeof(netsplit_t));
+}
+
+static netsplit_t *netsplit_get(server_info_t *server, const char *servers) {
+    netsplit_t *oldest = NULL;
+
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (split->in_use && !split->applied && strcmp(split->servers, servers) == 0) {
+            return split;
+        }
+    }
+
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (!split->in_use) {
+            oldest = split;
+            break;
+        }
+        if (!oldest || split->split_at_us < oldest->split_at_us) oldest = split;
+    }
+
+    // Losing the oldest split only costs netjoin coalescing for it
+    if (oldest->in_use) netsplit_free(server, oldest);
+
+    oldest->in_use = true;
+    strncpy(oldest->servers, servers, sizeof(oldest->servers) - 1);
+    oldest->split_at_us = get_monotonic_us();
+    return oldest;
+}
+
+// Removes everyone in the group from every roster in one pass per channel
+// and prints one collapsed line per affected channel.
+static void netsplit_apply(server_info_t *server, netsplit_t *split) {
+    int server_idx = server->index;
+    char count_str[32];
+    char servers[sizeof(split->servers) + 8];
+    char line[MAX_MSG_LENGTH];
+    bool changed = false;
+
+    format_servers(split, servers, sizeof(servers));
+    qsort(split->nicks, split->nick_count, sizeof(const intern_t*), intern_compare);
+
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (!channel || channel->is_private_msg) continue;
+
+        int removed = roster_remove_sorted(server, i, split->nicks, split->nick_count);
+        if (removed == 0) continue;
+
+        format_count(removed, count_str, sizeof(count_str));
+        snprintf(line, sizeof(line), "%s *** Netsplit %s: %s %s\n", get_timestamp(),
+                 servers, count_str, removed == 1 ? "user" : "users");
+        queue_channel_message(server_idx, i, line);
+        changed = true;
+    }
+
+    if (changed) roster_notify(server);
+
+    log_message("INFO", "Netsplit %s on %s: %d users", split->servers, server->config.name, split->nick_count);
+    split->applied = true;
+}
+
+static int joiner_compare(const void *a, const void *b) {
+    const netjoin_t *x = a;
+    const netjoin_t *y = b;
+    return (x->channel_idx > y->channel_idx) - (x->channel_idx < y->channel_idx);
+}
+
+// Adds the netjoiners collected so far to the rosters, one merge per
+// channel. Those whose channel went away meanwhile are dropped.
+static void netjoin_apply(server_info_t *server, netsplit_t *split) {
+    netjoin_t *joiners = split->joiners;
+    int count = split->joiner_count;
+
+    if (count == 0) return;
+    split->joiner_count = 0;
+
+    qsort(joiners, count, sizeof(netjoin_t), joiner_compare);
+
+    const intern_t **nicks = malloc(count * sizeof(const intern_t*));
+
+    for (int start = 0; start < count; ) {
+        int channel_idx = joiners[start].channel_idx;
+        int end = start;
+        int batch = 0;
+
+        while (end < count && joiners[end].channel_idx == channel_idx) end++;
+
+        if (!channel_current(server, channel_idx, joiners[start].generation)) {
+            pthread_mutex_lock(&client.gui_mutex);
+            for (int i = start; i < end; i++) intern_release(server, joiners[i].nick);
+            pthread_mutex_unlock(&client.gui_mutex);
+            start = end;
+            continue;
+        }
+
+        for (int i = start; i < end; i++) {
+            if (nicks) {
+                nicks[batch++] = joiners[i].nick;
+            } else {
+                roster_add_batch(server, channel_idx, &joiners[i].nick, 1);
+            }
+        }
+        if (batch > 0) roster_add_batch(server, channel_idx, nicks, batch);
+        start = end;
+    }
+
+    free(nicks);
+}
+
+static void netjoin_flush(server_info_t *server, netsplit_t *split) {
+    int server_idx = server->index;
+    char count_str[32];
+    char servers[sizeof(split->servers) + 8];
+    char line[MAX_MSG_LENGTH];
+
+    netjoin_apply(server, split);
+    format_servers(split, servers, sizeof(servers));
+
+    for (int i = 0; i < split->join_capacity; i++) {
+        int joined = split->join_counts[i];
+        if (joined == 0) continue;
+        split->join_counts[i] = 0;
+        if (!channel_get(server, i)) continue;
+
+        format_count(joined, count_str, sizeof(count_str));
+        snprintf(line, sizeof(line), "%s *** Netjoin %s: %s %s\n", get_timestamp(),
+                 servers, count_str, joined == 1 ? "user" : "users");
+        queue_channel_message(server_idx, i, line);
+    }
+
+    split->joins_pending = false;
+    roster_notify(server);
+}
+
+// Returns true when the QUIT belongs to a netsplit and was absorbed
+bool netsplit_handle_quit(server_info_t *server, const char *nick, const char *reason) {
+    if (!netsplit_is_split_reason(reason)) return false;
+
+    netsplit_t *split = netsplit_get(server, reason);
+
+    if (split->nick_count == split->nick_capacity) {
+        int capacity = split->nick_capacity ? split->nick_capacity * 2 : 256;
+        const intern_t **nicks = realloc(split->nicks, capacity * sizeof(const intern_t*));
+        if (!nicks) return false;
+        split->nicks = nicks;
+        split->nick_capacity = capacity;
+    }
+
+    // The reference keeps the entry, and so the netjoin match, alive
+    // after the user leaves every roster
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_nick(server, nick);
+    pthread_mutex_unlock(&client.gui_mutex);
+    if (!entry) return false;
+
+    split->nicks[split->nick_count++] = entry;
+    split->last_event_us = get_monotonic_us();
+    return true;
+}
+
+// Makes room for a per-channel netjoin count at channel_idx
+static bool netjoin_count_slot(netsplit_t *split, int channel_idx) {
+    if (channel_idx < split->join_capacity) return true;
+
+    int capacity = split->join_capacity ? split->join_capacity : 16;
+    while (capacity <= channel_idx) capacity *= 2;
+
+    int *counts = realloc(split->join_counts, capacity * sizeof(int));
+    if (!counts) return false;
+    memset(counts + split->join_capacity, 0, (capacity - split->join_capacity) * sizeof(int));
+    split->join_counts = counts;
+    split->join_capacity = capacity;
+    return true;
+}
+
+// Makes room for one more netjoiner
+static bool netjoin_joiner_slot(netsplit_t *split) {
+    if (split->joiner_count < split->joiner_capacity) return true;
+
+    int capacity = split->joiner_capacity ? split->joiner_capacity * 2 : 256;
+    netjoin_t *joiners = realloc(split->joiners, capacity * sizeof(netjoin_t));
+    if (!joiners) return false;
+    split->joiners = joiners;
+    split->joiner_capacity = capacity;
+    return true;
+}
+
+// Returns true when the JOIN is a user returning from a split. They are
+// added to the roster with the rest of the netjoin when it is flushed, so
+// the caller neither adds them nor prints a line for it.
+bool netsplit_handle_join(server_info_t *server, const char *nick, int channel_idx) {
+    bool found = false;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_lookup(server, nick);
+    pthread_mutex_unlock(&client.gui_mutex);
+    if (!entry) return false;
+
+    for (int i = 0; i < MAX_NETSPLITS && !found; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (!split->in_use) continue;
+
+        if (!split->applied) {
+            // Back before the burst was even applied: just drop them from it
+            for (int j = 0; j < split->nick_count; j++) {
+                if (split->nicks[j] == entry) {
+                    split->nicks[j] = split->nicks[--split->nick_count];
+                    pthread_mutex_lock(&client.gui_mutex);
+                    intern_release(server, entry);
+                    pthread_mutex_unlock(&client.gui_mutex);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (bsearch(&entry, split->nicks, split->nick_count, sizeof(const intern_t*), intern_compare)) {
+            // Without room the caller adds them on their own
+            if (!netjoin_joiner_slot(split)) return false;
+
+            netjoin_t *joiner = &split->joiners[split->joiner_count++];
+            pthread_mutex_lock(&client.gui_mutex);
+            intern_ref(entry);
+            pthread_mutex_unlock(&client.gui_mutex);
+            joiner->nick = entry;
+            joiner->channel_idx = channel_idx;
+            joiner->generation = channel_generation(server, channel_idx);
+
+            if (netjoin_count_slot(split, channel_idx)) split->join_counts[channel_idx]++;
+            split->joins_pending = true;
+            split->last_event_us = get_monotonic_us();
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Applies quiet split groups, flushes quiet netjoins and expires old splits
+void netsplit_tick(server_info_t *server) {
+    uint64_t now = get_monotonic_us();
+
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (!split->in_use) continue;
+
+        bool quiet = now - split->last_event_us >= (uint64_t)NETSPLIT_QUIET_MS * 1000;
+
+        if (!split->applied && quiet) {
+            netsplit_apply(server, split);
+        } else if (split->joins_pending && quiet) {
+            netjoin_flush(server, split);
+        } else if (split->applied && !split->joins_pending &&
+                   now - split->split_at_us >= (uint64_t)NETJOIN_WINDOW_MS * 1000) {
+            netsplit_free(server, split);
+        }
+    }
+}
+
+// Shortens the network thread's poll timeout while a group is waiting
+int netsplit_poll_timeout(server_info_t *server, int timeout_ms) {
+    uint64_t now = get_monotonic_us();
+
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (!split->in_use || (split->applied && !split->joins_pending)) continue;
+
+        uint64_t due = split->last_event_us + (uint64_t)NETSPLIT_QUIET_MS * 1000;
+        if (due <= now) return 0;
+
+        uint64_t wait_ms = (due - now) / 1000 + 1;
+        if (wait_ms < (uint64_t)timeout_ms) timeout_ms = (int)wait_ms;
+    }
+
+    return timeout_ms;
+}
+
+// Puts pending netjoiners into the rosters now, before a PART, QUIT or
+// NICK that concerns them is applied
+void netsplit_apply_joins(server_info_t *server) {
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_t *split = &server->netsplits[i];
+        if (split->in_use && split->joiner_count > 0) {
+            netjoin_apply(server, split);
+            roster_notify(server);
+        }
+    }
+}
+
+void netsplit_reset(server_info_t *server) {
+    for (int i = 0; i < MAX_NETSPLITS; i++) {
+        netsplit_free(server, &server->netsplits[i]);
+    }
+}
@@ -2,15 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
     // Define closesocket equivalent
     #define close closesocket
+    #define poll WSAPoll
+    #define SHUT_RDWR SD_BOTH
 #else
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
     #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #include <netdb.h>
 #endif
@@ -22,29 +29,179 @@
 #define strtok_r strtok_s
 #endif
 
-typedef struct {
+typedef struct gui_update {
     int server_idx;
+    int channel_idx;
+    uint32_t generation; // Dropped if the channel was removed meanwhile
+    activity_t activity;
+    uint64_t trace_id;   // Line that produced the update
+    struct gui_update *next;
     char message[MAX_MSG_LENGTH];
 } gui_update_data_t;
 
+// Lines for the GTK thread wait in one queue per shard (a single one
+// without shards), so a busy shard cannot bury the others' lines. One idle
+// callback takes up to GUI_MERGE_QUOTA lines from each queue in turn until
+// they are empty or GUI_MERGE_BUDGET_US is used up.
+#define GUI_MERGE_QUOTA 32
+#define GUI_MERGE_BUDGET_US 8000
+
+typedef struct {
+    pthread_mutex_t mutex;
+    gui_update_data_t *head;
+    gui_update_data_t *tail;
+    gint depth;
+    int max_depth;
+    uint64_t merged;     // GTK thread only
+} gui_queue_t;
+
+static gui_queue_t gui_queues[SHARD_MAX];
+static pthread_once_t gui_queues_once = PTHREAD_ONCE_INIT;
+static gint gui_merge_scheduled;
+static int gui_merge_next;
+
+#define NET_POLL_INTERVAL_MS 1000
+// Probes after this much silence, then every interval; a peer that stays
+// silent for the whole count is gone
+#define NET_KEEPALIVE_IDLE_S 30
+#define NET_KEEPALIVE_INTERVAL_S 5
+#define NET_KEEPALIVE_COUNT 3
+// Unacknowledged data older than this drops the connection
+#define NET_USER_TIMEOUT_MS 30000
+
+// Waits until the socket is ready for events. Returns >0 when ready,
+// 0 on timeout and -1 on error.
+int net_wait_socket(int sockfd, short events, int timeout_ms) {
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = sockfd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLNVAL))) return -1;
+    return ret;
+}
+
+static int set_socket_nonblocking(int sockfd) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+// Lets the kernel notice a half-open link in seconds: keepalive probes
+// cover a quiet connection, TCP_USER_TIMEOUT one with unacknowledged data.
+// Best effort; the lag meter's PING timeout backs both up.
+static void set_socket_keepalive(int sockfd) {
+    int on = 1;
+
+    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+    int idle = NET_KEEPALIVE_IDLE_S;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&idle, sizeof(idle));
+#endif
+#ifdef TCP_KEEPINTVL
+    int interval = NET_KEEPALIVE_INTERVAL_S;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&interval, sizeof(interval));
+#endif
+#ifdef TCP_KEEPCNT
+    int count = NET_KEEPALIVE_COUNT;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&count, sizeof(count));
+#endif
+#ifdef TCP_USER_TIMEOUT
+    unsigned int user_timeout = NET_USER_TIMEOUT_MS;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, (const char*)&user_timeout, sizeof(user_timeout));
+#endif
+}
+
+static bool net_would_block(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// Reads whatever is available. Returns -1 with errno EAGAIN when nothing is.
+static ssize_t net_recv(server_info_t *server, char *buf, size_t len) {
+    if (server->ssl) {
+        return tls_read(server, buf, len);
+    }
+
+    ssize_t ret = recv(server->sockfd, buf, len, 0);
+    if (ret < 0 && net_would_block()) errno = EAGAIN;
+    return ret;
+}
+
+static ssize_t net_send(server_info_t *server, const char *buf, size_t len) {
+    if (server->ssl) {
+        return tls_write(server, buf, len);
+    }
+
+    size_t total = 0;
+    uint64_t deadline = get_monotonic_us() + (uint64_t)NET_SEND_TIMEOUT_MS * 1000;
+
+    pthread_mutex_lock(&server->io_mutex);
+    if (server->uring) {
+        ssize_t sent = uring_send(server, buf, len);
+        pthread_mutex_unlock(&server->io_mutex);
+        return sent;
+    }
+    
+    while (total < len) {
+        server->net_stats.tx_syscalls++;
+        ssize_t sent = send(server->sockfd, buf + total, len - total, 0);
+        if (sent > 0) {
+            total += sent;
+            continue;
+        }
+
+        uint64_t now = get_monotonic_us();
+        server->net_stats.tx_syscalls += sent < 0 && net_would_block() ? 1 : 0;
+        if (sent < 0 && net_would_block() && now < deadline &&
+            net_wait_socket(server->sockfd, POLLOUT, (int)((deadline - now) / 1000)) >= 0) {
+            continue;
+        }
+
+        pthread_mutex_unlock(&server->io_mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&server->io_mutex);
+
+    return (ssize_t)total;
+}
+
 int connect_to_server(server_info_t *server) {
     struct addrinfo hints, *result, *rp;
     char port_str[16];
     int status;
 
     server->state = CONN_CONNECTING;
+    pthread_mutex_lock(&client.gui_mutex);
+    isupport_reset(&server->isupport);
+    pthread_mutex_unlock(&client.gui_mutex);
+    if (intern_rehash(server)) roster_resort(server);
     
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = 0;
     
-    snprintf(port_str, sizeof(port_str), "%d", server->port);
+    snprintf(port_str, sizeof(port_str), "%d", server->config.port);
     
-    status = getaddrinfo(server->hostname, port_str, &hints, &result);
+    status = getaddrinfo(server->config.hostname, port_str, &hints, &result);
     if (status != 0) {
         log_message("ERROR", "getaddrinfo failed for %s: %s", 
-                   server->hostname, gai_strerror(status));
+                   server->config.hostname, gai_strerror(status));
         server->state = CONN_ERROR;
         return -1;
     }
@@ -65,56 +222,150 @@ int connect_to_server(server_info_t *server) {
     freeaddrinfo(result);
 
     if (server->sockfd == -1) {
-        log_message("ERROR", "Could not connect to %s:%d", server->hostname, server->port);
+        log_message("ERROR", "Could not connect to %s:%d", server->config.hostname, server->config.port);
+        server->state = CONN_ERROR;
+        return -1;
+    }
+
+    set_socket_nonblocking(server->sockfd);
+    set_socket_keepalive(server->sockfd);
+
+    if (server->config.use_tls && tls_connect(server) < 0) {
+        log_message("ERROR", "TLS negotiation with %s:%d failed", server->config.hostname, server->config.port);
+        close(server->sockfd);
+        server->sockfd = -1;
         server->state = CONN_ERROR;
         return -1;
     }
 
+    memset(&server->net_stats, 0, sizeof(net_stats_t));
+    server->rx_pos = 0;
+    lag_reset(server);
+    // Shards poll many sockets at once; io_uring stays with the thread per server
+    if (shard_count() == 0 && uring_attach(server)) {
+        server->net_stats.backend = NET_BACKEND_URING;
+    }
+    
     server->state = CONN_CONNECTED;
-    log_message("INFO", "Connected to %s:%d", server->hostname, server->port);
+    log_message("INFO", "Connected to %s:%d%s%s", server->config.hostname, server->config.port,
+               server->ssl ? " (TLS)" : "", server->uring ? " (io_uring)" : "");
     
     // Send initial IRC commands
     char cmd[MAX_MSG_LENGTH];
     
-    if (strlen(server->password) > 0) {
-        snprintf(cmd, sizeof(cmd), "PASS %s\r\n", server->password);
+    // SASL EXTERNAL needs capability negotiation before registration
+    if (server->ssl && server->config.sasl_external && strlen(server->config.client_cert) > 0) {
+        server->cap_sasl_seen = false;
+        send_irc_command(server, "CAP LS 302\r\n");
+    }
+    
+    if (strlen(server->config.password) > 0) {
+        snprintf(cmd, sizeof(cmd), "PASS %s\r\n", server->config.password);
         send_irc_command(server, cmd);
     }
     
     snprintf(cmd, sizeof(cmd), "NICK %s\r\n", server->nick);
     send_irc_command(server, cmd);
     
-    snprintf(cmd, sizeof(cmd), "USER %s 0 * :%s\r\n", server->nick, server->real_name);
+    snprintf(cmd, sizeof(cmd), "USER %s 0 * :%s\r\n", server->nick, server->config.real_name);
     send_irc_command(server, cmd);
     
     return server->sockfd;
 }
 
-void disconnect_server(server_info_t *server) {
+// Connects and spawns the network thread, or hands the server to its
+// shard. Returns 0 on success.
+int start_server_connection(int server_idx) {
+    server_info_t *server = server_get(server_idx);
+    
+    // Reap the thread of a connection that dropped on its own
+    close_server_connection(server);
+    
+    uint64_t span = trace_begin();
+    const char *mark = watchdog_enter("connect_to_server");
+    int connected = connect_to_server(server);
+    watchdog_leave(mark);
+    trace_end("connect", span, 0);
+    if (connected < 0) {
+        return -1;
+    }
+    
+    if (shard_count() > 0) {
+        if (!shard_attach(server)) {
+            server->state = CONN_ERROR;
+            close_server_connection(server);
+            return -1;
+        }
+        return 0;
+    }
+    
+    int *server_idx_ptr = malloc(sizeof(int));
+    *server_idx_ptr = server_idx;
+    
+    if (pthread_create(&server->network_thread, NULL, network_thread_func, server_idx_ptr) != 0) {
+        log_message("ERROR", "Failed to create network thread");
+        server->network_thread = 0;
+        server->state = CONN_ERROR;
+        close_server_connection(server);
+        free(server_idx_ptr);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Tears down the socket and network thread without touching server->state
+void close_server_connection(server_info_t *server) {
+    // Wake the network thread out of poll() and let it exit on its own,
+    // so it is never cancelled while holding io_mutex
     if (server->sockfd > 0) {
-        send_irc_command(server, "QUIT :Client disconnecting\r\n");
-        close(server->sockfd);
-        server->sockfd = -1;
+        shutdown(server->sockfd, SHUT_RDWR);
     }
     
-    server->state = CONN_DISCONNECTED;
+    // A shard lets go of the server at the end of its current turn
+    shard_detach(server);
     
     if (server->network_thread) {
-        pthread_cancel(server->network_thread);
         pthread_join(server->network_thread, NULL);
         server->network_thread = 0;
     }
     
-    log_message("INFO", "Disconnected from %s", server->name);
+    if (server->sockfd > 0) {
+        uring_detach(server);
+        tls_close(server);
+        close(server->sockfd);
+        server->sockfd = -1;
+    }
+}
+
+void disconnect_server(server_info_t *server) {
+    // Joins the network thread, which can take a while
+    const char *mark = watchdog_enter("disconnect_server");
+    
+    if (server->sockfd > 0 && server->state == CONN_CONNECTED) {
+        send_irc_command(server, "QUIT :Client disconnecting\r\n");
+    }
+    
+    server->state = CONN_DISCONNECTED;
+    reconnect_cancel(server);
+    close_server_connection(server);
+    watchdog_leave(mark);
+    
+    log_message("INFO", "Disconnected from %s", server->config.name);
 }
 
 void send_irc_command(server_info_t *server, const char *cmd) {
+    // A replayed session has no socket; what it would send is in the capture
+    if (client.replaying) return;
+    
     if (server->state != CONN_CONNECTED || server->sockfd <= 0) {
         log_message("WARNING", "Attempted to send command to disconnected server");
         return;
     }
     
-    ssize_t sent = send(server->sockfd, cmd, strlen(cmd), 0);
+    const char *mark = watchdog_enter("send_irc_command");
+    ssize_t sent = net_send(server, cmd, strlen(cmd));
+    watchdog_leave(mark);
     if (sent < 0) {
 #ifdef _WIN32
         int error = WSAGetLastError();
@@ -125,28 +376,218 @@ void send_irc_command(server_info_t *server, const char *cmd) {
         server->state = CONN_ERROR;
     } else {
         log_message("DEBUG", "Sent: %s", cmd);
+        capture_line(server, true, cmd, strcspn(cmd, "\r\n"));
+        
+        if (plugin_wants(IRC_EVENT_SEND)) {
+            char line[MAX_MSG_LENGTH];
+            irc_event_t event = { .type = IRC_EVENT_SEND, .server_idx = server->index, .line = line };
+            snprintf(line, sizeof(line), "%.*s", (int)strcspn(cmd, "\r\n"), cmd);
+            plugin_emit(&event);
+        }
     }
 }
 
-gboolean gui_update_callback(gpointer data) {
-    gui_update_data_t *update = (gui_update_data_t*)data;
+// I/O cost of the current connection per 1k lines received, for comparing
+// the poll() and io_uring paths on the same traffic
+void net_format_stats(server_info_t *server, char *buf, size_t len) {
+    net_stats_t *stats = &server->net_stats;
+    double cpu_ms = -1;
+    char backend[32];
     
-    pthread_mutex_lock(&client.gui_mutex);
+    // A shard's CPU time is shared by its servers; shard_format_stats() has it
+    if (server->shard >= 0) {
+        snprintf(backend, sizeof(backend), "poll on shard %d", server->shard);
+    } else {
+        snprintf(backend, sizeof(backend), "%s", stats->backend == NET_BACKEND_URING ? "io_uring" : "poll");
+    }
     
-    // Find the appropriate channel and append message
-    server_info_t *server = &client.servers[update->server_idx];
+#ifndef _WIN32
+    clockid_t clock_id;
+    struct timespec ts;
+    if (server->network_thread && pthread_getcpuclockid(server->network_thread, &clock_id) == 0 &&
+        clock_gettime(clock_id, &ts) == 0) {
+        cpu_ms = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+#endif
     
-    // For now, just append to active channel or create a status channel
-    if (server->active_channel >= 0) {
-        append_message_to_channel(update->server_idx, server->active_channel, update->message);
+    if (stats->lines == 0) {
+        snprintf(buf, len, "%s Net: %s, no lines from %s yet\n", get_timestamp(), backend, server->config.name);
+        return;
     }
     
-    pthread_mutex_unlock(&client.gui_mutex);
+    double per_k = 1000.0 / stats->lines;
+    snprintf(buf, len,
+             "%s Net: %s, %llu lines (%llu not UTF-8), %llu bytes, %.1f rx + %.1f tx syscalls per 1k lines, %.2f ms CPU per 1k lines\n",
+             get_timestamp(), backend,
+             (unsigned long long)stats->lines, (unsigned long long)stats->converted, (unsigned long long)stats->bytes,
+             stats->rx_syscalls * per_k, stats->tx_syscalls * per_k,
+             cpu_ms >= 0 ? cpu_ms * per_k : 0.0);
+}
+
+gboolean gui_update_callback(gpointer data) {
+    gui_update_data_t *update = (gui_update_data_t*)data;
+    
+    // Find the appropriate channel and record the message; the append takes
+    // client.gui_mutex itself
+    server_info_t *server = server_get(update->server_idx);
+    int channel_idx = update->channel_idx >= 0 ? update->channel_idx : server->active_channel;
+    
+    if (update->channel_idx < 0 || channel_current(server, channel_idx, update->generation)) {
+        uint64_t span = trace_begin();
+        const char *mark = watchdog_enter("gui_update");
+        trace_set_current(update->trace_id);
+        core_append_line(update->server_idx, channel_idx, update->message, update->activity);
+        trace_set_current(0);
+        watchdog_leave(mark);
+        trace_end("gui_update", span, update->trace_id);
+    }
     
     free(update);
     return FALSE; // Don't repeat
 }
 
+// Queues a line for a channel buffer; safe to call from network threads.
+// A negative channel_idx targets whatever channel is active.
+void queue_channel_message(int server_idx, int channel_idx, const char *message) {
+    queue_channel_activity(server_idx, channel_idx, message, ACTIVITY_EVENT);
+}
+
+static void gui_queues_init(void) {
+    for (int i = 0; i < SHARD_MAX; i++) {
+        pthread_mutex_init(&gui_queues[i].mutex, NULL);
+    }
+}
+
+static bool gui_queues_empty(void) {
+    int count = shard_count() > 0 ? shard_count() : 1;
+    
+    for (int i = 0; i < count; i++) {
+        if (g_atomic_int_get(&gui_queues[i].depth) > 0) return false;
+    }
+    return true;
+}
+
+// Runs on the GTK thread while any queue has lines
+static gboolean gui_merge_cb(gpointer data) {
+    (void)data;
+    int count = shard_count() > 0 ? shard_count() : 1;
+    uint64_t deadline = get_monotonic_us() + GUI_MERGE_BUDGET_US;
+    bool progress = true;
+    
+    while (progress && get_monotonic_us() < deadline) {
+        progress = false;
+        
+        // The queue that goes first moves on every round
+        for (int n = 0; n < count; n++) {
+            gui_queue_t *queue = &gui_queues[(gui_merge_next + n) % count];
+            gui_update_data_t *batch, *last;
+            int taken = 1;
+            
+            pthread_mutex_lock(&queue->mutex);
+            batch = last = queue->head;
+            if (!batch) {
+                pthread_mutex_unlock(&queue->mutex);
+                continue;
+            }
+            while (taken < GUI_MERGE_QUOTA && last->next) {
+                last = last->next;
+                taken++;
+            }
+            queue->head = last->next;
+            if (!queue->head) queue->tail = NULL;
+            last->next = NULL;
+            g_atomic_int_add(&queue->depth, -taken);
+            pthread_mutex_unlock(&queue->mutex);
+            
+            while (batch) {
+                gui_update_data_t *next = batch->next;
+                gui_update_callback(batch);
+                batch = next;
+            }
+            queue->merged += (uint64_t)taken;
+            progress = true;
+        }
+        gui_merge_next = (gui_merge_next + 1) % count;
+    }
+    
+    if (!gui_queues_empty()) return G_SOURCE_CONTINUE;
+    
+    // A line queued after the check above schedules a callback of its own
+    g_atomic_int_set(&gui_merge_scheduled, 0);
+    if (!gui_queues_empty() && g_atomic_int_compare_and_exchange(&gui_merge_scheduled, 0, 1)) {
+        return G_SOURCE_CONTINUE;
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Same, for lines that should count as unread or highlight in the channel list
+void queue_channel_activity(int server_idx, int channel_idx, const char *message, activity_t activity) {
+    server_info_t *server = server_get(server_idx);
+    gui_update_data_t *update = malloc(sizeof(gui_update_data_t));
+    update->server_idx = server_idx;
+    update->channel_idx = channel_idx;
+    update->generation = channel_idx >= 0 ? channel_generation(server, channel_idx) : 0;
+    update->activity = activity;
+    update->trace_id = trace_current();
+    update->next = NULL;
+    strncpy(update->message, message, MAX_MSG_LENGTH - 1);
+    update->message[MAX_MSG_LENGTH - 1] = '\0';
+    
+    pthread_once(&gui_queues_once, gui_queues_init);
+    gui_queue_t *queue = &gui_queues[server->shard >= 0 ? server->shard : 0];
+    
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->tail) {
+        queue->tail->next = update;
+    } else {
+        queue->head = update;
+    }
+    queue->tail = update;
+    int depth = g_atomic_int_add(&queue->depth, 1) + 1;
+    if (depth > queue->max_depth) queue->max_depth = depth;
+    pthread_mutex_unlock(&queue->mutex);
+    
+    if (g_atomic_int_compare_and_exchange(&gui_merge_scheduled, 0, 1)) {
+        g_idle_add(gui_merge_cb, NULL);
+    }
+}
+
+// Lines waiting for the GTK thread in a shard's queue
+int net_queue_depth(int queue) {
+    return g_atomic_int_get(&gui_queues[queue].depth);
+}
+
+// Lines waiting now, the most ever waiting and lines the GTK thread has
+// taken so far; call on the GTK thread
+void net_queue_stats(int queue, int *depth, int *max_depth, uint64_t *merged) {
+    *depth = g_atomic_int_get(&gui_queues[queue].depth);
+    *max_depth = gui_queues[queue].max_depth;
+    *merged = gui_queues[queue].merged;
+}
+
+static bool is_nick_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           strchr("-_[]{}\\|^`", c) != NULL;
+}
+
+// Whether text mentions our nick as a whole word, under the server's casemapping
+static bool mentions_nick(server_info_t *server, const char *text) {
+    size_t nick_len = strlen(server->nick);
+    if (nick_len == 0) return false;
+    
+    for (const char *p = text; *p; p++) {
+        if (p > text && is_nick_char(p[-1])) continue;
+        
+        size_t i = 0;
+        while (i < nick_len && p[i] &&
+               isupport_fold(&server->isupport, p[i]) == isupport_fold(&server->isupport, server->nick[i])) {
+            i++;
+        }
+        if (i == nick_len && !is_nick_char(p[i])) return true;
+    }
+    return false;
+}
+
 void handle_irc_message(server_info_t *server, const char *message) {
     char *msg_copy = strdup(message);
     char *saveptr;
@@ -171,12 +612,21 @@ void handle_irc_message(server_info_t *server, const char *message) {
     
     params = saveptr;
     
+    if (plugin_wants(IRC_EVENT_MESSAGE)) {
+        irc_event_t event = { .type = IRC_EVENT_MESSAGE, .server_idx = server->index,
+                              .prefix = prefix, .command = command, .params = params };
+        plugin_emit(&event);
+    }
+    
     // Handle different IRC commands
     if (strcmp(command, "PING") == 0) {
         char pong[MAX_MSG_LENGTH];
         snprintf(pong, sizeof(pong), "PONG %s\r\n", params ? params : "");
         send_irc_command(server, pong);
     }
+    else if (strcmp(command, "PONG") == 0) {
+        lag_handle_pong(server, params);
+    }
     else if (strcmp(command, "PRIVMSG") == 0) {
         char *target = strtok_r(NULL, " ", &saveptr);
         char *msg_text = saveptr;
@@ -184,157 +634,451 @@ void handle_irc_message(server_info_t *server, const char *message) {
         if (msg_text && msg_text[0] == ':') msg_text++;
         
         if (target && msg_text && prefix) {
-            char *nick = strtok(prefix, "!");
+            char *nick_save;
+            char *nick = strtok_r(prefix, "!", &nick_save);
             char display_msg[MAX_MSG_LENGTH];
             
+            // DCC requests are handled on the main loop, not shown
+            if (strcmp(target, server->nick) == 0 && strncmp(msg_text, "\001DCC ", 5) == 0) {
+                dcc_post_ctcp(server->index, nick, msg_text);
+            }
             // Check if it's a private message to us
-            if (strcmp(target, server->nick) == 0) {
+            else if (strcmp(target, server->nick) == 0) {
                 // Private message - find or create DM channel
                 int dm_channel = -1;
-                for (int i = 0; i < server->channel_count; i++) {
-                    if (server->channels[i].is_private_msg && 
-                        strcmp(server->channels[i].target_nick, nick) == 0) {
+                for (int i = 0; i < server->channels.count; i++) {
+                    channel_info_t *dm = channel_get(server, i);
+                    if (dm && dm->is_private_msg && strcmp(dm->target_nick, nick) == 0) {
                         dm_channel = i;
                         break;
                     }
                 }
                 
                 if (dm_channel == -1) {
-                    int server_idx = server - client.servers;
-                    add_channel_to_server(server_idx, nick, true);
-                    dm_channel = server->channel_count - 1;
-                    strcpy(server->channels[dm_channel].target_nick, nick);
+                    dm_channel = add_channel_to_server(server->index, nick, true);
                 }
                 
                 snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
                          get_timestamp(), nick, msg_text);
                 
-                gui_update_data_t *update = malloc(sizeof(gui_update_data_t));
-                update->server_idx = server - client.servers;
-                strcpy(update->message, display_msg);
-                g_idle_add(gui_update_callback, update);
+                queue_channel_activity(server->index, dm_channel, display_msg, ACTIVITY_HIGHLIGHT);
             } else {
                 // Channel message
                 snprintf(display_msg, sizeof(display_msg), "%s <%s> %s\n", 
                          get_timestamp(), nick, msg_text);
                 
                 // Find the channel
-                for (int i = 0; i < server->channel_count; i++) {
-                    if (!server->channels[i].is_private_msg && 
-                        (strcmp(server->channels[i].name, target) == 0 ||
-                         (target[0] == '#' && strcmp(server->channels[i].name, target + 1) == 0))) {
+                for (int i = 0; i < server->channels.count; i++) {
+                    channel_info_t *channel = channel_get(server, i);
+                    if (channel && !channel->is_private_msg && 
+                        (strcmp(channel->name, target) == 0 ||
+                         (target[0] == '#' && strcmp(channel->name, target + 1) == 0))) {
                         
-                        gui_update_data_t *update = malloc(sizeof(gui_update_data_t));
-                        update->server_idx = server - client.servers;
-                        strcpy(update->message, display_msg);
-                        g_idle_add(gui_update_callback, update);
+                        queue_channel_activity(server->index, i, display_msg,
+                                               mentions_nick(server, msg_text) ? ACTIVITY_HIGHLIGHT : ACTIVITY_MESSAGE);
+                        roster_spoke(server, i, nick);
                         break;
                     }
                 }
             }
         }
     }
+    else if (strcmp(command, "CAP") == 0) {
+        // CAP <nick> <subcommand> [*] :<capabilities>
+        strtok_r(NULL, " ", &saveptr);
+        char *subcommand = strtok_r(NULL, " ", &saveptr);
+        char *caps = saveptr;
+        
+        if (subcommand && caps) {
+            bool more = strncmp(caps, "* ", 2) == 0;
+            if (more) caps += 2;
+            if (caps[0] == ':') caps++;
+            
+            if (strcmp(subcommand, "LS") == 0) {
+                // A long list comes as "CAP * LS * :..." lines; the last one decides
+                char *cap_save;
+                for (char *cap = strtok_r(caps, " ", &cap_save); cap; cap = strtok_r(NULL, " ", &cap_save)) {
+                    if (strcmp(cap, "sasl") == 0 || strncmp(cap, "sasl=", 5) == 0) {
+                        server->cap_sasl_seen = true;
+                    }
+                }
+                if (!more) {
+                    send_irc_command(server, server->cap_sasl_seen ? "CAP REQ :sasl\r\n" : "CAP END\r\n");
+                    server->cap_sasl_seen = false;
+                }
+            } else if (strcmp(subcommand, "ACK") == 0 && strstr(caps, "sasl")) {
+                send_irc_command(server, "AUTHENTICATE EXTERNAL\r\n");
+            } else if (strcmp(subcommand, "NAK") == 0) {
+                send_irc_command(server, "CAP END\r\n");
+            }
+        }
+    }
+    else if (strcmp(command, "AUTHENTICATE") == 0) {
+        if (params && strcmp(params, "+") == 0) {
+            // EXTERNAL takes its identity from the client certificate
+            send_irc_command(server, "AUTHENTICATE +\r\n");
+        }
+    }
+    else if (strcmp(command, "903") == 0) {
+        log_message("INFO", "SASL EXTERNAL authentication to %s succeeded", server->config.name);
+        send_irc_command(server, "CAP END\r\n");
+    }
+    else if (strcmp(command, "902") == 0 || strcmp(command, "904") == 0 ||
+             strcmp(command, "905") == 0 || strcmp(command, "906") == 0 ||
+             strcmp(command, "908") == 0) {
+        log_message("ERROR", "SASL EXTERNAL authentication to %s failed (%s)", server->config.name, command);
+        send_irc_command(server, "CAP END\r\n");
+    }
     else if (strcmp(command, "001") == 0) {
         // Welcome message - we're successfully connected
-        log_message("INFO", "Successfully logged into %s", server->name);
+        log_message("INFO", "Successfully logged into %s", server->config.name);
         update_status("Connected and logged in");
         
-        // Auto-join channels if any are configured
-        // This could be expanded to load from config
+        if (plugin_wants(IRC_EVENT_CONNECT)) {
+            irc_event_t event = { .type = IRC_EVENT_CONNECT, .server_idx = server->index };
+            plugin_emit(&event);
+        }
+        
+        // Join configured channels, or rejoin after a reconnect
+        rejoin_start(server);
+        lag_start(server);
+    }
+    else if (strcmp(command, "005") == 0) {
+        if (params) {
+            // The GTK thread reads the tables from the next snapshot
+            pthread_mutex_lock(&client.gui_mutex);
+            isupport_parse(&server->isupport, params);
+            pthread_mutex_unlock(&client.gui_mutex);
+            if (intern_rehash(server)) roster_resort(server);
+            channel_publish(server);
+        }
+    }
+    else if (strcmp(command, "403") == 0 || strcmp(command, "405") == 0 ||
+             strcmp(command, "471") == 0 || strcmp(command, "473") == 0 ||
+             strcmp(command, "474") == 0 || strcmp(command, "475") == 0 ||
+             strcmp(command, "477") == 0) {
+        // <nick> <channel> :<reason> - a JOIN we sent was refused
+        strtok_r(NULL, " ", &saveptr);
+        char *channel = strtok_r(NULL, " ", &saveptr);
+        if (channel) {
+            rejoin_channel_resolved(server, channel, false);
+        }
+    }
+    else if (strcmp(command, "321") == 0) {
+        chanlist_start(server);
+    }
+    else if (strcmp(command, "322") == 0) {
+        chanlist_add(server, params);
+    }
+    else if (strcmp(command, "323") == 0) {
+        chanlist_end(server);
+    }
+    else if (strcmp(command, "353") == 0) {
+        if (params) {
+            roster_handle_names(server, params);
+        }
+    }
+    else if (strcmp(command, "366") == 0) {
+        // End of NAMES
+        roster_notify(server);
     }
     else if (strcmp(command, "JOIN") == 0) {
         char *channel = strtok_r(NULL, " ", &saveptr);
         if (channel && prefix) {
-            char *nick = strtok(prefix, "!");
-            if (strcmp(nick, server->nick) == 0) {
+            char *nick_save;
+            char *nick = strtok_r(prefix, "!", &nick_save);
+            int server_idx = server->index;
+            
+            if (channel[0] == ':') channel++;
+            
+            if (plugin_wants(IRC_EVENT_JOIN)) {
+                irc_event_t event = { .type = IRC_EVENT_JOIN, .server_idx = server_idx,
+                                      .nick = nick, .channel = channel };
+                plugin_emit(&event);
+            }
+            
+            if (isupport_casecmp(&server->isupport, nick, server->nick) == 0) {
                 // We joined a channel
-                if (channel[0] == ':') channel++;
                 if (channel[0] == '#') channel++;
                 
-                int server_idx = server - client.servers;
                 add_channel_to_server(server_idx, channel, false);
+                
+                // NAMES follows and repopulates the roster
+                channel_info_t *joined = channel_get(server, find_channel(server, channel));
+                if (joined) {
+                    roster_clear(server, joined);
+                }
+                
+                rejoin_channel_resolved(server, channel, true);
                 log_message("INFO", "Joined channel #%s", channel);
+            } else {
+                int channel_idx = find_channel(server, channel);
+                // Netjoins are added, reported and refreshed as one batch
+                if (channel_idx >= 0 && !netsplit_handle_join(server, nick, channel_idx)) {
+                    char display_msg[MAX_MSG_LENGTH];
+                    
+                    roster_add(server, channel_idx, nick, 0);
+                    snprintf(display_msg, sizeof(display_msg), "%s *** %s has joined\n",
+                             get_timestamp(), nick);
+                    queue_channel_message(server_idx, channel_idx, display_msg);
+                    roster_notify(server);
+                }
             }
         }
     }
     else if (strcmp(command, "PART") == 0 || strcmp(command, "KICK") == 0) {
-        // Handle leaving channels
+        // PART <channel> [:reason] / KICK <channel> <victim> [:reason]
+        bool kick = command[0] == 'K';
         char *channel = strtok_r(NULL, " ", &saveptr);
-        if (channel && prefix) {
-            char *nick = strtok(prefix, "!");
-            if (strcmp(nick, server->nick) == 0) {
+        char *victim = kick ? strtok_r(NULL, " ", &saveptr) : NULL;
+        
+        if (channel && prefix && (!kick || victim)) {
+            char *nick_save;
+            char *nick = strtok_r(prefix, "!", &nick_save);
+            const char *leaving = kick ? victim : nick;
+            int server_idx = server->index;
+            
+            // A netjoiner still waiting for the batch leaves the roster too
+            netsplit_apply_joins(server);
+            if (channel[0] == ':') channel++;
+            
+            if (isupport_casecmp(&server->isupport, leaving, server->nick) == 0) {
                 // We left a channel - remove it from our list
-                if (channel[0] == ':') channel++;
                 if (channel[0] == '#') channel++;
                 
-                for (int i = 0; i < server->channel_count; i++) {
-                    if (!server->channels[i].is_private_msg && 
-                        strcmp(server->channels[i].name, channel) == 0) {
-                        // Remove channel (shift array)
-                        for (int j = i; j < server->channel_count - 1; j++) {
-                            server->channels[j] = server->channels[j + 1];
-                        }
-                        server->channel_count--;
-                        if (server->active_channel >= i) {
-                            server->active_channel--;
-                        }
-                        break;
-                    }
+                int i = find_channel(server, channel);
+                if (i >= 0) {
+                    // Frees the slot; other channels keep their indices
+                    channel_remove(server, i);
+                    core_channel_changed(server_idx, CHANNEL_ROW_REMOVE, i);
+                    config_mark_dirty(server);
                 }
                 log_message("INFO", "Left channel #%s", channel);
+            } else {
+                int channel_idx = find_channel(server, channel);
+                if (channel_idx >= 0 && roster_remove(server, channel_idx, leaving)) {
+                    char display_msg[MAX_MSG_LENGTH];
+                    if (kick) {
+                        snprintf(display_msg, sizeof(display_msg), "%s *** %s was kicked by %s\n",
+                                 get_timestamp(), leaving, nick);
+                    } else {
+                        snprintf(display_msg, sizeof(display_msg), "%s *** %s has left\n",
+                                 get_timestamp(), leaving);
+                    }
+                    queue_channel_message(server_idx, channel_idx, display_msg);
+                    roster_notify(server);
+                }
+            }
+        }
+    }
+    else if (strcmp(command, "QUIT") == 0) {
+        if (prefix) {
+            char *nick_save;
+            char *nick = strtok_r(prefix, "!", &nick_save);
+            const char *reason = params ? params : "";
+            if (reason[0] == ':') reason++;
+            
+            netsplit_apply_joins(server);
+            
+            // Netsplit QUITs are grouped and applied to the rosters in one batch
+            if (!netsplit_handle_quit(server, nick, reason)) {
+                int server_idx = server->index;
+                char display_msg[MAX_MSG_LENGTH];
+                bool removed = false;
+                
+                snprintf(display_msg, sizeof(display_msg), "%s *** %s has quit (%s)\n",
+                         get_timestamp(), nick, reason);
+                
+                for (int i = 0; i < server->channels.count; i++) {
+                    channel_info_t *channel = channel_get(server, i);
+                    if (channel && !channel->is_private_msg && roster_remove(server, i, nick)) {
+                        queue_channel_message(server_idx, i, display_msg);
+                        removed = true;
+                    }
+                }
+                
+                if (removed) roster_notify(server);
+            }
+        }
+    }
+    else if (strcmp(command, "NICK") == 0) {
+        char *new_nick = params;
+        if (new_nick && prefix) {
+            char *nick_save;
+            char *nick = strtok_r(prefix, "!", &nick_save);
+            int server_idx = server->index;
+            int channel_count = server->channels.count;
+            bool *in_channel = calloc(channel_count + 1, sizeof(bool));
+            
+            if (new_nick[0] == ':') new_nick++;
+            
+            netsplit_apply_joins(server);
+            
+            if (isupport_casecmp(&server->isupport, nick, server->nick) == 0) {
+                strncpy(server->nick, new_nick, MAX_NICK_LENGTH - 1);
+                server->nick[MAX_NICK_LENGTH - 1] = '\0';
+                config_mark_dirty(server);
+            }
+            
+            // Queries follow the nick
+            for (int i = 0; i < server->channels.count; i++) {
+                channel_info_t *channel = channel_get(server, i);
+                if (channel && channel->is_private_msg && isupport_casecmp(&server->isupport, channel->target_nick, nick) == 0) {
+                    pthread_mutex_lock(&client.gui_mutex);
+                    strncpy(channel->target_nick, new_nick, MAX_NICK_LENGTH - 1);
+                    channel->target_nick[MAX_NICK_LENGTH - 1] = '\0';
+                    pthread_mutex_unlock(&client.gui_mutex);
+                    channel_publish(server);
+                    core_channel_changed(server_idx, CHANNEL_ROW_RENAME, i);
+                    config_mark_dirty(server);
+                }
             }
+            
+            if (in_channel && roster_rename(server, nick, new_nick, in_channel, channel_count) > 0) {
+                char display_msg[MAX_MSG_LENGTH];
+                snprintf(display_msg, sizeof(display_msg), "%s *** %s is now known as %s\n",
+                         get_timestamp(), nick, new_nick);
+                
+                for (int i = 0; i < channel_count; i++) {
+                    if (in_channel[i]) queue_channel_message(server_idx, i, display_msg);
+                }
+                roster_notify(server);
+            }
+            free(in_channel);
         }
     }
     
     free(msg_copy);
 }
 
+// Everything a received line causes. Capture replay feeds lines in here too.
+void net_handle_line(server_info_t *server, const char *line) {
+    // Everything this line causes carries its ID, up to the buffer insert
+    uint64_t id = trace_new_id();
+    uint64_t span = trace_begin();
+    trace_set_current(id);
+    
+    char *converted = encoding_convert_line(server, line, strlen(line));
+    server->net_stats.lines++;
+    handle_irc_message(server, converted ? converted : line);
+    g_free(converted);
+    
+    trace_set_current(0);
+    trace_end("parse", span, id);
+}
+
+// Reads whatever is available; -1 with errno EAGAIN when nothing is
+ssize_t net_read(server_info_t *server, char *buf, size_t len) {
+    server->net_stats.rx_syscalls++;
+    return net_recv(server, buf, len);
+}
+
+// Sorts out a read that returned no data. Returns false when the connection
+// is over, with the state set to CONN_ERROR if it ended on its own.
+bool net_read_failed(server_info_t *server, ssize_t ret) {
+    if (ret < 0 && errno == EAGAIN) return true;
+    if (server->state != CONN_CONNECTED) return false;
+    
+    if (ret < 0) {
+#ifdef _WIN32
+        int error = WSAGetLastError();
+        log_message("ERROR", "recv() error: WSA error %d", error);
+#else
+        log_message("ERROR", "recv() error: %s", strerror(errno));
+#endif
+    } else {
+        log_message("INFO", "Server closed connection");
+    }
+    server->state = CONN_ERROR;
+    return false;
+}
+
+// Splits received bytes into lines and handles each; a partial line waits
+// in the server for the next read. Returns the number of lines handled.
+unsigned net_feed(server_info_t *server, const char *data, size_t len) {
+    unsigned lines = 0;
+    
+    server->net_stats.bytes += (uint64_t)len;
+    
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            server->rx_line[server->rx_pos] = '\0';
+            if (server->rx_pos > 0 && server->rx_line[server->rx_pos - 1] == '\r') {
+                server->rx_line[--server->rx_pos] = '\0';
+            }
+            
+            if (server->rx_pos > 0) {
+                capture_line(server, false, server->rx_line, server->rx_pos);
+                net_handle_line(server, server->rx_line);
+                lines++;
+            }
+            server->rx_pos = 0;
+        } else if (server->rx_pos < sizeof(server->rx_line) - 1) {
+            server->rx_line[server->rx_pos++] = data[i];
+        }
+    }
+    return lines;
+}
+
+// Timed work between reads: paced rejoins, netsplit reports and the lag
+// meter. Returns false when the lag meter gave up on the connection.
+bool net_tick(server_info_t *server) {
+    rejoin_tick(server);
+    netsplit_tick(server);
+    return lag_tick(server);
+}
+
+// How long the server can wait for data before net_tick() has work
+int net_poll_timeout(server_info_t *server, int timeout_ms) {
+    timeout_ms = rejoin_poll_timeout(server, timeout_ms);
+    return netsplit_poll_timeout(server, timeout_ms);
+}
+
 void* network_thread_func(void* arg) {
     int server_idx = *(int*)arg;
-    server_info_t *server = &client.servers[server_idx];
+    free(arg);
+    server_info_t *server = server_get(server_idx);
     char buffer[MAX_MSG_LENGTH];
-    char line_buffer[MAX_MSG_LENGTH * 2]; // For handling partial lines
-    size_t line_pos = 0;
+    char thread_name[32];
+    
+    snprintf(thread_name, sizeof(thread_name), "net %s", server->config.name);
+    trace_thread_name(thread_name);
     
     while (client.running && server->state == CONN_CONNECTED) {
-        ssize_t bytes_received = recv(server->sockfd, buffer, sizeof(buffer) - 1, 0);
+        int timeout = net_poll_timeout(server, NET_POLL_INTERVAL_MS);
+        const char *data = buffer;
+        ssize_t bytes_received;
+        uint64_t span = trace_begin();
         
-        if (bytes_received <= 0) {
-            if (bytes_received < 0) {
-#ifdef _WIN32
-                int error = WSAGetLastError();
-                log_message("ERROR", "recv() error: WSA error %d", error);
-#else
-                log_message("ERROR", "recv() error: %s", strerror(errno));
-#endif
-            } else {
-                log_message("INFO", "Server closed connection");
+        if (server->uring) {
+            // Waits and receives in one step, without copying
+            bytes_received = uring_recv(server, &data, timeout);
+            if (!net_tick(server)) break;
+        } else {
+            // Buffered TLS records never show up in poll()
+            if (!(server->ssl && tls_pending(server))) {
+                server->net_stats.rx_syscalls++;
+                int ready = net_wait_socket(server->sockfd, POLLIN, timeout);
+                if (!net_tick(server)) break;
+                if (ready == 0) continue;
             }
-            server->state = CONN_ERROR;
-            break;
+            
+            bytes_received = net_read(server, buffer, sizeof(buffer));
         }
+        trace_end("recv", span, 0);
         
-        buffer[bytes_received] = '\0';
-        
-        // Handle partial lines
-        for (ssize_t i = 0; i < bytes_received; i++) {
-            if (buffer[i] == '\n') {
-                line_buffer[line_pos] = '\0';
-                if (line_pos > 0 && line_buffer[line_pos - 1] == '\r') {
-                    line_buffer[line_pos - 1] = '\0';
-                }
-                
-                if (strlen(line_buffer) > 0) {
-                    handle_irc_message(server, line_buffer);
-                }
-                line_pos = 0;
-            } else if (line_pos < sizeof(line_buffer) - 1) {
-                line_buffer[line_pos++] = buffer[i];
-            }
+        if (bytes_received <= 0) {
+            if (net_read_failed(server, bytes_received)) continue;
+            break;
         }
+        
+        net_feed(server, data, (size_t)bytes_received);
     }
     
-    log_message("INFO", "Network thread for %s terminated", server->name);
-    server->network_thread = 0;
+    log_message("INFO", "Network thread for %s terminated", server->config.name);
+    
+    if (server->state == CONN_ERROR && client.running) {
+        reconnect_connection_lost(server);
+    }
     return NULL;
 }
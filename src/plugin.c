@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <dirent.h>
+    #include <dlfcn.h>
+#endif
+
+#define MAX_PLUGINS 16
+// Events waiting per plugin; beyond this new events are dropped for it
+#define PLUGIN_QUEUE_LENGTH 256
+// Room for all strings of one event
+#define PLUGIN_EVENT_DATA (MAX_MSG_LENGTH * 2)
+// A single handler call this slow is logged
+#define PLUGIN_SLOW_CALL_US 100000
+
+enum {
+    FIELD_SERVER_NAME,
+    FIELD_PREFIX,
+    FIELD_COMMAND,
+    FIELD_PARAMS,
+    FIELD_NICK,
+    FIELD_CHANNEL,
+    FIELD_LINE,
+    FIELD_COUNT
+};
+
+#define FIELD_NONE 0xffff
+
+// An event copied out of the emitting thread's stack
+typedef struct {
+    irc_event_type_t type;
+    int server_idx;
+    uint64_t timestamp_us;
+    uint16_t offsets[FIELD_COUNT];
+    char data[PLUGIN_EVENT_DATA];
+} plugin_record_t;
+
+typedef struct {
+    void *handle;
+    const irc_plugin_t *desc;
+    char path[MAX_PATH_LENGTH];
+
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    plugin_record_t *queue;
+    unsigned head;
+    unsigned count;
+    bool stopping;
+
+    // Guarded by mutex
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t slow_calls;
+} plugin_t;
+
+// OR of every loaded plugin's subscriptions; read without locking on the
+// hot path, written only while loading
+uint32_t plugin_event_mask = 0;
+
+static plugin_t plugins[MAX_PLUGINS];
+static int plugin_count = 0;
+
+static void api_send_raw(int server_idx, const char *line) {
+    char cmd[MAX_MSG_LENGTH];
+    size_t len = strlen(line);
+
+    if (server_idx < 0 || server_idx >= client.servers.count) return;
+
+    if (len >= 2 && strcmp(line + len - 2, "\r\n") == 0) {
+        snprintf(cmd, sizeof(cmd), "%s", line);
+    } else {
+        snprintf(cmd, sizeof(cmd), "%s\r\n", line);
+    }
+    send_irc_command(server_get(server_idx), cmd);
+}
+
+static void api_log(const char *level, const char *format, ...) {
+    char message[1024];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    log_message(level, "%s", message);
+}
+
+static const irc_plugin_api_t plugin_api = {
+    IRC_PLUGIN_ABI_VERSION,
+    api_send_raw,
+    api_log
+};
+
+static void record_pack(plugin_record_t *record, const irc_event_t *event) {
+    const char *fields[FIELD_COUNT] = {
+        event->server_name, event->prefix, event->command, event->params,
+        event->nick, event->channel, event->line
+    };
+    size_t used = 0;
+
+    record->type = event->type;
+    record->server_idx = event->server_idx;
+    record->timestamp_us = event->timestamp_us;
+
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (!fields[i] || used >= sizeof(record->data)) {
+            record->offsets[i] = FIELD_NONE;
+            continue;
+        }
+
+        // Truncate rather than drop; a line can never exceed MAX_MSG_LENGTH anyway
+        size_t len = strlen(fields[i]);
+        if (len > sizeof(record->data) - used - 1) len = sizeof(record->data) - used - 1;
+
+        memcpy(record->data + used, fields[i], len);
+        record->data[used + len] = '\0';
+        record->offsets[i] = (uint16_t)used;
+        used += len + 1;
+    }
+}
+
+static const char *record_field(const plugin_record_t *record, int field) {
+    return record->offsets[field] == FIELD_NONE ? NULL : record->data + record->offsets[field];
+}
+
+static void record_unpack(const plugin_record_t *record, irc_event_t *event) {
+    memset(event, 0, sizeof(irc_event_t));
+    event->type = record->type;
+    event->server_idx = record->server_idx;
+    event->timestamp_us = record->timestamp_us;
+    event->server_name = record_field(record, FIELD_SERVER_NAME);
+    event->prefix = record_field(record, FIELD_PREFIX);
+    event->command = record_field(record, FIELD_COMMAND);
+    event->params = record_field(record, FIELD_PARAMS);
+    event->nick = record_field(record, FIELD_NICK);
+    event->channel = record_field(record, FIELD_CHANNEL);
+    event->line = record_field(record, FIELD_LINE);
+}
+
+static void *plugin_worker(void *arg) {
+    plugin_t *plugin = arg;
+    plugin_record_t *record = malloc(sizeof(plugin_record_t));
+    irc_event_t event;
+
+    if (!record) return NULL;
+
+    pthread_mutex_lock(&plugin->mutex);
+    for (;;) {
+        while (plugin->count == 0 && !plugin->stopping) {
+            pthread_cond_wait(&plugin->cond, &plugin->mutex);
+        }
+        if (plugin->count == 0) break;
+
+        // Copy out so producers are never blocked behind the handler
+        memcpy(record, &plugin->queue[plugin->head], sizeof(plugin_record_t));
+        plugin->head = (plugin->head + 1) % PLUGIN_QUEUE_LENGTH;
+        plugin->count--;
+        pthread_mutex_unlock(&plugin->mutex);
+
+        record_unpack(record, &event);
+        uint64_t start = get_monotonic_us();
+        plugin->desc->handle_event(&event);
+        uint64_t elapsed = get_monotonic_us() - start;
+
+        if (elapsed >= PLUGIN_SLOW_CALL_US) {
+            log_message("WARNING", "Plugin %s took %.1f ms for one event",
+                       plugin->desc->name, elapsed / 1000.0);
+        }
+
+        pthread_mutex_lock(&plugin->mutex);
+        plugin->delivered++;
+        plugin->total_us += elapsed;
+        if (elapsed > plugin->max_us) plugin->max_us = elapsed;
+        if (elapsed >= PLUGIN_SLOW_CALL_US) plugin->slow_calls++;
+    }
+    pthread_mutex_unlock(&plugin->mutex);
+
+    free(record);
+    return NULL;
+}
+
+// Copies the event to the queue of every subscribed plugin. Callers check
+// plugin_wants() first, so unsubscribed events never get here.
+void plugin_emit(irc_event_t *event) {
+    plugin_record_t record;
+    server_info_t *server = server_get(event->server_idx);
+    if (server) event->server_name = server->config.name;
+    event->timestamp_us = get_monotonic_us();
+    record_pack(&record, event);
+
+    for (int i = 0; i < plugin_count; i++) {
+        plugin_t *plugin = &plugins[i];
+        if (!(plugin->desc->events & IRC_EVENT_MASK(event->type))) continue;
+
+        pthread_mutex_lock(&plugin->mutex);
+        if (plugin->count == PLUGIN_QUEUE_LENGTH) {
+            // A plugin that cannot keep up loses events, the network loop never waits
+            plugin->dropped++;
+        } else {
+            unsigned slot = (plugin->head + plugin->count) % PLUGIN_QUEUE_LENGTH;
+            memcpy(&plugin->queue[slot], &record, sizeof(plugin_record_t));
+            plugin->count++;
+            pthread_cond_signal(&plugin->cond);
+        }
+        pthread_mutex_unlock(&plugin->mutex);
+    }
+}
+
+#ifndef _WIN32
+static int plugin_load(const char *path) {
+    if (plugin_count >= MAX_PLUGINS) {
+        log_message("WARNING", "Too many plugins, skipping %s", path);
+        return -1;
+    }
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        log_message("ERROR", "Failed to load plugin %s: %s", path, dlerror());
+        return -1;
+    }
+
+    irc_plugin_register_fn register_fn;
+    // POSIX guarantees this conversion works for dlsym results
+    *(void **)&register_fn = dlsym(handle, IRC_PLUGIN_ENTRY);
+
+    const irc_plugin_t *desc = register_fn ? register_fn() : NULL;
+    if (!desc || desc->abi_version != IRC_PLUGIN_ABI_VERSION || !desc->handle_event || !desc->name) {
+        log_message("ERROR", "Plugin %s has no compatible %s", path, IRC_PLUGIN_ENTRY);
+        dlclose(handle);
+        return -1;
+    }
+
+    if (desc->init && desc->init(&plugin_api) != 0) {
+        log_message("ERROR", "Plugin %s refused to initialize", desc->name);
+        dlclose(handle);
+        return -1;
+    }
+
+    plugin_t *plugin = &plugins[plugin_count];
+    memset(plugin, 0, sizeof(plugin_t));
+    plugin->handle = handle;
+    plugin->desc = desc;
+    strncpy(plugin->path, path, MAX_PATH_LENGTH - 1);
+    plugin->queue = malloc(PLUGIN_QUEUE_LENGTH * sizeof(plugin_record_t));
+    pthread_mutex_init(&plugin->mutex, NULL);
+    pthread_cond_init(&plugin->cond, NULL);
+
+    if (!plugin->queue || pthread_create(&plugin->worker, NULL, plugin_worker, plugin) != 0) {
+        log_message("ERROR", "Failed to start worker for plugin %s", desc->name);
+        if (desc->shutdown) desc->shutdown();
+        free(plugin->queue);
+        pthread_mutex_destroy(&plugin->mutex);
+        pthread_cond_destroy(&plugin->cond);
+        dlclose(handle);
+        return -1;
+    }
+
+    plugin_count++;
+    plugin_event_mask |= desc->events;
+
+    log_message("INFO", "Loaded plugin %s from %s", desc->name, path);
+    return 0;
+}
+
+// Loads every *.so in dir; a missing directory just means no plugins
+void plugin_load_all(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+
+    if (!d) return;
+
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 3, ".so") != 0) continue;
+
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        plugin_load(path);
+    }
+
+    closedir(d);
+}
+#else
+void plugin_load_all(const char *dir) {
+    (void)dir;
+    log_message("INFO", "Plugins are not supported on Windows yet");
+}
+#endif
+
+void plugin_unload_all(void) {
+    // Nothing is emitted once the mask is clear
+    plugin_event_mask = 0;
+
+    for (int i = 0; i < plugin_count; i++) {
+        plugin_t *plugin = &plugins[i];
+
+        pthread_mutex_lock(&plugin->mutex);
+        plugin->stopping = true;
+        pthread_cond_signal(&plugin->cond);
+        pthread_mutex_unlock(&plugin->mutex);
+
+        // The worker drains what is queued before it exits
+        pthread_join(plugin->worker, NULL);
+
+        if (plugin->desc->shutdown) plugin->desc->shutdown();
+
+        free(plugin->queue);
+        pthread_mutex_destroy(&plugin->mutex);
+        pthread_cond_destroy(&plugin->cond);
+#ifndef _WIN32
+        dlclose(plugin->handle);
+#endif
+    }
+
+    plugin_count = 0;
+}
+
+int plugin_get_count(void) {
+    return plugin_count;
+}
+
+void plugin_format_stats(int idx, char *buf, size_t len) {
+    plugin_t *plugin = &plugins[idx];
+
+    pthread_mutex_lock(&plugin->mutex);
+    snprintf(buf, len,
+             "%s Plugin %s: %llu events, %.1f ms total, %.1f us avg, %.1f ms worst, %llu slow, %llu dropped, %u queued\n",
+             get_timestamp(), plugin->desc->name,
+             (unsigned long long)plugin->delivered, plugin->total_us / 1000.0,
+             plugin->delivered ? (double)plugin->total_us / plugin->delivered : 0.0,
+             plugin->max_us / 1000.0, (unsigned long long)plugin->slow_calls,
+             (unsigned long long)plugin->dropped, plugin->count);
+    pthread_mutex_unlock(&plugin->mutex);
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+#include "client.h"
+
+#define RECONNECT_BASE_MS 2000
+#define RECONNECT_MAX_MS 300000
+#define REJOIN_INTERVAL_MS 1000
+
+static uint32_t jitter_state = 0;
+
+// xorshift32; only used to spread reconnects, so quality barely matters
+static uint32_t jitter_next(void) {
+    if (jitter_state == 0) {
+        jitter_state = (uint32_t)get_monotonic_us() ^ (uint32_t)time(NULL);
+#ifndef _WIN32
+        jitter_state ^= (uint32_t)getpid() << 16;
+#endif
+        if (jitter_state == 0) jitter_state = 0x9e3779b9;
+    }
+
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 17;
+    jitter_state ^= jitter_state << 5;
+    return jitter_state;
+}
+
+// Exponential backoff with "equal jitter": half the delay is fixed so a
+// client never hammers the server, the other half is random so a fleet of
+// clients dropped by the same outage does not come back in lockstep.
+static unsigned reconnect_delay_ms(unsigned attempts) {
+    unsigned delay = RECONNECT_BASE_MS;
+
+    while (attempts-- > 0 && delay < RECONNECT_MAX_MS) {
+        delay *= 2;
+    }
+    if (delay > RECONNECT_MAX_MS) delay = RECONNECT_MAX_MS;
+
+    return delay / 2 + jitter_next() % (delay / 2 + 1);
+}
+
+static void append_to_all_channels(int server_idx, const char *message) {
+    server_info_t *server = server_get(server_idx);
+
+    for (int i = 0; i < server->channels.count; i++) {
+        core_append_line(server_idx, i, message, ACTIVITY_EVENT);
+    }
+}
+
+static gboolean reconnect_timer_cb(gpointer data) {
+    int server_idx = GPOINTER_TO_INT(data);
+    server_info_t *server = server_get(server_idx);
+
+    server->reconnect.timer_id = 0;
+    if (!client.running || server->state == CONN_CONNECTED) return FALSE;
+
+    log_message("INFO", "Reconnecting to %s (attempt %u)", server->config.name, server->reconnect.attempts);
+
+    if (start_server_connection(server_idx) < 0) {
+        reconnect_schedule(server);
+    }
+
+    return FALSE;
+}
+
+static gboolean connection_lost_cb(gpointer data) {
+    int server_idx = GPOINTER_TO_INT(data);
+    server_info_t *server = server_get(server_idx);
+
+    // A manual disconnect may have raced with the failure
+    if (server->state != CONN_ERROR) return FALSE;
+
+    close_server_connection(server);
+    netsplit_reset(server);
+
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (!channel) continue;
+        channel->rejoin_state = REJOIN_NONE;
+        roster_clear(server, channel);
+    }
+    roster_notify(server);
+
+    if (client.running && server->config.auto_reconnect) {
+        reconnect_schedule(server);
+    } else {
+        char note[MAX_MSG_LENGTH];
+        snprintf(note, sizeof(note), "%s *** Connection lost\n", get_timestamp());
+        append_to_all_channels(server_idx, note);
+    }
+
+    return FALSE;
+}
+
+// Called from the network thread when the link drops on its own
+void reconnect_connection_lost(server_info_t *server) {
+    int server_idx = server->index;
+
+    server->reconnect.rejoining = false;
+    if (server->reconnect.lost_at_us == 0) {
+        server->reconnect.lost_at_us = get_monotonic_us();
+    }
+
+    g_idle_add(connection_lost_cb, GINT_TO_POINTER(server_idx));
+}
+
+void reconnect_schedule(server_info_t *server) {
+    int server_idx = server->index;
+
+    if (server->reconnect.timer_id) return;
+
+    unsigned delay = reconnect_delay_ms(server->reconnect.attempts++);
+    server->reconnect.timer_id = g_timeout_add(delay, reconnect_timer_cb, GINT_TO_POINTER(server_idx));
+
+    char note[MAX_MSG_LENGTH];
+    snprintf(note, sizeof(note), "%s *** Connection lost, reconnecting in %.1f s\n",
+             get_timestamp(), delay / 1000.0);
+    append_to_all_channels(server_idx, note);
+
+    log_message("INFO", "Reconnect to %s scheduled in %u ms", server->config.name, delay);
+}
+
+void reconnect_cancel(server_info_t *server) {
+    if (server->reconnect.timer_id) {
+        g_source_remove(server->reconnect.timer_id);
+        server->reconnect.timer_id = 0;
+    }
+
+    server->reconnect.attempts = 0;
+    server->reconnect.lost_at_us = 0;
+}
+
+void reconnect_now(server_info_t *server) {
+    if (server->reconnect.timer_id) {
+        g_source_remove(server->reconnect.timer_id);
+        server->reconnect.timer_id = 0;
+    }
+
+    server->reconnect.attempts = 0;
+    reconnect_timer_cb(GINT_TO_POINTER(server->index));
+}
+
+static void rejoin_finish(server_info_t *server) {
+    reconnect_state_t *rc = &server->reconnect;
+
+    rc->rejoining = false;
+
+    if (rc->lost_at_us) {
+        rc->last_rejoin_us = get_monotonic_us() - rc->lost_at_us;
+        if (rc->last_rejoin_us > rc->max_rejoin_us) rc->max_rejoin_us = rc->last_rejoin_us;
+        rc->lost_at_us = 0;
+
+        log_message("INFO", "Fully rejoined %s %.2f s after the link was lost",
+                   server->config.name, rc->last_rejoin_us / 1000000.0);
+    }
+}
+
+// Called from the network thread on 001. Queues every channel we should be
+// in; rejoin_tick() then sends them as packed JOIN lines at a paced rate.
+void rejoin_start(server_info_t *server) {
+    reconnect_state_t *rc = &server->reconnect;
+    int server_idx = server->index;
+    int queued = 0;
+
+    rc->attempts = 0;
+
+    if (rc->lost_at_us) {
+        rc->reconnects++;
+        rc->last_reconnect_us = get_monotonic_us() - rc->lost_at_us;
+        if (rc->last_reconnect_us > rc->max_reconnect_us) rc->max_reconnect_us = rc->last_reconnect_us;
+
+        log_message("INFO", "Reconnected to %s %.2f s after the link was lost",
+                   server->config.name, rc->last_reconnect_us / 1000000.0);
+    }
+
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (!channel) continue;
+
+        if (rc->lost_at_us) {
+            // Queries and DMs keep their buffers; just mark the gap
+            char note[MAX_MSG_LENGTH];
+            snprintf(note, sizeof(note), "%s *** Reconnected\n", get_timestamp());
+            queue_channel_message(server_idx, i, note);
+        }
+
+        if (!channel->is_private_msg && channel->active) {
+            channel->rejoin_state = REJOIN_QUEUED;
+            queued++;
+        }
+    }
+
+    if (server->isupport.chanlimit > 0 && queued > server->isupport.chanlimit) {
+        log_message("WARNING", "%s allows %d channels, %d queued for joining",
+                   server->config.name, server->isupport.chanlimit, queued);
+    }
+
+    rc->rejoin_outstanding = queued;
+    rc->next_rejoin_us = 0;
+    rc->rejoining = true;
+
+    if (queued == 0) {
+        rejoin_finish(server);
+    } else {
+        rejoin_tick(server);
+    }
+}
+
+// Sends the next packed JOIN line once the pacing interval has elapsed
+void rejoin_tick(server_info_t *server) {
+    reconnect_state_t *rc = &server->reconnect;
+
+    if (!rc->rejoining || server->state != CONN_CONNECTED) return;
+
+    uint64_t now = get_monotonic_us();
+    if (now < rc->next_rejoin_us) return;
+
+    // More names than fit on one line are left for later ticks
+    char names[MAX_BATCH_TARGETS][MAX_CHANNEL_LENGTH + 1];
+    const char *targets[MAX_BATCH_TARGETS];
+    int indices[MAX_BATCH_TARGETS];
+    int count = 0;
+
+    for (int i = 0; i < server->channels.count && count < MAX_BATCH_TARGETS; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (!channel || channel->rejoin_state != REJOIN_QUEUED) continue;
+
+        snprintf(names[count], sizeof(names[count]), "#%s", channel->name);
+        targets[count] = names[count];
+        indices[count] = i;
+        count++;
+    }
+
+    if (count == 0) return;
+
+    // One line per tick, packed up to TARGMAX and the server's line length
+    char cmd[MAX_MSG_LENGTH];
+    int used = isupport_pack_targets(&server->isupport, "JOIN", targets, count, NULL, cmd, sizeof(cmd));
+    if (used == 0) {
+        // A name that can never fit gets no reply to wait for either
+        channel_get(server, indices[0])->rejoin_state = REJOIN_FAILED;
+        log_message("WARNING", "JOIN %s does not fit in one line on %s, not rejoining",
+                   targets[0], server->config.name);
+        if (--rc->rejoin_outstanding <= 0) {
+            rejoin_finish(server);
+        }
+        return;
+    }
+
+    send_irc_command(server, cmd);
+    for (int i = 0; i < used; i++) {
+        channel_get(server, indices[i])->rejoin_state = REJOIN_SENT;
+    }
+
+    rc->next_rejoin_us = now + (uint64_t)REJOIN_INTERVAL_MS * 1000;
+}
+
+// Shortens the network thread's poll timeout while a rejoin batch is due
+int rejoin_poll_timeout(server_info_t *server, int timeout_ms) {
+    reconnect_state_t *rc = &server->reconnect;
+
+    if (!rc->rejoining) return timeout_ms;
+
+    uint64_t now = get_monotonic_us();
+    if (now >= rc->next_rejoin_us) return 0;
+
+    uint64_t wait_ms = (rc->next_rejoin_us - now) / 1000 + 1;
+    return wait_ms < (uint64_t)timeout_ms ? (int)wait_ms : timeout_ms;
+}
+
+// A channel we asked for was joined, or refused (full, banned, invite-only...)
+void rejoin_channel_resolved(server_info_t *server, const char *channel_name, bool joined) {
+    reconnect_state_t *rc = &server->reconnect;
+
+    if (!rc->rejoining) return;
+    if (channel_name[0] == '#') channel_name++;
+
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+
+        if (channel && !channel->is_private_msg &&
+            (channel->rejoin_state == REJOIN_QUEUED || channel->rejoin_state == REJOIN_SENT) &&
+            isupport_casecmp(&server->isupport, channel->name, channel_name) == 0) {
+            channel->rejoin_state = REJOIN_NONE;
+            if (!joined) {
+                log_message("WARNING", "Could not rejoin #%s on %s", channel_name, server->config.name);
+            }
+            if (--rc->rejoin_outstanding <= 0) {
+                rejoin_finish(server);
+            }
+            return;
+        }
+    }
+}
+
+void reconnect_format_stats(server_info_t *server, char *buf, size_t len) {
+    reconnect_state_t *rc = &server->reconnect;
+
+    if (rc->reconnects == 0) {
+        snprintf(buf, len, "%s Reconnect: no reconnects to %s\n", get_timestamp(), server->config.name);
+        return;
+    }
+
+    snprintf(buf, len,
+             "%s Reconnect: %u reconnects, last %.2f s to log in / %.2f s to rejoin, worst %.2f s / %.2f s\n",
+             get_timestamp(), rc->reconnects,
+             rc->last_reconnect_us / 1000000.0, rc->last_rejoin_us / 1000000.0,
+             rc->max_reconnect_us / 1000000.0, rc->max_rejoin_us / 1000000.0);
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Server and channel registries. Both are slots_t arrays, so a server or
+// channel never moves once it exists: network threads keep plain pointers,
+// and removing a channel frees its slot for the next one instead of
+// shifting every index after it. Queued GUI updates carry the channel's
+// generation along with its index and are dropped once it was removed.
+//
+// Channels are written by network threads. The GTK thread reads names and
+// kinds from snapshots instead: channel_publish() copies the channel set
+// and the ISUPPORT tables into a fresh immutable array and swaps the
+// pointer, and the old array is freed from an idle callback. The main loop
+// running that callback means every reader has returned, so readers take
+// no lock and never wait. Rosters, scrollback and pending lines are not
+// in the snapshot; both sides still reach them under client.gui_mutex.
+
+void slots_init(slots_t *slots, size_t elem_size) {
+    memset(slots, 0, sizeof(slots_t));
+    slots->elem_size = elem_size;
+}
+
+// Segment k starts at index SLOTS_BASE * (2^k - 1)
+static void slots_locate(int idx, int *segment, int *offset) {
+    unsigned n = (unsigned)idx / SLOTS_BASE + 1;
+    int k = 0;
+
+    while (n >> (k + 1)) k++;
+    *segment = k;
+    *offset = idx - SLOTS_BASE * ((1 << k) - 1);
+}
+
+void *slots_at(const slots_t *slots, int idx) {
+    int segment, offset;
+
+    if (idx < 0 || idx >= slots->count) return NULL;
+
+    slots_locate(idx, &segment, &offset);
+    return (char*)slots->segments[segment] + (size_t)offset * slots->elem_size;
+}
+
+// Grows by one slot. Fresh slots are zeroed.
+static int slots_grow(slots_t *slots) {
+    int segment, offset;
+
+    slots_locate(slots->count, &segment, &offset);
+    if (segment >= SLOTS_SEGMENTS) return -1;
+
+    if (!slots->segments[segment]) {
+        slots->segments[segment] = calloc((size_t)SLOTS_BASE << segment, slots->elem_size);
+        if (!slots->segments[segment]) return -1;
+    }
+    return slots->count++;
+}
+
+// Returns a free index: a released one if any, or a new one. Released
+// slots keep their old contents. Returns -1 when out of memory.
+int slots_acquire(slots_t *slots) {
+    if (slots->free_count > 0) return slots->free_list[--slots->free_count];
+    return slots_grow(slots);
+}
+
+void slots_release(slots_t *slots, int idx) {
+    if (slots->free_count == slots->free_capacity) {
+        int capacity = slots->free_capacity ? slots->free_capacity * 2 : 16;
+        int *list = realloc(slots->free_list, capacity * sizeof(int));
+        if (!list) return; // Only costs the slot's reuse
+        slots->free_list = list;
+        slots->free_capacity = capacity;
+    }
+    slots->free_list[slots->free_count++] = idx;
+}
+
+// Takes a specific index, for mirrors that must match another process's
+// numbering. Returns false if it is out of memory or already taken.
+bool slots_claim(slots_t *slots, int idx) {
+    while (slots->count <= idx) {
+        int grown = slots_grow(slots);
+        if (grown < 0) return false;
+        if (grown < idx) slots_release(slots, grown);
+        if (grown == idx) return true;
+    }
+
+    for (int i = 0; i < slots->free_count; i++) {
+        if (slots->free_list[i] == idx) {
+            slots->free_list[i] = slots->free_list[--slots->free_count];
+            return true;
+        }
+    }
+    return false;
+}
+
+server_info_t *server_get(int server_idx) {
+    return slots_at(&client.servers, server_idx);
+}
+
+// Appends a server with default settings. GTK/main loop thread only.
+server_info_t *server_add(void) {
+    int idx = slots_acquire(&client.servers);
+    if (idx < 0) {
+        log_message("ERROR", "Out of memory adding a server");
+        return NULL;
+    }
+
+    server_info_t *server = server_get(idx);
+    init_server(server);
+    server->index = idx;
+    return server;
+}
+
+// NULL unless channel_idx names a channel that exists
+channel_info_t *channel_get(server_info_t *server, int channel_idx) {
+    channel_info_t *channel = slots_at(&server->channels, channel_idx);
+    return channel && channel->in_use ? channel : NULL;
+}
+
+// What a handle to this channel index carries right now
+uint32_t channel_generation(server_info_t *server, int channel_idx) {
+    channel_info_t *channel = slots_at(&server->channels, channel_idx);
+    return channel ? channel->generation : 0;
+}
+
+// Whether a handle taken earlier still names the same channel
+bool channel_current(server_info_t *server, int channel_idx, uint32_t generation) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+    return channel && channel->generation == generation;
+}
+
+// Same as channel_alloc(), for callers that hold client.gui_mutex so they
+// can look for an existing channel and fill in the new one atomically
+int channel_alloc_locked(server_info_t *server, int channel_idx) {
+    if (channel_idx < 0) {
+        channel_idx = slots_acquire(&server->channels);
+    } else if (!slots_claim(&server->channels, channel_idx)) {
+        channel_idx = -1;
+    }
+
+    if (channel_idx >= 0) {
+        channel_info_t *channel = slots_at(&server->channels, channel_idx);
+        uint32_t generation = channel->generation;
+
+        memset(channel, 0, sizeof(channel_info_t));
+        channel->generation = generation;
+        channel->in_use = true;
+    }
+    return channel_idx;
+}
+
+// Takes a free channel slot, or exactly channel_idx if it is not -1, and
+// resets it for the caller to fill in. Returns the index or -1.
+int channel_alloc(server_info_t *server, int channel_idx) {
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_idx = channel_alloc_locked(server, channel_idx);
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    if (channel_idx < 0) log_message("ERROR", "Out of memory adding a channel to %s", server->config.name);
+    return channel_idx;
+}
+
+static gboolean buffer_unref_cb(gpointer data) {
+    g_object_unref(data);
+    return FALSE;
+}
+
+// Frees a channel in O(1); later channels keep their indices. The GTK
+// thread clears active_channel when it removes the row.
+void channel_remove(server_info_t *server, int channel_idx) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+    if (!channel) return;
+
+    roster_clear(server, channel);
+
+    pthread_mutex_lock(&client.gui_mutex);
+    GtkTextBuffer *buffer = channel->ui.buffer;
+    channel->ui.buffer = NULL;
+    discard_pending_lines(channel);
+    scrollback_free(&channel->scrollback);
+    channel->in_use = false;
+    channel->generation++;
+    slots_release(&server->channels, channel_idx);
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    // This may be a network thread; GTK objects are released on the GTK one
+    if (buffer) g_idle_add(buffer_unref_cb, buffer);
+    channel_publish(server);
+}
+
+static gboolean snapshot_free_cb(gpointer data) {
+    free(data);
+    return FALSE;
+}
+
+// Publishes the server's channels for the GTK thread. Call after adding or
+// removing a channel or changing its name, before telling the GUI, and
+// after a 005 changed the ISUPPORT tables.
+void channel_publish(server_info_t *server) {
+    pthread_mutex_lock(&client.gui_mutex);
+
+    int live = 0;
+    for (int i = 0; i < server->channels.count; i++) {
+        if (channel_get(server, i)) live++;
+    }
+
+    server_snapshot_t *snapshot = malloc(sizeof(server_snapshot_t) + (size_t)live * sizeof(channel_view_t));
+    if (!snapshot) {
+        pthread_mutex_unlock(&client.gui_mutex);
+        log_message("ERROR", "Out of memory publishing the channels of %s", server->config.name);
+        return;
+    }
+
+    snapshot->isupport = server->isupport;
+    snapshot->count = 0;
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (!channel) continue;
+
+        channel_view_t *view = &snapshot->channels[snapshot->count++];
+        view->index = i;
+        view->generation = channel->generation;
+        view->is_private_msg = channel->is_private_msg;
+        memcpy(view->name, channel->name, sizeof(view->name));
+        memcpy(view->target_nick, channel->target_nick, sizeof(view->target_nick));
+    }
+    snapshot->version = ++server->snapshot_version;
+
+    server_snapshot_t *old = server->snapshot;
+    g_atomic_pointer_set(&server->snapshot, snapshot);
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    if (old) g_idle_add(snapshot_free_cb, old);
+}
+
+// The server's latest published channels. Main loop thread only, and only
+// until the current callback returns.
+const server_snapshot_t *server_snapshot(server_info_t *server) {
+    static const server_snapshot_t empty;
+    const server_snapshot_t *snapshot = g_atomic_pointer_get(&server->snapshot);
+    return snapshot ? snapshot : &empty;
+}
+
+// A channel of a snapshot by index, or NULL
+const channel_view_t *snapshot_channel(const server_snapshot_t *snapshot, int channel_idx) {
+    int lo = 0;
+    int hi = snapshot->count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (snapshot->channels[mid].index < channel_idx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < snapshot->count && snapshot->channels[lo].index == channel_idx ? &snapshot->channels[lo] : NULL;
+}
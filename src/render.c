@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+// Text insertion is spread over frames: each frame spends at most this long
+// inserting queued lines, then scrolls at most once.
+#define FRAME_INSERT_BUDGET_US 4000
+// Lines inserted between clock checks
+#define INSERT_CHECK_INTERVAL 16
+// Drain cadence while no frame clock drives the chat view
+#define UNMAPPED_DRAIN_MS 50
+// A tick callback silent for this long is not coming: a minimised window
+// stays mapped, but on Wayland its frame clock stops
+#define STALLED_TICK_US (250 * 1000)
+// How close to the bottom still counts as following the conversation
+#define PINNED_SLACK_PX 8.0
+// Lines put back at the top each time the view is scrolled to it
+#define PAGE_IN_LINES 200
+// Lines a buffer may run past its resident scrollback before it is trimmed
+#define TRIM_SLACK_LINES 64
+
+static guint tick_id = 0;
+static guint fallback_id = 0;
+static gint64 last_tick_us = 0;
+static int pending_total = 0;
+static int unseen_lines = 0;
+static guint page_in_id = 0;
+
+GtkTextBuffer *create_channel_buffer(void) {
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    GtkTextIter end;
+
+    // Right gravity keeps the mark after everything we append, so scrolling
+    // to it never needs the insert cursor or an iterator walk
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gtk_text_buffer_create_mark(buffer, "end", &end, FALSE);
+
+    return buffer;
+}
+
+// A channel's buffer, created on first use so that network threads adding
+// channels never call into GTK. GTK thread, with client.gui_mutex held.
+GtkTextBuffer *channel_buffer(channel_info_t *channel) {
+    if (!channel->ui.buffer) channel->ui.buffer = create_channel_buffer();
+    return channel->ui.buffer;
+}
+
+// Drops buffer lines older than the channel's resident scrollback, once at
+// least min_lines are, so buffers keep to the scrollback budget too. GTK
+// thread, with client.gui_mutex held; for the channel on screen only while
+// it is pinned to the bottom.
+void channel_trim_buffer(channel_info_t *channel, int min_lines) {
+    GtkTextBuffer *buffer = channel->ui.buffer;
+    uint64_t resident = scrollback_resident_seq(&channel->scrollback);
+    if (!buffer || resident < channel->ui.first_seq + (uint64_t)min_lines) return;
+
+    // Lines still queued are not in the buffer yet
+    int lines = (int)(resident - channel->ui.first_seq);
+    int in_buffer = gtk_text_buffer_get_line_count(buffer) - 1;
+    if (lines > in_buffer) lines = in_buffer;
+    if (lines <= 0) return;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_get_iter_at_line(buffer, &end, lines);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    channel->ui.first_seq += (uint64_t)lines;
+}
+
+// Puts older lines back at the top of a channel's buffer, from memory or
+// its spill segment, down to seq. The view stays on what it showed. GTK
+// thread, with client.gui_mutex held.
+void channel_page_in(channel_info_t *channel, uint64_t seq) {
+    scrollback_t *sb = &channel->scrollback;
+    uint64_t first = scrollback_first_seq(sb);
+    GtkTextBuffer *buffer = channel->ui.buffer;
+
+    if (seq < first) seq = first;
+    if (!buffer || seq >= channel->ui.first_seq) return;
+
+    GByteArray *text = g_byte_array_new();
+    for (uint64_t s = seq; s < channel->ui.first_seq; s++) {
+        const char *line = scrollback_get(sb, s);
+        // A line that cannot be read still takes its place
+        if (!line) line = "\n";
+        g_byte_array_append(text, (const guint8 *)line, (guint)strlen(line));
+    }
+
+    GtkTextIter start;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    // Right gravity: the mark stays on the old first line
+    GtkTextMark *mark = gtk_text_buffer_create_mark(buffer, NULL, &start, FALSE);
+    gtk_text_buffer_insert(buffer, &start, (const gchar *)text->data, (gint)text->len);
+    g_byte_array_free(text, TRUE);
+
+    sb->paged_in += channel->ui.first_seq - seq;
+    channel->ui.first_seq = seq;
+
+    if (gtk_text_view_get_buffer(GTK_TEXT_VIEW(client.chat_area)) == buffer) {
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(client.chat_area), mark, 0.0, TRUE, 0.0, 0.0);
+    }
+    gtk_text_buffer_delete_mark(buffer, mark);
+}
+
+static gboolean page_in_cb(gpointer data) {
+    (void)data;
+    page_in_id = 0;
+    if (client.active_server < 0) return FALSE;
+
+    server_info_t *server = server_get(client.active_server);
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, server->active_channel);
+    if (channel) {
+        uint64_t first = channel->ui.first_seq;
+        channel_page_in(channel, first > PAGE_IN_LINES ? first - PAGE_IN_LINES : 0);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+    return FALSE;
+}
+
+static GtkAdjustment *chat_vadjustment(void) {
+    return gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(client.chat_scrolled));
+}
+
+static bool chat_is_pinned(void) {
+    GtkAdjustment *adj = chat_vadjustment();
+    double bottom = gtk_adjustment_get_upper(adj) - gtk_adjustment_get_page_size(adj);
+    return gtk_adjustment_get_value(adj) >= bottom - PINNED_SLACK_PX;
+}
+
+static void update_new_lines_indicator(void) {
+    if (unseen_lines == 0) {
+        gtk_widget_hide(client.new_lines_button);
+        return;
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "%d new %s", unseen_lines, unseen_lines == 1 ? "line" : "lines");
+    gtk_button_set_label(GTK_BUTTON(client.new_lines_button), label);
+    gtk_widget_show(client.new_lines_button);
+}
+
+void scroll_chat_to_end(void) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(client.chat_area));
+    GtkTextMark *end = gtk_text_buffer_get_mark(buffer, "end");
+
+    if (end) {
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(client.chat_area), end, 0.0, FALSE, 0.0, 1.0);
+    }
+
+    unseen_lines = 0;
+    update_new_lines_indicator();
+}
+
+static void on_new_lines_clicked(GtkButton *button, gpointer data) {
+    (void)button;
+    (void)data;
+    scroll_chat_to_end();
+}
+
+static void on_chat_scrolled(GtkAdjustment *adj, gpointer data) {
+    (void)data;
+
+    // At the top: bring back what was trimmed, after this signal is done
+    if (gtk_adjustment_get_value(adj) <= PINNED_SLACK_PX && !page_in_id) {
+        page_in_id = g_idle_add(page_in_cb, NULL);
+    }
+
+    // Reaching the bottom by hand counts as having read everything
+    if (unseen_lines > 0 && chat_is_pinned()) {
+        unseen_lines = 0;
+        update_new_lines_indicator();
+    }
+}
+
+void init_render(void) {
+    g_signal_connect(client.new_lines_button, "clicked", G_CALLBACK(on_new_lines_clicked), NULL);
+    g_signal_connect(chat_vadjustment(), "value-changed", G_CALLBACK(on_chat_scrolled), NULL);
+}
+
+// Inserts queued lines of one channel until the deadline. Returns the
+// number inserted.
+static int drain_channel(channel_info_t *channel, gint64 deadline) {
+    GtkTextIter iter;
+    int inserted = 0;
+
+    if (!channel->pending_head) return 0;
+
+    GtkTextBuffer *buffer = channel_buffer(channel);
+    gtk_text_buffer_get_end_iter(buffer, &iter);
+
+    while (channel->pending_head) {
+        pending_line_t *line = channel->pending_head;
+        uint64_t span = trace_begin();
+
+        // Inserting at an iterator revalidates it to the end of the new text
+        gtk_text_buffer_insert(buffer, &iter, line->text, -1);
+        trace_end("insert", span, line->trace_id);
+
+        channel->pending_head = line->next;
+        channel->pending_count--;
+        pending_total--;
+        free(line);
+        inserted++;
+
+        if (inserted % INSERT_CHECK_INTERVAL == 0 && g_get_monotonic_time() >= deadline) break;
+    }
+
+    if (!channel->pending_head) channel->pending_tail = NULL;
+    return inserted;
+}
+
+// One frame's worth of insertion: the visible channel first, then the rest.
+// Returns true while lines remain queued.
+static bool drain_pending(void) {
+    gint64 deadline = g_get_monotonic_time() + FRAME_INSERT_BUDGET_US;
+    uint64_t span = trace_begin();
+    const char *mark = watchdog_enter("drain");
+    int visible_inserted = 0;
+    bool pinned = false;
+
+    pthread_mutex_lock(&client.gui_mutex);
+
+    if (client.active_server >= 0) {
+        server_info_t *server = server_get(client.active_server);
+        channel_info_t *channel = channel_get(server, server->active_channel);
+        if (channel && channel->pending_head) {
+            // Sample before inserting: the adjustment still describes what the user sees
+            pinned = chat_is_pinned();
+            visible_inserted = drain_channel(channel, deadline);
+            // Only text above a view at the bottom can go unnoticed
+            if (pinned) channel_trim_buffer(channel, TRIM_SLACK_LINES);
+        }
+    }
+
+    for (int s = 0; s < client.servers.count && g_get_monotonic_time() < deadline; s++) {
+        server_info_t *server = server_get(s);
+        for (int c = 0; c < server->channels.count && g_get_monotonic_time() < deadline; c++) {
+            channel_info_t *channel = channel_get(server, c);
+            if (channel && drain_channel(channel, deadline) > 0 &&
+                (s != client.active_server || c != server->active_channel)) {
+                channel_trim_buffer(channel, TRIM_SLACK_LINES);
+            }
+        }
+    }
+
+    bool remaining = pending_total > 0;
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    if (visible_inserted > 0) {
+        if (pinned) {
+            // A single scroll per frame, however many lines went in
+            GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(client.chat_area));
+            gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(client.chat_area),
+                                         gtk_text_buffer_get_mark(buffer, "end"), 0.0, FALSE, 0.0, 1.0);
+        } else {
+            // Text only grows below the viewport, so the reading position holds
+            unseen_lines += visible_inserted;
+            update_new_lines_indicator();
+        }
+    }
+
+    watchdog_leave(mark);
+    trace_end("drain", span, 0);
+    return remaining;
+}
+
+static gboolean drain_tick_cb(GtkWidget *widget, GdkFrameClock *clock, gpointer data) {
+    (void)widget;
+    (void)clock;
+    (void)data;
+
+    last_tick_us = g_get_monotonic_time();
+    if (drain_pending()) return G_SOURCE_CONTINUE;
+
+    tick_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// Drains while there is no tick callback, or while it has stopped firing;
+// armed next to every tick callback so queued lines never pile up
+static gboolean drain_fallback_cb(gpointer data) {
+    (void)data;
+
+    if (tick_id && g_get_monotonic_time() - last_tick_us < STALLED_TICK_US) return TRUE;
+    if (drain_pending()) return TRUE;
+
+    fallback_id = 0;
+    return FALSE;
+}
+
+static void schedule_drain(void) {
+    // Tick callbacks never run while the view is unmapped
+    if (!tick_id && gtk_widget_get_mapped(client.chat_area)) {
+        tick_id = gtk_widget_add_tick_callback(client.chat_area, drain_tick_cb, NULL, NULL);
+        last_tick_us = g_get_monotonic_time();
+    }
+    if (!fallback_id) {
+        fallback_id = g_timeout_add(UNMAPPED_DRAIN_MS, drain_fallback_cb, NULL);
+    }
+}
+
+void append_message_to_channel(int server_idx, int channel_idx, const char *message) {
+    server_info_t *server = server_get(server_idx);
+    if (!server || !channel_get(server, channel_idx)) return;
+
+    size_t len = strlen(message);
+    pending_line_t *line = malloc(sizeof(pending_line_t) + len + 1);
+    if (!line) return;
+
+    line->next = NULL;
+    line->trace_id = trace_current();
+    memcpy(line->text, message, len + 1);
+
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, channel_idx);
+    if (channel->pending_tail) {
+        channel->pending_tail->next = line;
+    } else {
+        channel->pending_head = line;
+    }
+    channel->pending_tail = line;
+    channel->pending_count++;
+    pending_total++;
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    schedule_drain();
+}
+
+// Drops lines that were never inserted, e.g. when a channel is removed.
+// Called with client.gui_mutex held.
+void discard_pending_lines(channel_info_t *channel) {
+    while (channel->pending_head) {
+        pending_line_t *line = channel->pending_head;
+        channel->pending_head = line->next;
+        pending_total--;
+        free(line);
+    }
+    channel->pending_tail = NULL;
+    channel->pending_count = 0;
+}
+
+// Called when the chat view switches buffers
+void reset_new_lines_indicator(void) {
+    unseen_lines = 0;
+    update_new_lines_indicator();
+}
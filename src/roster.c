@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+#ifdef _WIN32
+#define strtok_r strtok_s
+#endif
+
+// Rosters are mutated by the network thread and read by the GTK thread,
+// both under client.gui_mutex.
+
+// New members merged without a heap copy
+#define ROSTER_MERGE_STACK 128
+
+int find_channel(server_info_t *server, const char *name) {
+    if (isupport_is_channel(&server->isupport, name)) name++;
+
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (channel && !channel->is_private_msg &&
+            isupport_casecmp(&server->isupport, channel->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// qsort() has no context argument; every sort runs under client.gui_mutex
+static const isupport_t *sort_isupport;
+
+// Casefolded nick order; nicks that only collide under a changed
+// casemapping keep separate entries and are told apart by address
+static int member_compare(const void *a, const void *b) {
+    const channel_member_t *ma = a;
+    const channel_member_t *mb = b;
+    int cmp = isupport_casecmp(sort_isupport, ma->nick->name, mb->nick->name);
+
+    if (cmp != 0) return cmp;
+    return intern_compare(&ma->nick, &mb->nick);
+}
+
+// Index of the first member whose nick does not sort before name
+static int roster_lower_bound(server_info_t *server, channel_info_t *channel, const char *name) {
+    int lo = 0;
+    int hi = channel->member_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (isupport_casecmp(&server->isupport, channel->members[mid].nick->name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int roster_find(server_info_t *server, channel_info_t *channel, const intern_t *nick) {
+    for (int i = roster_lower_bound(server, channel, nick->name); i < channel->member_count; i++) {
+        if (channel->members[i].nick == nick) return i;
+        if (isupport_casecmp(&server->isupport, channel->members[i].nick->name, nick->name) != 0) break;
+    }
+    return -1;
+}
+
+static bool roster_reserve(channel_info_t *channel, int count) {
+    if (count <= channel->member_capacity) return true;
+
+    int capacity = channel->member_capacity ? channel->member_capacity : 64;
+    while (capacity < count) capacity *= 2;
+
+    channel_member_t *members = realloc(channel->members, capacity * sizeof(channel_member_t));
+    if (!members) return false;
+    channel->members = members;
+    channel->member_capacity = capacity;
+    return true;
+}
+
+// Drops new members that are already in the roster, or twice among the
+// new ones (a /names while joined repeats everyone). The newest prefix
+// wins; the duplicate's reference is released. Both runs are sorted, so
+// this is one pass. Returns the new member count past sorted.
+static int roster_dedup_tail(server_info_t *server, channel_info_t *channel, int sorted) {
+    channel_member_t *members = channel->members;
+    channel_member_t *tail = members + sorted;
+    int added = channel->member_count - sorted;
+    int kept = 0;
+    int i = 0;
+
+    for (int j = 0; j < added; j++) {
+        if (kept > 0 && tail[kept - 1].nick == tail[j].nick) {
+            tail[kept - 1].prefix = tail[j].prefix;
+            intern_release(server, tail[j].nick);
+            continue;
+        }
+
+        while (i < sorted && member_compare(&members[i], &tail[j]) < 0) i++;
+        if (i < sorted && members[i].nick == tail[j].nick) {
+            members[i].prefix = tail[j].prefix;
+            intern_release(server, tail[j].nick);
+            continue;
+        }
+
+        tail[kept++] = tail[j];
+    }
+
+    channel->member_count = sorted + kept;
+    return kept;
+}
+
+// Sorts the members appended after the first sorted ones and merges them
+// in from the back: O(n + k log k) for k new members, so a NAMES burst
+// does not pay for a full sort per line
+static void roster_merge_tail(server_info_t *server, channel_info_t *channel, int sorted) {
+    channel_member_t stack[ROSTER_MERGE_STACK];
+    channel_member_t *members = channel->members;
+    int added = channel->member_count - sorted;
+
+    if (added <= 0) return;
+
+    sort_isupport = &server->isupport;
+    qsort(members + sorted, added, sizeof(channel_member_t), member_compare);
+    added = roster_dedup_tail(server, channel, sorted);
+    if (sorted == 0 || added == 0) return;
+
+    channel_member_t *tail = added <= ROSTER_MERGE_STACK ? stack : malloc(added * sizeof(channel_member_t));
+    if (!tail) {
+        qsort(members, channel->member_count, sizeof(channel_member_t), member_compare);
+        return;
+    }
+    memcpy(tail, members + sorted, added * sizeof(channel_member_t));
+
+    int i = sorted - 1;
+    int j = added - 1;
+    for (int w = channel->member_count - 1; j >= 0; w--) {
+        if (i >= 0 && member_compare(&members[i], &tail[j]) > 0) {
+            members[w] = members[i--];
+        } else {
+            members[w] = tail[j--];
+        }
+    }
+
+    if (tail != stack) free(tail);
+}
+
+// Appends without ordering; the caller merges with roster_merge_tail().
+// Takes over the caller's reference on nick.
+static void roster_append(server_info_t *server, channel_info_t *channel, const intern_t *nick, char prefix) {
+    if (!roster_reserve(channel, channel->member_count + 1)) {
+        intern_release(server, nick);
+        return;
+    }
+
+    channel_member_t *member = &channel->members[channel->member_count++];
+    member->nick = nick;
+    member->last_spoke = 0;
+    member->prefix = prefix;
+}
+
+static void roster_delete(channel_info_t *channel, int idx) {
+    memmove(&channel->members[idx], &channel->members[idx + 1],
+            (channel->member_count - idx - 1) * sizeof(channel_member_t));
+    channel->member_count--;
+}
+
+void roster_add(server_info_t *server, int channel_idx, const char *nick, char prefix) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+
+    if (!channel) return;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_nick(server, nick);
+    if (entry) {
+        if (roster_find(server, channel, entry) < 0) {
+            int sorted = channel->member_count;
+            roster_append(server, channel, entry, prefix);
+            roster_merge_tail(server, channel, sorted);
+        } else {
+            intern_release(server, entry);
+        }
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+// roster_add() for count members with a single merge, e.g. the netjoins
+// of a split. Takes over the caller's references on nicks.
+void roster_add_batch(server_info_t *server, int channel_idx, const intern_t **nicks, int count) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+
+    pthread_mutex_lock(&client.gui_mutex);
+    if (!channel || !roster_reserve(channel, channel->member_count + count)) {
+        for (int i = 0; i < count; i++) intern_release(server, nicks[i]);
+        pthread_mutex_unlock(&client.gui_mutex);
+        return;
+    }
+
+    int sorted = channel->member_count;
+    for (int i = 0; i < count; i++) {
+        // Members already listed keep their prefix
+        if (roster_find(server, channel, nicks[i]) >= 0) {
+            intern_release(server, nicks[i]);
+        } else {
+            roster_append(server, channel, nicks[i], 0);
+        }
+    }
+    roster_merge_tail(server, channel, sorted);
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+bool roster_remove(server_info_t *server, int channel_idx, const char *nick) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+    bool removed = false;
+
+    if (!channel) return false;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_lookup(server, nick);
+    int idx = entry ? roster_find(server, channel, entry) : -1;
+    if (idx >= 0) {
+        roster_delete(channel, idx);
+        intern_release(server, entry);
+        removed = true;
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    return removed;
+}
+
+// Removes every member in nicks, which is sorted by intern_compare(), in
+// a single pass that keeps the order. Returns how many were removed.
+int roster_remove_sorted(server_info_t *server, int channel_idx, const intern_t **nicks, int count) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+    int kept = 0;
+
+    if (!channel) return 0;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < channel->member_count; i++) {
+        const intern_t *nick = channel->members[i].nick;
+
+        if (bsearch(&nick, nicks, count, sizeof(const intern_t*), intern_compare)) {
+            intern_release(server, nick);
+        } else {
+            channel->members[kept++] = channel->members[i];
+        }
+    }
+    int removed = channel->member_count - kept;
+    channel->member_count = kept;
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    return removed;
+}
+
+// Renames a nick in every channel; in_channel[i] tells whether channel i
+// had it, for the first channel_count channels. Returns the number of
+// channels touched.
+int roster_rename(server_info_t *server, const char *old_nick, const char *new_nick, bool *in_channel, int channel_count) {
+    channel_member_t *moved = malloc((channel_count + 1) * sizeof(channel_member_t));
+    int touched = 0;
+
+    if (!moved) return 0;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_lookup(server, old_nick);
+
+    // The new spelling sorts elsewhere: take the member out while it can
+    // still be found under the old one
+    for (int i = 0; i < channel_count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        int idx = !channel || channel->is_private_msg || !entry ? -1 : roster_find(server, channel, entry);
+
+        in_channel[i] = idx >= 0;
+        if (idx < 0) continue;
+        touched++;
+
+        moved[i] = channel->members[idx];
+        roster_delete(channel, idx);
+    }
+
+    // One rewrite normally renames the nick in every channel at once; if
+    // new_nick already has an entry (a desynced roster) members move to it
+    const intern_t *target = NULL;
+    if (entry && !intern_rename(server, entry, new_nick)) {
+        target = intern_lookup(server, new_nick);
+    }
+
+    for (int i = 0; i < channel_count; i++) {
+        if (!in_channel[i]) continue;
+        channel_info_t *channel = channel_get(server, i);
+        int sorted = channel->member_count;
+
+        if (target) {
+            intern_ref(target);
+            intern_release(server, moved[i].nick);
+            moved[i].nick = target;
+        }
+        channel->members[channel->member_count++] = moved[i];
+        roster_merge_tail(server, channel, sorted);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    free(moved);
+    return touched;
+}
+
+// Orders a roster filled by hand, e.g. mirrored from the daemon. Called
+// with client.gui_mutex held.
+void roster_sort(server_info_t *server, channel_info_t *channel) {
+    roster_merge_tail(server, channel, 0);
+}
+
+// The casemapping changed, so every roster's order did too
+void roster_resort(server_info_t *server) {
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < server->channels.count; i++) {
+        channel_info_t *channel = channel_get(server, i);
+        if (channel) roster_sort(server, channel);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+// Marks nick as the channel's latest speaker, for completion ranking
+void roster_spoke(server_info_t *server, int channel_idx, const char *nick) {
+    channel_info_t *channel = channel_get(server, channel_idx);
+
+    if (!channel) return;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    const intern_t *entry = intern_lookup(server, nick);
+    int idx = entry ? roster_find(server, channel, entry) : -1;
+    if (idx >= 0) channel->members[idx].last_spoke = ++channel->speak_seq;
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+static bool has_prefix(const isupport_t *isupport, const char *name, const char *prefix) {
+    for (; *prefix; name++, prefix++) {
+        if (isupport_fold(isupport, *name) != isupport_fold(isupport, *prefix)) return false;
+    }
+    return true;
+}
+
+// Copies up to max nicks starting with prefix into out, most recent
+// speakers first, then in nick order. The matches are one contiguous run
+// of the sorted roster, so only they are looked at. Returns the count.
+int roster_complete(server_info_t *server, int channel_idx, const char *prefix,
+                    char (*out)[MAX_NICK_LENGTH], int max) {
+    const channel_member_t *best[ROSTER_COMPLETE_MAX];
+    int count = 0;
+
+    if (max > ROSTER_COMPLETE_MAX) max = ROSTER_COMPLETE_MAX;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, channel_idx);
+
+    for (int i = channel ? roster_lower_bound(server, channel, prefix) : 0;
+         channel && i < channel->member_count; i++) {
+        const channel_member_t *member = &channel->members[i];
+        if (!has_prefix(&server->isupport, member->nick->name, prefix)) break;
+
+        // Insertion into a short ranked list; within equal recency the run
+        // is already in nick order, so later members go after
+        int pos = count;
+        while (pos > 0 && best[pos - 1]->last_spoke < member->last_spoke) pos--;
+        if (pos >= max) continue;
+
+        if (count < max) count++;
+        memmove(&best[pos + 1], &best[pos], (count - pos - 1) * sizeof(best[0]));
+        best[pos] = member;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memcpy(out[i], best[i]->nick->name, MAX_NICK_LENGTH);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    return count;
+}
+
+void roster_clear(server_info_t *server, channel_info_t *channel) {
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int i = 0; i < channel->member_count; i++) {
+        intern_release(server, channel->members[i].nick);
+    }
+    free(channel->members);
+    channel->members = NULL;
+    channel->member_count = 0;
+    channel->member_capacity = 0;
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+// 353: <nick> <symbol> <channel> :[prefix]nick [prefix]nick ...
+void roster_handle_names(server_info_t *server, char *params) {
+    char *saveptr;
+
+    strtok_r(params, " ", &saveptr);          // Our nick
+    strtok_r(NULL, " ", &saveptr);            // = * @
+    char *channel_name = strtok_r(NULL, " ", &saveptr);
+    char *names = saveptr;
+
+    if (!channel_name || !names) return;
+    if (names[0] == ':') names++;
+
+    int channel_idx = find_channel(server, channel_name);
+    if (channel_idx < 0) return;
+
+    channel_info_t *channel = channel_get(server, channel_idx);
+    const char *symbols = server->isupport.prefix_symbols;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    int sorted = channel->member_count;
+    for (char *name = strtok_r(names, " ", &saveptr); name; name = strtok_r(NULL, " ", &saveptr)) {
+        char prefix = 0;
+
+        // multi-prefix sends every status symbol; the first is the highest
+        while (*name && strchr(symbols, *name)) {
+            if (!prefix) prefix = *name;
+            name++;
+        }
+
+        // Appended as is; roster_merge_tail() drops members already listed
+        const intern_t *entry = *name ? intern_nick(server, name) : NULL;
+        if (entry) roster_append(server, channel, entry, prefix);
+    }
+    roster_merge_tail(server, channel, sorted);
+    pthread_mutex_unlock(&client.gui_mutex);
+}
+
+static gboolean roster_refresh_cb(gpointer data) {
+    int server_idx = GPOINTER_TO_INT(data);
+    server_info_t *server = server_get(server_idx);
+
+    server->roster_refresh_pending = false;
+
+    if (client.mode == CLIENT_DAEMON) {
+        daemon_broadcast_roster(server_idx);
+    } else if (server_idx == client.active_server) {
+        const channel_view_t *channel = snapshot_channel(server_snapshot(server), server->active_channel);
+        if (channel) show_user_list(server_idx, channel->name);
+    }
+
+    return FALSE;
+}
+
+// Schedules one user list refresh, however many roster changes precede it
+void roster_notify(server_info_t *server) {
+    if (!server->roster_refresh_pending) {
+        server->roster_refresh_pending = true;
+        g_idle_add(roster_refresh_cb, GINT_TO_POINTER(server->index));
+    }
+}
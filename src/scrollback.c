@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "client.h"
+
+// Raw per-channel history, independent of any GtkTextBuffer. Lines are
+// numbered by a per-channel sequence so a frontend can ask for exactly
+// what it is missing. Accessed under client.gui_mutex.
+//
+// All channels share SCROLLBACK_BUDGET_BYTES of resident history. Past it,
+// the oldest lines of the least recently viewed channels are spilled to a
+// segment file per channel, and their text buffers trimmed to match; the
+// ring then holds each spilled line's offset instead of its text. Spilled
+// lines are read back through a mapping of the segment: by searches, by the
+// daemon's backlog, and by the chat view when it is scrolled to the top.
+
+#define SCROLLBACK_INITIAL_CAPACITY 256
+// Allocator and text buffer bookkeeping per line, roughly
+#define SCROLLBACK_LINE_OVERHEAD 48
+// Eviction frees down to this, so it does not run again on the next line
+#define SCROLLBACK_LOW_WATER (SCROLLBACK_BUDGET_BYTES / 8 * 7)
+// Lines every channel keeps in memory, so switching to it needs no disk
+#define SCROLLBACK_RESIDENT_MIN 100
+// Bytes of dropped lines before a segment is rewritten without them
+#define SPILL_COMPACT_MIN (1 << 20)
+
+static size_t resident_total = 0;   // Over all channels
+static bool evict_scheduled = false;
+static unsigned spill_ids = 0;
+static char spill_dir[MAX_PATH_LENGTH];
+
+static scrollback_slot_t *scrollback_slot(scrollback_t *sb, int i) {
+    return &sb->lines[(sb->head + i) % sb->capacity];
+}
+
+static size_t line_cost(const char *text) {
+    return strlen(text) + 1 + SCROLLBACK_LINE_OVERHEAD;
+}
+
+static void spill_path(const scrollback_t *sb, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%u.seg", spill_dir, sb->spill_id);
+}
+
+// Forgets the mapping; it no longer covers the segment as it is
+static void spill_unmap(scrollback_t *sb) {
+    if (sb->spill_map) {
+        g_mapped_file_unref(sb->spill_map);
+        sb->spill_map = NULL;
+    }
+}
+
+static void spill_remove(scrollback_t *sb) {
+    spill_unmap(sb);
+    if (sb->spill_id && sb->spill_size) {
+        char path[MAX_PATH_LENGTH];
+        spill_path(sb, path, sizeof(path));
+        remove(path);
+    }
+    sb->spill_size = 0;
+}
+
+// A spilled line's text, valid until the lock is released
+static const char *spill_text(scrollback_t *sb, uint64_t offset) {
+    if (!sb->spill_map) {
+        char path[MAX_PATH_LENGTH];
+        spill_path(sb, path, sizeof(path));
+        sb->spill_map = g_mapped_file_new(path, FALSE, NULL);
+        if (!sb->spill_map) return NULL;
+    }
+    if (offset >= g_mapped_file_get_length(sb->spill_map)) return NULL;
+    return g_mapped_file_get_contents(sb->spill_map) + offset;
+}
+
+// Rewrites the segment without the lines that dropped off the ring, once
+// they make up most of it
+static void spill_compact(scrollback_t *sb) {
+    if (sb->spilled == 0) {
+        // Nothing on disk is live
+        spill_remove(sb);
+        return;
+    }
+
+    uint64_t dead = scrollback_slot(sb, 0)->offset;
+    if (dead < SPILL_COMPACT_MIN || dead < sb->spill_size - dead) return;
+
+    const char *live = spill_text(sb, dead);
+    if (!live) return;
+
+    char path[MAX_PATH_LENGTH];
+    char tmp[MAX_PATH_LENGTH + 4];
+    spill_path(sb, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    size_t len = (size_t)(sb->spill_size - dead);
+    FILE *file = fopen(tmp, "wb");
+    bool ok = file && fwrite(live, 1, len, file) == len;
+    if (file && fclose(file) != 0) ok = false;
+
+    spill_unmap(sb);
+#ifdef _WIN32
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0) {
+        log_message("WARNING", "Failed to compact scrollback segment %s", path);
+        remove(tmp);
+        return;
+    }
+
+    for (int i = 0; i < sb->spilled; i++) {
+        scrollback_slot(sb, i)->offset -= dead;
+    }
+    sb->spill_size = len;
+}
+
+// Creates the private segment directory on first use. Without it nothing
+// is spilled and history stays in memory.
+static bool spill_dir_ready(void) {
+    static bool failed = false;
+
+    if (spill_dir[0]) return true;
+    if (failed) return false;
+
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("irc-scrollback-XXXXXX", &error);
+    if (!dir) {
+        log_message("ERROR", "Failed to create a scrollback spill directory: %s", error->message);
+        g_error_free(error);
+        failed = true;
+        return false;
+    }
+    if (strlen(dir) >= sizeof(spill_dir)) {
+        log_message("ERROR", "Scrollback spill directory path too long: %s", dir);
+        g_rmdir(dir);
+        g_free(dir);
+        failed = true;
+        return false;
+    }
+
+    strcpy(spill_dir, dir);
+    g_free(dir);
+    return true;
+}
+
+// Writes the oldest resident lines to the segment until keep remain or
+// bytes have been freed. Returns the bytes freed.
+static size_t scrollback_evict(scrollback_t *sb, int keep, size_t bytes) {
+    int resident = sb->count - sb->spilled;
+    if (resident <= keep) return 0;
+
+    if (!spill_dir_ready()) return 0;
+    if (!sb->spill_id) sb->spill_id = ++spill_ids;
+    spill_compact(sb);
+
+    char path[MAX_PATH_LENGTH];
+    spill_path(sb, path, sizeof(path));
+    FILE *file = fopen(path, "ab");
+    if (!file) {
+        log_message("ERROR", "Failed to spill scrollback to %s", path);
+        return 0;
+    }
+
+    // Offsets follow the file, even after a short write
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    if (end >= 0) sb->spill_size = (uint64_t)end;
+
+    size_t freed = 0;
+    while (resident > keep && freed < bytes) {
+        scrollback_slot_t *slot = scrollback_slot(sb, sb->spilled);
+        char *text = slot->text;
+        size_t len = strlen(text) + 1;
+
+        if (fwrite(text, 1, len, file) != len) break;
+        slot->offset = sb->spill_size;
+        sb->spill_size += len;
+        freed += len + SCROLLBACK_LINE_OVERHEAD;
+        free(text);
+
+        sb->spilled++;
+        sb->evicted++;
+        resident--;
+    }
+
+    if (fclose(file) != 0) log_message("ERROR", "Failed to spill scrollback to %s", path);
+    spill_unmap(sb);
+
+    sb->resident_bytes -= freed;
+    resident_total -= freed;
+    return freed;
+}
+
+typedef struct {
+    channel_info_t *channel;
+    uint64_t viewed_us;
+    bool visible;
+} victim_t;
+
+static int victim_compare(const void *a, const void *b) {
+    const victim_t *va = a;
+    const victim_t *vb = b;
+    if (va->viewed_us != vb->viewed_us) return va->viewed_us < vb->viewed_us ? -1 : 1;
+    return 0;
+}
+
+// Spills the least recently viewed channels' oldest lines until the total
+// is back under the low water mark. Main loop thread.
+static gboolean scrollback_evict_cb(gpointer data) {
+    (void)data;
+    uint64_t span = trace_begin();
+    const char *mark = watchdog_enter("scrollback_evict");
+    int total = 0;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    evict_scheduled = false;
+
+    for (int s = 0; s < client.servers.count; s++) total += server_get(s)->channels.count;
+    victim_t *victims = malloc((total > 0 ? total : 1) * sizeof(victim_t));
+    int count = 0;
+
+    for (int s = 0; victims && s < client.servers.count; s++) {
+        server_info_t *server = server_get(s);
+        for (int c = 0; c < server->channels.count; c++) {
+            channel_info_t *channel = channel_get(server, c);
+            if (!channel || channel->scrollback.count - channel->scrollback.spilled <= SCROLLBACK_RESIDENT_MIN) continue;
+
+            victim_t *victim = &victims[count++];
+            victim->channel = channel;
+            victim->visible = s == client.active_server && c == server->active_channel;
+            // The channel on screen goes last
+            victim->viewed_us = victim->visible ? UINT64_MAX : channel->scrollback.viewed_us;
+        }
+    }
+
+    if (victims) {
+        qsort(victims, count, sizeof(victim_t), victim_compare);
+
+        for (int i = 0; i < count && resident_total > SCROLLBACK_LOW_WATER; i++) {
+            channel_info_t *channel = victims[i].channel;
+            scrollback_evict(&channel->scrollback, SCROLLBACK_RESIDENT_MIN, resident_total - SCROLLBACK_LOW_WATER);
+
+            // The view keeps its text until it is left or follows new lines
+            if (!victims[i].visible) channel_trim_buffer(channel, 1);
+        }
+        free(victims);
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    watchdog_leave(mark);
+    trace_end("evict", span, 0);
+    return FALSE;
+}
+
+// Appends a line, dropping the oldest once SCROLLBACK_MAX_LINES are kept.
+// Returns the line's sequence number.
+uint64_t scrollback_append(scrollback_t *sb, const char *text) {
+    char *copy = strdup(text);
+    if (!copy) return sb->next_seq;
+
+    if (sb->count == sb->capacity && sb->capacity < SCROLLBACK_MAX_LINES) {
+        int capacity = sb->capacity ? sb->capacity * 2 : SCROLLBACK_INITIAL_CAPACITY;
+        if (capacity > SCROLLBACK_MAX_LINES) capacity = SCROLLBACK_MAX_LINES;
+
+        scrollback_slot_t *lines = malloc(capacity * sizeof(scrollback_slot_t));
+        if (!lines) {
+            free(copy);
+            return sb->next_seq;
+        }
+
+        // Unwrap the ring so head is 0 again
+        for (int i = 0; i < sb->count; i++) {
+            lines[i] = *scrollback_slot(sb, i);
+        }
+        free(sb->lines);
+        sb->lines = lines;
+        sb->capacity = capacity;
+        sb->head = 0;
+    }
+
+    if (sb->count == sb->capacity) {
+        scrollback_slot_t *oldest = &sb->lines[sb->head];
+        if (sb->spilled > 0) {
+            // Its bytes on disk go at the next compaction
+            sb->spilled--;
+        } else {
+            size_t cost = line_cost(oldest->text);
+            sb->resident_bytes -= cost;
+            resident_total -= cost;
+            free(oldest->text);
+        }
+        oldest->text = copy;
+        sb->head = (sb->head + 1) % sb->capacity;
+    } else {
+        scrollback_slot(sb, sb->count)->text = copy;
+        sb->count++;
+    }
+
+    size_t cost = line_cost(copy);
+    sb->resident_bytes += cost;
+    resident_total += cost;
+
+    if (resident_total > SCROLLBACK_BUDGET_BYTES && !evict_scheduled) {
+        evict_scheduled = true;
+        g_idle_add(scrollback_evict_cb, NULL);
+    }
+
+    return sb->next_seq++;
+}
+
+uint64_t scrollback_first_seq(const scrollback_t *sb) {
+    return sb->next_seq - sb->count;
+}
+
+// Sequence of the oldest line still in memory
+uint64_t scrollback_resident_seq(const scrollback_t *sb) {
+    return scrollback_first_seq(sb) + sb->spilled;
+}
+
+// Line by sequence number, or NULL when it has been dropped or not yet seen
+// (or its segment cannot be read). Valid until client.gui_mutex is released.
+const char *scrollback_get(scrollback_t *sb, uint64_t seq) {
+    uint64_t first = scrollback_first_seq(sb);
+    if (seq < first || seq >= sb->next_seq) return NULL;
+
+    scrollback_slot_t *slot = scrollback_slot(sb, (int)(seq - first));
+    return seq - first < (uint64_t)sb->spilled ? spill_text(sb, slot->offset) : slot->text;
+}
+
+// Empties the scrollback; numbering continues at next_seq
+void scrollback_reset(scrollback_t *sb, uint64_t next_seq) {
+    for (int i = sb->spilled; i < sb->count; i++) {
+        char *text = scrollback_slot(sb, i)->text;
+        size_t cost = line_cost(text);
+        sb->resident_bytes -= cost;
+        resident_total -= cost;
+        free(text);
+    }
+    spill_remove(sb);
+    sb->spilled = 0;
+    sb->count = 0;
+    sb->head = 0;
+    sb->next_seq = next_seq;
+}
+
+void scrollback_free(scrollback_t *sb) {
+    scrollback_reset(sb, 0);
+    free(sb->lines);
+    memset(sb, 0, sizeof(scrollback_t));
+}
+
+// Removes every segment; called at exit
+void scrollback_cleanup(void) {
+    if (!spill_dir[0]) return;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int s = 0; s < client.servers.count; s++) {
+        server_info_t *server = server_get(s);
+        for (int c = 0; c < server->channels.count; c++) {
+            channel_info_t *channel = channel_get(server, c);
+            if (channel) spill_remove(&channel->scrollback);
+        }
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    g_rmdir(spill_dir);
+}
+
+// Memory and disk use over all channels, one line
+void scrollback_format_totals(char *buf, size_t len) {
+    uint64_t spilled_lines = 0;
+    uint64_t spilled_bytes = 0;
+    uint64_t evicted = 0;
+    uint64_t paged_in = 0;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    for (int s = 0; s < client.servers.count; s++) {
+        server_info_t *server = server_get(s);
+        for (int c = 0; c < server->channels.count; c++) {
+            channel_info_t *channel = channel_get(server, c);
+            if (!channel) continue;
+            spilled_lines += (uint64_t)channel->scrollback.spilled;
+            spilled_bytes += channel->scrollback.spill_size;
+            evicted += channel->scrollback.evicted;
+            paged_in += channel->scrollback.paged_in;
+        }
+    }
+    size_t resident = resident_total;
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    snprintf(buf, len, "%s Scrollback: %.1f of %.1f MB in memory; %llu lines on disk (%.1f MB); "
+             "%llu lines evicted, %llu paged back in\n", get_timestamp(),
+             resident / 1048576.0, SCROLLBACK_BUDGET_BYTES / 1048576.0,
+             (unsigned long long)spilled_lines, spilled_bytes / 1048576.0,
+             (unsigned long long)evicted, (unsigned long long)paged_in);
+}
+
+// One channel's residency and eviction counters. Returns false, leaving buf
+// alone, when the channel has no history.
+bool scrollback_format_channel(server_info_t *server, int channel_idx, char *buf, size_t len) {
+    bool shown = false;
+
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, channel_idx);
+    if (channel && channel->scrollback.count > 0) {
+        scrollback_t *sb = &channel->scrollback;
+        snprintf(buf, len, "%s   %s %s%s: %d lines in memory (%.0f KB), %d on disk, %llu evicted, %llu paged in\n",
+                 get_timestamp(), server->config.name, channel->is_private_msg ? "@" : "#",
+                 channel->is_private_msg ? channel->target_nick : channel->name,
+                 sb->count - sb->spilled, sb->resident_bytes / 1024.0, sb->spilled,
+                 (unsigned long long)sb->evicted, (unsigned long long)sb->paged_in);
+        shown = true;
+    }
+    pthread_mutex_unlock(&client.gui_mutex);
+    return shown;
+}
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+// Find in scrollback. Ctrl+F opens a bar under the chat; the query is
+// matched on a worker thread against the raw scrollback of the active
+// channel (or of every channel on the server), never against the
+// GtkTextBuffer. Lines are searched newest first and matches stream back
+// in chunks, so the closest ones show up at once. A new query cancels the
+// running search before its next chunk. Stepping through the matches
+// found so far needs no further searching.
+
+#define SEARCH_CHUNK_LINES 1024   // Lines scanned per gui_mutex hold
+#define SEARCH_QUERY_MAX 128
+
+typedef struct {
+    int channel_idx;
+    uint64_t seq;
+} search_hit_t;
+
+typedef struct {
+    uint32_t generation;
+    bool done;
+    uint64_t lines;           // Scanned so far; with done, the total
+    uint64_t elapsed_us;
+    int count;
+    search_hit_t hits[];
+} search_chunk_t;
+
+// Request for the worker, under mutex
+static struct {
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t generation;
+    bool pending;
+    char query[SEARCH_QUERY_MAX];
+    int server_idx;
+    int channel_idx;          // Searched first
+    bool all_channels;
+} worker = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// Bar and results, GTK thread only
+static struct {
+    GtkWidget *bar;
+    GtkWidget *entry;
+    GtkWidget *all_check;
+    GtkWidget *label;
+    uint32_t generation;
+    int server_idx;
+    search_hit_t *hits;       // Newest first
+    int count;
+    int capacity;
+    int current;              // Shown match, or -1
+    bool done;
+    uint64_t lines;
+    uint64_t elapsed_us;
+} view = { .current = -1 };
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + 32) : c;
+}
+
+static bool equal_folded(const char *text, const char *folded, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (fold((unsigned char)text[i]) != (unsigned char)folded[i]) return false;
+    }
+    return true;
+}
+
+#ifdef __SSE2__
+// ASCII lowercase of 16 bytes; bytes from 0x80 compare as negative and stay
+static __m128i fold16(__m128i v) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+// Whether text contains needle, ignoring ASCII case; needle is already
+// folded. With SSE2, 16 start positions are tested at once against the
+// needle's first and last bytes, and only those hits are compared fully.
+static bool search_contains(const char *text, size_t len, const char *needle, size_t needle_len) {
+    if (needle_len == 0 || needle_len > len) return false;
+
+    size_t last = len - needle_len;   // Last possible start
+    size_t middle = needle_len > 2 ? needle_len - 2 : 0;
+    unsigned char first_byte = (unsigned char)needle[0];
+    unsigned char last_byte = (unsigned char)needle[needle_len - 1];
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i first = _mm_set1_epi8((char)first_byte);
+    __m128i final = _mm_set1_epi8((char)last_byte);
+
+    for (; i + 15 <= last; i += 16) {
+        __m128i a = fold16(_mm_loadu_si128((const __m128i *)(const void *)(text + i)));
+        __m128i b = fold16(_mm_loadu_si128((const __m128i *)(const void *)(text + i + needle_len - 1)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+
+        while (mask) {
+            size_t start = i + (size_t)__builtin_ctz(mask);
+            if (equal_folded(text + start + 1, needle + 1, middle)) return true;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i <= last; i++) {
+        if (fold((unsigned char)text[i]) == first_byte &&
+            fold((unsigned char)text[i + needle_len - 1]) == last_byte &&
+            equal_folded(text + i + 1, needle + 1, middle)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static gboolean search_chunk_cb(gpointer data);
+
+static bool search_cancelled(uint32_t generation) {
+    pthread_mutex_lock(&worker.mutex);
+    bool cancelled = worker.generation != generation;
+    pthread_mutex_unlock(&worker.mutex);
+    return cancelled;
+}
+
+static void search_post(uint32_t generation, search_chunk_t *chunk, bool done,
+                        uint64_t lines, uint64_t start_us) {
+    chunk->generation = generation;
+    chunk->done = done;
+    chunk->lines = lines;
+    chunk->elapsed_us = get_monotonic_us() - start_us;
+    g_idle_add(search_chunk_cb, chunk);
+}
+
+// Scans one channel from its newest line back. Returns false if the
+// search was cancelled.
+static bool search_channel(server_info_t *server, int channel_idx, uint32_t generation,
+                           const char *needle, size_t needle_len, uint64_t *lines, uint64_t start_us) {
+    pthread_mutex_lock(&client.gui_mutex);
+    channel_info_t *channel = channel_get(server, channel_idx);
+    uint32_t channel_generation = channel ? channel->generation : 0;
+    uint64_t seq = channel ? channel->scrollback.next_seq : 0;
+    pthread_mutex_unlock(&client.gui_mutex);
+
+    while (channel) {
+        if (search_cancelled(generation)) return false;
+
+        search_chunk_t *chunk = malloc(sizeof(search_chunk_t) + SEARCH_CHUNK_LINES * sizeof(search_hit_t));
+        if (!chunk) return false;
+        chunk->count = 0;
+
+        pthread_mutex_lock(&client.gui_mutex);
+        // Removed meanwhile, or older lines dropped off the ring
+        bool current = channel_current(server, channel_idx, channel_generation);
+        uint64_t first = current ? scrollback_first_seq(&channel->scrollback) : seq;
+
+        for (int n = 0; n < SEARCH_CHUNK_LINES && seq > first; n++) {
+            const char *line = scrollback_get(&channel->scrollback, --seq);
+            if (line && search_contains(line, strlen(line), needle, needle_len)) {
+                chunk->hits[chunk->count].channel_idx = channel_idx;
+                chunk->hits[chunk->count].seq = seq;
+                chunk->count++;
+            }
+            (*lines)++;
+        }
+        bool finished = seq <= first;
+        pthread_mutex_unlock(&client.gui_mutex);
+
+        if (chunk->count > 0) {
+            search_post(generation, chunk, false, *lines, start_us);
+        } else {
+            free(chunk);
+        }
+        if (finished) break;
+    }
+    return true;
+}
+
+static void search_run(uint32_t generation, const char *query, int server_idx, int channel_idx, bool all_channels) {
+    server_info_t *server = server_get(server_idx);
+    char needle[SEARCH_QUERY_MAX];
+    size_t needle_len = strlen(query);
+    uint64_t start_us = get_monotonic_us();
+    uint64_t lines = 0;
+
+    if (!server) return;
+    for (size_t i = 0; i <= needle_len; i++) needle[i] = (char)fold((unsigned char)query[i]);
+
+    if (!search_channel(server, channel_idx, generation, needle, needle_len, &lines, start_us)) return;
+
+    if (all_channels) {
+        for (int i = 0; i < server->channels.count; i++) {
+            if (i == channel_idx) continue;
+            if (!search_channel(server, i, generation, needle, needle_len, &lines, start_us)) return;
+        }
+    }
+
+    search_chunk_t *chunk = malloc(sizeof(search_chunk_t));
+    if (!chunk) return;
+    chunk->count = 0;
+    search_post(generation, chunk, true, lines, start_us);
+}
+
+static void *search_worker(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&worker.mutex);
+    for (;;) {
+        while (!worker.pending) pthread_cond_wait(&worker.cond, &worker.mutex);
+
+        char query[SEARCH_QUERY_MAX];
+        uint32_t generation = worker.generation;
+        int server_idx = worker.server_idx;
+        int channel_idx = worker.channel_idx;
+        bool all_channels = worker.all_channels;
+        memcpy(query, worker.query, sizeof(query));
+        worker.pending = false;
+        pthread_mutex_unlock(&worker.mutex);
+
+        search_run(generation, query, server_idx, channel_idx, all_channels);
+
+        pthread_mutex_lock(&worker.mutex);
+    }
+    return NULL;
+}
+
+// Bar, GTK thread
+
+static void search_update_label(void) {
+    char text[128];
+
+    if (view.count == 0) {
+        snprintf(text, sizeof(text), view.done ? "No matches in %llu lines" : "Searching...",
+                 (unsigned long long)view.lines);
+    } else if (view.done) {
+        snprintf(text, sizeof(text), "%d of %d, %llu lines in %.1f ms", view.current + 1, view.count,
+                 (unsigned long long)view.lines, view.elapsed_us / 1000.0);
+    } else {
+        snprintf(text, sizeof(text), "%d of %d so far", view.current + 1, view.count);
+    }
+    gtk_label_set_text(GTK_LABEL(view.label), text);
+}
+
+// Selects match i in the chat view, switching channels if needed
+static void search_show(int i) {
+    search_hit_t *hit = &view.hits[i];
+    server_info_t *server = server_get(view.server_idx);
+    channel_info_t *channel = server ? channel_get(server, hit->channel_idx) : NULL;
+
+    view.current = i;
+    search_update_label();
+    if (!channel || view.server_idx != client.active_server) return;
+
+    if (server->active_channel != hit->channel_idx) {
+        // Switching focuses the message entry; keep typing in the bar
+        channel_list_select(view.server_idx, hit->channel_idx);
+        gtk_widget_grab_focus(view.entry);
+    }
+
+    pthread_mutex_lock(&client.gui_mutex);
+    GtkTextBuffer *buffer = channel_get(server, hit->channel_idx) ? channel_buffer(channel) : NULL;
+    // Older than the buffer: trimmed, maybe spilled to disk
+    if (buffer && hit->seq < channel->ui.first_seq) channel_page_in(channel, hit->seq);
+    pthread_mutex_unlock(&client.gui_mutex);
+    if (!buffer) return;
+
+    // Each scrollback line is one buffer line, counted from ui.first_seq
+    if (hit->seq < channel->ui.first_seq) return;
+    int line = (int)(hit->seq - channel->ui.first_seq);
+    if (line >= gtk_text_buffer_get_line_count(buffer)) return;
+
+    GtkTextIter start, end, match_start, match_end;
+    gtk_text_buffer_get_iter_at_line(buffer, &start, line);
+    end = start;
+    gtk_text_iter_forward_to_line_end(&end);
+
+    // Highlight the match itself; only this one line is searched
+    if (gtk_text_iter_forward_search(&start, gtk_entry_get_text(GTK_ENTRY(view.entry)),
+                                     GTK_TEXT_SEARCH_CASE_INSENSITIVE, &match_start, &match_end, &end)) {
+        start = match_start;
+        end = match_end;
+    }
+    gtk_text_buffer_select_range(buffer, &start, &end);
+
+    GtkTextMark *mark = gtk_text_buffer_get_mark(buffer, "search");
+    if (mark) {
+        gtk_text_buffer_move_mark(buffer, mark, &start);
+    } else {
+        mark = gtk_text_buffer_create_mark(buffer, "search", &start, TRUE);
+    }
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(client.chat_area), mark, 0.0, TRUE, 0.0, 0.5);
+}
+
+// Older is further down the list of hits
+static void search_step(bool older) {
+    if (view.count == 0) return;
+
+    int i = view.current + (older ? 1 : -1);
+    if (i < 0) i = view.count - 1;
+    if (i >= view.count) i = 0;
+    search_show(i);
+}
+
+static gboolean search_chunk_cb(gpointer data) {
+    search_chunk_t *chunk = data;
+
+    if (chunk->generation != view.generation) {
+        free(chunk);
+        return FALSE;
+    }
+
+    if (view.count + chunk->count > view.capacity) {
+        int capacity = view.capacity ? view.capacity : 256;
+        while (capacity < view.count + chunk->count) capacity *= 2;
+        search_hit_t *hits = realloc(view.hits, (size_t)capacity * sizeof(search_hit_t));
+        if (!hits) {
+            free(chunk);
+            return FALSE;
+        }
+        view.hits = hits;
+        view.capacity = capacity;
+    }
+    memcpy(view.hits + view.count, chunk->hits, (size_t)chunk->count * sizeof(search_hit_t));
+    view.count += chunk->count;
+    view.done = chunk->done;
+    view.lines = chunk->lines;
+    view.elapsed_us = chunk->elapsed_us;
+
+    // Jump to the newest match as soon as there is one
+    if (view.current < 0 && view.count > 0) {
+        search_show(0);
+    } else {
+        search_update_label();
+    }
+
+    free(chunk);
+    return FALSE;
+}
+
+// Starts over with the entry's text; also cancels the running search
+static void search_restart(void) {
+    const char *query = gtk_entry_get_text(GTK_ENTRY(view.entry));
+    server_info_t *server = client.active_server >= 0 ? server_get(client.active_server) : NULL;
+    bool searchable = server && channel_get(server, server->active_channel) && *query;
+
+    view.count = 0;
+    view.current = -1;
+    view.done = false;
+    view.lines = 0;
+    view.server_idx = client.active_server;
+
+    pthread_mutex_lock(&worker.mutex);
+    view.generation = ++worker.generation;
+    if (searchable) {
+        strncpy(worker.query, query, sizeof(worker.query) - 1);
+        worker.query[sizeof(worker.query) - 1] = '\0';
+        worker.server_idx = client.active_server;
+        worker.channel_idx = server->active_channel;
+        worker.all_channels = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(view.all_check));
+        worker.pending = true;
+        pthread_cond_signal(&worker.cond);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+
+    if (searchable) {
+        search_update_label();
+    } else {
+        gtk_label_set_text(GTK_LABEL(view.label), "");
+    }
+}
+
+static void on_search_changed(GtkEditable *editable, gpointer data) {
+    (void)editable;
+    (void)data;
+    search_restart();
+}
+
+static void on_search_toggled(GtkToggleButton *button, gpointer data) {
+    (void)button;
+    (void)data;
+    search_restart();
+}
+
+static void on_search_older(GtkButton *button, gpointer data) {
+    (void)button;
+    (void)data;
+    search_step(true);
+}
+
+static void on_search_newer(GtkButton *button, gpointer data) {
+    (void)button;
+    (void)data;
+    search_step(false);
+}
+
+static void search_close(void) {
+    pthread_mutex_lock(&worker.mutex);
+    view.generation = ++worker.generation;
+    pthread_mutex_unlock(&worker.mutex);
+
+    gtk_widget_hide(view.bar);
+    gtk_widget_grab_focus(client.message_entry);
+}
+
+static void on_search_close(GtkButton *button, gpointer data) {
+    (void)button;
+    (void)data;
+    search_close();
+}
+
+// Enter goes back in time, Shift+Enter forward, Escape closes
+static gboolean on_search_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+    (void)widget;
+    (void)data;
+
+    if (event->keyval == GDK_KEY_Escape) {
+        search_close();
+        return GDK_EVENT_STOP;
+    }
+    if (event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter) {
+        search_step(!(event->state & GDK_SHIFT_MASK));
+        return GDK_EVENT_STOP;
+    }
+    return FALSE;
+}
+
+// The hidden find bar, for main.c to pack under the chat view
+GtkWidget *search_bar_new(void) {
+    GtkWidget *older, *newer, *close;
+
+    view.bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+
+    view.entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(view.entry), "Find in history");
+    view.all_check = gtk_check_button_new_with_label("All channels");
+    older = gtk_button_new_with_label("Older");
+    newer = gtk_button_new_with_label("Newer");
+    view.label = gtk_label_new("");
+    close = gtk_button_new_with_label("Close");
+
+    gtk_box_pack_start(GTK_BOX(view.bar), view.entry, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(view.bar), view.all_check, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(view.bar), older, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(view.bar), newer, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(view.bar), view.label, FALSE, FALSE, 0);
+    gtk_box_pack_end(GTK_BOX(view.bar), close, FALSE, FALSE, 0);
+
+    g_signal_connect(view.entry, "changed", G_CALLBACK(on_search_changed), NULL);
+    g_signal_connect(view.entry, "key-press-event", G_CALLBACK(on_search_key_press), NULL);
+    g_signal_connect(view.all_check, "toggled", G_CALLBACK(on_search_toggled), NULL);
+    g_signal_connect(older, "clicked", G_CALLBACK(on_search_older), NULL);
+    g_signal_connect(newer, "clicked", G_CALLBACK(on_search_newer), NULL);
+    g_signal_connect(close, "clicked", G_CALLBACK(on_search_close), NULL);
+
+    // Hidden until search_open(); the window's show_all passes it over
+    gtk_widget_show_all(view.bar);
+    gtk_widget_hide(view.bar);
+    gtk_widget_set_no_show_all(view.bar, TRUE);
+    return view.bar;
+}
+
+// Shows the bar and focuses it, starting the worker the first time
+void search_open(void) {
+    if (!worker.started) {
+        if (pthread_create(&worker.thread, NULL, search_worker, NULL) != 0) {
+            log_message("ERROR", "Failed to start the search worker");
+            return;
+        }
+        pthread_detach(worker.thread);
+        worker.started = true;
+    }
+
+    gtk_widget_show(view.bar);
+    gtk_widget_grab_focus(view.entry);
+    search_restart();
+}
+
+// Ctrl+F anywhere in the main window
+gboolean on_main_window_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+    (void)widget;
+    (void)data;
+
+    if ((event->state & GDK_CONTROL_MASK) && (event->keyval == GDK_KEY_f || event->keyval == GDK_KEY_F)) {
+        search_open();
+        return GDK_EVENT_STOP;
+    }
+    return FALSE;
+}
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #define poll WSAPoll
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+#endif
+
+#include "client.h"
+
+// Sharded network workers for many connections. Started with --shards N,
+// N threads each run one poll() loop over the servers pinned to them,
+// instead of one thread per server. A server is pinned to the least loaded
+// shard the first time it connects and keeps it across reconnects, so its
+// rejoin, lag and netsplit state always has one owner. Every shard feeds
+// the GTK thread through a queue of its own, which the GTK thread merges
+// round robin (see queue_channel_activity()). While a shard's queue holds
+// more than SHARD_QUEUE_HIGH lines the shard stops reading and lets TCP
+// push back on its servers.
+
+#define SHARD_POLL_INTERVAL_MS 1000
+#define SHARD_READS_PER_TURN 4      // Per server, so one flood cannot starve the rest
+#define SHARD_QUEUE_HIGH 20000      // Lines waiting for the GTK thread
+#define SHARD_BACKOFF_MS 5
+#define SHARD_READ_SIZE (MAX_MSG_LENGTH * 8)
+
+typedef struct {
+    int index;
+    pthread_t thread;
+    int wake[2];                    // Self-pipe; -1 on Windows
+
+    pthread_mutex_t mutex;          // Guards everything below
+    pthread_cond_t turned;
+    server_info_t **servers;
+    int count;
+    int capacity;
+    int pinned;                     // Servers that ever picked this shard
+    bool busy;                      // In a turn, over a copy of servers
+    unsigned turns;
+    uint64_t lines;
+    uint64_t backoffs;
+} shard_t;
+
+static shard_t *shards;
+static int shard_total;
+
+static void shard_wake(shard_t *shard) {
+#ifndef _WIN32
+    char byte = 0;
+    if (shard->wake[1] >= 0 && write(shard->wake[1], &byte, 1) < 0 && errno != EAGAIN) {
+        log_message("WARNING", "Failed to wake shard %d: %s", shard->index, strerror(errno));
+    }
+#else
+    (void)shard;
+#endif
+}
+
+// Under shard->mutex
+static void shard_remove(shard_t *shard, server_info_t *server) {
+    for (int i = 0; i < shard->count; i++) {
+        if (shard->servers[i] == server) {
+            shard->servers[i] = shard->servers[--shard->count];
+            return;
+        }
+    }
+}
+
+// The server's connection is over; the shard thread lets go of it
+static void shard_drop(shard_t *shard, server_info_t *server) {
+    pthread_mutex_lock(&shard->mutex);
+    shard_remove(shard, server);
+    pthread_mutex_unlock(&shard->mutex);
+
+    log_message("INFO", "Shard %d let go of %s", shard->index, server->config.name);
+
+    if (server->state == CONN_ERROR && client.running) {
+        reconnect_connection_lost(server);
+    }
+}
+
+static void *shard_thread_func(void *arg) {
+    shard_t *shard = arg;
+    server_info_t **turn = NULL;
+    struct pollfd *fds = NULL;
+    int turn_capacity = 0;
+    char buffer[SHARD_READ_SIZE];
+    char name[16];
+
+    snprintf(name, sizeof(name), "shard %d", shard->index);
+    trace_thread_name(name);
+
+    while (client.running) {
+        int timeout = SHARD_POLL_INTERVAL_MS;
+        bool backlog = net_queue_depth(shard->index) > SHARD_QUEUE_HIGH;
+        uint64_t lines = 0;
+        int count;
+
+        // Works on a copy; shard_detach() waits for the turn to end
+        pthread_mutex_lock(&shard->mutex);
+        if (shard->count > turn_capacity) {
+            server_info_t **grown = realloc(turn, shard->count * sizeof(server_info_t*));
+            struct pollfd *grown_fds = realloc(fds, (shard->count + 1) * sizeof(struct pollfd));
+            if (grown) turn = grown;
+            if (grown_fds) fds = grown_fds;
+            if (grown && grown_fds) turn_capacity = shard->count;
+        }
+        if (!fds) {
+            fds = malloc(sizeof(struct pollfd));
+            if (!fds) {
+                pthread_mutex_unlock(&shard->mutex);
+                log_message("ERROR", "Shard %d is out of memory", shard->index);
+                break;
+            }
+        }
+        count = shard->count < turn_capacity ? shard->count : turn_capacity;
+        if (count > 0) memcpy(turn, shard->servers, count * sizeof(server_info_t*));
+        shard->busy = true;
+        pthread_mutex_unlock(&shard->mutex);
+
+        fds[0].fd = shard->wake[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        for (int i = 0; i < count; i++) {
+            server_info_t *server = turn[i];
+
+            timeout = net_poll_timeout(server, timeout);
+            // Buffered TLS records never show up in poll()
+            if (!backlog && server->ssl && tls_pending(server)) timeout = 0;
+            fds[i + 1].fd = backlog ? -1 : server->sockfd;
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+        }
+        if (backlog && timeout > SHARD_BACKOFF_MS) timeout = SHARD_BACKOFF_MS;
+#ifdef _WIN32
+        // Nothing wakes the shard early; attached servers wait this long at most
+        if (timeout > 50) timeout = 50;
+#endif
+
+        uint64_t span = trace_begin();
+        if (poll(fds, count + 1, timeout) < 0 && errno != EINTR) {
+            g_usleep(SHARD_BACKOFF_MS * 1000);
+        }
+        trace_end("poll", span, 0);
+
+#ifndef _WIN32
+        if (fds[0].revents & POLLIN) {
+            while (read(shard->wake[0], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+#endif
+
+        for (int i = 0; i < count; i++) {
+            server_info_t *server = turn[i];
+
+            if (server->state != CONN_CONNECTED || !net_tick(server)) {
+                shard_drop(shard, server);
+                continue;
+            }
+            if (!fds[i + 1].revents && !(server->ssl && tls_pending(server))) continue;
+
+            for (int r = 0; r < SHARD_READS_PER_TURN; r++) {
+                ssize_t got = net_read(server, buffer, sizeof(buffer));
+
+                if (got <= 0) {
+                    if (!net_read_failed(server, got)) shard_drop(shard, server);
+                    break;
+                }
+                lines += net_feed(server, buffer, (size_t)got);
+            }
+        }
+
+        pthread_mutex_lock(&shard->mutex);
+        shard->busy = false;
+        shard->turns++;
+        shard->lines += lines;
+        if (backlog) shard->backoffs++;
+        pthread_cond_broadcast(&shard->turned);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    // Servers still attached are shut down by shutdown_servers()
+    pthread_mutex_lock(&shard->mutex);
+    shard->busy = false;
+    pthread_cond_broadcast(&shard->turned);
+    pthread_mutex_unlock(&shard->mutex);
+
+    free(turn);
+    free(fds);
+    return NULL;
+}
+
+// Starts count shard threads; 0 keeps a thread per server. Call once,
+// before any server connects.
+void shard_init(int count) {
+    if (count <= 0) return;
+    if (count > SHARD_MAX) count = SHARD_MAX;
+
+    shards = calloc(count, sizeof(shard_t));
+    if (!shards) {
+        log_message("ERROR", "No memory for %d shards, using a thread per server", count);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        shard_t *shard = &shards[shard_total];
+
+        shard->index = shard_total;
+        shard->wake[0] = shard->wake[1] = -1;
+        pthread_mutex_init(&shard->mutex, NULL);
+        pthread_cond_init(&shard->turned, NULL);
+#ifndef _WIN32
+        if (pipe(shard->wake) == 0) {
+            fcntl(shard->wake[0], F_SETFL, fcntl(shard->wake[0], F_GETFL, 0) | O_NONBLOCK);
+            fcntl(shard->wake[1], F_SETFL, fcntl(shard->wake[1], F_GETFL, 0) | O_NONBLOCK);
+        } else {
+            shard->wake[0] = shard->wake[1] = -1;
+        }
+#endif
+
+        if (pthread_create(&shard->thread, NULL, shard_thread_func, shard) != 0) {
+            log_message("ERROR", "Failed to start shard %d", shard_total);
+            pthread_mutex_destroy(&shard->mutex);
+            pthread_cond_destroy(&shard->turned);
+#ifndef _WIN32
+            if (shard->wake[0] >= 0) {
+                close(shard->wake[0]);
+                close(shard->wake[1]);
+            }
+#endif
+            break;
+        }
+        pthread_detach(shard->thread);
+        shard_total++;
+    }
+
+    log_message("INFO", "Running %d network shards", shard_total);
+}
+
+// Number of shard threads, 0 with a thread per server
+int shard_count(void) {
+    return shard_total;
+}
+
+// Hands a connected server to its shard, picking the least loaded one the
+// first time. GTK thread (or the daemon's main thread).
+bool shard_attach(server_info_t *server) {
+    if (shard_total == 0) return false;
+
+    if (server->shard < 0) {
+        int best = 0;
+        for (int i = 1; i < shard_total; i++) {
+            if (shards[i].pinned < shards[best].pinned) best = i;
+        }
+        server->shard = best;
+        shards[best].pinned++;
+        log_message("INFO", "%s pinned to shard %d", server->config.name, best);
+    }
+
+    shard_t *shard = &shards[server->shard];
+
+    pthread_mutex_lock(&shard->mutex);
+    if (shard->count == shard->capacity) {
+        int capacity = shard->capacity ? shard->capacity * 2 : 8;
+        server_info_t **grown = realloc(shard->servers, capacity * sizeof(server_info_t*));
+        if (!grown) {
+            pthread_mutex_unlock(&shard->mutex);
+            log_message("ERROR", "No memory to attach %s to shard %d", server->config.name, shard->index);
+            return false;
+        }
+        shard->servers = grown;
+        shard->capacity = capacity;
+    }
+    shard->servers[shard->count++] = server;
+    shard_wake(shard);
+    pthread_mutex_unlock(&shard->mutex);
+    return true;
+}
+
+// Takes the server away from its shard. Once this returns the shard
+// thread no longer touches it, so the socket can be closed.
+void shard_detach(server_info_t *server) {
+    if (server->shard < 0 || server->shard >= shard_total) return;
+
+    shard_t *shard = &shards[server->shard];
+
+    pthread_mutex_lock(&shard->mutex);
+    shard_remove(shard, server);
+
+    // The current turn may still hold the server; the shard thread itself
+    // is past it already
+    if (shard->busy && !pthread_equal(pthread_self(), shard->thread)) {
+        unsigned turn = shard->turns;
+        shard_wake(shard);
+        while (shard->busy && shard->turns == turn) {
+            pthread_cond_wait(&shard->turned, &shard->mutex);
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Servers, lines, CPU time and GUI queue of one shard, one line. Returns
+// false past the last shard.
+bool shard_format_stats(int shard_idx, char *buf, size_t len) {
+    if (shard_idx < 0 || shard_idx >= shard_total) return false;
+
+    shard_t *shard = &shards[shard_idx];
+    double cpu_ms = 0;
+    int depth, max_depth;
+    uint64_t merged;
+
+#ifndef _WIN32
+    clockid_t clock_id;
+    struct timespec ts;
+    if (pthread_getcpuclockid(shard->thread, &clock_id) == 0 && clock_gettime(clock_id, &ts) == 0) {
+        cpu_ms = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+#endif
+
+    net_queue_stats(shard_idx, &depth, &max_depth, &merged);
+
+    pthread_mutex_lock(&shard->mutex);
+    snprintf(buf, len,
+             "%s Shard %d: %d servers, %llu lines in %u turns, %.0f ms CPU, %llu backoffs; GUI queue %d waiting (max %d), %llu merged\n",
+             get_timestamp(), shard_idx, shard->count, (unsigned long long)shard->lines, shard->turns, cpu_ms,
+             (unsigned long long)shard->backoffs, depth, max_depth, (unsigned long long)merged);
+    pthread_mutex_unlock(&shard->mutex);
+    return true;
+}
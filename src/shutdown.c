@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <glib-unix.h>
+#endif
+
+// Bounded-time shutdown. Every connected server gets its own thread that
+// sends QUIT and closes the connection, so one slow link does not hold up
+// the rest, while another thread saves the configuration. Whatever has not
+// finished when SHUTDOWN_BUDGET_MS runs out is left behind; the process is
+// about to exit anyway. Only the config save is always waited for, since a
+// half-written file would lose the user's settings.
+
+#define SHUTDOWN_BUDGET_MS 3000
+
+typedef struct {
+    server_info_t *server;
+    pthread_t thread;
+    gint done;
+} shutdown_job_t;
+
+static void *shutdown_server_func(void *arg) {
+    shutdown_job_t *job = arg;
+    server_info_t *server = job->server;
+
+    // QUIT goes out before the FIN; closing never discards queued output
+    send_irc_command(server, "QUIT :Client exiting\r\n");
+    server->state = CONN_DISCONNECTED;
+    close_server_connection(server);
+
+    g_atomic_int_set(&job->done, TRUE);
+    return NULL;
+}
+
+static void *shutdown_save_func(void *arg) {
+    (void)arg;
+
+    // Takes client.gui_mutex itself while it reads the channels
+    save_config();
+    return NULL;
+}
+
+// Disconnects every server and saves the config, in parallel. Returns false
+// when some server did not close within the budget; its threads may still
+// be running, so nothing they use may be freed.
+bool shutdown_servers(void) {
+    int count = client.servers.count;
+    shutdown_job_t *jobs = calloc(count > 0 ? count : 1, sizeof(shutdown_job_t));
+    uint64_t start = get_monotonic_us();
+    uint64_t deadline = start + (uint64_t)SHUTDOWN_BUDGET_MS * 1000;
+    pthread_t saver;
+    bool saving;
+    int pending = 0;
+
+    if (!jobs) {
+        // No memory for the parallel path; do it one by one
+        for (int i = 0; i < count; i++) disconnect_server(server_get(i));
+        save_config();
+        return true;
+    }
+
+    saving = pthread_create(&saver, NULL, shutdown_save_func, NULL) == 0;
+    if (!saving) save_config();
+
+    for (int i = 0; i < count; i++) {
+        server_info_t *server = server_get(i);
+        shutdown_job_t *job = &jobs[i];
+
+        job->server = server;
+        reconnect_cancel(server);
+
+        // A sharded server has no thread, only its socket
+        if (server->state != CONN_CONNECTED && !server->network_thread && server->sockfd < 0) {
+            job->done = TRUE;
+            continue;
+        }
+        if (pthread_create(&job->thread, NULL, shutdown_server_func, job) != 0) {
+            shutdown_server_func(job);
+            job->thread = 0;
+            continue;
+        }
+        pending++;
+    }
+
+    // One deadline for all of them
+    while (pending > 0 && get_monotonic_us() < deadline) {
+        g_usleep(5000);
+        pending = 0;
+        for (int i = 0; i < count; i++) {
+            if (!g_atomic_int_get(&jobs[i].done)) pending++;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        shutdown_job_t *job = &jobs[i];
+        bool done = g_atomic_int_get(&job->done);
+
+        if (!job->thread) continue;
+        if (done) {
+            pthread_join(job->thread, NULL);
+        } else {
+            log_message("WARNING", "%s did not close within %d ms", job->server->config.name, SHUTDOWN_BUDGET_MS);
+            pthread_detach(job->thread);
+        }
+    }
+
+    if (saving) pthread_join(saver, NULL);
+
+    log_message("INFO", "Shut down %d servers in %.0f ms", count, (get_monotonic_us() - start) / 1000.0);
+
+    // Jobs left running still point into the array
+    if (pending == 0) free(jobs);
+    return pending == 0;
+}
+
+#ifndef _WIN32
+static gboolean shutdown_signal_cb(gpointer data) {
+    (void)data;
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+}
+#endif
+
+// SIGINT and SIGTERM end gtk_main() through GLib's self-pipe, so the
+// cleanup after it runs on the GTK thread instead of in a signal handler
+void shutdown_install_signals(void) {
+#ifndef _WIN32
+    g_unix_signal_add(SIGINT, shutdown_signal_cb, NULL);
+    g_unix_signal_add(SIGTERM, shutdown_signal_cb, NULL);
+#endif
+}
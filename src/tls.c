@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#ifndef _WIN32
+    #include <poll.h>
+#endif
+
+#include "client.h"
+
+#define TLS_HANDSHAKE_TIMEOUT_MS 15000
+#define TLS_WRITE_TIMEOUT_MS 10000
+
+static SSL_CTX *tls_ctx = NULL;
+
+static void log_tls_error(const char *what) {
+    unsigned long err = ERR_get_error();
+    char err_buf[256];
+
+    if (err) {
+        ERR_error_string_n(err, err_buf, sizeof(err_buf));
+        log_message("ERROR", "%s: %s", what, err_buf);
+    } else {
+        log_message("ERROR", "%s failed", what);
+    }
+    ERR_clear_error();
+}
+
+// Called by OpenSSL whenever the server hands us a new session or ticket.
+// With TLS 1.3 tickets arrive after the handshake, from inside SSL_read(),
+// so this always runs with the server's io_mutex held.
+static int tls_new_session_cb(SSL *ssl, SSL_SESSION *session) {
+    server_info_t *server = SSL_get_app_data(ssl);
+    if (!server) return 0;
+
+    if (server->tls_session) {
+        SSL_SESSION_free(server->tls_session);
+    }
+    server->tls_session = session;
+    return 1; // We keep the reference
+}
+
+int tls_init(void) {
+    if (tls_ctx) return 0;
+
+    tls_ctx = SSL_CTX_new(TLS_client_method());
+    if (!tls_ctx) {
+        log_tls_error("SSL_CTX_new");
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(tls_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (SSL_CTX_set_default_verify_paths(tls_ctx) != 1) {
+        log_message("WARNING", "Could not load default CA certificates");
+    }
+
+    // Sessions are cached per server_info_t, not in OpenSSL's internal store
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls_ctx, tls_new_session_cb);
+
+    return 0;
+}
+
+void tls_cleanup(void) {
+    if (tls_ctx) {
+        SSL_CTX_free(tls_ctx);
+        tls_ctx = NULL;
+    }
+}
+
+static int tls_load_client_cert(server_info_t *server, SSL *ssl) {
+    const char *key_file = strlen(server->config.client_key) > 0 ? server->config.client_key : server->config.client_cert;
+
+    if (SSL_use_certificate_chain_file(ssl, server->config.client_cert) != 1) {
+        log_tls_error("Loading client certificate");
+        return -1;
+    }
+
+    if (SSL_use_PrivateKey_file(ssl, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_check_private_key(ssl) != 1) {
+        log_tls_error("Loading client key");
+        return -1;
+    }
+
+    return 0;
+}
+
+int tls_connect(server_info_t *server) {
+    if (tls_init() < 0) return -1;
+
+    SSL *ssl = SSL_new(tls_ctx);
+    if (!ssl) {
+        log_tls_error("SSL_new");
+        return -1;
+    }
+
+    SSL_set_app_data(ssl, server);
+    SSL_set_tlsext_host_name(ssl, server->config.hostname);
+
+    if (server->config.tls_verify) {
+        SSL_set_verify(ssl, SSL_VERIFY_PEER, NULL);
+        SSL_set1_host(ssl, server->config.hostname);
+    }
+
+    if (strlen(server->config.client_cert) > 0 && tls_load_client_cert(server, ssl) < 0) {
+        SSL_free(ssl);
+        return -1;
+    }
+
+    SSL_set_fd(ssl, server->sockfd);
+
+    pthread_mutex_lock(&server->io_mutex);
+
+    if (server->tls_session) {
+        SSL_set_session(ssl, server->tls_session);
+    }
+    server->ssl = ssl;
+
+    uint64_t start = get_monotonic_us();
+    uint64_t deadline = start + (uint64_t)TLS_HANDSHAKE_TIMEOUT_MS * 1000;
+    int ret;
+
+    while ((ret = SSL_connect(ssl)) != 1) {
+        int err = SSL_get_error(ssl, ret);
+        short events;
+
+        if (err == SSL_ERROR_WANT_READ) {
+            events = POLLIN;
+        } else if (err == SSL_ERROR_WANT_WRITE) {
+            events = POLLOUT;
+        } else {
+            break;
+        }
+
+        uint64_t now = get_monotonic_us();
+        if (now >= deadline ||
+            net_wait_socket(server->sockfd, events, (int)((deadline - now) / 1000)) <= 0) {
+            ret = -1;
+            ERR_clear_error();
+            log_message("ERROR", "TLS handshake with %s timed out", server->config.hostname);
+            break;
+        }
+    }
+
+    if (ret != 1) {
+        long verify = SSL_get_verify_result(ssl);
+        if (verify != X509_V_OK) {
+            log_message("ERROR", "Certificate verification failed for %s: %s",
+                       server->config.hostname, X509_verify_cert_error_string(verify));
+        } else {
+            log_tls_error("TLS handshake");
+        }
+
+        server->ssl = NULL;
+        pthread_mutex_unlock(&server->io_mutex);
+        SSL_free(ssl);
+
+        // A stale ticket must not poison every following attempt
+        tls_forget_session(server);
+        return -1;
+    }
+
+    uint64_t elapsed = get_monotonic_us() - start;
+    bool resumed = SSL_session_reused(ssl);
+
+    server->tls_stats.handshakes++;
+    if (resumed) server->tls_stats.resumed++;
+    server->tls_stats.total_handshake_us += elapsed;
+    server->tls_stats.last_handshake_us = elapsed;
+
+    pthread_mutex_unlock(&server->io_mutex);
+
+    log_message("INFO", "TLS handshake with %s: %.2f ms, %s, %s %s",
+               server->config.hostname, elapsed / 1000.0, resumed ? "resumed" : "full",
+               SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+
+    return 0;
+}
+
+void tls_close(server_info_t *server) {
+    pthread_mutex_lock(&server->io_mutex);
+
+    if (server->ssl) {
+        // Best effort close_notify; the socket is nonblocking so this never waits
+        SSL_shutdown(server->ssl);
+        SSL_free(server->ssl);
+        server->ssl = NULL;
+    }
+    ERR_clear_error();
+
+    pthread_mutex_unlock(&server->io_mutex);
+}
+
+void tls_forget_session(server_info_t *server) {
+    pthread_mutex_lock(&server->io_mutex);
+
+    if (server->tls_session) {
+        SSL_SESSION_free(server->tls_session);
+        server->tls_session = NULL;
+    }
+
+    pthread_mutex_unlock(&server->io_mutex);
+}
+
+bool tls_pending(server_info_t *server) {
+    bool pending = false;
+
+    pthread_mutex_lock(&server->io_mutex);
+    if (server->ssl) {
+        pending = SSL_pending(server->ssl) > 0;
+    }
+    pthread_mutex_unlock(&server->io_mutex);
+
+    return pending;
+}
+
+// Returns bytes read, 0 on orderly close, or -1 with errno set.
+// EAGAIN means no complete record is available yet.
+ssize_t tls_read(server_info_t *server, char *buf, size_t len) {
+    pthread_mutex_lock(&server->io_mutex);
+
+    if (!server->ssl) {
+        pthread_mutex_unlock(&server->io_mutex);
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    int ret = SSL_read(server->ssl, buf, (int)len);
+    int err = ret > 0 ? SSL_ERROR_NONE : SSL_get_error(server->ssl, ret);
+    int saved_errno = errno;
+
+    if (err == SSL_ERROR_SSL) {
+        log_tls_error("SSL_read");
+    }
+    ERR_clear_error();
+
+    pthread_mutex_unlock(&server->io_mutex);
+
+    switch (err) {
+        case SSL_ERROR_NONE:
+            return ret;
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            // Unexpected EOF without close_notify
+            if (saved_errno == 0) return 0;
+            errno = saved_errno;
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+// Writes the whole buffer, waiting on the socket as needed.
+// Returns len on success or -1 on error.
+ssize_t tls_write(server_info_t *server, const char *buf, size_t len) {
+    uint64_t deadline = get_monotonic_us() + (uint64_t)TLS_WRITE_TIMEOUT_MS * 1000;
+
+    pthread_mutex_lock(&server->io_mutex);
+
+    for (;;) {
+        if (!server->ssl) {
+            pthread_mutex_unlock(&server->io_mutex);
+            errno = ENOTCONN;
+            return -1;
+        }
+
+        int ret = SSL_write(server->ssl, buf, (int)len);
+        if (ret > 0) break;
+
+        int err = SSL_get_error(server->ssl, ret);
+        short events;
+
+        if (err == SSL_ERROR_WANT_WRITE) {
+            events = POLLOUT;
+        } else if (err == SSL_ERROR_WANT_READ) {
+            events = POLLIN;
+        } else {
+            if (err == SSL_ERROR_SSL) log_tls_error("SSL_write");
+            ERR_clear_error();
+            pthread_mutex_unlock(&server->io_mutex);
+            errno = EPIPE;
+            return -1;
+        }
+
+        uint64_t now = get_monotonic_us();
+        if (now >= deadline ||
+            net_wait_socket(server->sockfd, events, (int)((deadline - now) / 1000)) < 0) {
+            pthread_mutex_unlock(&server->io_mutex);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    pthread_mutex_unlock(&server->io_mutex);
+    return (ssize_t)len;
+}
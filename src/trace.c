@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <signal.h>
+#endif
+
+// Trace spans for "the client froze" reports. Each thread writes finished
+// spans into its own ring, so recording takes no lock: two clock reads and
+// a store. Spans of one IRC line share an ID from socket to screen (parse
+// on the network thread, then the GTK thread's update and buffer insert).
+// /trace, or SIGUSR1 when the window no longer responds, writes the last
+// few seconds as Chrome trace-event JSON for ui.perfetto.dev.
+
+#define TRACE_RING_SIZE 16384     // Spans kept per thread; a power of two
+#define TRACE_MAX_THREADS 64
+#define TRACE_SIGNAL_SECONDS 10   // What SIGUSR1 dumps
+
+typedef struct {
+    const char *name;         // Static string
+    uint64_t start_us;
+    uint64_t id;
+    uint32_t duration_us;
+} trace_span_t;
+
+typedef struct {
+    bool in_use;
+    int index;
+    char thread_name[32];
+    guint head;               // Spans ever written, wrapping; published atomically
+    uint64_t next_id;
+    uint64_t current_id;      // Line being handled on the owning thread
+    trace_span_t spans[TRACE_RING_SIZE];
+} trace_ring_t;
+
+// Read without locking on the hot path
+static bool trace_on = true;
+
+static trace_ring_t *rings[TRACE_MAX_THREADS];
+static int ring_count = 0;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+// A thread exited; the next new thread reuses its ring
+static void trace_release(void *data) {
+    trace_ring_t *ring = data;
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->in_use = false;
+    ring->current_id = 0;
+    pthread_mutex_unlock(&rings_mutex);
+}
+
+static void trace_make_key(void) {
+    pthread_key_create(&ring_key, trace_release);
+}
+
+// The calling thread's ring, taken on first use. NULL when all are taken.
+static trace_ring_t *trace_ring(void) {
+    pthread_once(&key_once, trace_make_key);
+
+    trace_ring_t *ring = pthread_getspecific(ring_key);
+    if (ring) return ring;
+
+    pthread_mutex_lock(&rings_mutex);
+    for (int i = 0; i < ring_count && !ring; i++) {
+        if (!rings[i]->in_use) ring = rings[i];
+    }
+    if (!ring && ring_count < TRACE_MAX_THREADS) {
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (ring) {
+            ring->index = ring_count;
+            // IDs carry the ring number, so threads never hand out the same one
+            ring->next_id = (uint64_t)(ring_count + 1) << 40;
+            rings[ring_count++] = ring;
+        }
+    }
+    if (ring) {
+        ring->in_use = true;
+        snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %d", ring->index);
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (ring) pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+// Names the calling thread in dumps
+void trace_thread_name(const char *name) {
+    trace_ring_t *ring = trace_ring();
+    if (!ring) return;
+
+    pthread_mutex_lock(&rings_mutex);
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    pthread_mutex_unlock(&rings_mutex);
+}
+
+// Start of a span, or 0 while tracing is off
+uint64_t trace_begin(void) {
+    return trace_on ? get_monotonic_us() : 0;
+}
+
+void trace_end(const char *name, uint64_t start_us, uint64_t id) {
+    if (!start_us) return;
+
+    trace_ring_t *ring = trace_ring();
+    if (!ring) return;
+
+    uint64_t now = get_monotonic_us();
+    guint head = ring->head;
+    trace_span_t *span = &ring->spans[head & (TRACE_RING_SIZE - 1)];
+
+    span->name = name;
+    span->start_us = start_us;
+    span->id = id;
+    span->duration_us = (uint32_t)(now - start_us);
+
+    // Past the wrap the ring stays full: skip the counts below its size,
+    // which land on the same slot
+    head++;
+    if (head == 0) head = TRACE_RING_SIZE;
+    g_atomic_int_set(&ring->head, head);
+}
+
+// A fresh ID for the spans of one line
+uint64_t trace_new_id(void) {
+    trace_ring_t *ring = trace_on ? trace_ring() : NULL;
+    return ring ? ++ring->next_id : 0;
+}
+
+// The ID that later spans on this thread belong to, 0 for none
+void trace_set_current(uint64_t id) {
+    trace_ring_t *ring = trace_ring();
+    if (ring) ring->current_id = id;
+}
+
+uint64_t trace_current(void) {
+    trace_ring_t *ring = trace_on ? trace_ring() : NULL;
+    return ring ? ring->current_id : 0;
+}
+
+void trace_set_enabled(bool enabled) {
+    trace_on = enabled;
+}
+
+bool trace_enabled(void) {
+    return trace_on;
+}
+
+static void trace_write_name(FILE *file, const char *name) {
+    for (; *name; name++) {
+        fputc(*name == '"' || *name == '\\' || (unsigned char)*name < 0x20 ? '_' : *name, file);
+    }
+}
+
+// Writes the last seconds of every thread's spans as Chrome trace-event
+// JSON. Spans with an ID are bound into one flow per line. Returns 0 with
+// the file name in path, or -1.
+int trace_dump(int seconds, char *path, size_t path_len) {
+    time_t now = time(NULL);
+    char stamp[32];
+    uint64_t since = get_monotonic_us() - (uint64_t)seconds * 1000000;
+    trace_span_t *copy = malloc(TRACE_RING_SIZE * sizeof(trace_span_t));
+    bool first = true;
+    int total = 0;
+
+    if (!copy) return -1;
+
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(path, path_len, "trace-%s.json", stamp);
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        log_message("ERROR", "Failed to write %s", path);
+        free(copy);
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&rings_mutex);
+    for (int t = 0; t < ring_count; t++) {
+        trace_ring_t *ring = rings[t];
+        guint end = (guint)g_atomic_int_get(&ring->head);
+        guint count = end < TRACE_RING_SIZE ? end : TRACE_RING_SIZE;
+        guint start = end - count;
+
+        for (guint i = 0; i < count; i++) {
+            copy[i] = ring->spans[(start + i) & (TRACE_RING_SIZE - 1)];
+        }
+
+        // The owner kept writing meanwhile; drop what it overwrote. The
+        // unsigned difference survives the counter wrapping.
+        guint written = (guint)g_atomic_int_get(&ring->head) - end;
+        guint valid = 0;
+        if (written >= TRACE_RING_SIZE) {
+            valid = count;
+        } else if (written + count >= TRACE_RING_SIZE) {
+            valid = written + count - TRACE_RING_SIZE + 1;
+        }
+
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+                first ? "" : ",\n", (int)getpid(), t);
+        trace_write_name(file, ring->thread_name);
+        fprintf(file, "\"}}");
+        first = false;
+
+        for (guint i = valid; i < count; i++) {
+            trace_span_t *span = &copy[i];
+            if (span->start_us < since) continue;
+
+            fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%u",
+                    span->name, (int)getpid(), t, (unsigned long long)span->start_us, span->duration_us);
+            if (span->id) {
+                fprintf(file, ",\"bind_id\":\"0x%llx\",\"flow_in\":true,\"flow_out\":true,\"args\":{\"line\":%llu}",
+                        (unsigned long long)span->id, (unsigned long long)span->id);
+            }
+            fprintf(file, "}");
+            total++;
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    free(copy);
+
+    log_message("INFO", "Wrote %d trace spans from the last %d s to %s", total, seconds, path);
+    return 0;
+}
+
+#ifndef _WIN32
+// Dumps on SIGUSR1, from a thread of its own, since a stuck GTK thread is
+// exactly when a dump is wanted
+static void *trace_signal_thread(void *arg) {
+    sigset_t *set = arg;
+    char path[64];
+    int sig;
+
+    trace_thread_name("trace");
+    while (sigwait(set, &sig) == 0) {
+        trace_dump(TRACE_SIGNAL_SECONDS, path, sizeof(path));
+    }
+    return NULL;
+}
+#endif
+
+// Call first thing in main(), before any other thread exists
+void trace_init(void) {
+    trace_thread_name("main");
+
+#ifndef _WIN32
+    static sigset_t set;
+    pthread_t thread;
+
+    // Every thread created from here on inherits the blocked signal, so
+    // only sigwait() sees it
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (pthread_create(&thread, NULL, trace_signal_thread, &set) == 0) {
+        pthread_detach(thread);
+    } else {
+        log_message("WARNING", "Failed to start the trace signal thread");
+    }
+#endif
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "client.h"
+
+#ifdef HAVE_IO_URING
+    #include <fcntl.h>
+    #include <liburing.h>
+#endif
+
+// Optional io_uring path for plaintext connections (make USE_IO_URING=1).
+// Receives use one multishot recv into a ring of provided buffers, so a
+// busy connection costs one io_uring_enter() per batch of completions
+// instead of a poll() and a recv() per read. Sends are linked to a timeout
+// so they are bounded like the poll() path. Anything that fails at runtime
+// (old kernel, seccomp, io_uring_disabled) falls back to poll().
+// Set IRC_NET_BACKEND=poll to force the old path for comparison.
+
+#ifdef HAVE_IO_URING
+
+#define URING_RX_ENTRIES 8
+#define URING_TX_ENTRIES 8
+// Provided receive buffers; the count must be a power of two
+#define URING_BUF_COUNT 64
+#define URING_BUF_SIZE 4096
+#define URING_BUF_GROUP 0
+
+#define URING_TAG_SEND 1
+#define URING_TAG_TIMEOUT 2
+
+struct net_uring {
+    struct io_uring rx;  // Network thread only
+    struct io_uring tx;  // Any thread, under io_mutex
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    int held_bid;        // Buffer handed out by the last uring_recv(), or -1
+    bool armed;          // Multishot recv outstanding
+    bool received;       // Multishot recv has worked at least once
+};
+
+// Set once io_uring turned out not to work here, so later connections
+// do not retry it. Read and set from every network thread.
+static gint uring_broken = 0;
+
+static void uring_give_up(const char *what, int err) {
+    if (!g_atomic_int_get(&uring_broken)) {
+        log_message("WARNING", "io_uring unavailable (%s: %s), using poll()", what, strerror(err));
+    }
+    g_atomic_int_set(&uring_broken, 1);
+}
+
+static void uring_free(net_uring_t *u) {
+    if (u->buf_ring) io_uring_free_buf_ring(&u->rx, u->buf_ring, URING_BUF_COUNT, URING_BUF_GROUP);
+    if (u->rx.ring_fd > 0) io_uring_queue_exit(&u->rx);
+    if (u->tx.ring_fd > 0) io_uring_queue_exit(&u->tx);
+    free(u->bufs);
+    free(u);
+}
+
+static void uring_recycle(net_uring_t *u, int bid) {
+    io_uring_buf_ring_add(u->buf_ring, u->bufs + (size_t)bid * URING_BUF_SIZE, URING_BUF_SIZE,
+                          (unsigned short)bid, io_uring_buf_ring_mask(URING_BUF_COUNT), 0);
+    io_uring_buf_ring_advance(u->buf_ring, 1);
+}
+
+// Switches a connected plaintext socket to io_uring. Returns false when
+// the connection should stay on the poll() path.
+bool uring_attach(server_info_t *server) {
+    const char *backend = getenv("IRC_NET_BACKEND");
+    int ret;
+
+    if (server->ssl || g_atomic_int_get(&uring_broken)) return false;
+    if (backend && strcmp(backend, "poll") == 0) return false;
+
+    net_uring_t *u = calloc(1, sizeof(net_uring_t));
+    if (!u) return false;
+    u->held_bid = -1;
+    u->rx.ring_fd = -1;
+    u->tx.ring_fd = -1;
+
+    u->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (!u->bufs) {
+        uring_free(u);
+        return false;
+    }
+
+    ret = io_uring_queue_init(URING_RX_ENTRIES, &u->rx, 0);
+    if (ret < 0) {
+        u->rx.ring_fd = -1;
+        uring_give_up("io_uring_queue_init", -ret);
+        uring_free(u);
+        return false;
+    }
+
+    // Needs 5.19; without provided buffers there is no multishot recv
+    u->buf_ring = io_uring_setup_buf_ring(&u->rx, URING_BUF_COUNT, URING_BUF_GROUP, 0, &ret);
+    if (!u->buf_ring) {
+        uring_give_up("io_uring_setup_buf_ring", -ret);
+        uring_free(u);
+        return false;
+    }
+    for (int i = 0; i < URING_BUF_COUNT; i++) {
+        io_uring_buf_ring_add(u->buf_ring, u->bufs + (size_t)i * URING_BUF_SIZE, URING_BUF_SIZE,
+                              (unsigned short)i, io_uring_buf_ring_mask(URING_BUF_COUNT), i);
+    }
+    io_uring_buf_ring_advance(u->buf_ring, URING_BUF_COUNT);
+
+    ret = io_uring_queue_init(URING_TX_ENTRIES, &u->tx, 0);
+    if (ret < 0) {
+        u->tx.ring_fd = -1;
+        uring_give_up("io_uring_queue_init", -ret);
+        uring_free(u);
+        return false;
+    }
+
+    // io_uring waits on the socket itself; with O_NONBLOCK set it would
+    // hand EAGAIN back instead
+    int flags = fcntl(server->sockfd, F_GETFL, 0);
+    if (flags >= 0) fcntl(server->sockfd, F_SETFL, flags & ~O_NONBLOCK);
+
+    server->uring = u;
+    return true;
+}
+
+void uring_detach(server_info_t *server) {
+    if (!server->uring) return;
+
+    uring_free(server->uring);
+    server->uring = NULL;
+
+    if (server->sockfd > 0) {
+        int flags = fcntl(server->sockfd, F_GETFL, 0);
+        if (flags >= 0) fcntl(server->sockfd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+// Waits up to timeout_ms for data. Returns its length with *data pointing
+// into a provided buffer that stays valid until the next call, 0 at end of
+// stream, or -1 with errno set (EAGAIN on timeout).
+ssize_t uring_recv(server_info_t *server, const char **data, int timeout_ms) {
+    net_uring_t *u = server->uring;
+    struct io_uring_cqe *cqe;
+
+    // The caller is done with the previous buffer
+    if (u->held_bid >= 0) {
+        uring_recycle(u, u->held_bid);
+        u->held_bid = -1;
+    }
+
+    if (!u->armed) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&u->rx);
+        io_uring_prep_recv_multishot(sqe, server->sockfd, NULL, 0, 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUF_GROUP;
+        u->armed = true;
+    }
+
+    // Completions that are already there cost no syscall
+    if (io_uring_peek_cqe(&u->rx, &cqe) != 0) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+        server->net_stats.rx_syscalls++;
+        int ret = io_uring_submit_and_wait_timeout(&u->rx, &cqe, 1, &ts, NULL);
+        if (ret == -ETIME || ret == -EINTR) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (ret < 0) {
+            errno = -ret;
+            return -1;
+        }
+    }
+
+    int res = cqe->res;
+    unsigned cqe_flags = cqe->flags;
+    io_uring_cqe_seen(&u->rx, cqe);
+
+    // The kernel ends a multishot recv on errors and when it runs out of
+    // buffers; it is re-armed on the next call
+    if (!(cqe_flags & IORING_CQE_F_MORE)) u->armed = false;
+
+    if (res == -ENOBUFS) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (res == -EINVAL && !u->received) {
+        // Pre-6.0 kernel without multishot recv; nothing was read yet
+        uring_give_up("multishot recv", EINVAL);
+        pthread_mutex_lock(&server->io_mutex);
+        uring_detach(server);
+        pthread_mutex_unlock(&server->io_mutex);
+        server->net_stats.backend = NET_BACKEND_POLL;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    if (res == 0 || !(cqe_flags & IORING_CQE_F_BUFFER)) return 0;
+
+    u->received = true;
+    u->held_bid = (int)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+    *data = u->bufs + (size_t)u->held_bid * URING_BUF_SIZE;
+    return res;
+}
+
+// Sends all of buf, giving up after NET_SEND_TIMEOUT_MS like the poll()
+// path. Called with io_mutex held.
+ssize_t uring_send(server_info_t *server, const char *buf, size_t len) {
+    net_uring_t *u = server->uring;
+    struct __kernel_timespec ts;
+    size_t total = 0;
+
+    ts.tv_sec = NET_SEND_TIMEOUT_MS / 1000;
+    ts.tv_nsec = (long long)(NET_SEND_TIMEOUT_MS % 1000) * 1000000;
+
+    while (total < len) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&u->tx);
+        io_uring_prep_send(sqe, server->sockfd, buf + total, len - total, MSG_NOSIGNAL);
+        io_uring_sqe_set_data64(sqe, URING_TAG_SEND);
+        sqe->flags |= IOSQE_IO_LINK;
+
+        sqe = io_uring_get_sqe(&u->tx);
+        io_uring_prep_link_timeout(sqe, &ts, 0);
+        io_uring_sqe_set_data64(sqe, URING_TAG_TIMEOUT);
+
+        server->net_stats.tx_syscalls++;
+        int ret = io_uring_submit_and_wait(&u->tx, 2);
+        if (ret < 0 && ret != -EINTR) {
+            errno = -ret;
+            return -1;
+        }
+
+        // Both the send and its timeout always complete
+        int sent = -ECANCELED;
+        for (int i = 0; i < 2; i++) {
+            struct io_uring_cqe *cqe;
+            while ((ret = io_uring_wait_cqe(&u->tx, &cqe)) == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                errno = -ret;
+                return -1;
+            }
+            if (io_uring_cqe_get_data64(cqe) == URING_TAG_SEND) sent = cqe->res;
+            io_uring_cqe_seen(&u->tx, cqe);
+        }
+
+        if (sent <= 0) {
+            errno = sent == -ECANCELED ? ETIMEDOUT : (sent == 0 ? EPIPE : -sent);
+            return -1;
+        }
+        total += (size_t)sent;
+    }
+
+    return (ssize_t)total;
+}
+
+#else
+
+bool uring_attach(server_info_t *server) {
+    (void)server;
+    return false;
+}
+
+void uring_detach(server_info_t *server) {
+    (void)server;
+}
+
+ssize_t uring_recv(server_info_t *server, const char **data, int timeout_ms) {
+    (void)server;
+    (void)data;
+    (void)timeout_ms;
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t uring_send(server_info_t *server, const char *buf, size_t len) {
+    (void)server;
+    (void)buf;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <string.h>
+#include "utf8.h"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+// Nearly every IRC line is pure ASCII, so validation skips ASCII 16 bytes
+// at a time with SSE2 (8 at a time elsewhere) and decodes multibyte
+// sequences one by one, going back to the fast path after each run of
+// them. Lines are at most a few hundred bytes, which is too short for a
+// fully vectorized validator to pay for its setup.
+
+// Length of the leading ASCII run of s
+size_t utf8_ascii_prefix(const char *s, size_t len) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)(s + i)));
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, s + i, sizeof(word));
+        if (word & 0x8080808080808080ull) break;
+    }
+#endif
+
+    while (i < len && !((unsigned char)s[i] & 0x80)) i++;
+    return i;
+}
+
+static bool is_continuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// Length of the well-formed sequence at s, or 0. Rejects overlong forms,
+// surrogates and code points past U+10FFFF (Unicode table 3-7).
+static size_t utf8_sequence(const unsigned char *s, size_t len) {
+    unsigned char c = s[0];
+
+    if (c >= 0xC2 && c <= 0xDF) {
+        return len >= 2 && is_continuation(s[1]) ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        unsigned char lo = c == 0xE0 ? 0xA0 : 0x80;
+        unsigned char hi = c == 0xED ? 0x9F : 0xBF;
+        return len >= 3 && s[1] >= lo && s[1] <= hi && is_continuation(s[2]) ? 3 : 0;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        unsigned char lo = c == 0xF0 ? 0x90 : 0x80;
+        unsigned char hi = c == 0xF4 ? 0x8F : 0xBF;
+        return len >= 4 && s[1] >= lo && s[1] <= hi && is_continuation(s[2]) && is_continuation(s[3]) ? 4 : 0;
+    }
+    return 0;
+}
+
+bool utf8_validate(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+
+    while (i < len) {
+        i += utf8_ascii_prefix(s + i, len - i);
+
+        // Text in other scripts is mostly multibyte; stay on this path
+        while (i < len && u[i] >= 0x80) {
+            size_t n = utf8_sequence(u + i, len - i);
+            if (!n) return false;
+            i += n;
+        }
+    }
+    return true;
+}
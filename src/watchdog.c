@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "client.h"
+
+#ifndef _WIN32
+    #include <signal.h>
+#endif
+#ifdef __GLIBC__
+    #include <execinfo.h>
+#endif
+
+// Main-loop stall watchdog. A timer on the main loop beats every
+// WATCHDOG_BEAT_MS; a thread of its own notices when the beats stop and
+// notes what the GTK thread said it was doing (watchdog_enter() at the
+// known blocking spots: connects, sends, disconnects, config saves, line
+// updates and buffer drains). When the loop comes back the stall is filed
+// with that activity. Frame clock phases give the work time of every
+// painted frame. /lagstats reports both; with backtraces on, a stall past
+// WATCHDOG_BACKTRACE_US also prints the GTK thread's stack to stderr.
+
+#define WATCHDOG_BEAT_MS 50
+#define WATCHDOG_STALL_US 200000        // Shorter hiccups are not stalls
+#define WATCHDOG_BACKTRACE_US 1000000
+#define WATCHDOG_RECENT 5               // Stalls listed by /lagstats
+#define FRAME_BUCKETS 8
+
+// Upper bounds of all but the last bucket
+static const unsigned frame_bounds_ms[FRAME_BUCKETS - 1] = { 4, 8, 16, 33, 50, 100, 250 };
+static const char *frame_bucket_names[FRAME_BUCKETS] = {
+    "<4 ms", "<8 ms", "<16 ms", "<33 ms", "<50 ms", "<100 ms", "<250 ms", ">=250 ms"
+};
+
+typedef struct {
+    time_t when;
+    uint32_t duration_ms;
+    const char *activity;
+} stall_t;
+
+static struct {
+    bool running;
+    pthread_t gtk_thread;
+    uint64_t beat_us;               // Written by the main loop, read without locking
+    const char *activity;           // Same; NULL between marked calls
+    bool backtraces;
+
+    pthread_mutex_t mutex;          // Guards everything below
+    const char *stall_activity;     // First activity seen during the current stall
+    bool stall_dumped;
+    unsigned stalls;
+    uint32_t longest_ms;
+    stall_t recent[WATCHDOG_RECENT];
+    unsigned frames[FRAME_BUCKETS];
+    unsigned frame_count;
+    uint64_t frame_max_us;
+    uint64_t frame_start_us;
+} watchdog = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Marks what the GTK thread is about to do; returns the previous mark for
+// watchdog_leave(). Other threads are ignored, so shared code can call it.
+const char *watchdog_enter(const char *activity) {
+    if (!watchdog.running || !pthread_equal(pthread_self(), watchdog.gtk_thread)) return NULL;
+
+    const char *previous = watchdog.activity;
+    watchdog.activity = activity;
+    return previous;
+}
+
+void watchdog_leave(const char *previous) {
+    if (!watchdog.running || !pthread_equal(pthread_self(), watchdog.gtk_thread)) return;
+    watchdog.activity = previous;
+}
+
+static gboolean watchdog_beat_cb(gpointer data) {
+    (void)data;
+    uint64_t now = get_monotonic_us();
+    uint64_t gap = now - watchdog.beat_us;
+
+    watchdog.beat_us = now;
+    if (gap < WATCHDOG_BEAT_MS * 1000 + WATCHDOG_STALL_US) return TRUE;
+
+    // The loop was away for the gap minus the expected beat
+    uint32_t duration_ms = (uint32_t)((gap - WATCHDOG_BEAT_MS * 1000) / 1000);
+
+    pthread_mutex_lock(&watchdog.mutex);
+    const char *activity = watchdog.stall_activity ? watchdog.stall_activity : "unmarked callback";
+    memmove(&watchdog.recent[1], &watchdog.recent[0], (WATCHDOG_RECENT - 1) * sizeof(stall_t));
+    watchdog.recent[0].when = time(NULL);
+    watchdog.recent[0].duration_ms = duration_ms;
+    watchdog.recent[0].activity = activity;
+    watchdog.stalls++;
+    if (duration_ms > watchdog.longest_ms) watchdog.longest_ms = duration_ms;
+    watchdog.stall_activity = NULL;
+    watchdog.stall_dumped = false;
+    pthread_mutex_unlock(&watchdog.mutex);
+
+    log_message("WARNING", "Main loop stalled for %u ms in %s", duration_ms, activity);
+    return TRUE;
+}
+
+#if defined(__GLIBC__) && !defined(_WIN32)
+// Runs on the GTK thread, interrupting whatever holds it up
+static void watchdog_backtrace_handler(int sig) {
+    void *frames[64];
+    static const char header[] = "--- GTK thread stack during stall ---\n";
+
+    (void)sig;
+    if (write(STDERR_FILENO, header, sizeof(header) - 1) < 0) return;
+    backtrace_symbols_fd(frames, backtrace(frames, 64), STDERR_FILENO);
+}
+#endif
+
+static void *watchdog_thread_func(void *arg) {
+    (void)arg;
+    trace_thread_name("watchdog");
+
+    while (client.running) {
+        g_usleep(WATCHDOG_BEAT_MS * 1000);
+
+        uint64_t silent = get_monotonic_us() - watchdog.beat_us;
+        if (silent < WATCHDOG_BEAT_MS * 1000 + WATCHDOG_STALL_US) continue;
+
+        pthread_mutex_lock(&watchdog.mutex);
+        if (!watchdog.stall_activity) watchdog.stall_activity = watchdog.activity;
+        bool dump = watchdog.backtraces && !watchdog.stall_dumped && silent >= WATCHDOG_BACKTRACE_US;
+        if (dump) watchdog.stall_dumped = true;
+        pthread_mutex_unlock(&watchdog.mutex);
+
+#if defined(__GLIBC__) && !defined(_WIN32)
+        if (dump) pthread_kill(watchdog.gtk_thread, SIGUSR2);
+#endif
+    }
+    return NULL;
+}
+
+static void on_frame_begin(GdkFrameClock *clock, gpointer data) {
+    (void)clock;
+    (void)data;
+    watchdog.frame_start_us = get_monotonic_us();
+}
+
+static void on_frame_end(GdkFrameClock *clock, gpointer data) {
+    (void)clock;
+    (void)data;
+    if (!watchdog.frame_start_us) return;
+
+    uint64_t frame_us = get_monotonic_us() - watchdog.frame_start_us;
+    int bucket = 0;
+
+    while (bucket < FRAME_BUCKETS - 1 && frame_us >= (uint64_t)frame_bounds_ms[bucket] * 1000) {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&watchdog.mutex);
+    watchdog.frames[bucket]++;
+    watchdog.frame_count++;
+    if (frame_us > watchdog.frame_max_us) watchdog.frame_max_us = frame_us;
+    pthread_mutex_unlock(&watchdog.mutex);
+    watchdog.frame_start_us = 0;
+}
+
+// Starts watching the calling thread's main loop; call from the GTK thread
+// (or the daemon's main thread) once the window, if any, is shown
+void watchdog_init(void) {
+    pthread_t thread;
+
+    watchdog.gtk_thread = pthread_self();
+    watchdog.beat_us = get_monotonic_us();
+    watchdog.running = true;
+    g_timeout_add(WATCHDOG_BEAT_MS, watchdog_beat_cb, NULL);
+
+    if (client.window) {
+        GdkFrameClock *clock = gtk_widget_get_frame_clock(client.window);
+        if (clock) {
+            g_signal_connect(clock, "flush-events", G_CALLBACK(on_frame_begin), NULL);
+            g_signal_connect(clock, "after-paint", G_CALLBACK(on_frame_end), NULL);
+        }
+    }
+
+#if defined(__GLIBC__) && !defined(_WIN32)
+    // The first backtrace() loads libgcc; done here so the handler never does
+    void *frame;
+    backtrace(&frame, 1);
+    signal(SIGUSR2, watchdog_backtrace_handler);
+#endif
+
+    if (pthread_create(&thread, NULL, watchdog_thread_func, NULL) == 0) {
+        pthread_detach(thread);
+    } else {
+        log_message("WARNING", "Failed to start the main loop watchdog");
+    }
+}
+
+void watchdog_set_backtraces(bool enabled) {
+    watchdog.backtraces = enabled;
+}
+
+// Frame work times as a histogram, one line
+void watchdog_format_frames(char *buf, size_t len) {
+    size_t pos;
+
+    pthread_mutex_lock(&watchdog.mutex);
+    if (watchdog.frame_count == 0) {
+        snprintf(buf, len, "%s UI frames: none painted yet\n", get_timestamp());
+        pthread_mutex_unlock(&watchdog.mutex);
+        return;
+    }
+
+    pos = (size_t)snprintf(buf, len, "%s UI frames: %u painted, max %.1f ms;", get_timestamp(),
+                           watchdog.frame_count, watchdog.frame_max_us / 1000.0);
+    for (int i = 0; i < FRAME_BUCKETS && pos < len; i++) {
+        if (watchdog.frames[i] == 0) continue;
+        pos += (size_t)snprintf(buf + pos, len - pos, " %s: %u", frame_bucket_names[i], watchdog.frames[i]);
+    }
+    pthread_mutex_unlock(&watchdog.mutex);
+    if (pos < len) snprintf(buf + pos, len - pos, "\n");
+}
+
+// Stall count, the longest one and the most recent ones with what was running
+void watchdog_format_stalls(char *buf, size_t len) {
+    size_t pos;
+
+    pthread_mutex_lock(&watchdog.mutex);
+    pos = (size_t)snprintf(buf, len, "%s UI stalls over %d ms: %u, longest %u ms%s", get_timestamp(),
+                           WATCHDOG_STALL_US / 1000, watchdog.stalls, watchdog.longest_ms,
+                           watchdog.stalls > 0 ? "; recent:" : "");
+    for (int i = 0; i < WATCHDOG_RECENT && watchdog.recent[i].duration_ms && pos < len; i++) {
+        char when[16];
+        strftime(when, sizeof(when), "%H:%M:%S", localtime(&watchdog.recent[i].when));
+        pos += (size_t)snprintf(buf + pos, len - pos, " %u ms in %s at %s%s", watchdog.recent[i].duration_ms,
+                                watchdog.recent[i].activity, when,
+                                i + 1 < WATCHDOG_RECENT && watchdog.recent[i + 1].duration_ms ? "," : "");
+    }
+    pthread_mutex_unlock(&watchdog.mutex);
+    if (pos < len) snprintf(buf + pos, len - pos, "\n");
+}
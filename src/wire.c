@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+#endif
+
+#include "client.h"
+
+// Framing for the daemon <-> GUI socket: u8 type, u32 payload length, then
+// the payload. Integers are big endian, strings are a u16 length and the
+// bytes without a terminator.
+
+size_t wire_begin(GByteArray *out, uint8_t type) {
+    size_t start = out->len;
+    uint8_t header[WIRE_HEADER_SIZE] = { type, 0, 0, 0, 0 };
+    g_byte_array_append(out, header, sizeof(header));
+    return start;
+}
+
+// Patches the payload length of the frame started at start
+void wire_end(GByteArray *out, size_t start) {
+    uint32_t len = (uint32_t)(out->len - start - WIRE_HEADER_SIZE);
+    out->data[start + 1] = (uint8_t)(len >> 24);
+    out->data[start + 2] = (uint8_t)(len >> 16);
+    out->data[start + 3] = (uint8_t)(len >> 8);
+    out->data[start + 4] = (uint8_t)len;
+}
+
+void wire_put_u8(GByteArray *out, uint8_t value) {
+    g_byte_array_append(out, &value, 1);
+}
+
+void wire_put_u16(GByteArray *out, uint16_t value) {
+    uint8_t bytes[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+    g_byte_array_append(out, bytes, sizeof(bytes));
+}
+
+void wire_put_u32(GByteArray *out, uint32_t value) {
+    uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    g_byte_array_append(out, bytes, sizeof(bytes));
+}
+
+void wire_put_u64(GByteArray *out, uint64_t value) {
+    wire_put_u32(out, (uint32_t)(value >> 32));
+    wire_put_u32(out, (uint32_t)value);
+}
+
+void wire_put_str(GByteArray *out, const char *str) {
+    size_t len = str ? strlen(str) : 0;
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    wire_put_u16(out, (uint16_t)len);
+    if (len > 0) g_byte_array_append(out, (const guint8*)str, (guint)len);
+}
+
+// Length of the first complete frame in buf, 0 when more data is needed,
+// or -1 when the stream is corrupt
+long wire_frame_length(const uint8_t *buf, size_t len) {
+    if (len < WIRE_HEADER_SIZE) return 0;
+
+    uint32_t payload = ((uint32_t)buf[1] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 8) | buf[4];
+    if (payload > WIRE_MAX_FRAME) return -1;
+    if (len < WIRE_HEADER_SIZE + payload) return 0;
+
+    return (long)(WIRE_HEADER_SIZE + payload);
+}
+
+void wire_reader_init(wire_reader_t *reader, const uint8_t *frame, size_t len) {
+    reader->type = frame[0];
+    reader->data = frame + WIRE_HEADER_SIZE;
+    reader->len = len - WIRE_HEADER_SIZE;
+    reader->pos = 0;
+    reader->error = false;
+}
+
+static bool wire_need(wire_reader_t *reader, size_t count) {
+    if (reader->error || reader->len - reader->pos < count) {
+        reader->error = true;
+        return false;
+    }
+    return true;
+}
+
+uint8_t wire_get_u8(wire_reader_t *reader) {
+    if (!wire_need(reader, 1)) return 0;
+    return reader->data[reader->pos++];
+}
+
+uint16_t wire_get_u16(wire_reader_t *reader) {
+    if (!wire_need(reader, 2)) return 0;
+    const uint8_t *p = reader->data + reader->pos;
+    reader->pos += 2;
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint32_t wire_get_u32(wire_reader_t *reader) {
+    if (!wire_need(reader, 4)) return 0;
+    const uint8_t *p = reader->data + reader->pos;
+    reader->pos += 4;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+uint64_t wire_get_u64(wire_reader_t *reader) {
+    uint64_t high = wire_get_u32(reader);
+    return (high << 32) | wire_get_u32(reader);
+}
+
+// Copies a string into buf, truncating to fit; always terminates buf
+void wire_get_str(wire_reader_t *reader, char *buf, size_t len) {
+    uint16_t str_len = wire_get_u16(reader);
+    buf[0] = '\0';
+    if (!wire_need(reader, str_len)) return;
+
+    size_t copy = str_len < len - 1 ? str_len : len - 1;
+    memcpy(buf, reader->data + reader->pos, copy);
+    buf[copy] = '\0';
+    reader->pos += str_len;
+}
+
+#ifndef _WIN32
+// Writes a whole buffer to a blocking or nonblocking socket, waiting for
+// room as needed. Returns -1 on error.
+int wire_write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (net_wait_socket(fd, POLLOUT, 1000) < 0) return -1;
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+void wire_socket_path(char *buf, size_t len) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir && *runtime_dir) {
+        snprintf(buf, len, "%s/%s", runtime_dir, DAEMON_SOCKET_NAME);
+    } else {
+        snprintf(buf, len, "/tmp/%s-%u", DAEMON_SOCKET_NAME, (unsigned)getuid());
+    }
+}
+#endif